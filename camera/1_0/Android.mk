@@ -775,6 +775,8 @@ LOCAL_SHARED_LIBRARIES += \
     libvencoder.vendor \
     libproc
 
+LOCAL_STATIC_LIBRARIES += libcamera_yuvkernel
+
 LOCAL_C_INCLUDES +=                                 \
     frameworks/base/core/jni/android/graphics         \
     frameworks/native/include/media/openmax            \
@@ -14,6 +14,7 @@
 #include "PreviewWindow.h"
 #include <system/camera.h>
 #include <vencoder.h>
+#include <yuv_kernel.h>
 extern "C" int scaler(unsigned char * psrc, unsigned char * pdst, int src_w, int src_h, int dst_w, int dst_h, int fmt, int align);
 
 extern "C" int AWJpecEnc(JpegEncInfo* pJpegInfo, EXIFInfo* pExifInfo, void* pOutBuffer, int* pOutBufferSize);
@@ -255,205 +256,34 @@ static void YVU420ToNV21(void* psrc, void* pdst, int width, int height)
 
 }
 
-static void createMap(int s_w,int s_h, int d_w, int d_h,int* mMap_w,int* mMap_h)
-{
-    int i,j;
-    int w_index_cur = -1;
-    int w_index_new;
-    int h_index_cur = -1;
-    int h_index_new;
-    memset((void *)mMap_w,0,d_w*sizeof(int));
-    memset((void *)mMap_h,0,d_h*sizeof(int));
-
-    i = 0;
-    j = 0;
-    while (i < s_w && j < d_w) {
-        w_index_new = i*d_w/s_w;
-        if (  w_index_new != w_index_cur) {
-                mMap_w[j]= i;
-                j++;
-                w_index_cur = w_index_new;
-            }
-            i++;
-        }
-    j = 0;
-    i = 0;
-    while (i < s_h && j < d_h) {
-            h_index_new = i*d_h/s_h;
-            if (  h_index_new != h_index_cur) {
-                    mMap_h[j]= i;
-                    j++;
-                    h_index_cur = h_index_new;
-                }
-            i++;
-        }
-}
-
-
-
+// the callback copies are scaled by the shared yuv kernels, any ratio
 static bool yuv420spDownScale(void* psrc, void* pdst, int src_w, int src_h, int dst_w, int dst_h)
 {
-    char * psrc_y = (char *)psrc;
-    char * pdst_y = (char *)pdst;
-    char * psrc_uv = (char *)psrc + src_w * src_h;
-    char * pdst_uv = (char *)pdst + dst_w * dst_h;
-
-    int scale = 1;
-    int scale_w = src_w / dst_w;
-    int scale_h = src_h / dst_h;
-    int h, w;
-
-    if (dst_w > src_w
-        || dst_h > src_h)
-    {
-        LOGE("error size, %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
-        return false;
-    }
-
-    if (scale_w == scale_h)
-    {
-        scale = scale_w;
-    }
-
-    LOGV("scale = %d\n", scale);
-
-    if (scale == 1)
-    {
-        if ((src_w == dst_w)
-            && (src_h == dst_h))
-        {
-            memcpy((char*)pdst, (char*)psrc, dst_w * dst_h * 3/2);
-        }
-        else
-        {
-            // crop
-            for (h = 0; h < dst_h; h++)
-            {
-                memcpy((char*)pdst + h * dst_w, (char*)psrc + h * src_w, dst_w);
-            }
-            for (h = 0; h < dst_h / 2; h++)
-            {
-                memcpy((char*)pdst_uv + h * dst_w, (char*)psrc_uv + h * src_w, dst_w);
-            }
-        }
-
-        return true;
-    }
-
-    for (h = 0; h < dst_h; h++)
-    {
-        for (w = 0; w < dst_w; w++)
-        {
-            *(pdst_y + h * dst_w + w) = *(psrc_y + h * scale * src_w + w * scale);
-        }
-    }
-    for (h = 0; h < dst_h / 2; h++)
-    {
-        for (w = 0; w < dst_w; w+=2)
-        {
-            *((short*)(pdst_uv + h * dst_w + w)) = *((short*)(psrc_uv + h * scale * src_w + w * scale));
-        }
-    }
+    yuv_kernel_image src, dst;
 
-    return true;
-}
-
-static bool yuv420spDown_noneScale(void* psrc, void* pdst, int src_w, int src_h, int dst_w, int dst_h)
-{
-    char * psrc_y = (char *)psrc;
-    char * pdst_y = (char *)pdst;
-    char * psrc_uv = (char *)psrc + src_w * src_h;
-    char * pdst_uv = (char *)pdst + dst_w * dst_h;
-    int y_h_index[dst_h];
-    int y_w_index[dst_w];
-    int uv_h_index[dst_h/2];
-    int uv_w_index[dst_w];
-    int h, w;
-    if (dst_w > src_w
-        || dst_h > src_h)
+    yuv_kernel_image_init(&src, psrc, YUV_KERNEL_NV21, src_w, src_h, src_w, 0);
+    yuv_kernel_image_init(&dst, pdst, YUV_KERNEL_NV21, dst_w, dst_h, dst_w, 0);
+    if (yuv_kernel_scale(&src, NULL, &dst, YUV_KERNEL_BOX) != 0)
     {
         LOGE("error size, %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
         return false;
     }
-
-    //y
-    createMap(src_w,src_h,dst_w,dst_h,y_w_index,y_h_index);
-    for (h = 0; h < dst_h; h++)
-    {
-        for (w = 0; w < dst_w; w++)
-        {
-            *(pdst_y + h * dst_w + w) = *(psrc_y +y_h_index[h]* src_w + y_w_index[w]);
-        }
-    }
-
-    //uv
-    createMap(src_w/2,src_h/2,dst_w/2,dst_h/2,uv_w_index,uv_h_index);
-    for (h = 0; h < dst_h / 2; h++)
-    {
-        for (w = 0; w < dst_w; w+=2)
-        {
-            *((short*)(pdst_uv + h * dst_w + w)) = *((short*)(psrc_uv +uv_h_index[h]* src_w + uv_w_index[w/2]*2));
-        }
-    }
     return true;
-
 }
 
-
 static bool yuv420pDownScale_align(void* psrc, void* pdst, int src_w, int src_h, int dst_w, int dst_h,int yStride,int uvStride)
 {
-    char * psrc_y = (char *)psrc;
-    char * pdst_y = (char *)pdst;
-    char * psrc_uv = (char *)psrc + src_w * src_h;
-    char * pdst_uv = (char *)pdst + dst_w * dst_h;
-    memset(pdst_uv,128,uvStride*dst_h/2);
-    int scale_w = src_w / dst_w;
-    int scale_h = src_h / dst_h;
-    int h, w;
-
-
-    if (dst_w > src_w
-        || dst_h > src_h)
+    yuv_kernel_image src, dst;
+
+    LOGD("src_w :%d,src_h :%d,dst_w: %d, dst_h :%d,yStride :%d,uvStride:%d",
+        src_w, src_h, dst_w, dst_h, yStride, uvStride);
+    yuv_kernel_image_init(&src, psrc, YUV_KERNEL_YV12, src_w, src_h, src_w, src_w / 2);
+    yuv_kernel_image_init(&dst, pdst, YUV_KERNEL_YV12, dst_w, dst_h, yStride, uvStride);
+    if (yuv_kernel_scale(&src, NULL, &dst, YUV_KERNEL_BOX) != 0)
     {
         LOGE("error size, %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
         return false;
     }
-
-        LOGD("src_w :%d,src_h :%d,dst_w: %d, dst_h :%d,yStride :%d,uvStride:%d,scale_w: %d,scale_h %d",
-            src_w, src_h, dst_w, dst_h, yStride,uvStride,scale_w,scale_h);
-    //y
-
-    int y_h_index[dst_h];
-    int y_w_index[dst_w];
-    createMap(src_w,src_h,dst_w,dst_h,y_w_index,y_h_index);
-    for (h = 0; h < dst_h; h++)
-    {
-        for (w = 0; w < dst_w; w++)
-        {
-            *(pdst_y + h *yStride + w) = *(psrc_y + y_h_index[h]* src_w + y_w_index[w]);
-        }
-    }
-
-    int uv_h_index[dst_h/2];
-    int uv_w_index[dst_w/2];
-    createMap(src_w/2,src_h/2,dst_w/2,dst_h/2,uv_w_index,uv_h_index);
-    //V
-    for (h = 0; h < dst_h/2 ; h++)
-    {
-        for (w = 0; w < dst_w/2; w++)
-        {
-            *(pdst_uv + h * uvStride+ w) = *(psrc_uv + uv_h_index[h]* src_w/2 + uv_w_index[w]);
-        }
-    }
-    //u
-    for (h = 0; h < dst_h/2 ; h++ )
-    {
-        for (w = 0; w < dst_w/2; w++)
-        {
-            *(pdst_uv + (h+dst_h/2)* uvStride+ w) = *(psrc_uv + src_w * src_h/4 + uv_h_index[h]* src_w/2 + uv_w_index[w]);
-        }
-    }
-
     return true;
 }
 
@@ -1196,14 +1026,9 @@ void CallbackNotifier::onNextFrameSW(const void* frame)
         } else {
             camera_memory_t* cam_buff = mGetMemoryCB(-1, mCBWidth * mCBHeight * 3 / 2, 1, mCallbackCookie);
             if (NULL != cam_buff && NULL != cam_buff->data) {
-                if ( src_width % mCBWidth == 0 &&  src_height % mCBHeight == 0)
                 yuv420spDownScale((void*)src_addr_vir, cam_buff->data,
                                 ALIGN_16B(src_width), src_height,
                                 mCBWidth, mCBHeight);
-                else
-                yuv420spDown_noneScale((void*)src_addr_vir, cam_buff->data,
-                                    ALIGN_16B(src_width), src_height,
-                                    mCBWidth, mCBHeight);
                 if (src_format == V4L2_PIX_FMT_NV12)
                 {
                     // NV12 <--> NV21
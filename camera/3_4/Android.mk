@@ -25,7 +25,8 @@ v4l2_shared_libs := \
   libvencoder.vendor
 
 v4l2_static_libs := \
-  android.hardware.camera.common@1.0-helper
+  android.hardware.camera.common@1.0-helper \
+  libcamera_yuvkernel
 
 v4l2_cflags += -fno-short-enums -Wall -Wextra -fvisibility=hidden -Wc++11-narrowing -DTARGET_BOARD_PLATFORM=$(TARGET_BOARD_PLATFORM) -Wno-unused-parameter -Wno-macro-redefined -Wno-unused-parameter -Wno-extra-tokens -Wno-null-arithmetic -Wno-format -Wno-reorder -Wno-unused-variable -Wno-writable-strings -Wno-logical-op-parentheses -Wno-sign-compare -Wno-unused-parameter -Wno-unused-value -Wno-unused-function -Wno-parentheses -Wno-extern-c-compat -Wno-null-conversion  -Wno-sometimes-uninitialized -Wno-gnu-designator -Wno-unused-label -Wno-pointer-arith -Wno-empty-body -fPIC -Wno-missing-field-initializers -Wno-pessimizing-move -Wno-unused-private-field -Wno-user-defined-warnings
 
@@ -63,9 +64,13 @@ v4l2_src_files := \
   v4l2_wrapper.cpp \
   stream_manager.cpp \
   camera_stream.cpp \
+  frame_fanout.cpp \
+  jpeg_encoder.cpp \
 
 v4l2_test_files := \
   format_metadata_factory_test.cpp \
+  frame_fanout_test.cpp \
+  jpeg_encoder_test.cpp \
   metadata/control_test.cpp \
   metadata/default_option_delegate_test.cpp \
   metadata/enum_converter_test.cpp \
@@ -85,6 +90,8 @@ v4l2_test_files := \
   metadata/v4l2_control_delegate_test.cpp \
   request_tracker_test.cpp \
   static_properties_test.cpp \
+  stream_manager_test.cpp \
+  v4l2_stream_test.cpp \
 
 # Platform setting.
 # ==============================================================================
@@ -599,10 +599,19 @@ void Camera::dump(int fd)
     android::Mutex::Autolock al(mDeviceLock);
 
     dprintf(fd, "Camera ID: %d (Busy: %d)\n", mId, mBusy);
+    dumpDevice(fd);
 
     // TODO: dump all settings
 }
 
+uint8_t Camera::pipelineMaxDepth()
+{
+    if (!mStaticInfo && loadStaticInfo()) {
+        return 0;
+    }
+    return mStaticInfo->pipeline_max_depth();
+}
+
 const char* Camera::templateToString(int type)
 {
     switch (type) {
@@ -76,6 +76,8 @@ class Camera : public virtual android::RefBase  {
             std::shared_ptr<CaptureRequest> request) = 0;
         // Flush in flight buffers.
         virtual int flushBuffers() = 0;
+        // Dump the device state, called with the device lock held.
+        virtual void dumpDevice(int fd) = 0;
 
 
         // Callback for when the device has filled in the requested data.
@@ -85,6 +87,8 @@ class Camera : public virtual android::RefBase  {
             std::shared_ptr<CaptureRequest> request, int err);
         // Prettyprint template names
         const char* templateToString(int type);
+        // android.request.pipelineMaxDepth, 0 if the static info is missing.
+        uint8_t pipelineMaxDepth();
 
 
         // Be compatible with camera api 1.
@@ -21,7 +21,11 @@
 #include <cstdlib>
 #include <string.h>
 
+#include <cutils/properties.h>
+#include <hal_public.h> //GPU dependencies
+
 #include "CameraMetadata.h"
+#include "yuv_kernel.h"
 #include <hardware/camera3.h>
 
 
@@ -68,6 +72,7 @@ CameraStream::CameraStream(std::shared_ptr<V4L2Stream> stream, int isBlob):
   mHeight = 0;
   mFormat = 0;
   mUsage = 0;
+  mBufferDepth = MAX_BUFFER_NUM;
 
 }
 
@@ -124,11 +129,30 @@ int CameraMainStream::stop(){
         return res;
       }
       mStreamOn = false;
+      if (isZeroCopy()) {
+        // STREAMOFF gave the queued buffers back, their requests go first again.
+        std::lock_guard<std::mutex> guard(main_yuv_buffer_queue_lock_);
+        std::queue<frame_bufferHandle_map_t> ahead;
+        for(auto& tmp : main_dmabuf_queued_) {
+          ahead.push(tmp);
+        }
+        main_dmabuf_queued_.clear();
+        requeueRequests(&ahead);
+      }
     }
   }
   return res;
 }
 
+// Put requests back in front of the pending ones, with the queue lock held.
+void CameraMainStream::requeueRequests(std::queue<frame_bufferHandle_map_t>* ahead) {
+  while(!main_frameNumber_buffers_map_queue_.empty()) {
+    ahead->push(main_frameNumber_buffers_map_queue_.front());
+    main_frameNumber_buffers_map_queue_.pop();
+  }
+  main_frameNumber_buffers_map_queue_.swap(*ahead);
+}
+
 int CameraMainStream::flush(){
   HAL_LOG_ENTER();
 
@@ -159,10 +183,16 @@ int CameraMainStream::initialize(uint32_t width, uint32_t height, int format, ui
     HAL_LOGE("Failed to SetParm.");
   }
 
-  uint32_t max_buffers = MAX_BUFFER_NUM;
+  uint32_t max_buffers = mBufferDepth;
   if(format == HAL_PIXEL_FORMAT_BLOB) {
     format = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
   }
+  if(!isBlobFlag && property_get_bool("persist.vendor.camera.zerocopy", false)) {
+    // Let the device write to the preview buffers, no copy in dequeue.
+    stream_->SetMemory(V4L2_MEMORY_DMABUF);
+  }
+  // The consumers of a frame run on the manager's workers.
+  stream_->SetHoldBuffers(true);
   StreamFormat stream_format(format, width, height);
   res = stream_->SetFormat(stream_format, &max_buffers);
   if (res) {
@@ -223,7 +253,27 @@ int CameraMainStream::getBuffer(buffer_handle_t ** buffer, uint32_t* frameNumber
   int res = -ENOMEM;
   HAL_LOGD("main_frameNumber_buffers_map_queue_ has %d buffer(s).", main_frameNumber_buffers_map_queue_.size());
   HAL_LOGD("main_blob_frameNumber_buffers_map_queue_ has %d buffer(s).", main_blob_frameNumber_buffers_map_queue_.size());
-  if(main_frameNumber_buffers_map_queue_.size() && !isBlobFlag){
+  if(isZeroCopy()) {
+    // The frame dequeued is in the request whose buffer was queued to that
+    // index, the driver need not give the buffers back in queue order.
+    std::unique_lock<std::mutex> lock(main_yuv_buffer_queue_lock_);
+    int fd = stream_->GetDequeuedDmabuf();
+    auto it = main_dmabuf_queued_.begin();
+    for(; it != main_dmabuf_queued_.end(); it++) {
+      if(((private_handle_t *)*it->bufferHandleptr)->share_fd == fd) {
+        break;
+      }
+    }
+    if(it == main_dmabuf_queued_.end()) {
+      HAL_LOGE("No request queued with dma-buf fd:%d.", fd);
+      return res;
+    }
+    *frameNumber = it->frameNum;
+    *buffer = it->bufferHandleptr;
+    main_dmabuf_queued_.erase(it);
+    HAL_LOGD("main_dmabuf_queued_ buffer_handle_t*:%p, FrameNumber:%d poped.", *buffer, *frameNumber);
+    res = 0;
+  } else if(main_frameNumber_buffers_map_queue_.size() && !isBlobFlag){
     std::unique_lock<std::mutex> lock(main_yuv_buffer_queue_lock_);
     frame_bufferHandle_map_t tmp = main_frameNumber_buffers_map_queue_.front();;
     *frameNumber = tmp.frameNum;
@@ -325,7 +375,7 @@ int CameraMainStream::encodebuffer(void * dst_addr, void * src_addr, unsigned lo
 
 }
 #endif
-int CameraMainStream::encodebuffer(void * dst_addr, void *src_addr, unsigned long mJpegBufferSizes) {
+int CameraMainStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done) {
 
   int res = -ENOMEM;
   //HAL_LOGD("Failed to prepare buffer.");
@@ -399,7 +449,7 @@ int CameraMainStream::encodebuffer(void * dst_addr, void *src_addr, unsigned lon
   jpeg_enc.thumbWidth        = mThumbnailSize[0];
   jpeg_enc.thumbHeight    = mThumbnailSize[1];
 
-  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc);
+  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc, done);
   if (res) {
     HAL_LOGE("Device EncodeBuffer failed.");
   }
@@ -432,6 +482,9 @@ int CameraMainStream::request(buffer_handle_t * buffer, uint32_t frameNumber, Ca
     tmp.frameNum = frameNumber;
     main_frameNumber_buffers_map_queue_.push(tmp);
     HAL_LOGD("main_frameNumber_buffers_map_queue_ buffer_handle_t*:%p, FrameNumber:%d pushed.", buffer, frameNumber);
+    if(isZeroCopy()) {
+      main_yuv_buffer_availabl_queue_.notify_one();
+    }
   } else {
     std::lock_guard<std::mutex> guard(main_blob_buffer_queue_lock_);
     frame_bufferHandle_map_t tmp;
@@ -465,6 +518,48 @@ int CameraMainStream::request(buffer_handle_t * buffer, uint32_t frameNumber, Ca
 int CameraMainStream::enqueueBuffer() {
   HAL_LOG_ENTER();
   int res = 0;
+  if(initialized && isZeroCopy()) {
+    // Queue the next request's own buffer to the device.
+    frame_bufferHandle_map_t tmp;
+    {
+      std::unique_lock<std::mutex> lock(main_yuv_buffer_queue_lock_);
+      if(main_frameNumber_buffers_map_queue_.empty()) {
+        main_yuv_buffer_availabl_queue_.wait_for(lock, std::chrono::milliseconds(100));
+        return 0;
+      }
+      tmp = main_frameNumber_buffers_map_queue_.front();
+      main_frameNumber_buffers_map_queue_.pop();
+      // Before the QBUF, the frame may be dequeued before we are back.
+      main_dmabuf_queued_.push_back(tmp);
+    }
+    private_handle_t *hnd = (private_handle_t *)*tmp.bufferHandleptr;
+    res = stream_->EnqueueDmabuf(hnd->share_fd, hnd->stride, hnd->size);
+    if (res) {
+      // Not queued, it is still the next request.
+      {
+        std::lock_guard<std::mutex> guard(main_yuv_buffer_queue_lock_);
+        main_dmabuf_queued_.pop_back();
+        std::queue<frame_bufferHandle_map_t> ahead;
+        ahead.push(tmp);
+        requeueRequests(&ahead);
+      }
+      if (res == -EINVAL) {
+        // The framework's buffers do not fit the device, copy into them.
+        // Retried with the next enqueue while dma-buf buffers are in use.
+        res = stream_->FallbackToMmap();
+        if (res && res != -EBUSY) {
+          HAL_LOGE("Device failed to fall back to mmap.");
+          return res;
+        }
+        return 0;
+      }
+      if (res != -EAGAIN) {
+        HAL_LOGE("Device failed to enqueue dma-buf.");
+        return res;
+      }
+    }
+    return 0;
+  }
   if(initialized) {
     res = stream_->EnqueueBuffer();
     if (res) {
@@ -476,6 +571,14 @@ int CameraMainStream::enqueueBuffer() {
   return res;
 }
 
+bool CameraMainStream::isZeroCopy() {
+  return !isBlobFlag && stream_->IsDmabuf();
+}
+
+int CameraMainStream::releaseBuffer(void * src_addr, bool drop) {
+  return stream_->ReleaseBuffer(src_addr, drop);
+}
+
 int CameraMainStream::dequeueBuffer(void ** src_addr,struct timeval * ts) {
   HAL_LOG_ENTER();
   int res = 0;
@@ -577,7 +680,7 @@ int CameraSubStream::initialize(uint32_t width, uint32_t height, int format, uin
     HAL_LOGE("Failed to SetParm.");
   }
 
-  uint32_t max_buffers = MAX_BUFFER_NUM;
+  uint32_t max_buffers = mBufferDepth;
   if(format == HAL_PIXEL_FORMAT_BLOB) {
     format = HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED;
   }
@@ -664,7 +767,7 @@ int CameraSubStream::getBuffer(buffer_handle_t ** buffer, uint32_t* frameNumber)
   return res;
 }
 
-int CameraSubStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes) {
+int CameraSubStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done) {
   HAL_LOG_ENTER();
 
   int res = -ENOMEM;
@@ -736,7 +839,7 @@ int CameraSubStream::encodebuffer(void * dst_addr, void * src_addr, unsigned lon
   jpeg_enc.thumbWidth        = mThumbnailSize[0];
   jpeg_enc.thumbHeight    = mThumbnailSize[1];
 
-  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc);
+  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc, done);
 
   if (res) {
     HAL_LOGE("Device EncodeBuffer failed.");
@@ -901,7 +1004,7 @@ int CameraMainMirrorStream::getBuffer(buffer_handle_t ** buffer, uint32_t* frame
 
   return res;
 }
-int CameraMainMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes) {
+int CameraMainMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done) {
 
   int res = -ENOMEM;
   //HAL_LOGD("Failed to prepare buffer.");
@@ -975,7 +1078,7 @@ int CameraMainMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsig
   jpeg_enc.thumbWidth        = mThumbnailSize[0];
   jpeg_enc.thumbHeight    = mThumbnailSize[1];
 
-  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc);
+  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc, done);
   if (res) {
     HAL_LOGE("Device EncodeBuffer failed.");
   }
@@ -1120,7 +1223,7 @@ int CameraSubMirrorStream::getBuffer(buffer_handle_t ** buffer, uint32_t* frameN
 
   return res;
 }
-int CameraSubMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes) {
+int CameraSubMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done) {
 
   int res = -ENOMEM;
   //HAL_LOGD("Failed to prepare buffer.");
@@ -1198,7 +1301,7 @@ int CameraSubMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsign
   jpeg_enc.thumbWidth        = mThumbnailSize[0];
   jpeg_enc.thumbHeight    = mThumbnailSize[1];
 
-  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc);
+  res = stream_->EncodeBuffer(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc, done);
   if (res) {
     HAL_LOGE("Device EncodeBuffer failed.");
   }
@@ -1208,69 +1311,14 @@ int CameraSubMirrorStream::encodebuffer(void * dst_addr, void * src_addr, unsign
 int CameraSubMirrorStream::yuv420spDownScale(void* psrc, void* pdst, int src_w, int src_h, int dst_w, int dst_h)
 {
   HAL_LOG_ENTER();
+  yuv_kernel_image src, dst;
 
-  char * psrc_y = (char *)psrc;
-  char * pdst_y = (char *)pdst;
-  char * psrc_uv = (char *)psrc + src_w * src_h;
-  char * pdst_uv = (char *)pdst + dst_w * dst_h;
-
-  int scale = 1;
-  int scale_w = src_w / dst_w;
-  int scale_h = src_h / dst_h;
-  int h, w;
-
-  if (dst_w > src_w
-      || dst_h > src_h)
-  {
+  yuv_kernel_image_init(&src, psrc, YUV_KERNEL_NV21, src_w, src_h, src_w, 0);
+  yuv_kernel_image_init(&dst, pdst, YUV_KERNEL_NV21, dst_w, dst_h, dst_w, 0);
+  if (yuv_kernel_scale(&src, NULL, &dst, YUV_KERNEL_BOX)) {
     HAL_LOGE("error size, %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
     return -1;
   }
-
-  if (scale_w == scale_h)
-  {
-    scale = scale_w;
-  }
-
-  HAL_LOGV("scale = %d\n", scale);
-
-  if (scale == 1)
-  {
-    if ((src_w == dst_w)
-        && (src_h == dst_h))
-    {
-      memcpy((char*)pdst, (char*)psrc, dst_w * dst_h * 3/2);
-    }
-    else
-    {
-      // crop
-      for (h = 0; h < dst_h; h++)
-      {
-        memcpy((char*)pdst + h * dst_w, (char*)psrc + h * src_w, dst_w);
-      }
-      for (h = 0; h < dst_h / 2; h++)
-      {
-        memcpy((char*)pdst_uv + h * dst_w, (char*)psrc_uv + h * src_w, dst_w);
-      }
-    }
-
-    return 0;
-  }
-
-  for (h = 0; h < dst_h; h++)
-  {
-    for (w = 0; w < dst_w; w++)
-    {
-      *(pdst_y + h * dst_w + w) = *(psrc_y + h * scale * src_w + w * scale);
-    }
-  }
-  for (h = 0; h < dst_h / 2; h++)
-  {
-    for (w = 0; w < dst_w; w+=2)
-    {
-      *((short*)(pdst_uv + h * dst_w + w)) = *((short*)(psrc_uv + h * scale * src_w + w * scale));
-    }
-  }
-
   return 0;
 }
 
@@ -6,6 +6,7 @@
 
 #include <array>
 #include <condition_variable>
+#include <deque>
 #include <map>
 #include <queue>
 #include <string>
@@ -46,8 +47,19 @@ public:
   virtual int getBuffer(buffer_handle_t ** buffer, uint32_t* frameNumber) = 0;
   virtual int enqueueBuffer() = 0;
   virtual int dequeueBuffer(void ** src_addr,struct timeval * ts) = 0;
-  virtual int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes) = 0;
+  // With |done| the encode is queued to the device stream's encoder and
+  // src_addr can be reused on return, done tells how it went.
+  virtual int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes,
+                           JpegEncoder::Done done = nullptr) = 0;
   virtual int copybuffer(void * dst_addr, void * src_addr) = 0;
+  // Zero copy streams are filled by the device directly. A dropped
+  // frame still goes back to its request, blanked, to keep the order.
+  virtual bool isZeroCopy() { return false; }
+  // Main stream frames stay held after the dequeue, src_addr is released
+  // once all its readers are done.
+  virtual int releaseBuffer(void * src_addr, bool drop) { return 0; }
+  // V4L2 buffers to ask for in initialize, the driver may give fewer.
+  void setBufferDepth(uint32_t buffers) { mBufferDepth = buffers; }
 
 protected:
   int isBlobFlag;
@@ -63,6 +75,7 @@ protected:
   uint32_t mHeight;
   int mFormat;
   uint32_t mUsage;
+  uint32_t mBufferDepth;
 
   typedef struct frame_bufferHandle_map_t{
       uint32_t    frameNum;
@@ -93,17 +106,22 @@ public:
   int request(buffer_handle_t * buffer, uint32_t frameNumber, CameraMetadata* metadata, StreamManager* mManager);
   int dequeueBuffer(void ** src_addr,struct timeval * ts);
   int enqueueBuffer();
-  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes);
+  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done = nullptr);
   int copybuffer(void * dst_addr, void * src_addr);
+  bool isZeroCopy();
+  int releaseBuffer(void * src_addr, bool drop);
 
 protected:
 
 
 private:
+  void requeueRequests(std::queue<frame_bufferHandle_map_t>* ahead);
 
   std::mutex main_yuv_buffer_queue_lock_;
   std::queue<frame_bufferHandle_map_t> main_frameNumber_buffers_map_queue_;
   std::condition_variable main_yuv_buffer_availabl_queue_;
+  // Requests whose buffer is queued to the device, in queue order.
+  std::deque<frame_bufferHandle_map_t> main_dmabuf_queued_;
 
   std::mutex main_blob_buffer_queue_lock_;
   std::queue<frame_bufferHandle_map_t> main_blob_frameNumber_buffers_map_queue_;
@@ -126,7 +144,7 @@ public:
   int request(buffer_handle_t * buffer, uint32_t frameNumber, CameraMetadata* metadata, StreamManager* mManager);
   int dequeueBuffer(void ** src_addr,struct timeval * ts);
   int enqueueBuffer();
-  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes);
+  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done = nullptr);
   int copybuffer(void * dst_addr, void * src_addr);
 
 
@@ -161,7 +179,7 @@ public:
   int request(buffer_handle_t * buffer, uint32_t frameNumber, CameraMetadata* metadata, StreamManager* mManager);
   int dequeueBuffer(void ** src_addr,struct timeval * ts);
   int enqueueBuffer();
-  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes);
+  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done = nullptr);
   int copybuffer(void * dst_addr, void * src_addr);
 
 protected:
@@ -195,7 +213,7 @@ public:
   int request(buffer_handle_t * buffer, uint32_t frameNumber, CameraMetadata* metadata, StreamManager* mManager);
   int dequeueBuffer(void ** src_addr,struct timeval * ts);
   int enqueueBuffer();
-  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes);
+  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JpegEncoder::Done done = nullptr);
   int copybuffer(void * dst_addr, void * src_addr);
 
 
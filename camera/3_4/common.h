@@ -62,6 +62,13 @@
 #define TIMEOUT_COUNT    0
 #define MAX_STREAM_NUM 3
 #define DROP_BUFFERS_NUM    3
+// Fewest V4L2 buffers a stream runs with, one with the driver, one dequeued.
+#define MIN_BUFFER_NUM    2
+// Most V4L2 buffers a stream asks for, with a deep pipeline. The arrays
+// indexed by the V4L2 buffer index are sized with it.
+#define MAX_STREAM_BUFFER_NUM    8
+// Captures waiting for the JPEG encoder thread.
+#define JPEG_ENCODE_QUEUE    2
 #define MAX_FRAME_NUM 128
 // ms delay between stream on and off.
 #define DELAY_BETWEEN_STREAM 500
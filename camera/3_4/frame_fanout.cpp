@@ -0,0 +1,192 @@
+
+#define LOG_TAG "CameraHALv3_FrameFanout"
+#include <utils/Log.h>
+
+#include "frame_fanout.h"
+
+#include <string>
+
+namespace v4l2_camera_hal {
+
+FrameFanout::FrameFanout(int workers)
+    : workers_(workers),
+      exit_(true),
+      frames_(0),
+      sequence_(0) {
+}
+
+FrameFanout::~FrameFanout() {
+  stop();
+}
+
+int FrameFanout::start(const char* name, int priority) {
+  HAL_LOG_ENTER();
+  std::lock_guard<std::mutex> guard(lock_);
+  exit_ = false;
+  for (size_t i = 0; i < workers_.size(); i++) {
+    if (workers_[i].thread != nullptr) {
+      continue;
+    }
+    workers_[i].thread = new FunctionThread(
+        std::bind(&FrameFanout::workerLoop, this, i));
+    std::string thread_name = std::string(name) + std::to_string(i);
+    int res = workers_[i].thread->run(thread_name.c_str(), priority);
+    if (res) {
+      // post() runs the jobs of this worker inline then.
+      HAL_LOGE("Failed to run worker %d: %d.", i, res);
+      workers_[i].thread.clear();
+      return res;
+    }
+  }
+  return 0;
+}
+
+void FrameFanout::stop() {
+  HAL_LOG_ENTER();
+  drain();
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (exit_) {
+      return;
+    }
+    exit_ = true;
+    for (size_t i = 0; i < workers_.size(); i++) {
+      workers_[i].cond.notify_one();
+    }
+  }
+  for (size_t i = 0; i < workers_.size(); i++) {
+    if (workers_[i].thread != nullptr) {
+      workers_[i].thread->requestExitAndWait();
+      workers_[i].thread.clear();
+    }
+    // Posted after the drain, the thread may have left before them.
+    while (!workers_[i].tasks.empty()) {
+      Task task = workers_[i].tasks.front();
+      workers_[i].tasks.pop_front();
+      task.job(task.frame);
+      put(task.frame);
+    }
+  }
+}
+
+FrameFanout::Frame* FrameFanout::newFrame(void * src_addr, struct timeval ts, Job release) {
+  Frame* frame = new Frame();
+  frame->refcnt = 1;
+  frame->release = release;
+  frame->src_addr = src_addr;
+  frame->ts = ts;
+  std::lock_guard<std::mutex> guard(lock_);
+  frame->sequence = sequence_++;
+  frames_++;
+  return frame;
+}
+
+int FrameFanout::post(Frame* frame, int worker, Consumer job) {
+  if (worker < 0 || worker >= (int)workers_.size()) {
+    HAL_LOGE("No worker %d.", worker);
+    return -EINVAL;
+  }
+  frame->refcnt++;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!exit_ && workers_[worker].thread != nullptr) {
+      workers_[worker].tasks.push_back({frame, job});
+      workers_[worker].cond.notify_one();
+      return 0;
+    }
+  }
+  // Stopped, or the worker never ran, do it in the caller.
+  job(frame);
+  put(frame);
+  return 0;
+}
+
+void FrameFanout::commit(Frame* frame) {
+  put(frame);
+}
+
+void FrameFanout::drain() {
+  wait(0);
+}
+
+void FrameFanout::wait(int frames) {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (frames_ > frames) {
+    idle_cond_.wait(lock);
+  }
+}
+
+int FrameFanout::shedOldest(Frame* to) {
+  Frame* from = nullptr;
+  int moved = 0;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    // Moved jobs are ahead of newer frames, look at all of them.
+    for (size_t i = 0; i < workers_.size(); i++) {
+      for (const Task& task : workers_[i].tasks) {
+        if (task.frame != to &&
+            (from == nullptr || task.frame->sequence < from->sequence)) {
+          from = task.frame;
+        }
+      }
+    }
+    if (from == nullptr) {
+      return 0;
+    }
+    for (size_t i = 0; i < workers_.size(); i++) {
+      for (Task& task : workers_[i].tasks) {
+        if (task.frame == from) {
+          task.frame = to;
+          to->refcnt++;
+          moved++;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < moved; i++) {
+    put(from);
+  }
+  return moved;
+}
+
+int FrameFanout::pending(int worker) {
+  std::lock_guard<std::mutex> guard(lock_);
+  return workers_[worker].tasks.size();
+}
+
+int FrameFanout::held() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return frames_;
+}
+
+bool FrameFanout::workerLoop(int worker) {
+  Task task;
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    Worker& w = workers_[worker];
+    while (w.tasks.empty() && !exit_) {
+      w.cond.wait(lock);
+    }
+    if (w.tasks.empty()) {
+      return false;
+    }
+    task = w.tasks.front();
+    w.tasks.pop_front();
+  }
+  task.job(task.frame);
+  put(task.frame);
+  return true;
+}
+
+void FrameFanout::put(Frame* frame) {
+  if (--frame->refcnt > 0) {
+    return;
+  }
+  frame->release();
+  delete frame;
+  std::lock_guard<std::mutex> guard(lock_);
+  frames_--;
+  idle_cond_.notify_all();
+}
+
+}  // namespace v4l2_camera_hal
@@ -0,0 +1,95 @@
+
+#ifndef V4L2_CAMERA_HAL_FRAME_FANOUT_H_
+#define V4L2_CAMERA_HAL_FRAME_FANOUT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <utils/StrongPointer.h>
+
+#include "common.h"
+#include "function_thread.h"
+
+namespace v4l2_camera_hal {
+
+// Hand one dequeued frame to several consumers, each on its own worker
+// thread, and release the frame once the last of them is done.
+// Jobs on one worker run in the order they were posted.
+class FrameFanout {
+ public:
+  typedef std::function<void()> Job;
+
+  // A frame shared by its dispatcher and the jobs posted for it.
+  struct Frame {
+    std::atomic<int> refcnt;
+    Job release;
+    // Handed out in this order.
+    uint64_t sequence;
+    void * src_addr;
+    struct timeval ts;
+  };
+  // Runs on a worker with the frame it was posted for, or the one it was
+  // moved to by shedOldest().
+  typedef std::function<void(const Frame* frame)> Consumer;
+
+  FrameFanout(int workers);
+  ~FrameFanout();
+
+  int start(const char* name, int priority);
+  // Run what is already posted, then stop the workers.
+  void stop();
+
+  // The dispatcher holds the first reference, |release| runs when the
+  // dispatcher has committed and every job posted for the frame ran.
+  Frame* newFrame(void * src_addr, struct timeval ts, Job release);
+  // Queue |job| on |worker|, holding a reference on |frame| until it ran.
+  int post(Frame* frame, int worker, Consumer job);
+  // Nothing more to post for |frame|, drop the dispatcher's reference.
+  void commit(Frame* frame);
+  // Wait until every frame handed out is released.
+  void drain();
+  // Wait until at most |frames| frames are handed out.
+  void wait(int frames);
+
+  // Move the jobs still waiting for the oldest frame, other than |to|, to
+  // |to|. That frame is released once its running jobs are done. |to| must
+  // not be committed yet. Returns the number of jobs moved.
+  int shedOldest(Frame* to);
+
+  // Jobs waiting on |worker|, not counting the one running.
+  int pending(int worker);
+  // Frames handed out and not released yet.
+  int held();
+
+ private:
+  struct Task {
+    Frame* frame;
+    Consumer job;
+  };
+  struct Worker {
+    std::deque<Task> tasks;
+    std::condition_variable cond;
+    android::sp<FunctionThread> thread;
+  };
+
+  bool workerLoop(int worker);
+  void put(Frame* frame);
+
+  std::vector<Worker> workers_;
+  bool exit_;
+  // Frames handed out and not released yet.
+  int frames_;
+  uint64_t sequence_;
+  std::mutex lock_;
+  std::condition_variable idle_cond_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameFanout);
+};
+
+}  // namespace v4l2_camera_hal
+
+#endif  // V4L2_CAMERA_HAL_FRAME_FANOUT_H_
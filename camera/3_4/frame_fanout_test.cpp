@@ -0,0 +1,210 @@
+
+#include "frame_fanout.h"
+
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using testing::Test;
+
+namespace v4l2_camera_hal {
+
+class FrameFanoutTest : public Test {
+ protected:
+  void SetUp() {
+    dut_.reset(new FrameFanout(3));
+    released_ = 0;
+  }
+
+  FrameFanout::Frame* NewFrame(void * src_addr = nullptr) {
+    struct timeval ts = {0, 0};
+    return dut_->newFrame(src_addr, ts, [this]() {
+      std::lock_guard<std::mutex> guard(lock_);
+      released_++;
+      cond_.notify_all();
+    });
+  }
+
+  // Wait for |flag| under lock_, false on timeout.
+  bool WaitFor(bool* flag) {
+    std::unique_lock<std::mutex> lock(lock_);
+    return cond_.wait_for(lock, std::chrono::seconds(5),
+                          [flag]() { return *flag; });
+  }
+
+  void Set(bool* flag) {
+    std::lock_guard<std::mutex> guard(lock_);
+    *flag = true;
+    cond_.notify_all();
+  }
+
+  int Released() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return released_;
+  }
+
+  std::unique_ptr<FrameFanout> dut_;
+  std::mutex lock_;
+  std::condition_variable cond_;
+  int released_;
+};
+
+TEST_F(FrameFanoutTest, NotStartedRunsInline) {
+  int ran = 0;
+  FrameFanout::Frame* frame = NewFrame();
+  EXPECT_EQ(dut_->post(frame, 0, [&ran](const FrameFanout::Frame*) { ran++; }), 0);
+  EXPECT_EQ(dut_->post(frame, 2, [&ran](const FrameFanout::Frame*) { ran++; }), 0);
+  EXPECT_EQ(ran, 2);
+  EXPECT_EQ(Released(), 0);
+  dut_->commit(frame);
+  EXPECT_EQ(Released(), 1);
+}
+
+TEST_F(FrameFanoutTest, BadWorker) {
+  FrameFanout::Frame* frame = NewFrame();
+  EXPECT_EQ(dut_->post(frame, 3, [](const FrameFanout::Frame*) {}), -EINVAL);
+  EXPECT_EQ(dut_->post(frame, -1, [](const FrameFanout::Frame*) {}), -EINVAL);
+  dut_->commit(frame);
+  EXPECT_EQ(Released(), 1);
+}
+
+TEST_F(FrameFanoutTest, ReleaseAfterLastJob) {
+  ASSERT_EQ(dut_->start("FanoutTest", 0), 0);
+  bool go = false;
+  bool done = false;
+  FrameFanout::Frame* frame = NewFrame();
+  dut_->post(frame, 0, [](const FrameFanout::Frame*) {});
+  dut_->post(frame, 1, [this, &go](const FrameFanout::Frame*) { WaitFor(&go); });
+  dut_->post(frame, 2, [this, &done](const FrameFanout::Frame*) { Set(&done); });
+  dut_->commit(frame);
+
+  ASSERT_TRUE(WaitFor(&done));
+  EXPECT_EQ(Released(), 0);
+  Set(&go);
+  dut_->drain();
+  EXPECT_EQ(Released(), 1);
+  dut_->stop();
+}
+
+TEST_F(FrameFanoutTest, SlowWorkerDoesNotStallOthers) {
+  ASSERT_EQ(dut_->start("FanoutTest", 0), 0);
+  bool encoded = false;
+  bool previewed = false;
+  // An encode of frame 1 waits for the preview of frame 2.
+  FrameFanout::Frame* frame1 = NewFrame();
+  dut_->post(frame1, 0, [](const FrameFanout::Frame*) {});
+  dut_->post(frame1, 1, [this, &previewed, &encoded](const FrameFanout::Frame*) {
+    if (WaitFor(&previewed)) {
+      Set(&encoded);
+    }
+  });
+  dut_->commit(frame1);
+  FrameFanout::Frame* frame2 = NewFrame();
+  dut_->post(frame2, 0, [this, &previewed](const FrameFanout::Frame*) { Set(&previewed); });
+  dut_->commit(frame2);
+
+  ASSERT_TRUE(WaitFor(&encoded));
+  dut_->drain();
+  EXPECT_EQ(Released(), 2);
+  dut_->stop();
+}
+
+TEST_F(FrameFanoutTest, OrderPerWorker) {
+  ASSERT_EQ(dut_->start("FanoutTest", 0), 0);
+  std::vector<int> order;
+  for (int i = 0; i < 64; i++) {
+    FrameFanout::Frame* frame = NewFrame();
+    dut_->post(frame, 1, [&order, i](const FrameFanout::Frame*) { order.push_back(i); });
+    dut_->commit(frame);
+  }
+  dut_->drain();
+  ASSERT_EQ(order.size(), 64u);
+  for (int i = 0; i < 64; i++) {
+    EXPECT_EQ(order[i], i);
+  }
+  EXPECT_EQ(Released(), 64);
+  EXPECT_EQ(dut_->pending(1), 0);
+  dut_->stop();
+}
+
+TEST_F(FrameFanoutTest, ShedOldest) {
+  ASSERT_EQ(dut_->start("FanoutTest", 0), 0);
+  bool go = false;
+  bool running = false;
+  int frames[3];
+  std::vector<void*> consumed;
+  FrameFanout::Frame* frame0 = NewFrame(&frames[0]);
+  dut_->post(frame0, 1, [this, &go, &running](const FrameFanout::Frame*) {
+    Set(&running);
+    WaitFor(&go);
+  });
+  dut_->commit(frame0);
+  ASSERT_TRUE(WaitFor(&running));
+  FrameFanout::Frame* frame1 = NewFrame(&frames[1]);
+  dut_->post(frame1, 1, [&consumed](const FrameFanout::Frame* frame) {
+    consumed.push_back(frame->src_addr);
+  });
+  dut_->commit(frame1);
+  EXPECT_EQ(dut_->held(), 2);
+
+  // frame0 is running, frame1 is the oldest waiting, it goes back at once.
+  FrameFanout::Frame* frame2 = NewFrame(&frames[2]);
+  EXPECT_EQ(dut_->shedOldest(frame2), 1);
+  EXPECT_EQ(Released(), 1);
+  EXPECT_EQ(dut_->shedOldest(frame2), 0);
+  dut_->post(frame2, 1, [&consumed](const FrameFanout::Frame* frame) {
+    consumed.push_back(frame->src_addr);
+  });
+  dut_->commit(frame2);
+
+  Set(&go);
+  dut_->wait(0);
+  EXPECT_EQ(Released(), 3);
+  ASSERT_EQ(consumed.size(), 2u);
+  EXPECT_EQ(consumed[0], &frames[2]);
+  EXPECT_EQ(consumed[1], &frames[2]);
+  dut_->stop();
+}
+
+TEST_F(FrameFanoutTest, WaitHeld) {
+  ASSERT_EQ(dut_->start("FanoutTest", 0), 0);
+  bool go = false;
+  for (int i = 0; i < 2; i++) {
+    FrameFanout::Frame* frame = NewFrame();
+    dut_->post(frame, i, [this, &go](const FrameFanout::Frame*) { WaitFor(&go); });
+    dut_->commit(frame);
+  }
+  EXPECT_EQ(dut_->held(), 2);
+  std::thread releaser([this, &go]() { Set(&go); });
+  dut_->wait(1);
+  EXPECT_LE(dut_->held(), 1);
+  releaser.join();
+  dut_->drain();
+  EXPECT_EQ(dut_->held(), 0);
+  dut_->stop();
+}
+
+TEST_F(FrameFanoutTest, StopRunsPosted) {
+  ASSERT_EQ(dut_->start("FanoutTest", 0), 0);
+  std::atomic<int> ran(0);
+  for (int i = 0; i < 16; i++) {
+    FrameFanout::Frame* frame = NewFrame();
+    for (int w = 0; w < 3; w++) {
+      dut_->post(frame, w, [&ran](const FrameFanout::Frame*) { ran++; });
+    }
+    dut_->commit(frame);
+  }
+  dut_->stop();
+  EXPECT_EQ(ran, 48);
+  EXPECT_EQ(Released(), 16);
+
+  // Stopped, back to running in the caller.
+  FrameFanout::Frame* frame = NewFrame();
+  dut_->post(frame, 0, [&ran](const FrameFanout::Frame*) { ran++; });
+  EXPECT_EQ(ran, 49);
+  dut_->commit(frame);
+  EXPECT_EQ(Released(), 17);
+}
+
+}  // namespace v4l2_camera_hal
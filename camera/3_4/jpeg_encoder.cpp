@@ -0,0 +1,310 @@
+
+#define LOG_TAG "CameraHALv3_JpegEncoder"
+#include <utils/Log.h>
+
+#include "jpeg_encoder.h"
+
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <cutils/properties.h>
+#include <hardware/camera3.h>
+
+#include "vencoder.h"
+
+extern "C" int AWJpecEnc(JpegEncInfo* pJpegInfo, EXIFInfo* pExifInfo, void* pOutBuffer, int* pOutBufferSize);
+
+namespace v4l2_camera_hal {
+
+JpegEncoder::JpegEncoder(int max_jobs)
+    : max_jobs_(max_jobs),
+      busy_(false),
+      exit_(false) {
+  memset(&latency_, 0, sizeof(latency_));
+}
+
+JpegEncoder::~JpegEncoder() {
+  Stop();
+}
+
+void JpegEncoder::Configure() {
+  char property[PROPERTY_VALUE_MAX];
+  std::lock_guard<std::mutex> guard(lock_);
+  if (property_get("ro.product.manufacturer", property, "") > 0) {
+    make_ = property;
+  }
+  if (property_get("ro.product.model", property, "") > 0) {
+    model_ = property;
+  }
+  HAL_LOGD("jpeg exif make:%s, model:%s.", make_.c_str(), model_.c_str());
+}
+
+int JpegEncoder::Encode(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc) {
+  nsecs_t start = systemTime();
+  int res = EncodeFrame(dst_addr, src_addr, mJpegBufferSizes, &jpeg_enc);
+  account(0, systemTime() - start);
+  return res;
+}
+
+int JpegEncoder::Queue(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc, Done done) {
+  size_t src_size = jpeg_enc.src_w * jpeg_enc.src_h * 3 / 2;
+  Job job;
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (thread_ == nullptr) {
+      exit_ = false;
+      thread_ = new FunctionThread(std::bind(&JpegEncoder::encodeLoop, this));
+      int res = thread_->run("JpegEncoder", android::PRIORITY_DEFAULT);
+      if (res) {
+        HAL_LOGE("Failed to run the encoder thread: %d.", res);
+        thread_.clear();
+        lock.unlock();
+        res = Encode(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc);
+        done(res);
+        return 0;
+      }
+    }
+    while (jobs_.size() >= max_jobs_) {
+      slot_cond_.wait(lock);
+    }
+    if (!spare_.empty()) {
+      job.src.swap(spare_.back());
+      spare_.pop_back();
+    }
+  }
+
+  // Copy out of the lock, the thread keeps encoding the queued ones.
+  job.src.resize(src_size);
+  memcpy(job.src.data(), src_addr, src_size);
+  job.dst_addr = dst_addr;
+  job.dst_size = mJpegBufferSizes;
+  job.jpeg_enc = jpeg_enc;
+  // The copy has no share fd, encode it by the virtual address.
+  job.jpeg_enc.crop_h = 0;
+  job.done = done;
+  job.queued = systemTime();
+
+  std::lock_guard<std::mutex> guard(lock_);
+  jobs_.push_back(std::move(job));
+  job_cond_.notify_one();
+  HAL_LOGD("jpeg %dx%d queued, %d waiting.", jpeg_enc.pic_w, jpeg_enc.pic_h, jobs_.size());
+  return 0;
+}
+
+void JpegEncoder::Flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (!jobs_.empty() || busy_) {
+    slot_cond_.wait(lock);
+  }
+}
+
+void JpegEncoder::Stop() {
+  Flush();
+  android::sp<FunctionThread> thread;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    exit_ = true;
+    job_cond_.notify_one();
+    thread = thread_;
+    thread_.clear();
+  }
+  if (thread != nullptr) {
+    thread->requestExitAndWait();
+  }
+  // Queued after the flush, the thread may have left before them.
+  while (true) {
+    Job job;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (jobs_.empty()) {
+        break;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job.done(Encode(job.dst_addr, job.src.data(), job.dst_size, job.jpeg_enc));
+  }
+}
+
+void JpegEncoder::GetLatency(JpegLatency* latency) {
+  std::lock_guard<std::mutex> guard(lock_);
+  *latency = latency_;
+}
+
+bool JpegEncoder::encodeLoop() {
+  Job job;
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (jobs_.empty() && !exit_) {
+      job_cond_.wait(lock);
+    }
+    if (jobs_.empty()) {
+      return false;
+    }
+    job = std::move(jobs_.front());
+    jobs_.pop_front();
+    busy_ = true;
+    // The slot is free once the job is out of the queue.
+    slot_cond_.notify_all();
+  }
+
+  nsecs_t start = systemTime();
+  int res = EncodeFrame(job.dst_addr, job.src.data(), job.dst_size, &job.jpeg_enc);
+  nsecs_t end = systemTime();
+  account(start - job.queued, end - start);
+  job.done(res);
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if (spare_.size() < max_jobs_) {
+    spare_.push_back(std::move(job.src));
+  }
+  busy_ = false;
+  slot_cond_.notify_all();
+  return true;
+}
+
+void JpegEncoder::account(nsecs_t wait, nsecs_t encode) {
+  std::lock_guard<std::mutex> guard(lock_);
+  latency_.count++;
+  latency_.last_wait = wait;
+  latency_.last_encode = encode;
+  latency_.total_encode += encode;
+  if (encode > latency_.max_encode) {
+    latency_.max_encode = encode;
+  }
+  ATRACE_INT("JpegEncodeMs", ns2ms(encode));
+  HAL_LOGD("jpeg capture %d: wait %lld ms, encode %lld ms, max %lld ms.", latency_.count,
+           ns2ms(wait), ns2ms(encode), ns2ms(latency_.max_encode));
+}
+
+int JpegEncoder::EncodeFrame(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes,
+                             JPEG_ENC_t* jpeg_enc) {
+  unsigned long jpeg_buf = (unsigned long)dst_addr;
+  int bufSize = 0;
+
+  HAL_LOGD("jpeg info:lock_buffer vaddr:%p, buffer size:%d.", jpeg_buf, mJpegBufferSizes);
+
+  jpeg_enc->colorFormat    = JPEG_COLOR_YUV420_NV21;
+
+  time_t t;
+  struct tm tm_t;
+  time(&t);
+  localtime_r(&t, &tm_t);
+  snprintf(jpeg_enc->DateTime, sizeof(jpeg_enc->DateTime), "%4d:%02d:%02d %02d:%02d:%02d",
+      tm_t.tm_year+1900, tm_t.tm_mon+1, tm_t.tm_mday,
+      tm_t.tm_hour, tm_t.tm_min, tm_t.tm_sec);
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    strncpy(jpeg_enc->CameraMake, make_.c_str(), sizeof(jpeg_enc->CameraMake) - 1);
+    strncpy(jpeg_enc->CameraModel, model_.c_str(), sizeof(jpeg_enc->CameraModel) - 1);
+  }
+  HAL_LOGD("jpeg info:%s.", jpeg_enc->DateTime);
+
+  jpeg_enc->whitebalance   = 0;
+  jpeg_enc->focal_length    = 3.04;
+
+  HAL_LOGD("src: %dx%d, pic: %dx%d, quality: %d, rotate: %d, Gps method: %s,\
+      thumbW: %d, thumbH: %d, thubmFactor: %d, crop: [%d, %d, %d, %d]",
+      jpeg_enc->src_w, jpeg_enc->src_h,
+      jpeg_enc->pic_w, jpeg_enc->pic_h,
+      jpeg_enc->quality, jpeg_enc->rotate,
+      jpeg_enc->gps_processing_method,
+      jpeg_enc->thumbWidth,
+      jpeg_enc->thumbHeight,
+      jpeg_enc->scale_factor,
+      jpeg_enc->crop_x,
+      jpeg_enc->crop_y,
+      jpeg_enc->crop_w,
+      jpeg_enc->crop_h);
+
+  JpegEncInfo sjpegInfo;
+  EXIFInfo   exifInfo;
+
+  memset(&sjpegInfo, 0, sizeof(JpegEncInfo));
+  memset(&exifInfo, 0, sizeof(EXIFInfo));
+
+  sjpegInfo.sBaseInfo.nStride = jpeg_enc->src_w;
+  sjpegInfo.sBaseInfo.nInputWidth = jpeg_enc->src_w;
+  sjpegInfo.sBaseInfo.nInputHeight = jpeg_enc->src_h;
+  sjpegInfo.sBaseInfo.nDstWidth = jpeg_enc->pic_w;
+  sjpegInfo.sBaseInfo.nDstHeight = jpeg_enc->pic_h;
+  sjpegInfo.sBaseInfo.eInputFormat = VENC_PIXEL_YVU420SP;
+  sjpegInfo.quality        = jpeg_enc->quality;
+  exifInfo.Orientation    = jpeg_enc->rotate;
+  // crop_h carries the share fd of src_addr, if any.
+  sjpegInfo.nShareBufFd = jpeg_enc->crop_h;
+  sjpegInfo.bNoUseAddrPhy = jpeg_enc->crop_h != 0 ? 0 : 1;
+
+  sjpegInfo.pAddrPhyY = (unsigned char *)src_addr;
+  sjpegInfo.pAddrPhyC = (unsigned char *)((unsigned long)src_addr + jpeg_enc->src_w *jpeg_enc->src_h);
+  sjpegInfo.pAddrVirY = (unsigned char *)src_addr;
+  sjpegInfo.pAddrVirC = (unsigned char *)((unsigned long)src_addr + jpeg_enc->src_w *jpeg_enc->src_h);
+
+  exifInfo.ThumbWidth = jpeg_enc->thumbWidth;
+  exifInfo.ThumbHeight = jpeg_enc->thumbHeight;
+
+  strcpy((char*)exifInfo.CameraMake,    jpeg_enc->CameraMake);
+  strcpy((char*)exifInfo.CameraModel,    jpeg_enc->CameraModel);
+  strcpy((char*)exifInfo.DateTime, jpeg_enc->DateTime);
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  char       subSecTime[8];
+  sprintf(subSecTime, "%06ld", tv.tv_usec);
+  strcpy((char*)exifInfo.subSecTime,     subSecTime);
+  strcpy((char*)exifInfo.subSecTimeOrig, subSecTime);
+  strcpy((char*)exifInfo.subSecTimeDig,  subSecTime);
+
+  if (0 != strlen(jpeg_enc->gps_processing_method)){
+      strcpy((char*)exifInfo.gpsProcessingMethod,jpeg_enc->gps_processing_method);
+      exifInfo.enableGpsInfo = 1;
+      exifInfo.gps_latitude = jpeg_enc->gps_latitude;
+      exifInfo.gps_longitude = jpeg_enc->gps_longitude;
+      exifInfo.gps_altitude = jpeg_enc->gps_altitude;
+      exifInfo.gps_timestamp = jpeg_enc->gps_timestamp;
+  }
+  else
+      exifInfo.enableGpsInfo = 0;
+
+  // TODO: fix parameter for sensor
+  exifInfo.ExposureTime.num = 25;
+  exifInfo.ExposureTime.den = 100;
+
+  exifInfo.FNumber.num = 200; //eg:FNum=2.2, aperture = 220, --> num = 220,den = 100
+  exifInfo.FNumber.den = 100;
+  exifInfo.ISOSpeed = 400;
+
+  exifInfo.ExposureBiasValue.num= 25;
+  exifInfo.ExposureBiasValue.den= 100;
+
+  exifInfo.MeteringMode = 0;
+  exifInfo.FlashUsed = 0;
+
+  exifInfo.FocalLength.num = 304;
+  exifInfo.FocalLength.den = 100;
+
+  exifInfo.DigitalZoomRatio.num = 0;
+  exifInfo.DigitalZoomRatio.den = 0;
+
+  exifInfo.WhiteBalance = 0;
+  exifInfo.ExposureMode = 0;
+
+  int ret = AWJpecEnc(&sjpegInfo, &exifInfo, (void *)jpeg_buf, &bufSize);
+  if (ret < 0)
+  {
+      HAL_LOGE("JpegEnc failed");
+      return -ENODEV;
+  }
+  camera3_jpeg_blob_t jpegHeader;
+  jpegHeader.jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
+  jpegHeader.jpeg_size = bufSize;
+  unsigned long jpeg_eof_offset =
+          (unsigned long)(mJpegBufferSizes - (unsigned long)sizeof(jpegHeader));
+  char *jpeg_eof = reinterpret_cast<char *>(jpeg_buf +jpeg_eof_offset);
+  memcpy(jpeg_eof, &jpegHeader, sizeof(jpegHeader));
+
+  return 0;
+}
+
+}  // namespace v4l2_camera_hal
@@ -0,0 +1,95 @@
+
+#ifndef V4L2_CAMERA_HAL_JPEG_ENCODER_H_
+#define V4L2_CAMERA_HAL_JPEG_ENCODER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <utils/StrongPointer.h>
+#include <utils/Timers.h>
+
+#include "common.h"
+#include "function_thread.h"
+#include "type_camera.h"
+
+namespace v4l2_camera_hal {
+
+// Encode time of the captures, in ns.
+typedef struct {
+  uint32_t count;
+  // Time the last capture waited in the queue, then took to encode.
+  nsecs_t last_wait;
+  nsecs_t last_encode;
+  nsecs_t max_encode;
+  nsecs_t total_encode;
+} JpegLatency;
+
+// NV21 to JPEG with the EXIF of this HAL, a camera3 blob header at the end.
+// Encode runs in the caller. Queue copies the input and runs the encode on
+// the encoder thread, in order, so the input buffer (a dequeued frame, or a
+// reprocess input) can be reused as soon as Queue returns. At most
+// |max_jobs| wait, Queue blocks for a slot when they are all taken.
+class JpegEncoder {
+ public:
+  // Called on the encoder thread, res 0 when the JPEG is in dst_addr.
+  typedef std::function<void(int res)> Done;
+
+  JpegEncoder(int max_jobs);
+  virtual ~JpegEncoder();
+
+  // Cache the EXIF fields fixed for the device, at stream configure time.
+  void Configure();
+  // jpeg_enc.src_w/src_h give the input size.
+  int Encode(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc);
+  int Queue(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc, Done done);
+  // Wait until the queued encodes are all done.
+  void Flush();
+  void Stop();
+
+  void GetLatency(JpegLatency* latency);
+
+ protected:
+  // The hardware encode, a test seam.
+  virtual int EncodeFrame(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes,
+                          JPEG_ENC_t* jpeg_enc);
+
+ private:
+  struct Job {
+    void * dst_addr;
+    unsigned long dst_size;
+    // Private copy of the input.
+    std::vector<uint8_t> src;
+    JPEG_ENC_t jpeg_enc;
+    Done done;
+    nsecs_t queued;
+  };
+
+  bool encodeLoop();
+  void account(nsecs_t wait, nsecs_t encode);
+
+  const size_t max_jobs_;
+  std::string make_;
+  std::string model_;
+
+  std::mutex lock_;
+  std::condition_variable job_cond_;
+  std::condition_variable slot_cond_;
+  std::deque<Job> jobs_;
+  // Input copies of finished jobs, kept for the next ones.
+  std::vector<std::vector<uint8_t>> spare_;
+  // A job is out of jobs_ and encoding.
+  bool busy_;
+  bool exit_;
+  android::sp<FunctionThread> thread_;
+  JpegLatency latency_;
+
+  DISALLOW_COPY_AND_ASSIGN(JpegEncoder);
+};
+
+}  // namespace v4l2_camera_hal
+
+#endif  // V4L2_CAMERA_HAL_JPEG_ENCODER_H_
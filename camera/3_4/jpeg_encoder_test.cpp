@@ -0,0 +1,173 @@
+
+#include "jpeg_encoder.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using testing::Test;
+
+namespace v4l2_camera_hal {
+
+// Stands in for the hardware encoder, "encodes" the first byte of the input.
+class FakeJpegEncoder : public JpegEncoder {
+ public:
+  FakeJpegEncoder(int max_jobs)
+      : JpegEncoder(max_jobs), hold_(false), encoding_(0), result_(0) {}
+
+  // Encodes wait until Release() while held.
+  void Hold() {
+    std::lock_guard<std::mutex> guard(lock_);
+    hold_ = true;
+  }
+  void Release() {
+    std::lock_guard<std::mutex> guard(lock_);
+    hold_ = false;
+    cond_.notify_all();
+  }
+  bool WaitEncoding() {
+    std::unique_lock<std::mutex> lock(lock_);
+    return cond_.wait_for(lock, std::chrono::seconds(5),
+                          [this]() { return encoding_ > 0; });
+  }
+  void SetResult(int res) { result_ = res; }
+
+ protected:
+  int EncodeFrame(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes,
+                  JPEG_ENC_t* jpeg_enc) override {
+    std::unique_lock<std::mutex> lock(lock_);
+    encoding_++;
+    cond_.notify_all();
+    cond_.wait(lock, [this]() { return !hold_; });
+    if (mJpegBufferSizes > 0) {
+      *(uint8_t*)dst_addr = *(uint8_t*)src_addr;
+    }
+    return result_;
+  }
+
+ private:
+  std::mutex lock_;
+  std::condition_variable cond_;
+  bool hold_;
+  int encoding_;
+  int result_;
+};
+
+class JpegEncoderTest : public Test {
+ protected:
+  void SetUp() {
+    dut_.reset(new FakeJpegEncoder(2));
+    memset(&jpeg_enc_, 0, sizeof(jpeg_enc_));
+    jpeg_enc_.src_w = 16;
+    jpeg_enc_.src_h = 8;
+    jpeg_enc_.pic_w = 16;
+    jpeg_enc_.pic_h = 8;
+    src_.resize(16 * 8 * 3 / 2);
+  }
+
+  void TearDown() { dut_->Stop(); }
+
+  std::unique_ptr<FakeJpegEncoder> dut_;
+  JPEG_ENC_t jpeg_enc_;
+  std::vector<uint8_t> src_;
+};
+
+TEST_F(JpegEncoderTest, EncodeInCaller) {
+  uint8_t dst = 0;
+  src_[0] = 7;
+  EXPECT_EQ(dut_->Encode(&dst, src_.data(), 1, jpeg_enc_), 0);
+  EXPECT_EQ(dst, 7);
+
+  JpegLatency latency;
+  dut_->GetLatency(&latency);
+  EXPECT_EQ(latency.count, 1u);
+  EXPECT_EQ(latency.last_wait, 0);
+}
+
+TEST_F(JpegEncoderTest, QueueCopiesInput) {
+  uint8_t dst = 0;
+  int res = -1;
+  dut_->Hold();
+  src_[0] = 3;
+  ASSERT_EQ(dut_->Queue(&dst, src_.data(), 1, jpeg_enc_,
+                        [&res](int r) { res = r; }), 0);
+  // The frame goes back to the device while the encode still runs.
+  src_[0] = 9;
+  dut_->Release();
+  dut_->Flush();
+  EXPECT_EQ(res, 0);
+  EXPECT_EQ(dst, 3);
+}
+
+TEST_F(JpegEncoderTest, QueueInOrder) {
+  uint8_t dst[16] = {0};
+  std::vector<int> order;
+  for (int i = 0; i < 16; i++) {
+    src_[0] = i;
+    dut_->Queue(&dst[i], src_.data(), 1, jpeg_enc_,
+                [&order, i](int r) { order.push_back(i); });
+  }
+  dut_->Flush();
+  ASSERT_EQ(order.size(), 16u);
+  for (int i = 0; i < 16; i++) {
+    EXPECT_EQ(order[i], i);
+    EXPECT_EQ(dst[i], i);
+  }
+
+  JpegLatency latency;
+  dut_->GetLatency(&latency);
+  EXPECT_EQ(latency.count, 16u);
+  EXPECT_GE(latency.max_encode, latency.last_encode);
+  EXPECT_GE(latency.total_encode, latency.max_encode);
+}
+
+TEST_F(JpegEncoderTest, QueueBounded) {
+  uint8_t dst = 0;
+  std::atomic<int> queued(0);
+  dut_->Hold();
+  // One encoding, two waiting, the fourth waits for a slot.
+  dut_->Queue(&dst, src_.data(), 1, jpeg_enc_, [](int r) {});
+  ASSERT_TRUE(dut_->WaitEncoding());
+  std::thread producer([this, &dst, &queued]() {
+    for (int i = 0; i < 3; i++) {
+      dut_->Queue(&dst, src_.data(), 1, jpeg_enc_, [](int r) {});
+      queued++;
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(queued, 2);
+  dut_->Release();
+  producer.join();
+  EXPECT_EQ(queued, 3);
+  dut_->Flush();
+}
+
+TEST_F(JpegEncoderTest, FailureReported) {
+  uint8_t dst = 0;
+  int res = 0;
+  dut_->SetResult(-ENODEV);
+  dut_->Queue(&dst, src_.data(), 1, jpeg_enc_, [&res](int r) { res = r; });
+  dut_->Flush();
+  EXPECT_EQ(res, -ENODEV);
+}
+
+TEST_F(JpegEncoderTest, StopRunsQueued) {
+  uint8_t dst = 0;
+  std::atomic<int> done(0);
+  for (int i = 0; i < 8; i++) {
+    dut_->Queue(&dst, src_.data(), 1, jpeg_enc_, [&done](int r) { done++; });
+  }
+  dut_->Stop();
+  EXPECT_EQ(done, 8);
+
+  // Queue starts the thread again after a stop.
+  dut_->Queue(&dst, src_.data(), 1, jpeg_enc_, [&done](int r) { done++; });
+  dut_->Flush();
+  EXPECT_EQ(done, 9);
+}
+
+}  // namespace v4l2_camera_hal
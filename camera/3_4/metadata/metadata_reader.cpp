@@ -99,6 +99,21 @@ int MetadataReader::MaxOutputStreams(int32_t* max_raw,
   return 0;
 }
 
+int MetadataReader::PipelineMaxDepth(uint8_t* pipeline_max_depth) const {
+  int res = v4l2_camera_hal::SingleTagValue(
+      *metadata_, ANDROID_REQUEST_PIPELINE_MAX_DEPTH, pipeline_max_depth);
+  if (res) {
+    ALOGE("%s: Failed to get pipeline max depth from static metadata.",
+          __func__);
+    return res;
+  }
+  if (*pipeline_max_depth < 1) {
+    ALOGE("%s: Invalid pipeline max depth %d.", __func__, *pipeline_max_depth);
+    return -EINVAL;
+  }
+  return 0;
+}
+
 int MetadataReader::RequestCapabilities(std::set<uint8_t>* capabilities) const {
   std::vector<uint8_t> raw_capabilities;
   int res = v4l2_camera_hal::VectorTagValue(
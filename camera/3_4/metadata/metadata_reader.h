@@ -47,6 +47,8 @@ class MetadataReader {
                                int32_t* max_non_stalling_output_streams,
                                int32_t* max_stalling_output_streams) const;
   virtual int RequestCapabilities(std::set<uint8_t>* capabilites) const;
+  // Frames a request may take from capture to result, at least 1.
+  virtual int PipelineMaxDepth(uint8_t* pipeline_max_depth) const;
   virtual int StreamConfigurations(
       std::vector<StreamConfiguration>* configs) const;
   virtual int StreamStallDurations(
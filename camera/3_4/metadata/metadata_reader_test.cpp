@@ -40,6 +40,7 @@ class MetadataReaderTest : public Test {
   const int32_t orientation_tag_ = ANDROID_SENSOR_ORIENTATION;
   const int32_t max_inputs_tag_ = ANDROID_REQUEST_MAX_NUM_INPUT_STREAMS;
   const int32_t max_outputs_tag_ = ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS;
+  const int32_t pipeline_max_depth_tag_ = ANDROID_REQUEST_PIPELINE_MAX_DEPTH;
   const int32_t configs_tag_ = ANDROID_SCALER_AVAILABLE_STREAM_CONFIGURATIONS;
   const int32_t stalls_tag_ = ANDROID_SCALER_AVAILABLE_STALL_DURATIONS;
   const int32_t reprocess_formats_tag_ =
@@ -174,6 +175,33 @@ TEST_F(MetadataReaderTest, EmptyMaxOutputs) {
   ASSERT_EQ(dut_->MaxOutputStreams(&actual, &actual, &actual), -ENOENT);
 }
 
+TEST_F(MetadataReaderTest, PipelineMaxDepth) {
+  uint8_t expected = 4;
+  ASSERT_EQ(v4l2_camera_hal::UpdateMetadata(
+                metadata_.get(), pipeline_max_depth_tag_, expected),
+            0);
+  FillDUT();
+  uint8_t actual = expected + 1;
+  ASSERT_EQ(dut_->PipelineMaxDepth(&actual), 0);
+  EXPECT_EQ(actual, expected);
+}
+
+TEST_F(MetadataReaderTest, InvalidPipelineMaxDepth) {
+  uint8_t invalid = 0;
+  ASSERT_EQ(v4l2_camera_hal::UpdateMetadata(
+                metadata_.get(), pipeline_max_depth_tag_, invalid),
+            0);
+  FillDUT();
+  uint8_t actual;
+  EXPECT_EQ(dut_->PipelineMaxDepth(&actual), -EINVAL);
+}
+
+TEST_F(MetadataReaderTest, EmptyPipelineMaxDepth) {
+  FillDUT();
+  uint8_t actual;
+  EXPECT_EQ(dut_->PipelineMaxDepth(&actual), -ENOENT);
+}
+
 TEST_F(MetadataReaderTest, StreamConfigurations) {
   v4l2_camera_hal::ArrayVector<int32_t, 4> configs;
   std::array<int32_t, 4> config1{
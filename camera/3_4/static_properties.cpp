@@ -132,6 +132,7 @@ StaticProperties* StaticProperties::NewStaticProperties(
   int32_t max_raw_output_streams = 0;
   int32_t max_non_stalling_output_streams = 0;
   int32_t max_stalling_output_streams = 0;
+  uint8_t pipeline_max_depth = 0;
   std::set<uint8_t> request_capabilities;
   std::vector<StreamConfiguration> configs;
   std::vector<StreamStallDuration> stalls;
@@ -145,6 +146,7 @@ StaticProperties* StaticProperties::NewStaticProperties(
       metadata_reader->MaxOutputStreams(&max_raw_output_streams,
                                         &max_non_stalling_output_streams,
                                         &max_stalling_output_streams) ||
+      metadata_reader->PipelineMaxDepth(&pipeline_max_depth) ||
       metadata_reader->RequestCapabilities(&request_capabilities) ||
       metadata_reader->StreamConfigurations(&configs) ||
       metadata_reader->StreamStallDurations(&stalls) ||
@@ -168,6 +170,7 @@ StaticProperties* StaticProperties::NewStaticProperties(
                               max_raw_output_streams,
                               max_non_stalling_output_streams,
                               max_stalling_output_streams,
+                              pipeline_max_depth,
                               std::move(request_capabilities),
                               std::move(stream_capabilities),
                               std::move(reprocess_map));
@@ -181,6 +184,7 @@ StaticProperties::StaticProperties(
     int32_t max_raw_output_streams,
     int32_t max_non_stalling_output_streams,
     int32_t max_stalling_output_streams,
+    uint8_t pipeline_max_depth,
     std::set<uint8_t> request_capabilities,
     CapabilitiesMap stream_capabilities,
     ReprocessFormatMap supported_reprocess_outputs)
@@ -191,6 +195,7 @@ StaticProperties::StaticProperties(
       max_raw_output_streams_(max_raw_output_streams),
       max_non_stalling_output_streams_(max_non_stalling_output_streams),
       max_stalling_output_streams_(max_stalling_output_streams),
+      pipeline_max_depth_(pipeline_max_depth),
       request_capabilities_(std::move(request_capabilities)),
       stream_capabilities_(std::move(stream_capabilities)),
       supported_reprocess_outputs_(std::move(supported_reprocess_outputs)) {}
@@ -48,6 +48,7 @@ class StaticProperties {
   // Simple accessors.
   int facing() const { return facing_; };
   int orientation() const { return orientation_; };
+  uint8_t pipeline_max_depth() const { return pipeline_max_depth_; };
   // Carrying on the promise of the underlying reader,
   // the returned pointer is valid only as long as this object is alive.
   const camera_metadata_t* raw_metadata() const {
@@ -75,6 +76,7 @@ class StaticProperties {
                    int32_t max_raw_output_streams,
                    int32_t max_non_stalling_output_streams,
                    int32_t max_stalling_output_streams,
+                   uint8_t pipeline_max_depth,
                    std::set<uint8_t> request_capabilities,
                    CapabilitiesMap stream_capabilities,
                    ReprocessFormatMap supported_reprocess_outputs);
@@ -96,6 +98,7 @@ class StaticProperties {
   const int32_t max_raw_output_streams_;
   const int32_t max_non_stalling_output_streams_;
   const int32_t max_stalling_output_streams_;
+  const uint8_t pipeline_max_depth_;
   const std::set<uint8_t> request_capabilities_;
   const CapabilitiesMap stream_capabilities_;
   const ReprocessFormatMap supported_reprocess_outputs_;
@@ -51,6 +51,10 @@ class StaticPropertiesTest : public Test {
                         SetArgPointee<1>(test_max_non_stalling_outputs_),
                         SetArgPointee<2>(test_max_stalling_outputs_),
                         Return(0)));
+    EXPECT_CALL(*mock_reader_, PipelineMaxDepth(_))
+        .Times(AtMost(1))
+        .WillOnce(
+            DoAll(SetArgPointee<0>(test_pipeline_max_depth_), Return(0)));
     EXPECT_CALL(*mock_reader_, RequestCapabilities(_))
         .Times(AtMost(1))
         .WillOnce(
@@ -114,6 +118,7 @@ class StaticPropertiesTest : public Test {
   const int32_t test_max_raw_outputs_ = 1;
   const int32_t test_max_non_stalling_outputs_ = 2;
   const int32_t test_max_stalling_outputs_ = 3;
+  const uint8_t test_pipeline_max_depth_ = 4;
   const std::set<uint8_t> test_request_capabilities_ = {
       ANDROID_REQUEST_AVAILABLE_CAPABILITIES_BACKWARD_COMPATIBLE,
       ANDROID_REQUEST_AVAILABLE_CAPABILITIES_MANUAL_SENSOR,
@@ -184,6 +189,7 @@ TEST_F(StaticPropertiesTest, FactorySuccess) {
   PrepareDefaultDUT();
   EXPECT_EQ(dut_->facing(), test_facing_);
   EXPECT_EQ(dut_->orientation(), test_orientation_);
+  EXPECT_EQ(dut_->pipeline_max_depth(), test_pipeline_max_depth_);
 
   // Stream configurations tested seperately.
 }
@@ -220,6 +226,14 @@ TEST_F(StaticPropertiesTest, FactoryFailedMaxOutputs) {
   EXPECT_EQ(dut_, nullptr);
 }
 
+TEST_F(StaticPropertiesTest, FactoryFailedPipelineMaxDepth) {
+  SetDefaultExpectations();
+  // Override with a failure expectation.
+  EXPECT_CALL(*mock_reader_, PipelineMaxDepth(_)).WillOnce(Return(99));
+  PrepareDUT();
+  EXPECT_EQ(dut_, nullptr);
+}
+
 TEST_F(StaticPropertiesTest, FactoryFailedRequestCapabilities) {
   SetDefaultExpectations();
   // Override with a failure expectation.
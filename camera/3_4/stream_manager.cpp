@@ -13,7 +13,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <stdio.h>
 
+#include <algorithm>
 #include <cstdlib>
 
 #include "CameraMetadata.h"
@@ -28,6 +30,41 @@
 
 namespace v4l2_camera_hal {
 
+// The streams reading the main frames, each one has its own fan-out worker.
+static const STREAM_SERIAL kMainConsumers[] = {
+  MAIN_STREAM,
+  MAIN_STREAM_BLOB,
+  MAIN_MIRROR_STREAM,
+  MAIN_MIRROR_STREAM_BLOB,
+};
+
+static const char* kDropPolicyNames[] = {"oldest", "newest", "block"};
+
+StreamConfig PickStreamConfig(STREAM_SERIAL ss, uint8_t pipeline_max_depth) {
+  StreamConfig config;
+  // A frame for each request in flight and one buffer left to the driver,
+  // the platform default while the depth is unknown.
+  config.buffers = pipeline_max_depth > 0 ? pipeline_max_depth + 1 : MAX_BUFFER_NUM;
+  config.buffers = std::max<uint32_t>(MIN_BUFFER_NUM,
+                                      std::min<uint32_t>(config.buffers, MAX_STREAM_BUFFER_NUM));
+  bool sub = ss == SUB_0_STREAM || ss == SUB_0_STREAM_BLOB
+      || ss == SUB_0_MIRROR_STREAM || ss == SUB_0_MIRROR_STREAM_BLOB;
+  // Only a pipeline deeper than the buffers can cover has frames to shed.
+  bool deep = pipeline_max_depth >= MAX_STREAM_BUFFER_NUM;
+  if(sub || !deep) {
+    // The sub frames are consumed in the dequeue thread, and with enough
+    // buffers the driver is never left without one.
+    config.policy = DROP_BLOCK;
+  } else if(ss == MAIN_STREAM_BLOB || ss == MAIN_MIRROR_STREAM_BLOB) {
+    // A still keeps the frame nearest to its request.
+    config.policy = DROP_NEWEST;
+  } else {
+    // The preview shows the latest frame.
+    config.policy = DROP_OLDEST;
+  }
+  return config;
+}
+
 std::shared_ptr<StreamManager> StreamManager::NewStreamManager(std::shared_ptr<V4L2Wrapper> device, std::shared_ptr<V4L2Camera> camera) {
   HAL_LOG_ENTER();
 
@@ -53,6 +90,11 @@ StreamManager::StreamManager(std::shared_ptr<V4L2Wrapper> device,
 
   mDrop_main_buffers = 0;
   mDrop_sub_buffers = 0;
+  mMainFanout.reset(new FrameFanout(ARRAY_SIZE(kMainConsumers)));
+  for(int ss = 0; ss < MAX_STREAM; ss++) {
+    mStreamConfig[ss] = PickStreamConfig((STREAM_SERIAL)ss, 0);
+    mHalDrops[ss] = 0;
+  }
 
   //instance = std::make_shared<StreamManager>(std::shared_ptr<StreamManager>(this));
 
@@ -64,6 +106,7 @@ StreamManager::StreamManager(std::shared_ptr<V4L2Wrapper> device,
 StreamManager::~StreamManager(){
   HAL_LOG_ENTER();
   HAL_LOGD("~StreamManager");
+  mMainFanout->stop();
 
   for(int ss = 0; ss < MAX_STREAM; ss++) {
     HAL_LOGD("before reset null mStream[%d].use_count:%d.", ss, mStream[ss].use_count());
@@ -104,6 +147,37 @@ StreamManager::~StreamManager(){
 
 }
 
+void StreamManager::setPipelineDepth(uint8_t pipeline_max_depth) {
+  for(int ss = 0; ss < MAX_STREAM; ss++) {
+    mStreamConfig[ss] = PickStreamConfig((STREAM_SERIAL)ss, pipeline_max_depth);
+    HAL_LOGD("Stream %d: pipeline depth %d, %d buffers, drop %s.", ss, pipeline_max_depth,
+             mStreamConfig[ss].buffers, kDropPolicyNames[mStreamConfig[ss].policy]);
+  }
+}
+
+void StreamManager::dump(int fd) {
+  for(int ss = 0; ss < MAX_STREAM; ss++) {
+    if(mCameraStream[ss] == nullptr) {
+      continue;
+    }
+    dprintf(fd, "  Stream %d: %u buffers asked, drop %s\n", ss,
+            mStreamConfig[ss].buffers, kDropPolicyNames[mStreamConfig[ss].policy]);
+  }
+  const STREAM_SERIAL devices[] = {MAIN_STREAM, SUB_0_STREAM};
+  for(size_t i = 0; i < ARRAY_SIZE(devices); i++) {
+    STREAM_SERIAL ss = devices[i];
+    std::shared_ptr<V4L2Stream> stream = mStream[ss] != nullptr ? mStream[ss] : mStream[ss +1];
+    if(stream == nullptr) {
+      continue;
+    }
+    uint32_t dequeued = 0;
+    uint32_t driver_drops = 0;
+    stream->GetFrameStats(&dequeued, &driver_drops);
+    dprintf(fd, "  Device %d: %d buffers, %u frames, %u driver drops, %u HAL drops\n", ss,
+            stream->GetBufferCount(), dequeued, driver_drops, mHalDrops[ss].load());
+  }
+}
+
 CameraStream* StreamManager::createStream(STREAM_SERIAL ss,
                                   uint32_t width, uint32_t height, int format, uint32_t usage, int isBlob) {
   HAL_LOG_ENTER();
@@ -143,6 +217,7 @@ CameraStream* StreamManager::createStream(STREAM_SERIAL ss,
     mConnection[ss +isBlob].reset();
     return nullptr;
   }
+  mCameraStream[ss +isBlob]->setBufferDepth(mStreamConfig[ss +isBlob].buffers);
 
   int res = mCameraStream[ss +isBlob]->setFormat(width, height, format, usage);
   if (res) {
@@ -213,6 +288,7 @@ int StreamManager::start(STREAM_SERIAL ss) {
           // init YUV main stream Dequeue thread
           msYUVmainDequeue = new StreamYUVMDQ(this);
           mYUVMDThreadState = STREAM_STATE_NULL;
+          mMainFanout->start("StreamYUVmainFanout", android::PRIORITY_URGENT_DISPLAY);
           msYUVmainDequeue->startThread();
           HAL_LOGD("msYUVmainDequeue was created.");
         }
@@ -269,6 +345,15 @@ int StreamManager::start(STREAM_SERIAL ss) {
 }
 int StreamManager::stop(STREAM_SERIAL ss) {
   HAL_LOG_ENTER();
+  if((ss == MAIN_STREAM || ss == MAIN_STREAM_BLOB) && msYUVmainDequeue != NULL) {
+    // The workers call resultCallback, let them finish before taking the lock,
+    // and before the stream is turned off under the frames they hold.
+    msYUVmainDequeue->stopThread();
+    mMainFanout->stop();
+    if(mStream[ss] != nullptr) {
+      mStream[ss]->FlushEncoder();
+    }
+  }
   std::lock_guard<std::mutex> guard(frameNumber_lock_);
   if(mCameraStream[ss] != nullptr) {
 
@@ -438,6 +523,17 @@ bool StreamManager::sYUVmainDequeue() {
   int res = -1;
   void * src_addr = nullptr;
   struct timeval stream_timestamp;
+  // The device fills the preview buffers itself, nothing to copy for them.
+  // Those are the requests' own buffers, the framework paces them.
+  bool zero_copy = mCameraStream[MAIN_STREAM] != nullptr
+      && mCameraStream[MAIN_STREAM]->isZeroCopy();
+  STREAM_SERIAL owner = mainDeviceStream();
+  int device_buffers = mStream[owner] != nullptr ? mStream[owner]->GetBufferCount() : 0;
+  DROP_POLICY policy = mStreamConfig[owner].policy;
+  if(!zero_copy && policy == DROP_BLOCK) {
+    // Leave the driver a buffer, it drops the frames while the consumers catch up.
+    mMainFanout->wait(std::max(device_buffers - 2, 0));
+  }
   if(mCameraStream[MAIN_STREAM] != nullptr) {
     res = mCameraStream[MAIN_STREAM]->dequeueBuffer(&src_addr,&stream_timestamp);
     if (res) {
@@ -457,9 +553,18 @@ bool StreamManager::sYUVmainDequeue() {
     }   
   }
 
+  buffer_handle_t * buffer = nullptr;
+  uint32_t frameNumber = 0;
+
   if(mDrop_main_buffers <= DROP_BUFFERS_NUM) {
     mDrop_main_buffers++;
+    mHalDrops[MAIN_STREAM]++;
     HAL_LOGD("mDrop_main_buffers:%d, DequeueBuffer %p.", mDrop_main_buffers, src_addr);
+    // With zero copy the frame is in a request's buffer already, give it back blank.
+    releaseMainFrame(src_addr, zero_copy);
+    if(zero_copy && !mCameraStream[MAIN_STREAM]->getBuffer(&buffer, &frameNumber)) {
+      resultCallback(frameNumber,stream_timestamp);
+    }
     return true;
   }
 
@@ -473,71 +578,97 @@ bool StreamManager::sYUVmainDequeue() {
     gtimemain = systemTime() / 1000000;
   }
 
-  void * dst_addr = nullptr;
-  buffer_handle_t * buffer = nullptr;
-  uint32_t frameNumber = 0;
+  // This frame takes the last buffer, the driver has none until one is released.
+  bool backlog = !zero_copy && mMainFanout->held() + 1 >= device_buffers;
+  if(backlog && policy == DROP_NEWEST) {
+    mHalDrops[MAIN_STREAM]++;
+    HAL_LOGD("Consumers behind, give back the new frame %p.", src_addr);
+    releaseMainFrame(src_addr, false);
+    return true;
+  }
 
-  if(mCameraStream[MAIN_STREAM] != nullptr) {
-    res = mCameraStream[MAIN_STREAM]->getBuffer(&buffer, &frameNumber);
-    if(!res) {
-      gralloc_->lock_handle(buffer, &dst_addr);
-      if(mCameraStream[MAIN_STREAM]->copybuffer(dst_addr, src_addr)) {
-        gralloc_->unlock_handle(buffer);
-        HAL_LOGE("Device copybuffer failed.");
-      } else {
-        gralloc_->unlock_handle(buffer);
-        //TODO: avoid deadlock there.
-        resultCallback(frameNumber,stream_timestamp);
-      }
+  // The frame stays held until its last consumer is done, so a JPEG encode
+  // does not hold up the preview of the next frames. The zero copy preview
+  // is the frame itself, its result goes when the frame is released.
+  bool zero_copy_result = zero_copy
+      && !mCameraStream[MAIN_STREAM]->getBuffer(&buffer, &frameNumber);
+  uint32_t zero_copy_frameNumber = frameNumber;
+  FrameFanout::Frame* frame = mMainFanout->newFrame(src_addr, stream_timestamp,
+      [this, src_addr, stream_timestamp, zero_copy_result, zero_copy_frameNumber]() {
+    releaseMainFrame(src_addr, false);
+    if(zero_copy_result) {
+      resultCallback(zero_copy_frameNumber,stream_timestamp);
     }
-  }
-  if(mCameraStream[MAIN_STREAM_BLOB] != nullptr){
-    res = mCameraStream[MAIN_STREAM_BLOB]->getBuffer(&buffer, &frameNumber);
-    if(!res) {
-      unsigned long  mJpegBufferSizes = 0;
-      int sharefd = 0;
-      gralloc_->lock_handle(buffer, &dst_addr, &mJpegBufferSizes);
-      if(mCameraStream[MAIN_STREAM_BLOB]->encodebuffer(dst_addr, src_addr, mJpegBufferSizes)) {
-        gralloc_->unlock_handle(buffer);
-        HAL_LOGE("Device copybuffer failed.");
-      } else {
-        gralloc_->unlock_handle(buffer);
-        //TODO: avoid deadlock there.
-        resultCallback(frameNumber,stream_timestamp);
-      }
+  });
+  for(size_t i = 0; i < ARRAY_SIZE(kMainConsumers) && src_addr != nullptr; i++) {
+    STREAM_SERIAL ss = kMainConsumers[i];
+    if(mCameraStream[ss] == nullptr || (ss == MAIN_STREAM && zero_copy)) {
+      continue;
     }
-  }
-  if(mCameraStream[MAIN_MIRROR_STREAM] != nullptr) {
-    res = mCameraStream[MAIN_MIRROR_STREAM]->getBuffer(&buffer, &frameNumber);
-    if(!res) {
-      gralloc_->lock_handle(buffer, &dst_addr);
-      if(mCameraStream[MAIN_MIRROR_STREAM]->copybuffer(dst_addr, src_addr)) {
-        gralloc_->unlock_handle(buffer);
-        HAL_LOGE("Device copybuffer failed.");
-      } else {
-        gralloc_->unlock_handle(buffer);
-        //TODO: avoid deadlock there.
-        resultCallback(frameNumber,stream_timestamp);
-      }
+    // Take the request here to keep the requests in frame order.
+    if(mCameraStream[ss]->getBuffer(&buffer, &frameNumber)) {
+      continue;
     }
+    mMainFanout->post(frame, i,
+        [this, ss, buffer, frameNumber](const FrameFanout::Frame* f) {
+      consumeMainFrame(ss, buffer, frameNumber, f->src_addr, f->ts);
+    });
   }
-  if(mCameraStream[MAIN_MIRROR_STREAM_BLOB] != nullptr){
-    res = mCameraStream[MAIN_MIRROR_STREAM_BLOB]->getBuffer(&buffer, &frameNumber);
-    if(!res) {
-      unsigned long  mJpegBufferSizes = 0;
-      gralloc_->lock_handle(buffer, &dst_addr, &mJpegBufferSizes);
-      if(mCameraStream[MAIN_MIRROR_STREAM_BLOB]->encodebuffer(dst_addr, src_addr, mJpegBufferSizes)) {
-        gralloc_->unlock_handle(buffer);
-        HAL_LOGE("Device copybuffer failed.");
-      } else {
-        gralloc_->unlock_handle(buffer);
-        //TODO: avoid deadlock there.
-        resultCallback(frameNumber,stream_timestamp);
+  if(backlog && policy == DROP_OLDEST && mMainFanout->shedOldest(frame) > 0) {
+    // The requests of the oldest frame waiting get this one instead.
+    mHalDrops[MAIN_STREAM]++;
+    HAL_LOGD("Consumers behind, the oldest frame waiting is dropped for %p.", src_addr);
+  }
+  mMainFanout->commit(frame);
+
+  return true;
+}
+
+void StreamManager::consumeMainFrame(STREAM_SERIAL ss, buffer_handle_t * buffer,
+                                     uint32_t frameNumber, void * src_addr, struct timeval ts) {
+  void * dst_addr = nullptr;
+  int res = 0;
+  if(ss == MAIN_STREAM_BLOB || ss == MAIN_MIRROR_STREAM_BLOB) {
+    unsigned long  mJpegBufferSizes = 0;
+    gralloc_->lock_handle(buffer, &dst_addr, &mJpegBufferSizes);
+    // The encoder takes a copy of the frame, the frame is not held for the
+    // encode and a burst keeps going with the preview.
+    res = mCameraStream[ss]->encodebuffer(dst_addr, src_addr, mJpegBufferSizes,
+        [this, ss, buffer, frameNumber, ts](int res) {
+      gralloc_->unlock_handle(buffer);
+      if(res) {
+        HAL_LOGE("Device encodebuffer failed, stream:%d.", ss);
+        return;
       }
+      resultCallback(frameNumber,ts);
+    });
+    if(res) {
+      gralloc_->unlock_handle(buffer);
+      HAL_LOGE("Device encodebuffer failed, stream:%d.", ss);
     }
+    return;
+  }
+  gralloc_->lock_handle(buffer, &dst_addr);
+  res = mCameraStream[ss]->copybuffer(dst_addr, src_addr);
+  gralloc_->unlock_handle(buffer);
+  if(res) {
+    HAL_LOGE("Device copybuffer failed, stream:%d.", ss);
+    return;
   }
+  //TODO: avoid deadlock there.
+  resultCallback(frameNumber,ts);
+}
 
-  return true;
+STREAM_SERIAL StreamManager::mainDeviceStream() {
+  // MAIN_STREAM and MAIN_STREAM_BLOB share the device stream.
+  return mCameraStream[MAIN_STREAM] != nullptr ? MAIN_STREAM : MAIN_STREAM_BLOB;
+}
+
+void StreamManager::releaseMainFrame(void * src_addr, bool drop) {
+  STREAM_SERIAL ss = mainDeviceStream();
+  if(mCameraStream[ss] != nullptr && mCameraStream[ss]->releaseBuffer(src_addr, drop)) {
+    HAL_LOGE("Device releaseBuffer failed, src_addr:%p.", src_addr);
+  }
 }
 
 bool StreamManager::sYUVsubEnqueue() {
@@ -601,6 +732,7 @@ bool StreamManager::sYUVsubDequeue() {
   }
   if(mDrop_sub_buffers <= DROP_BUFFERS_NUM) {
     mDrop_sub_buffers++;
+    mHalDrops[SUB_0_STREAM]++;
     HAL_LOGD("mDrop_sub_buffers:%d, DequeueBuffer %p.", mDrop_sub_buffers, src_addr);
     return true;
   }
@@ -5,6 +5,7 @@
 #define V4L2_CAMERA_HAL_STREAM_MANAGER_H_
 
 #include <array>
+#include <atomic>
 #include <condition_variable>
 #include <map>
 #include <queue>
@@ -19,6 +20,7 @@
 #include "CameraMetadata.h"
 #include "camera.h"
 #include "common.h"
+#include "frame_fanout.h"
 #include "metadata/metadata.h"
 #include "v4l2_wrapper.h"
 #include "v4l2_camera.h"
@@ -32,9 +34,31 @@ typedef struct{
        int frameNum;
     }FrameNumRef;
 
+// What the main dequeue thread does with a new frame while the consumers
+// hold every device buffer but the one being filled.
+enum DROP_POLICY {
+  // Move the requests of the oldest frame not consumed yet to the new one.
+  DROP_OLDEST = 0,
+  // Give the new frame back, its requests wait for the next one.
+  DROP_NEWEST,
+  // Wait for the consumers before dequeuing, the driver drops meanwhile.
+  DROP_BLOCK,
+};
+
+typedef struct {
+  // V4L2 buffers asked for the device stream.
+  uint32_t buffers;
+  DROP_POLICY policy;
+} StreamConfig;
+
+// Buffer depth and drop policy of |ss| with at most |pipeline_max_depth|
+// requests in flight, 0 if unknown.
+StreamConfig PickStreamConfig(STREAM_SERIAL ss, uint8_t pipeline_max_depth);
+
 class StreamManager : public android::RefBase  {
   friend class CameraStream;
   friend class V4L2Camera;
+  friend class TestStreamManager;
 
 public:
   static std::shared_ptr<StreamManager> NewStreamManager(std::shared_ptr<V4L2Wrapper> device, std::shared_ptr<V4L2Camera> camera);
@@ -46,6 +70,9 @@ public:
   int resultCallback(uint32_t frameNumber,struct timeval ts);
   int markFrameNumber(uint32_t frameNumber);
   int request(uint32_t frameNumber);
+  // Before the streams are created.
+  void setPipelineDepth(uint8_t pipeline_max_depth);
+  void dump(int fd);
 
   ~StreamManager();
 private:
@@ -171,6 +198,12 @@ private:
   bool sYUVmainEnqueue();
 
   bool sYUVmainDequeue();
+  // One consumer of a main frame, on its fan-out worker.
+  virtual void consumeMainFrame(STREAM_SERIAL ss, buffer_handle_t * buffer,
+                        uint32_t frameNumber, void * src_addr, struct timeval ts);
+  void releaseMainFrame(void * src_addr, bool drop);
+  // The stream owning the main device, MAIN_STREAM_BLOB if it is alone.
+  STREAM_SERIAL mainDeviceStream();
 
   bool sYUVsubEnqueue();
 
@@ -182,6 +215,11 @@ private:
   std::unique_ptr<V4L2Wrapper::Connection> mConnection[MAX_STREAM];
   std::shared_ptr<V4L2Stream> mStream[MAX_STREAM];
   std::shared_ptr<CameraStream> mCameraStream[MAX_STREAM];
+  // Workers for the consumers of the main frames, see kMainConsumers.
+  std::unique_ptr<FrameFanout> mMainFanout;
+  StreamConfig mStreamConfig[MAX_STREAM];
+  // Frames the HAL gave back unused, indexed by the device's stream.
+  std::atomic<uint32_t> mHalDrops[MAX_STREAM];
   
   int64_t gtimemain;
 
@@ -0,0 +1,245 @@
+
+#include "stream_manager.h"
+
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "camera_stream.h"
+#include "v4l2_stream_mock.h"
+
+using testing::Test;
+
+namespace v4l2_camera_hal {
+
+TEST(PickStreamConfigTest, UnknownDepth) {
+  // As before the depth was known: all the buffers, the dequeue waits.
+  StreamConfig config = PickStreamConfig(MAIN_STREAM, 0);
+  EXPECT_EQ(config.buffers, (uint32_t)MAX_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_BLOCK);
+}
+
+TEST(PickStreamConfigTest, EnoughBuffers) {
+  // One frame per request and one buffer for the driver, nothing to drop.
+  StreamConfig config = PickStreamConfig(MAIN_STREAM, MAX_BUFFER_NUM - 1);
+  EXPECT_EQ(config.buffers, (uint32_t)MAX_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_BLOCK);
+
+  config = PickStreamConfig(MAIN_STREAM, 1);
+  EXPECT_EQ(config.buffers, (uint32_t)MIN_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_BLOCK);
+}
+
+TEST(PickStreamConfigTest, FactoryDepth) {
+  // The depth of 4 the factory reports is past the platform default.
+  StreamConfig config = PickStreamConfig(MAIN_STREAM, 4);
+  EXPECT_EQ(config.buffers, 5u);
+  EXPECT_EQ(config.policy, DROP_BLOCK);
+
+  config = PickStreamConfig(MAIN_STREAM, MAX_STREAM_BUFFER_NUM - 1);
+  EXPECT_EQ(config.buffers, (uint32_t)MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_BLOCK);
+}
+
+TEST(PickStreamConfigTest, DeepPipeline) {
+  StreamConfig config = PickStreamConfig(MAIN_STREAM, MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.buffers, (uint32_t)MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_OLDEST);
+
+  config = PickStreamConfig(MAIN_STREAM, 255);
+  EXPECT_EQ(config.buffers, (uint32_t)MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_OLDEST);
+
+  config = PickStreamConfig(MAIN_STREAM_BLOB, MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_NEWEST);
+
+  // The sub frames are consumed in the dequeue thread.
+  config = PickStreamConfig(SUB_0_STREAM, MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.buffers, (uint32_t)MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(config.policy, DROP_BLOCK);
+}
+
+// The main device stream, with a request waiting for every frame.
+class FakeMainStream : public CameraStream {
+ public:
+  FakeMainStream() : CameraStream(nullptr, 0), dequeued_(0), requests_(0) {}
+
+  int start() override { return 0; }
+  int stop() override { return 0; }
+  int flush() override { return 0; }
+  int initialize(uint32_t width, uint32_t height, int format, uint32_t usage) override {
+    return 0;
+  }
+  int setFormat(uint32_t width, uint32_t height, int format, uint32_t usage) override {
+    return 0;
+  }
+  int request(buffer_handle_t * buffer, uint32_t frameNumber, CameraMetadata* metadata,
+              StreamManager* mManager) override {
+    return 0;
+  }
+  int getBuffer(buffer_handle_t ** buffer, uint32_t* frameNumber) override {
+    *buffer = nullptr;
+    *frameNumber = ++requests_;
+    return 0;
+  }
+  int enqueueBuffer() override { return 0; }
+  int dequeueBuffer(void ** src_addr, struct timeval * ts) override {
+    *src_addr = Frame(++dequeued_);
+    ts->tv_sec = dequeued_;
+    ts->tv_usec = 0;
+    return 0;
+  }
+  int encodebuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes,
+                   JpegEncoder::Done done) override {
+    return 0;
+  }
+  int copybuffer(void * dst_addr, void * src_addr) override { return 0; }
+  int releaseBuffer(void * src_addr, bool drop) override {
+    std::lock_guard<std::mutex> guard(lock_);
+    released_.push_back(src_addr);
+    return 0;
+  }
+
+  // The address of the |n|th frame dequeued.
+  static void * Frame(int n) { return reinterpret_cast<void *>(n * 0x1000); }
+  std::vector<void *> Released() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return released_;
+  }
+  uint32_t Requests() { return requests_; }
+
+ private:
+  int dequeued_;
+  uint32_t requests_;
+  std::mutex lock_;
+  std::vector<void *> released_;
+};
+
+// Runs sYUVmainDequeue on the fake stream with MAX_BUFFER_NUM device
+// buffers. The consumers wait in consumeMainFrame until Open().
+class TestStreamManager : public StreamManager {
+ public:
+  TestStreamManager(DROP_POLICY policy)
+      : StreamManager(nullptr, nullptr, nullptr), open_(false) {
+    stream_ = std::make_shared<FakeMainStream>();
+    mCameraStream[MAIN_STREAM] = stream_;
+    std::shared_ptr<V4L2StreamMock> device(new V4L2StreamMock());
+    device->SetBufferCount(MAX_BUFFER_NUM);
+    mStream[MAIN_STREAM] = device;
+    mStreamConfig[MAIN_STREAM].buffers = MAX_BUFFER_NUM;
+    mStreamConfig[MAIN_STREAM].policy = policy;
+    // Past the start-up drops.
+    mDrop_main_buffers = DROP_BUFFERS_NUM + 1;
+    mYUVMDThreadState = STREAM_STATE_STARTED;
+    mMainFanout->start("StreamManagerTest", android::PRIORITY_NORMAL);
+  }
+  ~TestStreamManager() {
+    // The base consumers must not run, stop the workers here.
+    Open();
+    mMainFanout->stop();
+  }
+
+  bool Dequeue() { return sYUVmainDequeue(); }
+  void Drain() { mMainFanout->drain(); }
+  uint32_t HalDrops() { return mHalDrops[MAIN_STREAM]; }
+
+  void Open() {
+    std::lock_guard<std::mutex> guard(lock_);
+    open_ = true;
+    cond_.notify_all();
+  }
+  // Wait for |n| consumers to have started, false on timeout.
+  bool WaitConsumed(size_t n) {
+    std::unique_lock<std::mutex> lock(lock_);
+    return cond_.wait_for(lock, std::chrono::seconds(5),
+                          [this, n]() { return consumed_.size() >= n; });
+  }
+  // The request and frame of each consumer, in the order they ran.
+  std::vector<std::pair<uint32_t, void *>> Consumed() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return consumed_;
+  }
+
+  std::shared_ptr<FakeMainStream> stream_;
+
+ private:
+  void consumeMainFrame(STREAM_SERIAL ss, buffer_handle_t * buffer,
+                        uint32_t frameNumber, void * src_addr, struct timeval ts) override {
+    std::unique_lock<std::mutex> lock(lock_);
+    consumed_.push_back(std::make_pair(frameNumber, src_addr));
+    cond_.notify_all();
+    cond_.wait(lock, [this]() { return open_; });
+  }
+
+  std::mutex lock_;
+  std::condition_variable cond_;
+  bool open_;
+  std::vector<std::pair<uint32_t, void *>> consumed_;
+};
+
+TEST(MainDequeueTest, NoBacklogNoDrop) {
+  std::unique_ptr<TestStreamManager> dut(new TestStreamManager(DROP_OLDEST));
+  dut->Open();
+  for (int i = 1; i <= 5; i++) {
+    ASSERT_TRUE(dut->Dequeue());
+    dut->Drain();
+  }
+  EXPECT_EQ(dut->HalDrops(), 0u);
+  ASSERT_EQ(dut->Consumed().size(), 5u);
+  EXPECT_EQ(dut->stream_->Released().size(), 5u);
+}
+
+TEST(MainDequeueTest, DropOldestShedsWaitingFrame) {
+  std::unique_ptr<TestStreamManager> dut(new TestStreamManager(DROP_OLDEST));
+  FakeMainStream* stream = dut->stream_.get();
+  ASSERT_TRUE(dut->Dequeue());
+  ASSERT_TRUE(dut->WaitConsumed(1));
+  // Frame 2 waits behind frame 1.
+  ASSERT_TRUE(dut->Dequeue());
+  EXPECT_EQ(dut->HalDrops(), 0u);
+  EXPECT_TRUE(stream->Released().empty());
+
+  // Frame 3 takes the last buffer, request 2 moves to it from frame 2.
+  ASSERT_TRUE(dut->Dequeue());
+  EXPECT_EQ(dut->HalDrops(), 1u);
+  EXPECT_EQ(stream->Released(), std::vector<void *>({FakeMainStream::Frame(2)}));
+
+  dut->Open();
+  dut->Drain();
+  std::vector<std::pair<uint32_t, void *>> consumed = dut->Consumed();
+  ASSERT_EQ(consumed.size(), 3u);
+  EXPECT_EQ(consumed[0], std::make_pair(1u, FakeMainStream::Frame(1)));
+  EXPECT_EQ(consumed[1], std::make_pair(2u, FakeMainStream::Frame(3)));
+  EXPECT_EQ(consumed[2], std::make_pair(3u, FakeMainStream::Frame(3)));
+  EXPECT_EQ(stream->Released().size(), 3u);
+}
+
+TEST(MainDequeueTest, DropNewestGivesBackNewFrame) {
+  std::unique_ptr<TestStreamManager> dut(new TestStreamManager(DROP_NEWEST));
+  FakeMainStream* stream = dut->stream_.get();
+  ASSERT_TRUE(dut->Dequeue());
+  ASSERT_TRUE(dut->WaitConsumed(1));
+  ASSERT_TRUE(dut->Dequeue());
+
+  // Frame 3 goes back untouched, no request is taken for it.
+  ASSERT_TRUE(dut->Dequeue());
+  EXPECT_EQ(dut->HalDrops(), 1u);
+  EXPECT_EQ(stream->Released(), std::vector<void *>({FakeMainStream::Frame(3)}));
+  EXPECT_EQ(stream->Requests(), 2u);
+
+  // The next request gets the next frame.
+  dut->Open();
+  dut->Drain();
+  ASSERT_TRUE(dut->Dequeue());
+  dut->Drain();
+  std::vector<std::pair<uint32_t, void *>> consumed = dut->Consumed();
+  ASSERT_EQ(consumed.size(), 3u);
+  EXPECT_EQ(consumed[0], std::make_pair(1u, FakeMainStream::Frame(1)));
+  EXPECT_EQ(consumed[1], std::make_pair(2u, FakeMainStream::Frame(2)));
+  EXPECT_EQ(consumed[2], std::make_pair(3u, FakeMainStream::Frame(4)));
+  EXPECT_EQ(dut->HalDrops(), 1u);
+}
+
+}  // namespace v4l2_camera_hal
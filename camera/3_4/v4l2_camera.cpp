@@ -169,6 +169,13 @@ int V4L2Camera::flushBuffers() {
   return res;
 }
 
+void V4L2Camera::dumpDevice(int fd) {
+  HAL_LOG_ENTER();
+  if(mStreamManager_ != nullptr) {
+    mStreamManager_->dump(fd);
+  }
+}
+
 int V4L2Camera::flushRequests(int err) {
   HAL_LOG_ENTER();
     //Calvin: encount wrong in picture mode.
@@ -895,6 +902,7 @@ int V4L2Camera::setupStreams(camera3_stream_configuration_t* stream_config) {
   mMapFrameNumRequest.clear();
   mStreamManager_.reset();
   mStreamManager_ = StreamManager::NewStreamManager(device_, instance);
+  mStreamManager_->setPipelineDepth(pipelineMaxDepth());
 
 
   int numStreamsSet = 0;
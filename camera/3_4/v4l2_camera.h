@@ -85,6 +85,8 @@ class V4L2Camera : public default_camera_hal::Camera {
       std::shared_ptr<default_camera_hal::CaptureRequest> request) override;
   // Flush in flight buffers.
   int flushBuffers() override;
+  // Dump the buffer depth and frame drops of the streams.
+  void dumpDevice(int fd) override;
 
   int flushRequests(int err);
   int flushRequestsForCTS(int err);
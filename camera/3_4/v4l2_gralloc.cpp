@@ -69,7 +69,7 @@ V4L2Gralloc* V4L2Gralloc::NewV4L2Gralloc() {
 // Private. As checked by above factory, module will be non-null
 // and a supported version.
 V4L2Gralloc::V4L2Gralloc(const gralloc_module_t* module) : mModule(module) {
-  for(int i = 0; i< MAX_BUFFER_NUM; i++) {
+  for(int i = 0; i< MAX_STREAM_BUFFER_NUM; i++) {
     aBufferData[i] = (BufferData *)malloc(sizeof(BufferData));
     memset(aBufferData[i],0,sizeof(BufferData));
   }
@@ -78,7 +78,7 @@ V4L2Gralloc::V4L2Gralloc(const gralloc_module_t* module) : mModule(module) {
 V4L2Gralloc::~V4L2Gralloc() {
   // Unlock buffers that are still locked.
   unlockAllBuffers();
-  for(int i = 0; i< MAX_BUFFER_NUM; i++) {
+  for(int i = 0; i< MAX_STREAM_BUFFER_NUM; i++) {
     free(aBufferData[i]);
   }
 }
@@ -687,7 +687,7 @@ int V4L2Gralloc::unlockAllBuffers() {
   //mBufferMap.clear();
   //TODOzjw: fix unlock buffer
 #if 0
-  for(int i = 0; i< MAX_BUFFER_NUM; i++) {
+  for(int i = 0; i< MAX_STREAM_BUFFER_NUM; i++) {
     if(aBufferData[i]->camera_buffer == NULL) {
       HAL_LOGE("Index in %d point to NULL",i);
       break;
@@ -69,8 +69,8 @@ class V4L2Gralloc {
     //std::unique_ptr<android_ycbcr> transform_dest;  // nullptr if no transform.
     uint32_t v4l2_bytes_per_line;
   };
-  BufferData* aBufferData[MAX_BUFFER_NUM];
-  buffer_handle_t aBufferDataVideo[MAX_BUFFER_NUM];
+  BufferData* aBufferData[MAX_STREAM_BUFFER_NUM];
+  buffer_handle_t aBufferDataVideo[MAX_STREAM_BUFFER_NUM];
 
   // Map buffer index : BufferData about that buffer.
   std::unordered_map<int, const BufferData*> mBufferMap;
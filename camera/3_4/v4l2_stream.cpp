@@ -53,8 +53,6 @@
 #include <hal_public.h> //GPU dependencies
 
 
-extern "C" int AWJpecEnc(JpegEncInfo* pJpegInfo, EXIFInfo* pExifInfo, void* pOutBuffer, int* pOutBufferSize);
-
 namespace v4l2_camera_hal {
 
 
@@ -74,6 +72,13 @@ V4L2Stream::V4L2Stream(const int id,
       buffer_state_(BUFFER_UNINIT),
       isTakePicure(false),
       mflush_buffers(false),
+      memory_(V4L2_MEMORY_MMAP),
+      dequeued_fd_(-1),
+      hold_buffers_(false),
+      last_sequence_(-1),
+      frames_dequeued_(0),
+      driver_drops_(0),
+      jpeg_encoder_(new JpegEncoder(JPEG_ENCODE_QUEUE)),
 #ifdef USE_ISP
       mAWIspApi(NULL),
       mIspId(-1),
@@ -86,6 +91,11 @@ V4L2Stream::V4L2Stream(const int id,
   } else if(device_path_.compare(SUB_0_STREAM_PATH) == 0) {
     device_ss_ = SUB_0_STREAM;
   }
+  for (int i = 0; i < MAX_STREAM_BUFFER_NUM; i++) {
+    dmabuf_fd_[i] = -1;
+    dmabuf_map_[i] = nullptr;
+    buffers_held_[i] = false;
+  }
 
 }
 
@@ -196,6 +206,10 @@ int V4L2Stream::IoctlLocked(int request, T data) {
     return -ENODEV;
   }
   HAL_LOGV("Stream fd:%d..", device_fd_);
+  return Ioctl(request, (void*)data);
+}
+
+int V4L2Stream::Ioctl(int request, void* data) {
   return TEMP_FAILURE_RETRY(ioctl(device_fd_, request, data));
 }
 
@@ -222,6 +236,10 @@ int V4L2Stream::StreamOn() {
   }else {
     buffer_state_ = BUFFER_UNINIT;
     has_StreamOn = true;
+    // The driver starts the sequence over.
+    last_sequence_ = -1;
+    frames_dequeued_ = 0;
+    driver_drops_ = 0;
   }
 #if DELAY_BETWEEN_ON_OFF
   HAL_LOGV("Stream turned on.");
@@ -287,6 +305,21 @@ int V4L2Stream::StreamOff() {
   for (size_t i = 0; i < buffers_.size(); ++i) {
     buffers_[i] = false;
   }
+  for (int i = 0; i < MAX_STREAM_BUFFER_NUM; i++) {
+    buffers_held_[i] = false;
+  }
+  if (IsDmabuf()) {
+    // The buffers belong to the framework, only drop our mappings.
+    for (int i = 0; i < MAX_STREAM_BUFFER_NUM; i++) {
+      if (dmabuf_map_[i] != nullptr) {
+        munmap(dmabuf_map_[i], FrameSize());
+        dmabuf_map_[i] = nullptr;
+      }
+    }
+    has_StreamOn = false;
+    HAL_LOGV("Stream %d, ind:%d turned off.", device_id_, device_fd_);
+    return 0;
+  }
   // munmap buffer.
   for (int i = 0; i < buffers_.size(); i++)
   {
@@ -744,17 +777,32 @@ int V4L2Stream::SetFormat(const StreamFormat& desired_format,
   }
   *result_max_buffers = buffers_.size();
   HAL_LOGD("*result_max_buffers:%d.",*result_max_buffers);
+  jpeg_encoder_->Configure();
   return 0;
 }
 
 int V4L2Stream::RequestBuffers(uint32_t num_requested) {
+  num_requested = std::min<uint32_t>(num_requested, MAX_STREAM_BUFFER_NUM);
   v4l2_requestbuffers req_buffers;
   memset(&req_buffers, 0, sizeof(req_buffers));
   req_buffers.type = format_->type();
-  req_buffers.memory = format_->memory();
+  req_buffers.memory = memory_;
   req_buffers.count = num_requested;
 
+  // Only the single plane NV21/YV12 layout can be imported as one fd.
+  if (IsDmabuf() && format_->nplanes() > 1) {
+    HAL_LOGW("%d planes can not be imported by dma-buf, use mmap.", format_->nplanes());
+    memory_ = V4L2_MEMORY_MMAP;
+    req_buffers.memory = memory_;
+  }
   int res = IoctlLocked(VIDIOC_REQBUFS, &req_buffers);
+  if (res < 0 && IsDmabuf() && num_requested > 0) {
+    HAL_LOGW("REQBUFS dma-buf failed: %s, use mmap.", strerror(errno));
+    memory_ = V4L2_MEMORY_MMAP;
+    req_buffers.memory = memory_;
+    req_buffers.count = num_requested;
+    res = IoctlLocked(VIDIOC_REQBUFS, &req_buffers);
+  }
   // Calling REQBUFS releases all queued buffers back to the user.
   //int gralloc_res = gralloc_->unlockAllBuffers();
   if (res < 0) {
@@ -768,6 +816,11 @@ int V4L2Stream::RequestBuffers(uint32_t num_requested) {
     HAL_LOGE("REQBUFS claims it can't handle any buffers.");
     return -ENODEV;
   }
+  // The driver may raise the count, the indices past the cap stay unused.
+  if (req_buffers.count > MAX_STREAM_BUFFER_NUM) {
+    HAL_LOGW("REQBUFS gave %d buffers, use %d.", req_buffers.count, MAX_STREAM_BUFFER_NUM);
+    req_buffers.count = MAX_STREAM_BUFFER_NUM;
+  }
 
   {
     std::lock_guard<std::mutex> guard(cmd_queue_lock_);
@@ -787,8 +840,12 @@ int V4L2Stream::RequestBuffers(uint32_t num_requested) {
   }
 
   buffers_.resize(req_buffers.count, false);
+  for (int i = 0; i < MAX_STREAM_BUFFER_NUM; i++) {
+    dmabuf_fd_[i] = -1;
+    buffers_held_[i] = false;
+  }
 
-  HAL_LOGD("num_requested:%d,req_buffers.count:%d.",num_requested,req_buffers.count);
+  HAL_LOGD("num_requested:%d,req_buffers.count:%d, memory:%d.",num_requested,req_buffers.count, memory_);
 
   return 0;
 }
@@ -820,6 +877,12 @@ int V4L2Stream::PrepareBuffer() {
     return -ENODEV;
   }
 
+  // dma-buf buffers are queued as the requests bring them.
+  if (IsDmabuf()) {
+    HAL_LOGD("Buffers will be imported by dma-buf.");
+    return 0;
+  }
+
   int ret = 0;
   struct v4l2_buffer device_buffer;
   int index = -1;
@@ -835,7 +898,7 @@ int V4L2Stream::PrepareBuffer() {
     memset(&device_buffer, 0, sizeof(device_buffer));
     device_buffer.type = format_->type();
     device_buffer.index = index;
-    device_buffer.memory = format_->memory();
+    device_buffer.memory = memory_;
     device_buffer.length = format_->nplanes();
     struct v4l2_plane planes[VIDEO_MAX_PLANES];
     //TODOzjw:support mutiplanar.
@@ -925,7 +988,7 @@ int V4L2Stream::EnqueueBuffer() {
   memset(&device_buffer, 0, sizeof(device_buffer));
   device_buffer.type = format_->type();
   device_buffer.index = index;
-  device_buffer.memory = format_->memory();
+  device_buffer.memory = memory_;
   device_buffer.length = format_->nplanes();
   struct v4l2_plane planes[VIDEO_MAX_PLANES];
   memset(planes, 0, VIDEO_MAX_PLANES*sizeof(struct v4l2_plane));
@@ -961,7 +1024,7 @@ int V4L2Stream::DequeueBuffer(void ** src_addr_,struct timeval * ts) {
   v4l2_buffer buffer;
   memset(&buffer, 0, sizeof(buffer));
   buffer.type = format_->type();
-  buffer.memory = format_->memory();
+  buffer.memory = memory_;
   buffer.length = format_->nplanes();
   struct v4l2_plane planes[VIDEO_MAX_PLANES];
   memset(planes, 0, VIDEO_MAX_PLANES*sizeof(struct v4l2_plane));
@@ -985,7 +1048,38 @@ int V4L2Stream::DequeueBuffer(void ** src_addr_,struct timeval * ts) {
   }
 
   *ts =  buffer.timestamp;
+  frames_dequeued_++;
+  uint32_t gap = SequenceGap(last_sequence_, buffer.sequence);
+  if (gap) {
+    driver_drops_ += gap;
+    HAL_LOGW("Driver dropped %u frames before sequence %u.", gap, buffer.sequence);
+  }
+  last_sequence_ = buffer.sequence;
+  if (IsDmabuf()) {
+    // Keep the buffer held until the readers of src_addr are done.
+    std::lock_guard<std::mutex> guard(buffer_queue_lock_);
+    void * map = mmap(0, FrameSize(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                      dmabuf_fd_[buffer.index], 0);
+    if (map == MAP_FAILED) {
+      HAL_LOGE("Unable to map dma-buf fd:%d (%s)", dmabuf_fd_[buffer.index], strerror(errno));
+      // Still held, the frame is delivered with nothing read from it.
+      map = nullptr;
+    }
+    dmabuf_map_[buffer.index] = map;
+    buffers_held_[buffer.index] = true;
+    dequeued_fd_ = dmabuf_fd_[buffer.index];
+    *src_addr_ = map;
+    HAL_LOGV("dma-buf index:%d, fd:%d, map:%p held.", buffer.index, dmabuf_fd_[buffer.index], map);
+    return 0;
+  }
   *src_addr_ = mMapMem.mem[buffer.index];
+  if (hold_buffers_) {
+    // Back to buffers_num_ in ReleaseBuffer.
+    std::lock_guard<std::mutex> guard(buffer_queue_lock_);
+    buffers_held_[buffer.index] = true;
+    HAL_LOGV("mMapMem.mem[%d]:%p held.", buffer.index, mMapMem.mem[buffer.index]);
+    return 0;
+  }
 
   // Mark the buffer as no longer in flight.
   {
@@ -1002,229 +1096,218 @@ int V4L2Stream::DequeueBuffer(void ** src_addr_,struct timeval * ts) {
   return 0;
 }
 
-int V4L2Stream::CopyBuffer(void * dst_addr, void * src_addr) {
-  if (!format_) {
-    HAL_LOGE("Stream format must be set before enqueuing buffers.");
-    return -ENODEV;
+int PickDmabufIndex(const std::vector<bool>& in_flight, const int* fds, int fd) {
+  int index = -1;
+  for (size_t i = 0; i < in_flight.size(); i++) {
+    if (in_flight[i]) {
+      continue;
+    }
+    if (fds[i] == fd) {
+      return i;
+    }
+    if (index < 0) {
+      index = i;
+    }
   }
+  return index;
+}
 
-  int mCopySize = ALIGN_16B(format_->width())*ALIGN_16B(format_->height())*3/2;
-  HAL_LOGD("dst_addr:%p,src_addr:%p,mCopySize:%d.", dst_addr, src_addr, mCopySize);
-  memcpy(dst_addr, src_addr, mCopySize);
+uint32_t SequenceGap(int64_t last_sequence, uint32_t sequence) {
+  if (last_sequence < 0 || sequence <= last_sequence) {
+    return 0;
+  }
+  return sequence - last_sequence - 1;
+}
 
+int V4L2Stream::SetMemory(uint32_t memory) {
+  if (memory != V4L2_MEMORY_MMAP && memory != V4L2_MEMORY_DMABUF) {
+    HAL_LOGE("Unsupported memory type %d.", memory);
+    return -EINVAL;
+  }
+  if (format_) {
+    HAL_LOGE("Memory type must be set before the format.");
+    return -EBUSY;
+  }
+  memory_ = memory;
   return 0;
 }
-int V4L2Stream::EncodeBuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc){
-  isTakePicure = true;
-
-  unsigned long jpeg_buf = (unsigned long)dst_addr;
-  int bufSize = 0;
 
-  // Get buffer size.
-  HAL_LOGD("jpeg info:lock_buffer vaddr:%p, buffer size:%d.", jpeg_buf, mJpegBufferSizes);
-
-#if 1
-  if(jpeg_enc.src_w == 0) {
-    jpeg_enc.src_w            = format_->width();
+int V4L2Stream::EnqueueDmabuf(int dmabuf_fd, int stride, int size) {
+  if (!format_ || !IsDmabuf()) {
+    HAL_LOGE("Stream is not set up for dma-buf.");
+    return -ENODEV;
   }
-  if(jpeg_enc.src_h == 0) {
-    jpeg_enc.src_h            = format_->height();
+  // The device writes the frame as CopyBuffer would have copied it.
+  if (stride != ALIGN_16B(format_->width()) || size < FrameSize()) {
+    HAL_LOGE("dma-buf fd:%d stride:%d size:%d does not fit %dx%d, size:%d.",
+             dmabuf_fd, stride, size, format_->width(), format_->height(), FrameSize());
+    return -EINVAL;
   }
 
-  jpeg_enc.colorFormat    = JPEG_COLOR_YUV420_NV21;
-  //jpeg_enc.quality        = 90;
-  //jpeg_enc.rotate            = 0;
+  int index = -1;
+  {
+    std::unique_lock<std::mutex> lock(buffer_queue_lock_);
+    while((index = PickDmabufIndex(buffers_, dmabuf_fd_, dmabuf_fd)) < 0) {
+      HAL_LOGD("All buffers in flight, wait for one to be released.");
+      if(mflush_buffers) {
+        mflush_buffers = false;
+        return -EAGAIN;
+      }
+      buffer_availabl_queue_.wait(lock);
+      if(mflush_buffers) {
+        mflush_buffers = false;
+        return -EAGAIN;
+      }
+    }
+    buffers_[index] = true;
+    dmabuf_fd_[index] = dmabuf_fd;
+  }
 
-  char                              mDateTime[64];
-  time_t t;
-  struct tm *tm_t;
-  time(&t);
-  tm_t = localtime(&t);
-  sprintf(mDateTime, "%4d:%02d:%02d %02d:%02d:%02d",
-      tm_t->tm_year+1900, tm_t->tm_mon+1, tm_t->tm_mday,
-      tm_t->tm_hour, tm_t->tm_min, tm_t->tm_sec);
+  // Set up a v4l2 buffer struct.
+  v4l2_buffer device_buffer;
+  memset(&device_buffer, 0, sizeof(device_buffer));
+  device_buffer.type = format_->type();
+  device_buffer.index = index;
+  device_buffer.memory = V4L2_MEMORY_DMABUF;
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  memset(planes, 0, VIDEO_MAX_PLANES*sizeof(struct v4l2_plane));
+  if(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == device_buffer.type) {
+    device_buffer.length = format_->nplanes();
+    device_buffer.m.planes = planes;
+    planes[0].m.fd = dmabuf_fd;
+    planes[0].length = FrameSize();
+  } else {
+    device_buffer.m.fd = dmabuf_fd;
+    device_buffer.length = FrameSize();
+  }
 
-  char property[PROPERTY_VALUE_MAX];
-  if (property_get("ro.product.manufacturer", property, "") > 0)
-  {
-      strcpy(jpeg_enc.CameraMake, property);
+  if (queueBuffer(&device_buffer) < 0) {
+    HAL_LOGE("QBUF dma-buf fd:%d fails: %s", dmabuf_fd, strerror(errno));
+    std::lock_guard<std::mutex> guard(buffer_queue_lock_);
+    buffers_[index] = false;
+    return -ENODEV;
+  }
+  HAL_LOGD("dma-buf fd:%d queued to index:%d.", dmabuf_fd, index);
+  return 0;
+}
+
+int V4L2Stream::FallbackToMmap() {
+  if (!format_ || !IsDmabuf()) {
+    return -EINVAL;
   }
-  if (property_get("ro.product.model", property, "") > 0)
   {
-      strcpy(jpeg_enc.CameraModel, property);
+    std::lock_guard<std::mutex> guard(buffer_queue_lock_);
+    for (size_t i = 0; i < buffers_.size(); i++) {
+      if (buffers_[i]) {
+        HAL_LOGE("dma-buf index:%d in use, can not fall back to mmap.", i);
+        return -EBUSY;
+      }
+    }
   }
 
-  strcpy(jpeg_enc.DateTime, mDateTime);
-  HAL_LOGD("jpeg info:%s.", mDateTime);
+  uint32_t num_buffers = buffers_.size();
+  bool stream_on = has_StreamOn;
+  int res = StreamOff();
+  if (res) {
+    return res;
+  }
+  // The dma-buf buffers are freed with their own memory type.
+  res = RequestBuffers(0);
+  if (res) {
+    return res;
+  }
+  memory_ = V4L2_MEMORY_MMAP;
+  res = RequestBuffers(num_buffers);
+  if (res) {
+    return res;
+  }
+  dequeued_fd_ = -1;
+  res = PrepareBuffer();
+  if (res) {
+    return res;
+  }
+  HAL_LOGW("Fell back to %d mmap buffers.", buffers_.size());
+  return stream_on ? StreamOn() : 0;
+}
 
-  //jpeg_enc.thumbWidth        = 320;
-  //jpeg_enc.thumbHeight    = 240;
-  jpeg_enc.whitebalance   = 0;
-  jpeg_enc.focal_length    = 3.04;
+void V4L2Stream::SetHoldBuffers(bool hold) {
+  std::lock_guard<std::mutex> guard(buffer_queue_lock_);
+  hold_buffers_ = hold;
+}
 
-#if 0
-  if ((src_crop.width != jpeg_enc.src_w)
-      || (src_crop.height != jpeg_enc.src_h))
-  {
-      jpeg_enc.enable_crop        = 1;
-      jpeg_enc.crop_x                = src_crop.left;
-      jpeg_enc.crop_y                = src_crop.top;
-      jpeg_enc.crop_w                = src_crop.width;
-      jpeg_enc.crop_h                = src_crop.height;
+int V4L2Stream::ReleaseBuffer(void * src_addr, bool blank) {
+  std::lock_guard<std::mutex> guard(buffer_queue_lock_);
+  if (!IsDmabuf() && !hold_buffers_) {
+    return 0;
   }
-  else
-  {
-      jpeg_enc.enable_crop        = 0;
+  int index = -1;
+  for (size_t i = 0; i < buffers_.size() && i < MAX_STREAM_BUFFER_NUM; i++) {
+    void * addr = IsDmabuf() ? dmabuf_map_[i] : mMapMem.mem[i];
+    if (buffers_held_[i] && addr == src_addr) {
+      index = i;
+      break;
+    }
   }
-#endif
-  HAL_LOGD("src: %dx%d, pic: %dx%d, quality: %d, rotate: %d, Gps method: %s,\
-      thumbW: %d, thumbH: %d, thubmFactor: %d, crop: [%d, %d, %d, %d]",
-      jpeg_enc.src_w, jpeg_enc.src_h,
-      jpeg_enc.pic_w, jpeg_enc.pic_h,
-      jpeg_enc.quality, jpeg_enc.rotate,
-      jpeg_enc.gps_processing_method,
-      jpeg_enc.thumbWidth,
-      jpeg_enc.thumbHeight,
-      jpeg_enc.scale_factor,
-      jpeg_enc.crop_x,
-      jpeg_enc.crop_y,
-      jpeg_enc.crop_w,
-      jpeg_enc.crop_h);
-
-
-  JpegEncInfo sjpegInfo;
-  EXIFInfo   exifInfo;
-    
-  memset(&sjpegInfo, 0, sizeof(JpegEncInfo));
-  memset(&exifInfo, 0, sizeof(EXIFInfo));
-  
-  sjpegInfo.sBaseInfo.nStride = jpeg_enc.src_w;
-  sjpegInfo.sBaseInfo.nInputWidth = jpeg_enc.src_w;
-  sjpegInfo.sBaseInfo.nInputHeight = jpeg_enc.src_h;
-  sjpegInfo.sBaseInfo.nDstWidth = jpeg_enc.pic_w;
-  sjpegInfo.sBaseInfo.nDstHeight = jpeg_enc.pic_h;
-  //sjpegInfo.sBaseInfo.memops = (ScMemOpsS*)memOpsS;
-  //sjpegInfo.pAddrPhyY = (unsigned char*)src_addr_phy;
-  //sjpegInfo.pAddrPhyC = (unsigned char*)src_addr_phy + ALIGN_16B(src_width) * src_height;
-  sjpegInfo.sBaseInfo.eInputFormat = VENC_PIXEL_YVU420SP;
-  sjpegInfo.quality        = jpeg_enc.quality;
-  exifInfo.Orientation    = jpeg_enc.rotate;
-  if(jpeg_enc.crop_h != 0) {
-    sjpegInfo.nShareBufFd = jpeg_enc.crop_h;
-    jpeg_enc.crop_h = 0;
-    sjpegInfo.bNoUseAddrPhy = 0;
+  if (index < 0) {
+    HAL_LOGE("No held buffer for src_addr:%p.", src_addr);
+    return -EINVAL;
+  }
+  if (blank && src_addr != nullptr) {
+    int y_size = ALIGN_16B(format_->width())*ALIGN_16B(format_->height());
+    memset(src_addr, 0x10, y_size);
+    memset((char *)src_addr + y_size, 0x80, FrameSize() - y_size);
+  }
+  buffers_[index] = false;
+  buffers_held_[index] = false;
+  if (IsDmabuf()) {
+    if (src_addr != nullptr) {
+      munmap(src_addr, FrameSize());
+    }
+    dmabuf_map_[index] = nullptr;
   } else {
-    sjpegInfo.nShareBufFd = jpeg_enc.crop_h;
-    jpeg_enc.crop_h = 0;
-    sjpegInfo.bNoUseAddrPhy = 1;
+    buffers_num_.push(index);
   }
+  buffer_availabl_queue_.notify_one();
+  HAL_LOGV("index:%d released, src_addr:%p.", index, src_addr);
+  return 0;
+}
 
-  sjpegInfo.pAddrPhyY = (unsigned char *)src_addr;
-  sjpegInfo.pAddrPhyC = (unsigned char *)((unsigned long)src_addr + jpeg_enc.src_w *jpeg_enc.src_h); 
-  sjpegInfo.pAddrVirY = (unsigned char *)src_addr;
-  sjpegInfo.pAddrVirC = (unsigned char *)((unsigned long)src_addr + jpeg_enc.src_w *jpeg_enc.src_h); 
+void V4L2Stream::GetFrameStats(uint32_t* dequeued, uint32_t* driver_drops) {
+  *dequeued = frames_dequeued_;
+  *driver_drops = driver_drops_;
+}
 
-#if 0
-  if ((((unsigned int)src_crop.width ) != sjpegInfo.sBaseInfo.nInputWidth)
-      || (src_crop.height != sjpegInfo.sBaseInfo.nInputHeight))
-  {
-      sjpegInfo.bEnableCorp        = 1;
-      sjpegInfo.sCropInfo.nLeft    = src_crop.left;
-      sjpegInfo.sCropInfo.nTop    = src_crop.top;
-      sjpegInfo.sCropInfo.nWidth    = src_crop.width;
-      sjpegInfo.sCropInfo.nHeight    = src_crop.height;
-  }
-  else
-  {
-      sjpegInfo.bEnableCorp        = 0;
+int V4L2Stream::CopyBuffer(void * dst_addr, void * src_addr) {
+  if (!format_) {
+    HAL_LOGE("Stream format must be set before enqueuing buffers.");
+    return -ENODEV;
   }
-#endif
 
-  exifInfo.ThumbWidth = jpeg_enc.thumbWidth;
-  exifInfo.ThumbHeight = jpeg_enc.thumbHeight;
-
-  HAL_LOGD("src: %dx%d, pic: %dx%d, quality: %d, rotate: %d,\
-      thumbW: %d, thumbH: %d,EnableCorp: %d,crop: [%d, %d, %d, %d],share_fd:%d",
-      sjpegInfo.sBaseInfo.nInputWidth, sjpegInfo.sBaseInfo.nInputHeight,
-      sjpegInfo.sBaseInfo.nDstWidth, sjpegInfo.sBaseInfo.nDstHeight,
-      sjpegInfo.quality, exifInfo.Orientation,
-      exifInfo.ThumbWidth,
-      exifInfo.ThumbHeight,
-      sjpegInfo.bEnableCorp,
-      sjpegInfo.sCropInfo.nLeft,
-      sjpegInfo.sCropInfo.nTop,
-      sjpegInfo.sCropInfo.nWidth,
-      sjpegInfo.sCropInfo.nHeight,sjpegInfo.nShareBufFd);
-
-  strcpy((char*)exifInfo.CameraMake,    jpeg_enc.CameraMake);
-  strcpy((char*)exifInfo.CameraModel,    jpeg_enc.CameraModel);
-  strcpy((char*)exifInfo.DateTime, jpeg_enc.DateTime);
+  int mCopySize = ALIGN_16B(format_->width())*ALIGN_16B(format_->height())*3/2;
+  HAL_LOGD("dst_addr:%p,src_addr:%p,mCopySize:%d.", dst_addr, src_addr, mCopySize);
+  memcpy(dst_addr, src_addr, mCopySize);
+
+  return 0;
+}
+int V4L2Stream::EncodeBuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc,
+                             JpegEncoder::Done done){
+  isTakePicure = true;
 
-  struct timeval tv;
-  int res = gettimeofday(&tv, NULL);
-  char       subSecTime1[8];
-  char       subSecTime2[8];
-  char       subSecTime3[8];
-  sprintf(subSecTime1, "%06ld", tv.tv_usec);
-  sprintf(subSecTime2, "%06ld", tv.tv_usec);
-  sprintf(subSecTime3, "%06ld", tv.tv_usec);
-  strcpy((char*)exifInfo.subSecTime,     subSecTime1);
-  strcpy((char*)exifInfo.subSecTimeOrig, subSecTime2);
-  strcpy((char*)exifInfo.subSecTimeDig,  subSecTime3);
-
-  if (0 != strlen(jpeg_enc.gps_processing_method)){
-      strcpy((char*)exifInfo.gpsProcessingMethod,jpeg_enc.gps_processing_method);
-      exifInfo.enableGpsInfo = 1;
-      exifInfo.gps_latitude = jpeg_enc.gps_latitude;
-      exifInfo.gps_longitude = jpeg_enc.gps_longitude;
-      exifInfo.gps_altitude = jpeg_enc.gps_altitude;
-      exifInfo.gps_timestamp = jpeg_enc.gps_timestamp;
-  }
-  else
-      exifInfo.enableGpsInfo = 0;
-
-  // TODO: fix parameter for sensor
-  exifInfo.ExposureTime.num = 25;
-  exifInfo.ExposureTime.den = 100;
-  
-  exifInfo.FNumber.num = 200; //eg:FNum=2.2, aperture = 220, --> num = 220,den = 100
-  exifInfo.FNumber.den = 100;
-  exifInfo.ISOSpeed = 400;
-  
-  exifInfo.ExposureBiasValue.num= 25;
-  exifInfo.ExposureBiasValue.den= 100;
-  
-  exifInfo.MeteringMode = 0;
-  exifInfo.FlashUsed = 0;
-  
-  exifInfo.FocalLength.num = 304;
-  exifInfo.FocalLength.den = 100;
-
-  exifInfo.DigitalZoomRatio.num = 0;
-  exifInfo.DigitalZoomRatio.den = 0;
-  
-  exifInfo.WhiteBalance = 0;
-  exifInfo.ExposureMode = 0;
-
-  int ret = AWJpecEnc(&sjpegInfo, &exifInfo, (void *)jpeg_buf, &bufSize);
-  //int64_t lasttime = systemTime();
-  if (ret < 0)
-  {
-      HAL_LOGE("JpegEnc failed");
-      return false;
-  }
-  //LOGV("hw enc time: %lld(ms), size: %d", (systemTime() - lasttime)/1000000, bufSize);
-  camera3_jpeg_blob_t jpegHeader;
-  jpegHeader.jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
-  jpegHeader.jpeg_size = bufSize;
-  unsigned long jpeg_eof_offset =
-          (unsigned long)(mJpegBufferSizes - (unsigned long)sizeof(jpegHeader));
-  char *jpeg_eof = reinterpret_cast<char *>(jpeg_buf +jpeg_eof_offset);
-  memcpy(jpeg_eof, &jpegHeader, sizeof(jpegHeader));
-#endif
+  if(jpeg_enc.src_w == 0) {
+    jpeg_enc.src_w            = format_->width();
+  }
+  if(jpeg_enc.src_h == 0) {
+    jpeg_enc.src_h            = format_->height();
+  }
 
+  if (done) {
+    return jpeg_encoder_->Queue(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc, done);
+  }
+  return jpeg_encoder_->Encode(dst_addr, src_addr, mJpegBufferSizes, jpeg_enc);
+}
 
-  return 0;
+void V4L2Stream::FlushEncoder() {
+  jpeg_encoder_->Flush();
 }
 
 int V4L2Stream::WaitCameraReady()
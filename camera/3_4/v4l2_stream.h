@@ -3,6 +3,7 @@
 #define V4L2_CAMERA_HAL_V4L2_STREAM_H_
 
 #include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -29,11 +30,21 @@
 #endif
 
 #include "type_camera.h"
+#include "jpeg_encoder.h"
 
 //#include "MetadataBufferType.h"
 
 namespace v4l2_camera_hal {
 
+// Pick the buffer index to queue a dma-buf fd to, the free one last used
+// with the same fd first so the driver can keep its attachment.
+// Returns -1 if all buffers are in flight.
+int PickDmabufIndex(const std::vector<bool>& in_flight, const int* fds, int fd);
+
+// Frames the driver skipped between two dequeued sequence numbers,
+// |last_sequence| is -1 for the first frame after stream on.
+uint32_t SequenceGap(int64_t last_sequence, uint32_t sequence);
+
 class V4L2Stream : public virtual android::RefBase  {
  friend class V4L2Wrapper;
  friend class ConnectionStream;
@@ -72,10 +83,38 @@ class V4L2Stream : public virtual android::RefBase  {
   virtual int EnqueueBuffer();
   virtual int DequeueBuffer(void ** src_addr_,struct timeval * ts);
   virtual int CopyBuffer(void * dst_addr, void * src_addr);
-  virtual int EncodeBuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc);
+  // With |done|, the encode runs on the encoder thread and src_addr can be
+  // reused on return, see JpegEncoder::Queue.
+  virtual int EncodeBuffer(void * dst_addr, void * src_addr, unsigned long mJpegBufferSizes, JPEG_ENC_t jpeg_enc,
+                           JpegEncoder::Done done = nullptr);
+  // Wait for the encodes queued so far.
+  virtual void FlushEncoder();
   virtual int queueBuffer(v4l2_buffer* pdevice_buffer);
   virtual int dequeueBuffer(v4l2_buffer* pdevice_buffer);
 
+  // Zero copy: queue the framework's buffers to the driver by dma-buf fd
+  // instead of copying out of MMAP buffers. SetMemory must be called
+  // before SetFormat, and falls back to MMAP if the driver refuses it.
+  virtual int SetMemory(uint32_t memory);
+  bool IsDmabuf(){ return memory_ == V4L2_MEMORY_DMABUF;};
+  // |stride| and |size| are the gralloc buffer's, a buffer that does not
+  // have the layout CopyBuffer writes is refused with -EINVAL.
+  virtual int EnqueueDmabuf(int dmabuf_fd, int stride, int size);
+  // The dma-buf fd of the buffer DequeueBuffer gave last, -1 for none.
+  int GetDequeuedDmabuf(){ return dequeued_fd_;};
+  // Back to MMAP buffers and the copy while streaming, only with no
+  // dma-buf buffer queued or held.
+  virtual int FallbackToMmap();
+  // Keep MMAP buffers out of the enqueue free list after the dequeue, dma-buf
+  // buffers are always held. A held buffer goes back by ReleaseBuffer with
+  // the src_addr DequeueBuffer gave, blanked first if the frame is dropped.
+  virtual void SetHoldBuffers(bool hold);
+  virtual int ReleaseBuffer(void * src_addr, bool blank);
+  // Frames dequeued since the last StreamOn, and the frames the driver
+  // dropped for want of a queued buffer, seen as gaps in the sequence.
+  virtual void GetFrameStats(uint32_t* dequeued, uint32_t* driver_drops);
+  int GetBufferCount(){ return buffers_.size();};
+
   // Take picture tools.
  // virtual int TakePicture(const camera3_stream_buffer_t* camera_buffer,
   //                               uint32_t result_index);
@@ -103,6 +142,7 @@ private:
   int IoctlLocked(int request, T data);
   // Request/release userspace buffer mode via VIDIOC_REQBUFS.
   int RequestBuffers(uint32_t num_buffers);
+  int FrameSize(){ return ALIGN_16B(format_->width())*ALIGN_16B(format_->height())*3/2;};
 
   inline bool connected() { return device_fd_ >= 0; }
 
@@ -146,6 +186,25 @@ private:
   // can handle in its current format.
   std::vector<bool> buffers_;
 
+  // V4L2_MEMORY_MMAP or V4L2_MEMORY_DMABUF.
+  uint32_t memory_;
+  // The dma-buf fd queued to each index.
+  int dmabuf_fd_[MAX_STREAM_BUFFER_NUM];
+  // The dma-buf fd of the index dequeued last.
+  int dequeued_fd_;
+  // The mapping of each dma-buf index dequeued and not released yet.
+  void * dmabuf_map_[MAX_STREAM_BUFFER_NUM];
+  bool hold_buffers_;
+  // Indices dequeued and not released yet.
+  bool buffers_held_[MAX_STREAM_BUFFER_NUM];
+  // v4l2_buffer.sequence of the last frame dequeued, -1 for none yet.
+  int64_t last_sequence_;
+  std::atomic<uint32_t> frames_dequeued_;
+  std::atomic<uint32_t> driver_drops_;
+
+  // One encoder thread per device stream, the hardware encodes one at a time.
+  std::unique_ptr<JpegEncoder> jpeg_encoder_;
+
   // Lock protecting use of the buffer tracker.
   std::mutex buffer_queue_lock_;
   std::queue<int>buffers_num_;
@@ -163,14 +222,14 @@ private:
   int connection_count_;
 
   // Debug tools for save buffers.
-  void * buffers_addr[MAX_BUFFER_NUM];
-  int buffers_fd[MAX_BUFFER_NUM];
+  void * buffers_addr[MAX_STREAM_BUFFER_NUM];
+  int buffers_fd[MAX_STREAM_BUFFER_NUM];
   
   typedef struct v4l2_mem_map_t{
-      void *    mem[MAX_BUFFER_NUM];
+      void *    mem[MAX_STREAM_BUFFER_NUM];
       int     length;
-      int             nShareBufFd[MAX_BUFFER_NUM];
-      int             nDmaBufFd[MAX_BUFFER_NUM];
+      int             nShareBufFd[MAX_STREAM_BUFFER_NUM];
+      int             nDmaBufFd[MAX_STREAM_BUFFER_NUM];
   }v4l2_mem_map_t;
   v4l2_mem_map_t                    mMapMem;
 
@@ -181,11 +240,16 @@ private:
 
   friend class Connection;
   //friend class V4L2WrapperMock;
+  friend class V4L2StreamMock;
 #ifdef USE_ISP
   friend class android::AWIspApi;
 #endif
 
   DISALLOW_COPY_AND_ASSIGN(V4L2Stream);
+
+ protected:
+  // Every ioctl on the device goes through here.
+  virtual int Ioctl(int request, void* data);
 };
 
 // Helper class to ensure all opened connections are closed.
@@ -0,0 +1,30 @@
+// Mock for the device ioctls of a V4L2Stream.
+
+#ifndef V4L2_CAMERA_HAL_V4L2_STREAM_MOCK_H_
+#define V4L2_CAMERA_HAL_V4L2_STREAM_MOCK_H_
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gmock/gmock.h>
+
+#include "v4l2_stream.h"
+
+namespace v4l2_camera_hal {
+
+class V4L2StreamMock : public V4L2Stream {
+ public:
+  V4L2StreamMock() : V4L2Stream(0, MAIN_STREAM_PATH, nullptr) {
+    // Stands in for the device, the MMAP buffers are mapped from it.
+    device_fd_ = syscall(__NR_memfd_create, "v4l2_stream_mock", 0);
+    ftruncate(device_fd_, 64 << 20);
+  }
+  ~V4L2StreamMock() { close(device_fd_); }
+  // As if REQBUFS gave |count| buffers.
+  void SetBufferCount(size_t count) { buffers_.resize(count, false); }
+  MOCK_METHOD2(Ioctl, int(int request, void* data));
+};
+
+}  // namespace v4l2_camera_hal
+
+#endif  // V4L2_CAMERA_HAL_V4L2_STREAM_MOCK_H_
@@ -0,0 +1,327 @@
+
+#include "v4l2_stream.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <system/graphics.h>
+
+#include "v4l2_stream_mock.h"
+
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Test;
+using testing::_;
+
+namespace v4l2_camera_hal {
+
+class PickDmabufIndexTest : public Test {
+ protected:
+  std::vector<bool> in_flight_ = {false, false, false};
+  int fds_[MAX_BUFFER_NUM] = {-1, -1, -1};
+};
+
+TEST_F(PickDmabufIndexTest, FirstFree) {
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 10), 0);
+  in_flight_[0] = true;
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 10), 1);
+}
+
+TEST_F(PickDmabufIndexTest, SameFdFirst) {
+  fds_[0] = 10;
+  fds_[1] = 11;
+  fds_[2] = 12;
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 12), 2);
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 11), 1);
+  // A new fd takes the first free one.
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 13), 0);
+}
+
+TEST_F(PickDmabufIndexTest, SameFdInFlight) {
+  fds_[0] = 10;
+  fds_[1] = 11;
+  in_flight_[1] = true;
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 11), 0);
+}
+
+TEST_F(PickDmabufIndexTest, AllInFlight) {
+  in_flight_ = {true, true, true};
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 10), -1);
+}
+
+TEST_F(PickDmabufIndexTest, FewerBuffers) {
+  // The driver may give less than MAX_BUFFER_NUM.
+  in_flight_ = {true};
+  fds_[1] = 10;
+  EXPECT_EQ(PickDmabufIndex(in_flight_, fds_, 10), -1);
+}
+
+TEST(SequenceGapTest, Gaps) {
+  EXPECT_EQ(SequenceGap(-1, 5), 0u);
+  EXPECT_EQ(SequenceGap(4, 5), 0u);
+  EXPECT_EQ(SequenceGap(4, 8), 3u);
+  // Not counted backwards if the driver restarts the sequence.
+  EXPECT_EQ(SequenceGap(8, 0), 0u);
+}
+
+// A driver behind the mocked ioctls. DQBUF gives back the queued buffer
+// at |next_dequeue_| of the indices queued, not the one queued first.
+class V4L2StreamDmabufTest : public Test {
+ protected:
+  struct Queued {
+    uint32_t index;
+    uint32_t memory;
+    int fd;
+  };
+
+  void SetUp() {
+    dut_.reset(new NiceMock<V4L2StreamMock>());
+    ON_CALL(*dut_, Ioctl(_, _))
+        .WillByDefault(Invoke(this, &V4L2StreamDmabufTest::FakeIoctl));
+  }
+
+  void TearDown() {
+    for (int fd : fds_) {
+      close(fd);
+    }
+  }
+
+  int FakeIoctl(int request, void* data) {
+    switch (request) {
+      case VIDIOC_S_FMT:
+      case VIDIOC_STREAMON:
+        return 0;
+      case VIDIOC_STREAMOFF:
+        queued_.clear();
+        return 0;
+      case VIDIOC_G_FMT: {
+        v4l2_format* format = (v4l2_format*)data;
+        format->type = V4L2_CAPTURE_TYPE;
+        format->fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV21;
+        format->fmt.pix_mp.width = kWidth;
+        format->fmt.pix_mp.height = kHeight;
+        format->fmt.pix_mp.num_planes = 1;
+        return 0;
+      }
+      case VIDIOC_REQBUFS: {
+        v4l2_requestbuffers* req = (v4l2_requestbuffers*)data;
+        reqbufs_.push_back(std::make_pair(req->memory, req->count));
+        if (req->memory == V4L2_MEMORY_DMABUF && !dmabuf_supported_) {
+          errno = EINVAL;
+          return -1;
+        }
+        if (req->count > driver_max_) {
+          req->count = driver_max_;
+        }
+        if (req->count > 0 && req->count < driver_min_) {
+          req->count = driver_min_;
+        }
+        return 0;
+      }
+      case VIDIOC_QUERYBUF: {
+        v4l2_buffer* buffer = (v4l2_buffer*)data;
+        buffer->m.planes[0].length = kFrameSize;
+        buffer->m.planes[0].m.mem_offset = buffer->index << 20;
+        return 0;
+      }
+      case VIDIOC_QBUF: {
+        v4l2_buffer* buffer = (v4l2_buffer*)data;
+        int fd = V4L2_TYPE_IS_MULTIPLANAR(buffer->type) ? buffer->m.planes[0].m.fd
+                                                         : buffer->m.fd;
+        queued_.push_back({buffer->index, buffer->memory,
+                           buffer->memory == V4L2_MEMORY_DMABUF ? fd : -1});
+        return 0;
+      }
+      case VIDIOC_DQBUF: {
+        v4l2_buffer* buffer = (v4l2_buffer*)data;
+        if (next_dequeue_ >= queued_.size()) {
+          errno = EAGAIN;
+          return -1;
+        }
+        buffer->index = queued_[next_dequeue_].index;
+        buffer->sequence = sequence_++;
+        queued_.erase(queued_.begin() + next_dequeue_);
+        return 0;
+      }
+    }
+    errno = ENOTTY;
+    return -1;
+  }
+
+  int SetFormat(uint32_t memory, uint32_t max_buffers = MAX_BUFFER_NUM) {
+    int res = dut_->SetMemory(memory);
+    if (res) {
+      return res;
+    }
+    return dut_->SetFormat(
+        StreamFormat(HAL_PIXEL_FORMAT_YCrCb_420_SP, kWidth, kHeight), &max_buffers);
+  }
+
+  // A gralloc buffer of |size| bytes.
+  int NewBuffer(int size) {
+    int fd = syscall(__NR_memfd_create, "v4l2_stream_test", 0);
+    if (fd >= 0) {
+      ftruncate(fd, size);
+      fds_.push_back(fd);
+    }
+    return fd;
+  }
+
+  static const int kWidth = 640;
+  static const int kHeight = 480;
+  static const int kFrameSize = kWidth * kHeight * 3 / 2;
+
+  std::unique_ptr<NiceMock<V4L2StreamMock>> dut_;
+  bool dmabuf_supported_ = true;
+  // The buffer count REQBUFS gives back is clamped to these.
+  uint32_t driver_min_ = 1;
+  uint32_t driver_max_ = 32;
+  size_t next_dequeue_ = 0;
+  uint32_t sequence_ = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> reqbufs_;
+  std::vector<Queued> queued_;
+  std::vector<int> fds_;
+};
+
+TEST_F(V4L2StreamDmabufTest, ReqbufsDmabuf) {
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  EXPECT_TRUE(dut_->IsDmabuf());
+  ASSERT_EQ(reqbufs_.size(), 1u);
+  EXPECT_EQ(reqbufs_[0].first, (uint32_t)V4L2_MEMORY_DMABUF);
+  EXPECT_EQ(dut_->GetBufferCount(), MAX_BUFFER_NUM);
+  // Nothing is queued until the requests bring their buffers.
+  EXPECT_EQ(dut_->PrepareBuffer(), 0);
+  EXPECT_TRUE(queued_.empty());
+  EXPECT_EQ(dut_->SetMemory(V4L2_MEMORY_MMAP), -EBUSY);
+}
+
+TEST_F(V4L2StreamDmabufTest, ReqbufsRefusedFallsBackToMmap) {
+  dmabuf_supported_ = false;
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  EXPECT_FALSE(dut_->IsDmabuf());
+  ASSERT_EQ(reqbufs_.size(), 2u);
+  EXPECT_EQ(reqbufs_[0].first, (uint32_t)V4L2_MEMORY_DMABUF);
+  EXPECT_EQ(reqbufs_[1].first, (uint32_t)V4L2_MEMORY_MMAP);
+  EXPECT_EQ(reqbufs_[1].second, (uint32_t)MAX_BUFFER_NUM);
+
+  ASSERT_EQ(dut_->PrepareBuffer(), 0);
+  ASSERT_EQ(queued_.size(), (size_t)MAX_BUFFER_NUM);
+  for (auto& queued : queued_) {
+    EXPECT_EQ(queued.memory, (uint32_t)V4L2_MEMORY_MMAP);
+  }
+  EXPECT_EQ(dut_->EnqueueDmabuf(NewBuffer(kFrameSize), kWidth, kFrameSize), -ENODEV);
+}
+
+TEST_F(V4L2StreamDmabufTest, ReqbufsDeepPipeline) {
+  // More than MAX_BUFFER_NUM for a deep pipeline, at most the index arrays.
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF, MAX_STREAM_BUFFER_NUM - 1), 0);
+  EXPECT_EQ(dut_->GetBufferCount(), MAX_STREAM_BUFFER_NUM - 1);
+
+  reqbufs_.clear();
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF, MAX_STREAM_BUFFER_NUM + 4), 0);
+  ASSERT_EQ(reqbufs_.size(), 2u);
+  EXPECT_EQ(reqbufs_[1].second, (uint32_t)MAX_STREAM_BUFFER_NUM);
+  EXPECT_EQ(dut_->GetBufferCount(), MAX_STREAM_BUFFER_NUM);
+}
+
+TEST_F(V4L2StreamDmabufTest, ReqbufsDriverRaisesCount) {
+  driver_min_ = MAX_STREAM_BUFFER_NUM * 2;
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  EXPECT_EQ(dut_->GetBufferCount(), MAX_STREAM_BUFFER_NUM);
+}
+
+TEST_F(V4L2StreamDmabufTest, QbufDmabuf) {
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  int fd = NewBuffer(kFrameSize);
+  ASSERT_EQ(dut_->EnqueueDmabuf(fd, kWidth, kFrameSize), 0);
+  ASSERT_EQ(queued_.size(), 1u);
+  EXPECT_EQ(queued_[0].memory, (uint32_t)V4L2_MEMORY_DMABUF);
+  EXPECT_EQ(queued_[0].fd, fd);
+}
+
+TEST_F(V4L2StreamDmabufTest, QbufRefusesOtherLayout) {
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  int fd = NewBuffer(kFrameSize);
+  EXPECT_EQ(dut_->EnqueueDmabuf(fd, kWidth + 64, kFrameSize), -EINVAL);
+  EXPECT_EQ(dut_->EnqueueDmabuf(fd, kWidth, kFrameSize - 1), -EINVAL);
+  EXPECT_TRUE(queued_.empty());
+  // A bigger buffer of the same stride is fine.
+  EXPECT_EQ(dut_->EnqueueDmabuf(fd, kWidth, kFrameSize + 4096), 0);
+}
+
+TEST_F(V4L2StreamDmabufTest, DequeueByIndex) {
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  int fd[MAX_BUFFER_NUM];
+  for (int i = 0; i < MAX_BUFFER_NUM; i++) {
+    fd[i] = NewBuffer(kFrameSize);
+    ASSERT_EQ(dut_->EnqueueDmabuf(fd[i], kWidth, kFrameSize), 0);
+  }
+
+  // The second buffer queued comes back first.
+  void* addr = nullptr;
+  struct timeval ts;
+  next_dequeue_ = 1;
+  ASSERT_EQ(dut_->DequeueBuffer(&addr, &ts), 0);
+  EXPECT_EQ(dut_->GetDequeuedDmabuf(), fd[1]);
+  EXPECT_NE(addr, nullptr);
+  EXPECT_EQ(dut_->ReleaseBuffer(addr, false), 0);
+
+  next_dequeue_ = 0;
+  ASSERT_EQ(dut_->DequeueBuffer(&addr, &ts), 0);
+  EXPECT_EQ(dut_->GetDequeuedDmabuf(), fd[0]);
+  EXPECT_EQ(dut_->ReleaseBuffer(addr, false), 0);
+}
+
+TEST_F(V4L2StreamDmabufTest, DequeueLastIndexOfDeepPipeline) {
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF, MAX_STREAM_BUFFER_NUM), 0);
+  int fd[MAX_STREAM_BUFFER_NUM];
+  for (int i = 0; i < MAX_STREAM_BUFFER_NUM; i++) {
+    fd[i] = NewBuffer(kFrameSize);
+    ASSERT_EQ(dut_->EnqueueDmabuf(fd[i], kWidth, kFrameSize), 0);
+  }
+  EXPECT_EQ(queued_.back().index, (uint32_t)MAX_STREAM_BUFFER_NUM - 1);
+
+  void* addr = nullptr;
+  struct timeval ts;
+  next_dequeue_ = MAX_STREAM_BUFFER_NUM - 1;
+  ASSERT_EQ(dut_->DequeueBuffer(&addr, &ts), 0);
+  EXPECT_EQ(dut_->GetDequeuedDmabuf(), fd[MAX_STREAM_BUFFER_NUM - 1]);
+  EXPECT_EQ(dut_->ReleaseBuffer(addr, false), 0);
+}
+
+TEST_F(V4L2StreamDmabufTest, FallbackToMmap) {
+  ASSERT_EQ(SetFormat(V4L2_MEMORY_DMABUF), 0);
+  ASSERT_EQ(dut_->StreamOn(), 0);
+  ASSERT_EQ(dut_->EnqueueDmabuf(NewBuffer(kFrameSize), kWidth, kFrameSize), 0);
+  // Not while the device or a consumer has a dma-buf buffer.
+  EXPECT_EQ(dut_->FallbackToMmap(), -EBUSY);
+  void* addr = nullptr;
+  struct timeval ts;
+  ASSERT_EQ(dut_->DequeueBuffer(&addr, &ts), 0);
+  EXPECT_EQ(dut_->FallbackToMmap(), -EBUSY);
+  ASSERT_EQ(dut_->ReleaseBuffer(addr, false), 0);
+
+  reqbufs_.clear();
+  ASSERT_EQ(dut_->FallbackToMmap(), 0);
+  EXPECT_FALSE(dut_->IsDmabuf());
+  EXPECT_EQ(dut_->GetDequeuedDmabuf(), -1);
+  ASSERT_EQ(reqbufs_.size(), 2u);
+  EXPECT_EQ(reqbufs_[0], std::make_pair((uint32_t)V4L2_MEMORY_DMABUF, 0u));
+  EXPECT_EQ(reqbufs_[1], std::make_pair((uint32_t)V4L2_MEMORY_MMAP, (uint32_t)MAX_BUFFER_NUM));
+  ASSERT_EQ(queued_.size(), (size_t)MAX_BUFFER_NUM);
+  for (auto& queued : queued_) {
+    EXPECT_EQ(queued.memory, (uint32_t)V4L2_MEMORY_MMAP);
+  }
+
+  // The copy path dequeues the MMAP buffers.
+  ASSERT_EQ(dut_->DequeueBuffer(&addr, &ts), 0);
+  EXPECT_NE(addr, nullptr);
+  EXPECT_EQ(dut_->FallbackToMmap(), -EINVAL);
+}
+
+}  // namespace v4l2_camera_hal
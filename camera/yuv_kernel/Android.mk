@@ -0,0 +1,55 @@
+LOCAL_PATH := $(call my-dir)
+
+# yuv420 crop/scale kernels shared by the camera HALs.
+# ==============================================================================
+yuv_kernel_cflags := -O3 -Wall -Wextra -Werror
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libcamera_yuvkernel
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := yuv_kernel.c
+LOCAL_CFLAGS := $(yuv_kernel_cflags)
+LOCAL_ARM_NEON := true
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libcamera_yuvkernel_host
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := yuv_kernel.c
+LOCAL_CFLAGS := $(yuv_kernel_cflags)
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+# Golden image tests, on the device for NEON, and on the host for the C kernels.
+# ==============================================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera_yuvkernel_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := yuv_kernel_test.cpp
+LOCAL_STATIC_LIBRARIES := libcamera_yuvkernel
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera_yuvkernel_host_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := yuv_kernel_test.cpp
+LOCAL_STATIC_LIBRARIES := libcamera_yuvkernel_host
+include $(BUILD_HOST_NATIVE_TEST)
+
+# Benchmarks.
+# ==============================================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera_yuvkernel_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := yuv_kernel_benchmark.cpp
+LOCAL_STATIC_LIBRARIES := libcamera_yuvkernel
+include $(BUILD_NATIVE_BENCHMARK)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera_yuvkernel_host_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := yuv_kernel_benchmark.cpp
+LOCAL_STATIC_LIBRARIES := libcamera_yuvkernel_host
+include $(BUILD_HOST_NATIVE_BENCHMARK)
@@ -0,0 +1,497 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "yuv_kernel.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_KERNEL_NEON 1
+#else
+#define YUV_KERNEL_NEON 0
+#endif
+
+/*
+ * every plane is scaled on its own, a row at a time:
+ * the vertical pass makes a 16 bit row from the source rows,
+ * the horizontal pass writes the channels of it to the destination.
+ * interleaved uv is one plane of 2 channels, so it is read once,
+ * and the channels can be written to any layout, that is the format swap.
+ */
+#define BOX_ROWS_MAX 256    // keep the 16 bit row sum from overflow
+
+typedef struct kernelChan
+{
+    unsigned char *data;
+    int stride;
+    int step;
+} kernelChan;
+
+static int useSimd = YUV_KERNEL_NEON;
+
+int yuv_kernel_set_simd(int enable)
+{
+    int old = useSimd;
+
+    useSimd = enable && YUV_KERNEL_NEON;
+    return old;
+}
+
+/* t = r0 * (256 - fy) + r1 * fy */
+static void blendRow_C(const unsigned char *r0, const unsigned char *r1, int fy,
+        unsigned short *t, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        t[i] = r0[i] * (256 - fy) + r1[i] * fy;
+}
+
+/* t += r */
+static void sumRow_C(const unsigned char *r, unsigned short *t, int n, int first)
+{
+    int i;
+
+    if (first) {
+        for (i = 0; i < n; i++)
+            t[i] = r[i];
+        return;
+    }
+    for (i = 0; i < n; i++)
+        t[i] += r[i];
+}
+
+/* 2x2 box from a 2 row sum */
+static void halveRow_C(const unsigned short *t, unsigned char *d, int dw)
+{
+    int x;
+
+    for (x = 0; x < dw; x++)
+        d[x] = (t[2 * x] + t[2 * x + 1] + 2) >> 2;
+}
+
+/* odd samples, the centers of a 2:1 nearest */
+static void oddRow_C(const unsigned char *s, unsigned char *d, int dw)
+{
+    int x;
+
+    for (x = 0; x < dw; x++)
+        d[x] = s[2 * x + 1];
+}
+
+/* split/swap the 2 channels of a row */
+static void copyChan2_C(const unsigned char *s, kernelChan *dst, int row, int w)
+{
+    unsigned char *d0 = dst[0].data + row * dst[0].stride;
+    unsigned char *d1 = dst[1].data + row * dst[1].stride;
+    int x;
+
+    for (x = 0; x < w; x++) {
+        d0[x * dst[0].step] = s[2 * x];
+        d1[x * dst[1].step] = s[2 * x + 1];
+    }
+}
+
+#if YUV_KERNEL_NEON
+static void blendRow_NEON(const unsigned char *r0, const unsigned char *r1, int fy,
+        unsigned short *t, int n)
+{
+    uint8x8_t w0 = vdup_n_u8(256 - fy);
+    uint8x8_t w1 = vdup_n_u8(fy);
+    int i = 0;
+
+    if (fy == 0) {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t a = vld1q_u8(r0 + i);
+            vst1q_u16(t + i, vshll_n_u8(vget_low_u8(a), 8));
+            vst1q_u16(t + i + 8, vshll_n_u8(vget_high_u8(a), 8));
+        }
+    } else {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t a = vld1q_u8(r0 + i);
+            uint8x16_t b = vld1q_u8(r1 + i);
+            vst1q_u16(t + i, vmlal_u8(vmull_u8(vget_low_u8(a), w0), vget_low_u8(b), w1));
+            vst1q_u16(t + i + 8, vmlal_u8(vmull_u8(vget_high_u8(a), w0), vget_high_u8(b), w1));
+        }
+    }
+    blendRow_C(r0 + i, r1 + i, fy, t + i, n - i);
+}
+
+static void sumRow_NEON(const unsigned char *r, unsigned short *t, int n, int first)
+{
+    int i = 0;
+
+    if (first) {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t a = vld1q_u8(r + i);
+            vst1q_u16(t + i, vmovl_u8(vget_low_u8(a)));
+            vst1q_u16(t + i + 8, vmovl_u8(vget_high_u8(a)));
+        }
+    } else {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t a = vld1q_u8(r + i);
+            vst1q_u16(t + i, vaddw_u8(vld1q_u16(t + i), vget_low_u8(a)));
+            vst1q_u16(t + i + 8, vaddw_u8(vld1q_u16(t + i + 8), vget_high_u8(a)));
+        }
+    }
+    sumRow_C(r + i, t + i, n - i, first);
+}
+
+static void halveRow_NEON(const unsigned short *t, unsigned char *d, int dw)
+{
+    int x = 0;
+
+    for (; x + 8 <= dw; x += 8) {
+        uint16x8x2_t a = vld2q_u16(t + 2 * x);
+        vst1_u8(d + x, vrshrn_n_u16(vaddq_u16(a.val[0], a.val[1]), 2));
+    }
+    halveRow_C(t + 2 * x, d + x, dw - x);
+}
+
+static void oddRow_NEON(const unsigned char *s, unsigned char *d, int dw)
+{
+    int x = 0;
+
+    for (; x + 16 <= dw; x += 16)
+        vst1q_u8(d + x, vld2q_u8(s + 2 * x).val[1]);
+    oddRow_C(s + 2 * x, d + x, dw - x);
+}
+
+static void copyChan2_NEON(const unsigned char *s, kernelChan *dst, int row, int w)
+{
+    unsigned char *d0 = dst[0].data + row * dst[0].stride;
+    unsigned char *d1 = dst[1].data + row * dst[1].stride;
+    int x = 0;
+
+    if (dst[0].step == 1 && dst[1].step == 1) {
+        for (; x + 16 <= w; x += 16) {
+            uint8x16x2_t a = vld2q_u8(s + 2 * x);
+            vst1q_u8(d0 + x, a.val[0]);
+            vst1q_u8(d1 + x, a.val[1]);
+        }
+    } else if (dst[0].step == 2 && dst[1].step == 2 && d1 + 1 == d0) {
+        for (; x + 16 <= w; x += 16) {
+            uint8x16x2_t a = vld2q_u8(s + 2 * x);
+            uint8x16x2_t b = {{a.val[1], a.val[0]}};
+            vst2q_u8(d1 + 2 * x, b);
+        }
+    }
+    for (; x < w; x++) {
+        d0[x * dst[0].step] = s[2 * x];
+        d1[x * dst[1].step] = s[2 * x + 1];
+    }
+}
+#endif
+
+static inline void blendRow(const unsigned char *r0, const unsigned char *r1, int fy,
+        unsigned short *t, int n)
+{
+#if YUV_KERNEL_NEON
+    if (useSimd) {
+        blendRow_NEON(r0, r1, fy, t, n);
+        return;
+    }
+#endif
+    blendRow_C(r0, r1, fy, t, n);
+}
+
+static inline void sumRow(const unsigned char *r, unsigned short *t, int n, int first)
+{
+#if YUV_KERNEL_NEON
+    if (useSimd) {
+        sumRow_NEON(r, t, n, first);
+        return;
+    }
+#endif
+    sumRow_C(r, t, n, first);
+}
+
+static inline void halveRow(const unsigned short *t, unsigned char *d, int dw)
+{
+#if YUV_KERNEL_NEON
+    if (useSimd) {
+        halveRow_NEON(t, d, dw);
+        return;
+    }
+#endif
+    halveRow_C(t, d, dw);
+}
+
+static inline void oddRow(const unsigned char *s, unsigned char *d, int dw)
+{
+#if YUV_KERNEL_NEON
+    if (useSimd) {
+        oddRow_NEON(s, d, dw);
+        return;
+    }
+#endif
+    oddRow_C(s, d, dw);
+}
+
+static inline void copyChan2(const unsigned char *s, kernelChan *dst, int row, int w)
+{
+#if YUV_KERNEL_NEON
+    if (useSimd) {
+        copyChan2_NEON(s, dst, row, w);
+        return;
+    }
+#endif
+    copyChan2_C(s, dst, row, w);
+}
+
+/* center of dst pixel i in src, rounded to 8 bit fraction */
+static inline int bilinearPos(int i, int sn, int dn)
+{
+    int pos = (int)(((long long)(2 * i + 1) * sn * 256 + dn) / (2 * dn)) - 128;
+
+    return pos < 0 ? 0 : pos;
+}
+
+static void copyPlane(const unsigned char *src, int stride, int nch,
+        kernelChan *dst, int w, int h)
+{
+    int y, x;
+
+    for (y = 0; y < h; y++) {
+        const unsigned char *s = src + y * stride;
+
+        if (nch == 2 && !(dst[0].step == 2 && dst[1].data == dst[0].data + 1)) {
+            copyChan2(s, dst, y, w);
+        } else if (dst[0].step == nch) {
+            memcpy(dst[0].data + y * dst[0].stride, s, w * nch);
+        } else {
+            unsigned char *d = dst[0].data + y * dst[0].stride;
+
+            for (x = 0; x < w; x++)
+                d[x * dst[0].step] = s[x];
+        }
+    }
+}
+
+static void nearestPlane(const unsigned char *src, int stride, int nch, int sw, int sh,
+        kernelChan *dst, int dw, int dh, int *xmap)
+{
+    int x, y, c;
+
+    for (x = 0; x < dw; x++)
+        xmap[x] = (int)((long long)(2 * x + 1) * sw / (2 * dw)) * nch;
+
+    for (y = 0; y < dh; y++) {
+        const unsigned char *s = src
+            + (int)((long long)(2 * y + 1) * sh / (2 * dh)) * stride;
+
+        if (nch == 1 && dst[0].step == 1 && sw == 2 * dw) {
+            oddRow(s, dst[0].data + y * dst[0].stride, dw);
+            continue;
+        }
+        for (c = 0; c < nch; c++) {
+            unsigned char *d = dst[c].data + y * dst[c].stride;
+
+            for (x = 0; x < dw; x++)
+                d[x * dst[c].step] = s[xmap[x] + c];
+        }
+    }
+}
+
+static void bilinearPlane(const unsigned char *src, int stride, int nch, int sw, int sh,
+        kernelChan *dst, int dw, int dh, int *xmap, unsigned short *t)
+{
+    int *x0 = xmap, *x1 = xmap + dw, *xf = xmap + 2 * dw;
+    int x, y, c, pos, i, f;
+
+    for (x = 0; x < dw; x++) {
+        pos = bilinearPos(x, sw, dw);
+        i = pos >> 8;
+        f = pos & 0xff;
+        if (i >= sw - 1) {
+            i = sw - 1;
+            f = 0;
+        }
+        x0[x] = i * nch;
+        x1[x] = (i + 1 < sw ? i + 1 : i) * nch;
+        xf[x] = f;
+    }
+
+    for (y = 0; y < dh; y++) {
+        pos = bilinearPos(y, sh, dh);
+        i = pos >> 8;
+        f = pos & 0xff;
+        if (i >= sh - 1) {
+            i = sh - 1;
+            f = 0;
+        }
+        blendRow(src + i * stride, src + (f ? i + 1 : i) * stride, f, t, sw * nch);
+
+        for (c = 0; c < nch; c++) {
+            unsigned char *d = dst[c].data + y * dst[c].stride;
+
+            for (x = 0; x < dw; x++)
+                d[x * dst[c].step] = (t[x0[x] + c] * (256 - xf[x])
+                        + t[x1[x] + c] * xf[x] + 32768) >> 16;
+        }
+    }
+}
+
+/* [start, end) of dst pixel i in src, at least one pixel */
+static inline void boxRange(int i, int sn, int dn, int *start, int *end)
+{
+    *start = (int)((long long)i * sn / dn);
+    *end = (int)((long long)(i + 1) * sn / dn);
+    if (*end <= *start)
+        *end = *start + 1;
+}
+
+static int boxPlane(const unsigned char *src, int stride, int nch, int sw, int sh,
+        kernelChan *dst, int dw, int dh, int *xmap, unsigned short *t)
+{
+    int *xs = xmap, *xe = xmap + dw;
+    int x, y, c, i, ys, ye, area, sum;
+
+    if ((sh + dh - 1) / dh + 1 > BOX_ROWS_MAX)
+        return -1;
+    for (x = 0; x < dw; x++)
+        boxRange(x, sw, dw, &xs[x], &xe[x]);
+
+    for (y = 0; y < dh; y++) {
+        boxRange(y, sh, dh, &ys, &ye);
+        for (i = ys; i < ye; i++)
+            sumRow(src + i * stride, t, sw * nch, i == ys);
+
+        if (nch == 1 && dst[0].step == 1 && sw == 2 * dw && ye - ys == 2) {
+            halveRow(t, dst[0].data + y * dst[0].stride, dw);
+            continue;
+        }
+        for (c = 0; c < nch; c++) {
+            unsigned char *d = dst[c].data + y * dst[c].stride;
+
+            for (x = 0; x < dw; x++) {
+                sum = 0;
+                for (i = xs[x]; i < xe[x]; i++)
+                    sum += t[i * nch + c];
+                area = (xe[x] - xs[x]) * (ye - ys);
+                d[x * dst[c].step] = (sum + area / 2) / area;
+            }
+        }
+    }
+    return 0;
+}
+
+/* src at the crop origin, nch interleaved channels, dst[c] for channel c */
+static int scalePlane(const unsigned char *src, int stride, int nch, int sw, int sh,
+        kernelChan *dst, int dw, int dh, int filter)
+{
+    unsigned short *t;
+    int *xmap;
+    int ret = 0;
+
+    if (sw == dw && sh == dh) {
+        copyPlane(src, stride, nch, dst, dw, dh);
+        return 0;
+    }
+
+    xmap = (int *)malloc(3 * dw * sizeof(int));
+    t = (unsigned short *)malloc(sw * nch * sizeof(unsigned short));
+    if (xmap == NULL || t == NULL) {
+        ret = -1;
+        goto out;
+    }
+
+    switch (filter) {
+    case YUV_KERNEL_BOX:
+        ret = boxPlane(src, stride, nch, sw, sh, dst, dw, dh, xmap, t);
+        break;
+    case YUV_KERNEL_BILINEAR:
+        bilinearPlane(src, stride, nch, sw, sh, dst, dw, dh, xmap, t);
+        break;
+    default:
+        nearestPlane(src, stride, nch, sw, sh, dst, dw, dh, xmap);
+    }
+
+out:
+    free(xmap);
+    free(t);
+    return ret;
+}
+
+void yuv_kernel_image_init(yuv_kernel_image *img, void *data, int format,
+        int width, int height, int y_stride, int uv_stride)
+{
+    unsigned char *uv = (unsigned char *)data + y_stride * height;
+
+    img->format = format;
+    img->width = width;
+    img->height = height;
+    img->y = (unsigned char *)data;
+    img->y_stride = y_stride;
+    switch (format) {
+    case YUV_KERNEL_YV12:
+        img->uv_stride = uv_stride ? uv_stride : y_stride / 2;
+        img->v = uv;
+        img->u = uv + img->uv_stride * height / 2;
+        break;
+    case YUV_KERNEL_NV21:
+        img->uv_stride = uv_stride ? uv_stride : y_stride;
+        img->v = uv;
+        img->u = uv + 1;
+        break;
+    default:
+        img->uv_stride = uv_stride ? uv_stride : y_stride;
+        img->u = uv;
+        img->v = uv + 1;
+    }
+}
+
+static inline int isPlanar(const yuv_kernel_image *img)
+{
+    return img->format == YUV_KERNEL_YV12;
+}
+
+int yuv_kernel_scale(const yuv_kernel_image *src, const yuv_kernel_rect *crop,
+        yuv_kernel_image *dst, int filter)
+{
+    yuv_kernel_rect r = {0, 0, src->width, src->height};
+    kernelChan out[2];
+    int step = isPlanar(dst) ? 1 : 2;
+    int cx, cy, cw, ch, dcw, dch;
+
+    if (crop != NULL)
+        r = *crop;
+    if (r.x < 0 || r.y < 0 || r.w < 2 || r.h < 2
+        || r.x + r.w > src->width || r.y + r.h > src->height
+        || (r.x | r.y | r.w | r.h) & 1
+        || dst->width < 2 || dst->height < 2 || (dst->width | dst->height) & 1)
+        return -1;
+
+    out[0].data = dst->y;
+    out[0].stride = dst->y_stride;
+    out[0].step = 1;
+    if (scalePlane(src->y + r.y * src->y_stride + r.x, src->y_stride, 1,
+            r.w, r.h, out, dst->width, dst->height, filter))
+        return -1;
+
+    cx = r.x / 2;
+    cy = r.y / 2;
+    cw = r.w / 2;
+    ch = r.h / 2;
+    dcw = dst->width / 2;
+    dch = dst->height / 2;
+    if (isPlanar(src)) {
+        out[0].data = dst->u;
+        out[0].stride = dst->uv_stride;
+        out[0].step = step;
+        if (scalePlane(src->u + cy * src->uv_stride + cx, src->uv_stride, 1,
+                cw, ch, out, dcw, dch, filter))
+            return -1;
+        out[0].data = dst->v;
+        return scalePlane(src->v + cy * src->uv_stride + cx, src->uv_stride, 1,
+                cw, ch, out, dcw, dch, filter);
+    }
+
+    /* channel 0 is the first byte of the interleaved plane */
+    out[0].data = src->u < src->v ? dst->u : dst->v;
+    out[1].data = src->u < src->v ? dst->v : dst->u;
+    out[0].stride = out[1].stride = dst->uv_stride;
+    out[0].step = out[1].step = step;
+    return scalePlane((src->u < src->v ? src->u : src->v) + cy * src->uv_stride + cx * 2,
+            src->uv_stride, 2, cw, ch, out, dcw, dch, filter);
+}
@@ -0,0 +1,70 @@
+
+#ifndef __YUV_KERNEL_H__
+#define __YUV_KERNEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * yuv420 crop/scale/format swap shared by the camera HALs.
+ * row kernels are NEON when the target has it, with a C fallback
+ * giving the same bits.
+ */
+
+enum {
+    YUV_KERNEL_NV12 = 0,    // Y, UV interleaved
+    YUV_KERNEL_NV21,        // Y, VU interleaved
+    YUV_KERNEL_YV12,        // Y, V, U planes
+};
+
+enum {
+    YUV_KERNEL_NEAREST = 0,
+    YUV_KERNEL_BOX,         // area average, for downscale
+    YUV_KERNEL_BILINEAR,
+};
+
+typedef struct yuv_kernel_image
+{
+    int format;
+    int width;
+    int height;
+    unsigned char *y;
+    unsigned char *u;       // for NV12/NV21, u and v point into the same plane
+    unsigned char *v;
+    int y_stride;
+    int uv_stride;          // line of the uv plane, or of each of the v/u planes
+} yuv_kernel_image;
+
+typedef struct yuv_kernel_rect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+} yuv_kernel_rect;
+
+/*
+ * describe a contiguous buffer, chroma right after the luma.
+ * uv_stride 0 means y_stride for NV12/NV21, y_stride / 2 for YV12.
+ */
+void yuv_kernel_image_init(yuv_kernel_image *img, void *data, int format,
+        int width, int height, int y_stride, int uv_stride);
+
+/*
+ * scale the crop of src (whole src if NULL, even x/y/w/h) to the size of dst,
+ * any ratio, converting to dst->format on the way.
+ * same size with any filter is a plain crop/copy.
+ * return 0, or -1 on bad arguments.
+ */
+int yuv_kernel_scale(const yuv_kernel_image *src, const yuv_kernel_rect *crop,
+        yuv_kernel_image *dst, int filter);
+
+/* use the NEON kernels if built with them, return the previous setting */
+int yuv_kernel_set_simd(int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+
+#include "yuv_kernel.h"
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// 1080p NV21 from the sensor to the usual callback/thumbnail sizes.
+static void BM_Scale(benchmark::State& state) {
+  int dw = state.range(0), dh = state.range(1), filter = state.range(2), format = state.range(3);
+  std::vector<unsigned char> src_buf(1920 * 1088 * 3 / 2, 0x80);
+  std::vector<unsigned char> dst_buf(dw * dh * 3 / 2);
+  yuv_kernel_image src, dst;
+
+  yuv_kernel_image_init(&src, src_buf.data(), YUV_KERNEL_NV21, 1920, 1080, 1920, 0);
+  yuv_kernel_image_init(&dst, dst_buf.data(), format, dw, dh, dw, 0);
+  for (auto _ : state) {
+    yuv_kernel_scale(&src, nullptr, &dst, filter);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * 1920 * 1080 * 3 / 2);
+}
+
+BENCHMARK(BM_Scale)
+    ->ArgNames({"w", "h", "filter", "format"})
+    ->Args({1920, 1080, YUV_KERNEL_NEAREST, YUV_KERNEL_NV21})
+    ->Args({1920, 1080, YUV_KERNEL_NEAREST, YUV_KERNEL_YV12})
+    ->Args({960, 540, YUV_KERNEL_NEAREST, YUV_KERNEL_NV21})
+    ->Args({960, 540, YUV_KERNEL_BOX, YUV_KERNEL_NV21})
+    ->Args({960, 540, YUV_KERNEL_BILINEAR, YUV_KERNEL_NV21})
+    ->Args({640, 480, YUV_KERNEL_NEAREST, YUV_KERNEL_NV21})
+    ->Args({640, 480, YUV_KERNEL_BOX, YUV_KERNEL_NV21})
+    ->Args({640, 480, YUV_KERNEL_BILINEAR, YUV_KERNEL_NV21})
+    ->Args({176, 144, YUV_KERNEL_BOX, YUV_KERNEL_YV12})
+    ->Args({160, 120, YUV_KERNEL_BOX, YUV_KERNEL_NV21});
+
+BENCHMARK_MAIN();
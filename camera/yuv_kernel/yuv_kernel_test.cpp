@@ -0,0 +1,275 @@
+
+#include "yuv_kernel.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using testing::Test;
+
+namespace {
+
+// A yuv420 frame in its own buffer, strides padded like gralloc does.
+class Frame {
+ public:
+  Frame(int format, int width, int height, int align = 16)
+      : buffer_((align_up(width, align) + align_up(width / 2, align)) * height * 2 + 64, 0) {
+    int y_stride = align_up(width, align);
+    int uv_stride = format == YUV_KERNEL_YV12 ? align_up(width / 2, align) : y_stride;
+    yuv_kernel_image_init(&image_, buffer_.data(), format, width, height, y_stride, uv_stride);
+  }
+
+  // Fill with a pattern that has edges and gradients in every plane.
+  void Fill(unsigned seed) {
+    srand(seed);
+    for (int y = 0; y < image_.height; y++) {
+      for (int x = 0; x < image_.width; x++) {
+        Y(x, y) = (x * 7 + y * 3 + (rand() & 31)) & 0xff;
+      }
+    }
+    for (int y = 0; y < image_.height / 2; y++) {
+      for (int x = 0; x < image_.width / 2; x++) {
+        U(x, y) = (x * 5 + (rand() & 15)) & 0xff;
+        V(x, y) = (255 - y * 9 + (rand() & 15)) & 0xff;
+      }
+    }
+  }
+
+  unsigned char& Y(int x, int y) { return image_.y[y * image_.y_stride + x]; }
+  unsigned char& U(int x, int y) { return image_.u[y * image_.uv_stride + x * Step()]; }
+  unsigned char& V(int x, int y) { return image_.v[y * image_.uv_stride + x * Step()]; }
+  unsigned char& At(int plane, int x, int y) {
+    return plane == 0 ? Y(x, y) : plane == 1 ? U(x, y) : V(x, y);
+  }
+
+  yuv_kernel_image* image() { return &image_; }
+  int width() { return image_.width; }
+  int height() { return image_.height; }
+
+ private:
+  static int align_up(int v, int a) { return (v + a - 1) / a * a; }
+  int Step() { return image_.format == YUV_KERNEL_YV12 ? 1 : 2; }
+
+  std::vector<unsigned char> buffer_;
+  yuv_kernel_image image_;
+};
+
+// Straight from the definition of each filter, one pixel at a time.
+int Reference(Frame& src, int plane, const yuv_kernel_rect& crop,
+              int dw, int dh, int filter, int x, int y) {
+  int sub = plane == 0 ? 1 : 2;
+  int sx = crop.x / sub, sy = crop.y / sub, sw = crop.w / sub, sh = crop.h / sub;
+
+  switch (filter) {
+    case YUV_KERNEL_NEAREST:
+      return src.At(plane, sx + (2 * x + 1) * sw / (2 * dw),
+                    sy + (2 * y + 1) * sh / (2 * dh));
+    case YUV_KERNEL_BOX: {
+      int xs = x * sw / dw, xe = std::max((x + 1) * sw / dw, xs + 1);
+      int ys = y * sh / dh, ye = std::max((y + 1) * sh / dh, ys + 1);
+      int sum = 0;
+      for (int j = ys; j < ye; j++) {
+        for (int i = xs; i < xe; i++) {
+          sum += src.At(plane, sx + i, sy + j);
+        }
+      }
+      int area = (xe - xs) * (ye - ys);
+      return (sum + area / 2) / area;
+    }
+    default: {
+      double fx = std::min(std::max((x + 0.5) * sw / dw - 0.5, 0.0), sw - 1.0);
+      double fy = std::min(std::max((y + 0.5) * sh / dh - 0.5, 0.0), sh - 1.0);
+      int x0 = (int)fx, y0 = (int)fy;
+      int x1 = std::min(x0 + 1, sw - 1), y1 = std::min(y0 + 1, sh - 1);
+      double ax = fx - x0, ay = fy - y0;
+      double top = src.At(plane, sx + x0, sy + y0) * (1 - ax) + src.At(plane, sx + x1, sy + y0) * ax;
+      double bottom = src.At(plane, sx + x0, sy + y1) * (1 - ax) + src.At(plane, sx + x1, sy + y1) * ax;
+      return (int)floor(top * (1 - ay) + bottom * ay + 0.5);
+    }
+  }
+}
+
+void ExpectMatchesReference(Frame& src, const yuv_kernel_rect& crop, Frame& dst, int filter) {
+  // The bilinear kernel has 8 bit phases, off by up to 1/256 of a step
+  // on each axis next to hard edges.
+  int tolerance = filter == YUV_KERNEL_BILINEAR ? 2 : 0;
+  for (int plane = 0; plane < 3; plane++) {
+    int sub = plane == 0 ? 1 : 2;
+    int dw = dst.width() / sub, dh = dst.height() / sub;
+    for (int y = 0; y < dh; y++) {
+      for (int x = 0; x < dw; x++) {
+        int expected = Reference(src, plane, crop, dw, dh, filter, x, y);
+        ASSERT_NEAR(dst.At(plane, x, y), expected, tolerance)
+            << "plane " << plane << " at " << x << "," << y << " filter " << filter
+            << " " << crop.w << "x" << crop.h << "->" << dst.width() << "x" << dst.height();
+      }
+    }
+  }
+}
+
+}  // namespace
+
+class YuvKernelTest : public Test {
+ protected:
+  void SetUp() { simd_ = yuv_kernel_set_simd(1); }
+  void TearDown() { yuv_kernel_set_simd(simd_); }
+
+  int simd_;
+};
+
+TEST_F(YuvKernelTest, BoxGolden) {
+  Frame src(YUV_KERNEL_NV12, 4, 4, 4);
+  Frame dst(YUV_KERNEL_NV21, 2, 2, 2);
+  const unsigned char y[4][4] = {
+      {0, 10, 20, 30}, {40, 50, 60, 70}, {80, 90, 100, 110}, {120, 130, 140, 150}};
+  for (int j = 0; j < 4; j++) {
+    for (int i = 0; i < 4; i++) {
+      src.Y(i, j) = y[j][i];
+    }
+  }
+  src.U(0, 0) = 100; src.V(0, 0) = 200; src.U(1, 0) = 110; src.V(1, 0) = 210;
+  src.U(0, 1) = 120; src.V(0, 1) = 220; src.U(1, 1) = 130; src.V(1, 1) = 230;
+
+  ASSERT_EQ(yuv_kernel_scale(src.image(), nullptr, dst.image(), YUV_KERNEL_BOX), 0);
+  EXPECT_EQ(dst.Y(0, 0), 25);
+  EXPECT_EQ(dst.Y(1, 0), 45);
+  EXPECT_EQ(dst.Y(0, 1), 105);
+  EXPECT_EQ(dst.Y(1, 1), 125);
+  // NV21 keeps v first.
+  EXPECT_EQ(dst.image()->v[0], 215);
+  EXPECT_EQ(dst.image()->v[1], 115);
+}
+
+TEST_F(YuvKernelTest, BilinearGolden) {
+  Frame src(YUV_KERNEL_NV21, 2, 2, 2);
+  Frame dst(YUV_KERNEL_NV21, 4, 4, 4);
+  src.Y(0, 0) = 0; src.Y(1, 0) = 64; src.Y(0, 1) = 128; src.Y(1, 1) = 192;
+  src.U(0, 0) = 50; src.V(0, 0) = 60;
+
+  ASSERT_EQ(yuv_kernel_scale(src.image(), nullptr, dst.image(), YUV_KERNEL_BILINEAR), 0);
+  const unsigned char y[4][4] = {
+      {0, 16, 48, 64}, {32, 48, 80, 96}, {96, 112, 144, 160}, {128, 144, 176, 192}};
+  for (int j = 0; j < 4; j++) {
+    for (int i = 0; i < 4; i++) {
+      EXPECT_EQ(dst.Y(i, j), y[j][i]) << i << "," << j;
+    }
+  }
+  for (int j = 0; j < 2; j++) {
+    for (int i = 0; i < 2; i++) {
+      EXPECT_EQ(dst.U(i, j), 50);
+      EXPECT_EQ(dst.V(i, j), 60);
+    }
+  }
+}
+
+TEST_F(YuvKernelTest, CropIsCopy) {
+  Frame src(YUV_KERNEL_NV21, 64, 32);
+  Frame dst(YUV_KERNEL_NV21, 20, 10);
+  src.Fill(1);
+  yuv_kernel_rect crop = {6, 4, 20, 10};
+
+  for (int filter = YUV_KERNEL_NEAREST; filter <= YUV_KERNEL_BILINEAR; filter++) {
+    ASSERT_EQ(yuv_kernel_scale(src.image(), &crop, dst.image(), filter), 0);
+    for (int y = 0; y < 10; y++) {
+      for (int x = 0; x < 20; x++) {
+        ASSERT_EQ(dst.Y(x, y), src.Y(x + 6, y + 4));
+      }
+    }
+    for (int y = 0; y < 5; y++) {
+      for (int x = 0; x < 10; x++) {
+        ASSERT_EQ(dst.U(x, y), src.U(x + 3, y + 2));
+        ASSERT_EQ(dst.V(x, y), src.V(x + 3, y + 2));
+      }
+    }
+  }
+}
+
+TEST_F(YuvKernelTest, FormatSwap) {
+  const int formats[] = {YUV_KERNEL_NV12, YUV_KERNEL_NV21, YUV_KERNEL_YV12};
+  for (int sf : formats) {
+    for (int df : formats) {
+      Frame src(sf, 40, 12);
+      Frame dst(df, 40, 12);
+      src.Fill(2);
+      ASSERT_EQ(yuv_kernel_scale(src.image(), nullptr, dst.image(), YUV_KERNEL_NEAREST), 0);
+      for (int plane = 0; plane < 3; plane++) {
+        int sub = plane == 0 ? 1 : 2;
+        for (int y = 0; y < 12 / sub; y++) {
+          for (int x = 0; x < 40 / sub; x++) {
+            ASSERT_EQ(dst.At(plane, x, y), src.At(plane, x, y))
+                << sf << "->" << df << " plane " << plane << " at " << x << "," << y;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(YuvKernelTest, AnyRatioMatchesReference) {
+  const int formats[] = {YUV_KERNEL_NV12, YUV_KERNEL_NV21, YUV_KERNEL_YV12};
+  const int sizes[][4] = {
+      // src w, h, dst w, h
+      {64, 48, 32, 24},     // 2:1, the fast paths
+      {64, 48, 16, 12},     // 4:1
+      {100, 60, 36, 22},    // odd ratios
+      {48, 36, 64, 48},     // upscale
+      {160, 120, 158, 90},  // close to 1
+  };
+  for (auto& s : sizes) {
+    for (int filter = YUV_KERNEL_NEAREST; filter <= YUV_KERNEL_BILINEAR; filter++) {
+      for (int sf : formats) {
+        Frame src(sf, s[0], s[1]);
+        Frame dst(formats[(sf + filter) % 3], s[2], s[3]);
+        src.Fill(s[0] + filter);
+        yuv_kernel_rect crop = {0, 0, s[0], s[1]};
+        ASSERT_EQ(yuv_kernel_scale(src.image(), &crop, dst.image(), filter), 0);
+        ExpectMatchesReference(src, crop, dst, filter);
+      }
+    }
+  }
+}
+
+TEST_F(YuvKernelTest, CropAndScale) {
+  Frame src(YUV_KERNEL_NV21, 96, 64);
+  Frame dst(YUV_KERNEL_YV12, 30, 20);
+  src.Fill(3);
+  yuv_kernel_rect crop = {10, 8, 60, 40};
+  for (int filter = YUV_KERNEL_NEAREST; filter <= YUV_KERNEL_BILINEAR; filter++) {
+    ASSERT_EQ(yuv_kernel_scale(src.image(), &crop, dst.image(), filter), 0);
+    ExpectMatchesReference(src, crop, dst, filter);
+  }
+}
+
+TEST_F(YuvKernelTest, SimdMatchesC) {
+  Frame src(YUV_KERNEL_NV21, 1280, 720);
+  src.Fill(4);
+  for (int filter = YUV_KERNEL_NEAREST; filter <= YUV_KERNEL_BILINEAR; filter++) {
+    Frame simd(YUV_KERNEL_NV21, 640, 360);
+    Frame c(YUV_KERNEL_NV21, 640, 360);
+    yuv_kernel_set_simd(1);
+    ASSERT_EQ(yuv_kernel_scale(src.image(), nullptr, simd.image(), filter), 0);
+    yuv_kernel_set_simd(0);
+    ASSERT_EQ(yuv_kernel_scale(src.image(), nullptr, c.image(), filter), 0);
+    for (int plane = 0; plane < 3; plane++) {
+      int sub = plane == 0 ? 1 : 2;
+      for (int y = 0; y < 360 / sub; y++) {
+        for (int x = 0; x < 640 / sub; x++) {
+          ASSERT_EQ(simd.At(plane, x, y), c.At(plane, x, y));
+        }
+      }
+    }
+  }
+}
+
+TEST_F(YuvKernelTest, BadArguments) {
+  Frame src(YUV_KERNEL_NV21, 64, 48);
+  Frame dst(YUV_KERNEL_NV21, 32, 24);
+  yuv_kernel_rect odd = {1, 0, 32, 24};
+  yuv_kernel_rect outside = {40, 0, 32, 24};
+  EXPECT_EQ(yuv_kernel_scale(src.image(), &odd, dst.image(), YUV_KERNEL_BOX), -1);
+  EXPECT_EQ(yuv_kernel_scale(src.image(), &outside, dst.image(), YUV_KERNEL_BOX), -1);
+}
@@ -45,14 +45,24 @@ LOCAL_SRC_FILES :=\
     $(ROTATE) \
     other/debug.cpp \
     other/memcontrl.cpp \
-    other/layerRecord.cpp \
+    other/slab.cpp \
     threadResouce/hwc_event_thread.cpp \
+    threadResouce/hwc_vsync_parse.cpp \
     threadResouce/hwc_submit_thread.cpp
 
 ifeq ($(USE_IOMMU),true)
 	LOCAL_CFLAGS += -DUSE_IOMMU
 endif
 
+# blend the layers out of pipes by g2d instead of gpu,
+# only with a g2d, the cpu stub backend is for the tests.
+ifeq ($(TARGET_USES_G2D_COMPOSE),true)
+ifeq ($(TARGET_USES_G2D),true)
+	LOCAL_CFLAGS += -DG2D_COMPOSE
+	LOCAL_SRC_FILES += other/g2d_compose.cpp other/g2d_compose_dev.cpp
+endif
+endif
+
 ifneq ($(wildcard hardware/aw/gpu/include/hal_public.h),)
 LOCAL_C_INCLUDES += hardware/aw/gpu/include
 LOCAL_CFLAGS += -DHAL_PUBLIC_UNIFIED_ENABLE
@@ -68,6 +78,13 @@ else
 	LOCAL_CFLAGS += -DWB_MODE=2
 endif
 	LOCAL_CFLAGS += -DENABLE_WRITEBACK
+# max capture size of the mirror: 720p(default), 1080p
+ifeq ($(HWC_WRITEBACK_SIZE), 1080p)
+	LOCAL_CFLAGS += -DWB_WIDTH=1920 -DWB_HEIGHT=1080
+endif
+ifneq ($(HWC_WRITEBACK_BUFFERS),)
+	LOCAL_CFLAGS += -DWB_CACHE_NUM=$(HWC_WRITEBACK_BUFFERS)
+endif
 	LOCAL_SRC_FILES += other/write_back.cpp
 else
 ifeq ($(COMPOSER_READBACK_ENABLE), enable)
@@ -141,3 +158,167 @@ LOCAL_CFLAGS += -DLOG_TAG=\"sunxihwc\" -DTARGET_BOARD_PLATFORM=$(TARGET_BOARD_PL
 LOCAL_MODULE_TAGS := optional
 #TARGET_GLOBAL_CFLAGS += -DTARGET_BOARD_PLATFORM=$(TARGET_BOARD_PLATFORM)
 include $(BUILD_SHARED_LIBRARY)
+
+# Unit tests for the hwc2 HAL.
+# ==============================================================================
+ifeq ($(USE_HWC2_TEST),true)
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwcomposer_test
+LOCAL_MODULE_TAGS := optional
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := \
+    layer.cpp \
+    other/slab.cpp \
+    other/slab_test.cpp \
+    layer_test.cpp \
+    other/g2d_compose.cpp \
+    other/g2d_compose_stub.cpp \
+    other/g2d_compose_test.cpp \
+    threadResouce/hwc_submit_thread.cpp \
+    threadResouce/hwc_submit_thread_test.cpp
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    liblog \
+    libcutils \
+    libsync_aw \
+    libion
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
+LOCAL_C_INCLUDES += system/core/libion/include \
+    system/core/include \
+    hardware/libhardware/include \
+    hardware/aw/hwc2/include
+ifneq ($(wildcard hardware/aw/gpu/include/hal_public.h),)
+LOCAL_C_INCLUDES += hardware/aw/gpu/include
+LOCAL_CFLAGS += -DHAL_PUBLIC_UNIFIED_ENABLE
+endif
+LOCAL_CFLAGS += -DLOG_TAG=\"sunxihwc_test\"
+include $(BUILD_NATIVE_TEST)
+
+# Benchmarks of the validate path, run on the device.
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwcomposer_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_SRC_FILES := \
+    layer.cpp \
+    other/slab.cpp \
+    layer_bench.cpp
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    liblog \
+    libcutils
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
+LOCAL_C_INCLUDES += system/core/libion/include \
+    system/core/include \
+    hardware/libhardware/include \
+    hardware/aw/hwc2/include
+ifneq ($(wildcard hardware/aw/gpu/include/hal_public.h),)
+LOCAL_C_INCLUDES += hardware/aw/gpu/include
+LOCAL_CFLAGS += -DHAL_PUBLIC_UNIFIED_ENABLE
+endif
+LOCAL_CFLAGS += -DLOG_TAG=\"sunxihwc_bench\"
+include $(BUILD_NATIVE_BENCHMARK)
+
+# Host benchmark of the present to submit thread handoff.
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_submit_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := threadResouce/hwc_submit_bench.cpp
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host replay of recorded vsync uevents through the vsync parsers.
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_vsync_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+    threadResouce/hwc_vsync_parse.cpp \
+    threadResouce/hwc_vsync_bench.cpp
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host report of the layer stack traces recorded on the device.
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_trace_report
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := other/hwc_trace_report.cpp
+include $(BUILD_HOST_EXECUTABLE)
+# Host replay of the layer stack traces through the hal on a fake display driver.
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_replay
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+    hwc.cpp \
+    layer.cpp \
+    hwc_common.cpp \
+    de2family/DisplayOpr.cpp \
+    other/ion.cpp \
+    other/rotate.cpp \
+    other/debug.cpp \
+    other/memcontrl.cpp \
+    other/slab.cpp \
+    threadResouce/hwc_event_thread.cpp \
+    threadResouce/hwc_vsync_parse.cpp \
+    threadResouce/hwc_submit_thread.cpp \
+    host/fake_disp.cpp \
+    host/fake_libs.cpp \
+    host/hwc_replay.cpp
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    liblog \
+    libcutils
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/host/include
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
+LOCAL_C_INCLUDES += system/core/include \
+    hardware/libhardware/include \
+    hardware/aw/hwc2/include \
+    hardware/aw/display/include
+ifneq ($(wildcard hardware/aw/gpu/include/hal_public.h),)
+LOCAL_C_INCLUDES += hardware/aw/gpu/include
+LOCAL_CFLAGS += -DHAL_PUBLIC_UNIFIED_ENABLE
+endif
+LOCAL_CFLAGS += -Wno-error=unused-variable -Wno-error=unused-function -Wno-error=unused-label -Wno-error=unused-value -Wno-error=unused-parameter -Wno-error=incompatible-pointer-types -Wno-error=implicit-function-declaration -Wno-error=format -Wno-error=return-type
+LOCAL_CFLAGS += -DLOG_TAG=\"sunxihwc_replay\" -DTARGET_BOARD_PLATFORM=$(TARGET_BOARD_PLATFORM) -DHWC_VENDOR_SERVICE
+LOCAL_LDFLAGS := -Wl,--wrap=open -Wl,--wrap=open64 -Wl,--wrap=ioctl \
+    -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+# Host benchmark of the layer assignment on synthetic stacks.
+include $(CLEAR_VARS)
+LOCAL_MODULE := hwc_assign_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+    hwc.cpp \
+    layer.cpp \
+    hwc_common.cpp \
+    de2family/DisplayOpr.cpp \
+    other/ion.cpp \
+    other/rotate.cpp \
+    other/debug.cpp \
+    other/memcontrl.cpp \
+    other/slab.cpp \
+    threadResouce/hwc_event_thread.cpp \
+    threadResouce/hwc_vsync_parse.cpp \
+    threadResouce/hwc_submit_thread.cpp \
+    host/fake_disp.cpp \
+    host/fake_libs.cpp \
+    host/hwc_assign_bench.cpp
+LOCAL_SHARED_LIBRARIES := \
+    libutils \
+    liblog \
+    libcutils
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/host/include
+LOCAL_C_INCLUDES += $(TARGET_HARDWARE_INCLUDE)
+LOCAL_C_INCLUDES += system/core/include \
+    hardware/libhardware/include \
+    hardware/aw/hwc2/include \
+    hardware/aw/display/include
+ifneq ($(wildcard hardware/aw/gpu/include/hal_public.h),)
+LOCAL_C_INCLUDES += hardware/aw/gpu/include
+LOCAL_CFLAGS += -DHAL_PUBLIC_UNIFIED_ENABLE
+endif
+LOCAL_CFLAGS += -Wno-error=unused-variable -Wno-error=unused-function -Wno-error=unused-label -Wno-error=unused-value -Wno-error=unused-parameter -Wno-error=incompatible-pointer-types -Wno-error=implicit-function-declaration -Wno-error=format -Wno-error=return-type
+LOCAL_CFLAGS += -DLOG_TAG=\"sunxihwc_bench\" -DTARGET_BOARD_PLATFORM=$(TARGET_BOARD_PLATFORM) -DHWC_VENDOR_SERVICE
+LOCAL_LDFLAGS := -Wl,--wrap=open -Wl,--wrap=open64 -Wl,--wrap=ioctl
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+endif #USE_HWC2_TEST
@@ -46,6 +46,8 @@
 #define LAYER_BY_PIPE 4
 
 #define VI_NUM 1
+/* layers blended by g2d into the client target a frame */
+#define G2D_MAX_LAYER 64
 /*limited by atw hardware*/
 #define ATW_DEVICE_MAX_EYE_BUFFER_WIDTH 1280
 #define SCALEMAX 32
@@ -82,6 +84,7 @@ typedef struct PipeInfo {
 	float scaleW;
 	float scaleH;
 	int curentMem;
+	hwc_rect_t bound;//union of hwcLayer frames
 }PipeInfo_t;
 
 /*
@@ -93,6 +96,8 @@ typedef struct DELayerPrivate {
 	int zOrder;
 	float pipeScaleW;
 	float pipeScaleH;
+	int32_t comType;//assigned composition type, for reuse
+	bool g2d;//blended by g2d into the client target
 }DELayerPrivate_t;
 
 /*
@@ -111,6 +116,13 @@ typedef struct DESource {
 	PipeInfo_t *Pipe;
 	disp_layer_config2 *layerInfo;
 	DisplayConfig_t currentConfig;
+	/* last assignment fingerprint */
+	bool signValid;
+	uint64_t assignSign;
+	memCtrlShot_t memDelta;
+	unsigned int assignHit;
+	unsigned int assignMiss;
+	bool g2dUsed;
 } DESource_t;
 
 int dispFd;
@@ -394,6 +406,7 @@ static inline void resetLayer(Layer_t *layer)
 	deLayer->pipe = -1;
 	deLayer->layerId = -1;
 	deLayer->zOrder = -1;
+	deLayer->g2d = 0;
 	layer->typeChange = 0;
 	layer->clearClientTarget = 0;
 	layer->duetoFlag = HWC_LAYER;
@@ -752,6 +765,8 @@ bool checkLayerPipeCross(PipeInfo_t *pipe, Layer_t *layer)
 	int i = 0;
 	bool cross = 0;
 
+	if (pipe->layNum == 0 || !regionCrossed(&pipe->bound, &layer->frame, NULL))
+		return 0;
 	for (i = 0; i < pipe->layNum; i++) {
 		if (pipe->hwcLayer[i] != NULL)
 			cross |= checkLayerCross(pipe->hwcLayer[i], layer);
@@ -761,6 +776,21 @@ bool checkLayerPipeCross(PipeInfo_t *pipe, Layer_t *layer)
 	return cross;
 }
 
+static void pipeAddLayer(PipeInfo_t *pipe, Layer_t *layer)
+{
+	hwc_rect_t *rect = &layer->frame;
+
+	if (pipe->layNum == 0) {
+		pipe->bound = *rect;
+	} else {
+		pipe->bound.left = min(pipe->bound.left, rect->left);
+		pipe->bound.top = min(pipe->bound.top, rect->top);
+		pipe->bound.right = max(pipe->bound.right, rect->right);
+		pipe->bound.bottom = max(pipe->bound.bottom, rect->bottom);
+	}
+	pipe->hwcLayer[pipe->layNum++] = layer;
+}
+
 bool checkLayerClientCross(struct listnode *layerSortedByZorder, Layer_t *layer)
 {
 	struct listnode *node;
@@ -786,6 +816,7 @@ static bool layerIsPremult(Layer_t *layer)
 
 bool checkSimpleSupport(Display_t *display, Layer_t *layer)
 {
+	layer->prescale = 0;
 	if(layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET)
 		return true;
 	if (display->colorTransformHint != 0) {
@@ -858,8 +889,13 @@ bool checkSimpleSupport(Display_t *display, Layer_t *layer)
 		return false;
 	}
 	if (displayFrameIsScale(display, layer) && !layerCanScale(deFreq, display, layer)) {
-		layer->duetoFlag = SCALE_OUT;
-		return false;
+		/* big video: let g2d downscale it to the frame, the de shows it 1:1 */
+		layer->prescale = layerIsVideo(layer) && supportPreScale(display, layer);
+		if (!layer->prescale || !aquireTRlimmit(layer)) {
+			layer->prescale = 0;
+			layer->duetoFlag = SCALE_OUT;
+			return false;
+		}
 	}
 	// for afbc
 	private_handle_t *handle = (private_handle_t *)layer->buffer;
@@ -924,7 +960,7 @@ void assignLayerComType(Display_t *display)
 		deLayer = toHwLayer(layer);
 		if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET)
 			continue;
-		if (deLayer->pipe == -1) {
+		if (deLayer->pipe == -1 && !deLayer->g2d) {
 			if (layer->compositionType != HWC2_COMPOSITION_CLIENT)
 				layer->typeChange = 1;
 			layer->compositionType = HWC2_COMPOSITION_CLIENT;
@@ -937,7 +973,8 @@ void assignLayerComType(Display_t *display)
 				layer->compositionType = HWC2_COMPOSITION_DEVICE;
 			}
 		}
-		if (deLayer->pipe == -1) {
+		/* the cache of a layer no more rotated or prescaled is useless */
+		if (deLayer->pipe == -1 || (layer->transform == 0 && !layer->prescale)) {
 			if (trCachePut(layer->trcache, 0))
 				layer->trcache = NULL;
 		}
@@ -997,22 +1034,13 @@ void reAssignHwPipeZorder(DESource_t *hw)
 
 void setPipeScale(PipeInfo_t *Pipe, Layer_t *layer)
 {
-	float w, h, tmp;
 	if (checkSoildLayer(layer)) {
 		return;
 	}
 	if (!checkFloatSame(Pipe->scaleW, 1.0)
 		|| !checkFloatSame(Pipe->scaleH, 1.0))
 		return;
-	w = layer->crop.right - layer->crop.left;
-	h = layer->crop.bottom - layer->crop.top;
-	if (layer->transform & HAL_TRANSFORM_ROT_90) {
-		tmp = w;
-		w = h;
-		h = tmp;
-	}
-	Pipe->scaleW = (layer->frame.right - layer->frame.left) / w;
-	Pipe->scaleH = (layer->frame.bottom - layer->frame.top) / h;
+	calcLayerFactor(layer, &Pipe->scaleW, &Pipe->scaleH);
 }
 
 int matchPipeAttribute(Display_t *display, int i, Layer_t *uplayer)
@@ -1279,7 +1307,7 @@ assign_FB:
 			}
 		}
 		if (!isAreadyIn) {
-			matchPipe->hwcLayer[matchPipe->layNum++] = layer;
+			pipeAddLayer(matchPipe, layer);
 		}
 
 	}
@@ -1329,23 +1357,139 @@ static void TryToAssignLayer(Display_t *display)
 
 }
 
+#ifdef G2D_COMPOSE
+/*
+ * the layers left to the client target can be blended by g2d
+ * instead of the gpu, but only if all of them can, and no more
+ * than g2dComposeSubmit takes.
+ */
+static bool tryG2dCompose(Display_t *display)
+{
+	struct listnode *node;
+	Layer_t *layer;
+	int num = 0;
+
+	if (!display->needclientTarget
+		|| toHwLayer(display->clientTargetLayer)->pipe == -1)
+		return false;
+	list_for_each(node, display->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET
+			|| toHwLayer(layer)->pipe != -1)
+			continue;
+		if (++num > G2D_MAX_LAYER || !g2dComposeSupport(display, layer))
+			return false;
+	}
+	list_for_each(node, display->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->compositionType != HWC2_COMPOSITION_CLIENT_TARGET
+			&& toHwLayer(layer)->pipe == -1)
+			toHwLayer(layer)->g2d = 1;
+	}
+	return true;
+}
+
+/*
+ * the g2d layers are DEVICE for surfaceflinger so the gpu did not draw
+ * them, on failure ask for a refresh and compose the next frame by gpu.
+ */
+static int g2dComposeSubmit(LayerSubmit_t *submitLayer)
+{
+	struct listnode *node;
+	Layer_t *layer, *fb = NULL, *g2dLayer[G2D_MAX_LAYER];
+	Display_t *display;
+	int num = 0;
+
+	list_for_each(node, &submitLayer->layerNode) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET)
+			fb = layer;
+		else if (toHwLayer(layer)->g2d && num < G2D_MAX_LAYER)
+			/* tryG2dCompose never marks more */
+			g2dLayer[num++] = layer;
+	}
+	if (num == 0)
+		return 0;
+	if (fb != NULL && fb->buffer != NULL
+		&& !g2dComposeLayers(submitLayer, fb, g2dLayer, num))
+		return 0;
+
+	display = findHwDisplay(submitLayer->hwid);
+	if (display != NULL)
+		callRefresh(display);
+	return -1;
+}
+#endif
+
+static inline void invalidateAssign(Display_t *display)
+{
+	DESource[display->displayId].signValid = 0;
+}
+
+/*
+ * SurfaceFlinger request the same types every frame,
+ * so restore what we had assigned, typeChange and clearClientTarget are kept.
+ */
+static void reuseLastAssign(Display_t *display)
+{
+	struct listnode *node;
+	Layer_t *layer;
+
+	list_for_each(node, display->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		layer->compositionType = toHwLayer(layer)->comType;
+	}
+}
+
 int32_t de2AssignLayer(Display_t *display)
 {
 	DESource_t *deHw = &DESource[display->displayId];
+	struct listnode *node;
+	Layer_t *layer;
+	memCtrlShot_t begin;
+	uint64_t sign;
+	bool g2dFallback = 0;
+
+	sign = layerListSign(display);
+	memResetPerframe(display);
+#ifdef G2D_COMPOSE
+	g2dFallback = g2dComposeFallback(display);
+	if (deHw->g2dUsed && (g2dFallback || !g2dComposeUsable(display)))
+		invalidateAssign(display);
+#endif
+	if (deHw->signValid && deHw->assignSign == sign
+		&& memCtrlReplay(&deHw->memDelta)) {
+		reuseLastAssign(display);
+		memContrlComplet(display);
+		deHw->assignHit++;
+		return 0;
+	}
+	deHw->assignMiss++;
+	memCtrlSnapshot(&begin);
 
 	resetDisplay(display);
 	resetLayerList(display);
 	resetHwPipe(display, 0, deHw->fixPipeNumber - 1, true);
-	memResetPerframe(display);
 
 	reCalPipeForHDR(display);
 
 	TryToAssignLayer(display);
+#ifdef G2D_COMPOSE
+	deHw->g2dUsed = !g2dFallback && tryG2dCompose(display);
+#endif
 
+	memCtrlShotDiff(&deHw->memDelta, &begin);
 	memContrlComplet(display);
 	reAssignHwPipeZorder(deHw);
 	assignLayerComType(display);
 
+	list_for_each(node, display->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		toHwLayer(layer)->comType = layer->compositionType;
+	}
+	deHw->assignSign = sign;
+	deHw->signValid = 1;
+
 	return 0;
 }
 
@@ -1816,10 +1960,17 @@ int de2SetupLayer(LayerSubmit_t *submitLayer)
 	for (i = 0; i < chn * 4; i++) {
 		layerConfig[i].enable = 0;
 	}
+#ifdef G2D_COMPOSE
+	if (g2dComposeSubmit(submitLayer))
+		ALOGW("g2d compose frame:%u err, fall back to client composition",
+			submitLayer->frameCount);
+#endif
 
 	list_for_each(node, &submitLayer->layerNode) {
 		layer = node_to_item(node, Layer_t, node);
 		hwlayer = toHwLayer(layer);
+		if (hwlayer->g2d)
+			continue;
 		layerConfig[hwlayer->pipe * 4 + hwlayer->layerId].enable = 1;
 		setupDisplayInfo(submitLayer, layer,
 			&layerConfig[hwlayer->pipe * 4 + hwlayer->layerId], hwlayer->zOrder);
@@ -1906,7 +2057,7 @@ void showlayers(Display_t *display)
 	Layer_t *lay;
 	private_handle_t *handle;
 
-	char mem[200];
+	char mem[512];
 	memCtrlDump(mem);
 
 	ALOGI("dispy%d(hwid%d) cur:%d-%d-%d mem:%s\n", (int)toClientId(display->clientId), display->displayId, display->frameCount,
@@ -1951,9 +2102,16 @@ void de2Dump(Display_t *display, uint32_t* outSize, char* outBuffer, uint32_t ma
 	struct listnode *node;
 	Layer_t *lay;
 	private_handle_t *handle;
+	uint32_t lines;
 	hwdisplay = toHwDisplay(display);
 	if (outBuffer == NULL) {
-		*outSize += (display->nubmerLayer + display->needclientTarget + 3) * max;
+		lines = display->nubmerLayer + display->needclientTarget + 10 + FRAME_PHASE_NUM
+				+ MEM_CALLER_N + 2;
+#ifdef COMPOSER_READBACK
+		/*the readback stream line*/
+		lines++;
+#endif
+		*outSize += lines * max;
 		return;
 	}
 	if(!display->plugIn) {
@@ -1992,12 +2150,31 @@ void de2Dump(Display_t *display, uint32_t* outSize, char* outBuffer, uint32_t ma
 		count += sprintf(outBuffer + count, "%2d|", hwlayer->layerId);
 		count += sprintf(outBuffer + count, "%s\n", hwcPrintInfo(lay->duetoFlag));
 	}
-	count += sprintf(outBuffer + count, "disp:%d cur:%u-%u ker:%u\n"
+	count += sprintf(outBuffer + count, "disp:%d cur:%u-%u ker:%u pend:%d full:%u(drop %u) drop:%u idle:%u assign hit:%u miss:%u\n"
 			"--------------------------------------------------------------------------"
 			"--------------------------------------------------------------------------\n",
-			display->displayId, display->frameCount,display->commitThread->diplayCount, display->commitThread->SubmitCount);
+			display->displayId, display->frameCount,display->commitThread->diplayCount, display->commitThread->SubmitCount,
+			submitPendingCount(display), display->commitThread->ringFullCount,
+			display->commitThread->ringDropCount,
+			display->commitThread->dropCount, display->idleSkip,
+			DESource[display->displayId].assignHit, DESource[display->displayId].assignMiss);
 	count += memCtrlDump(outBuffer + count);
 	count += hwc_mem_dump(outBuffer + count);
+	count += layerCacheDump(outBuffer + count);
+	count += frameTimeDump(display, outBuffer + count);
+	count += submitVsyncDump(display, outBuffer + count);
+	count += trCacheDump(outBuffer + count);
+#ifdef ENABLE_WRITEBACK
+	if (display->displayId == 0)
+		count += writebackDump(outBuffer + count);
+#endif
+#ifdef COMPOSER_READBACK
+	if (display->displayId == 0)
+		count += readbackDump(outBuffer + count);
+#endif
+#ifdef G2D_COMPOSE
+	count += g2dComposeDump(display, outBuffer + count);
+#endif
 	*outSize = count;
 }
 
@@ -2104,13 +2281,14 @@ Layer_t* de2creatLayer(Display_t* display)
 {
 	Layer_t *layer;
 	DELayerPrivate_t *deLayer;
-	unusedpara(display);
 
 	layer= layerCacheGet(sizeof(DELayerPrivate_t));
 	if (layer== NULL) {
 		ALOGE("creat layer err...");
 		return NULL;
 	}
+	/* the layer may reuse a freed one's address */
+	invalidateAssign(display);
 	deLayer = toHwLayer(layer);
 	deLayer->pipe = -1;
 	deLayer->layerId = -1;
@@ -2450,8 +2628,10 @@ int de2Init(Display_t* display)
 
 	pthread_mutex_lock(&display->listMutex);
 
+	invalidateAssign(display);
 	if (!list_empty(display->layerSortedByZorder)) {
 			ALOGE("%s:SurfaceFlinger do not destroyed the layer",__FUNCTION__);
+			layerTableClear(&display->layerTable);
 			clearList(display->layerSortedByZorder, 1);
 	}
 	display->clientTargetLayer = layerCacheGet(sizeof(DELayerPrivate_t));
@@ -2467,6 +2647,7 @@ int de2Init(Display_t* display)
 
 	if (display->plugIn == 1 && display->displayId == 0) {
 		display->retirfence = -1;
+		display->presentFence = -1;
 		display->nubmerLayer = 0;
 		ALOGD("get a plug in display:%d", display->displayId);
 		return 0;
@@ -2566,6 +2747,7 @@ int de2Init(Display_t* display)
 	display->vsyncEn = 1;
 	display->plugIn = 1;
 	display->retirfence = -1;
+	display->presentFence = -1;
 	display->dataspace_mode = DISPLAY_OUTPUT_DATASPACE_MODE_SDR;
 	display->screenRadio = SCREEN_FULL;
 
@@ -2643,6 +2825,7 @@ int de2Deinit(Display_t *display)
 	clearAllLayers(display->displayId);
 
 	pthread_mutex_lock(&display->listMutex);
+	invalidateAssign(display);
 	while (display->configNumber--) {
 		if (display->displayConfigList[display->configNumber])
 			hwc_free(display->displayConfigList[display->configNumber]);
@@ -2651,7 +2834,9 @@ int de2Deinit(Display_t *display)
 	hwc_free(display->displayConfigList);
 	display->displayConfigList = NULL;
 	display->clientTargetLayer = NULL;
+	layerTableClear(&display->layerTable);
 	clearList(display->layerSortedByZorder, 1);
+	display->nubmerLayer = 0;
 	pthread_mutex_unlock(&display->listMutex);
 /* JetCui: becareful for switch displayid */
 	deinit_sync(display->displayId);
@@ -2674,6 +2859,7 @@ int32_t de2SetPowerMode(Display_t* display, int32_t mode)
 			arg[1] = 1;
 			vsyncEn = 0;
 			clearAllLayers(display->displayId);
+			invalidateAssign(display);
 			break;
 		case HWC2_POWER_MODE_DOZE:
 		case HWC2_POWER_MODE_DOZE_SUSPEND:
@@ -2834,6 +3020,11 @@ int displayDeviceDeInit(Display_t **display)
 	close(dispFd);
 	dispFd = -1;
 	for (i = 0; i < DE_NUM; i++) {
+		layerTableClear(&display[i]->layerTable);
+		if (display[i]->layerTable.size) {
+			hwc_free(display[i]->layerTable.layer);
+			hwc_free(display[i]->layerTable.gen);
+		}
 		clearList(display[i]->layerSortedByZorder, 1);
 		display[i]->clientTargetLayer = NULL;
 		hwc_free(DESource[i].layerInfo);
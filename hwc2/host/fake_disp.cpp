@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include "fake_disp.h"
+
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/fb.h>
+
+/*
+ * the display driver as DisplayOpr.cpp uses it: de0 has an lcd, de1 has
+ * nothing plugged in. a frame gets its fence by HWC_ACQUIRE_FENCE with
+ * the next count of the timeline, committing count n signals all the
+ * fences below n, as the driver does when frame n is on screen.
+ */
+
+extern "C" int __real_open(const char *path, int flags, ...);
+extern "C" int __real_open64(const char *path, int flags, ...);
+extern "C" int __real_ioctl(int fd, unsigned long request, ...);
+
+#define FAKE_DISP_NUM 2
+#define FAKE_FENCE_MAX 64
+
+typedef struct fakeFence {
+	unsigned int count;
+	int fd;
+}fakeFence_t;
+
+typedef struct fakeDisp {
+	struct disp_output output;
+	bool client;
+	unsigned int count;
+	int fenceNum;
+	fakeFence_t fence[FAKE_FENCE_MAX];
+	fakeDispStat_t stat;
+}fakeDisp_t;
+
+static fakeDisp_t fakeDisp[FAKE_DISP_NUM];
+static pthread_mutex_t fakeMutex = PTHREAD_MUTEX_INITIALIZER;
+static int fakeDispFd = -1;
+static int fakeFbFd = -1;
+static int fakeWidth = 1920;
+static int fakeHeight = 1080;
+
+void fakeDispSetLcd(int width, int height)
+{
+	fakeWidth = width;
+	fakeHeight = height;
+}
+
+void fakeDispGetStat(int disp, fakeDispStat_t *stat)
+{
+	pthread_mutex_lock(&fakeMutex);
+	*stat = fakeDisp[disp].stat;
+	pthread_mutex_unlock(&fakeMutex);
+}
+
+/* must hold fakeMutex */
+static void fakeFenceSignal(fakeDisp_t *disp, unsigned int below)
+{
+	uint64_t one = 1;
+	int i, n = 0;
+
+	for (i = 0; i < disp->fenceNum; i++) {
+		if (disp->fence[i].count < below) {
+			write(disp->fence[i].fd, &one, sizeof(one));
+			close(disp->fence[i].fd);
+			disp->stat.signaled++;
+			continue;
+		}
+		disp->fence[n++] = disp->fence[i];
+	}
+	disp->fenceNum = n;
+}
+
+static int fakeDispCommit(fakeDisp_t *disp, unsigned long *arg)
+{
+	struct sync_info *sync;
+	int fd;
+
+	switch (arg[1]) {
+	case HWC_NEW_CLIENT:
+		disp->client = true;
+		*(unsigned long *)arg[2] = 254000000;
+		return 0;
+	case HWC_DESTROY_CLIENT:
+		fakeFenceSignal(disp, UINT_MAX);
+		disp->client = false;
+		return 0;
+	case HWC_ACQUIRE_FENCE:
+		if (!disp->client)
+			break;
+		/* nobody commits any more, the oldest can not be waited for */
+		if (disp->fenceNum == FAKE_FENCE_MAX)
+			fakeFenceSignal(disp, disp->fence[0].count + 1);
+		fd = eventfd(0, EFD_CLOEXEC);
+		if (fd < 0)
+			return -1;
+		sync = (struct sync_info *)arg[2];
+		sync->count = ++disp->count;
+		sync->fd = dup(fd);
+		disp->fence[disp->fenceNum].count = sync->count;
+		disp->fence[disp->fenceNum++].fd = fd;
+		disp->stat.fences++;
+		return 0;
+	case HWC_SUBMIT_FENCE:
+		if (!disp->client)
+			break;
+		fakeFenceSignal(disp, (unsigned int)arg[2]);
+		disp->stat.commits++;
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static int fakeDispIoctl(unsigned long request, unsigned long *arg)
+{
+	struct disp_device_config *config;
+	struct disp_layer_config2 *layer;
+	fakeDisp_t *disp;
+	int ret = 0;
+
+	if (arg == NULL || arg[0] >= FAKE_DISP_NUM) {
+		errno = EINVAL;
+		return -1;
+	}
+	disp = &fakeDisp[arg[0]];
+	pthread_mutex_lock(&fakeMutex);
+	switch (request) {
+	case DISP_GET_OUTPUT:
+		*(struct disp_output *)arg[1] = disp->output;
+		break;
+	case DISP_DEVICE_SWITCH:
+		disp->output.type = arg[1];
+		disp->output.mode = arg[2];
+		break;
+	case DISP_DEVICE_SET_CONFIG:
+		config = (struct disp_device_config *)arg[1];
+		disp->output.type = config->type;
+		disp->output.mode = config->mode;
+		break;
+	case DISP_DEVICE_GET_CONFIG:
+		config = (struct disp_device_config *)arg[1];
+		memset(config, 0, sizeof(*config));
+		config->type = (enum disp_output_type)disp->output.type;
+		config->mode = (enum disp_tv_mode)disp->output.mode;
+		break;
+	case DISP_HWC_COMMIT:
+		ret = fakeDispCommit(disp, arg);
+		break;
+	case DISP_LAYER_SET_CONFIG2:
+		layer = (struct disp_layer_config2 *)arg[1];
+		for (unsigned long i = 0; i < arg[2]; i++)
+			disp->stat.layers += layer[i].enable;
+		break;
+	case DISP_GET_SCN_WIDTH:
+		ret = disp->output.type == DISP_OUTPUT_TYPE_NONE ? 0 : fakeWidth;
+		break;
+	case DISP_GET_SCN_HEIGHT:
+		ret = disp->output.type == DISP_OUTPUT_TYPE_NONE ? 0 : fakeHeight;
+		break;
+	/* no hdmi on the fake */
+	case DISP_HDMI_SUPPORT_MODE:
+		break;
+	case DISP_SHADOW_PROTECT:
+	case DISP_BLANK:
+	case DISP_VSYNC_EVENT_EN:
+	case DISP_SMBL_ENABLE:
+	case DISP_SMBL_DISABLE:
+	case DISP_SMBL_SET_WINDOW:
+		break;
+	default:
+		ALOGE("fake disp: ioctl 0x%lx is not faked", request);
+		errno = ENOTTY;
+		ret = -1;
+	}
+	pthread_mutex_unlock(&fakeMutex);
+	return ret;
+}
+
+/* 1080p timing of 148.5MHz, 60Hz at any size */
+static int fakeFbIoctl(unsigned long request, void *arg)
+{
+	struct fb_var_screeninfo *info = (struct fb_var_screeninfo *)arg;
+
+	if (request != FBIOGET_VSCREENINFO) {
+		errno = ENOTTY;
+		return -1;
+	}
+	memset(info, 0, sizeof(*info));
+	info->xres = fakeWidth;
+	info->yres = fakeHeight;
+	info->left_margin = 2200 - fakeWidth;
+	info->upper_margin = 1125 - fakeHeight;
+	info->pixclock = 1000000000000LL / (2200LL * 1125 * 60);
+	if (fakeWidth > 2200 || fakeHeight > 1125) {
+		info->left_margin = 0;
+		info->upper_margin = 0;
+		info->pixclock = 1000000000000LL / ((long long)fakeWidth * fakeHeight * 60);
+	}
+	return 0;
+}
+
+static int fakeOpen(int *fd)
+{
+	if (*fd < 0)
+		*fd = eventfd(0, EFD_CLOEXEC);
+	if (*fd >= 0 && fd == &fakeDispFd) {
+		fakeDisp[0].output.type = DISP_OUTPUT_TYPE_LCD;
+		fakeDisp[1].output.type = DISP_OUTPUT_TYPE_NONE;
+	}
+	return *fd;
+}
+
+/* the nodes of the board, the real open for the rest */
+static int fakeOpenPath(const char *path)
+{
+	if (!strcmp(path, "/dev/disp"))
+		return fakeOpen(&fakeDispFd);
+	if (!strcmp(path, "/dev/graphics/fb0"))
+		return fakeOpen(&fakeFbFd);
+	if (!strncmp(path, "/dev/", 5) || !strncmp(path, "/sys/", 5)) {
+		errno = ENOENT;
+		return -1;
+	}
+	return -2;
+}
+
+extern "C" int __wrap_open(const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode = 0, fd;
+
+	fd = fakeOpenPath(path);
+	if (fd != -2)
+		return fd;
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return __real_open(path, flags, mode);
+}
+
+extern "C" int __wrap_open64(const char *path, int flags, ...)
+{
+	va_list ap;
+	int mode = 0, fd;
+
+	fd = fakeOpenPath(path);
+	if (fd != -2)
+		return fd;
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return __real_open64(path, flags, mode);
+}
+
+extern "C" int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	if (fd >= 0 && fd == fakeDispFd)
+		return fakeDispIoctl(request, (unsigned long *)arg);
+	if (fd >= 0 && fd == fakeFbFd)
+		return fakeFbIoctl(request, arg);
+	return __real_ioctl(fd, request, arg);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _HWC_FAKE_DISP_H_
+#define _HWC_FAKE_DISP_H_
+
+/*
+ * the host fakes of the board, linked with the hal for the replay:
+ * /dev/disp and /dev/graphics/fb0 are served by fake_disp.cpp through
+ * -Wl,--wrap=open,--wrap=ioctl, any other /dev or /sys node is absent.
+ * the fences of the driver are eventfds, signaled by the next commit.
+ */
+
+typedef struct fakeDispStat {
+	unsigned int fences;		/* HWC_ACQUIRE_FENCE */
+	unsigned int commits;		/* HWC_SUBMIT_FENCE */
+	unsigned int signaled;		/* fences signaled by a commit */
+	unsigned long long layers;	/* enabled layers of DISP_LAYER_SET_CONFIG2 */
+} fakeDispStat_t;
+
+/* the lcd of de0, before the hal is opened */
+extern void fakeDispSetLcd(int width, int height);
+extern void fakeDispGetStat(int disp, fakeDispStat_t *stat);
+
+/* the properties the hal reads, the host libcutils has none */
+extern int fakePropertySet(const char *key, const char *value);
+
+#endif
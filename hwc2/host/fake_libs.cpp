@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include "../other/vendorservice.h"
+#include "fake_disp.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <cutils/properties.h>
+#include <cutils/uevent.h>
+
+/*
+ * the device only libraries of the hal: the properties and uevents of
+ * libcutils, libsync_aw, libion and the vendor service.
+ */
+
+#define FAKE_PROP_MAX 32
+
+typedef struct fakeProp {
+	char key[PROPERTY_KEY_MAX];
+	char value[PROPERTY_VALUE_MAX];
+}fakeProp_t;
+
+static fakeProp_t fakeProp[FAKE_PROP_MAX];
+static int fakePropNum;
+
+int fakePropertySet(const char *key, const char *value)
+{
+	int i;
+
+	if (strlen(key) >= PROPERTY_KEY_MAX || strlen(value) >= PROPERTY_VALUE_MAX)
+		return -1;
+	for (i = 0; i < fakePropNum; i++) {
+		if (!strcmp(fakeProp[i].key, key))
+			break;
+	}
+	if (i == FAKE_PROP_MAX)
+		return -1;
+	if (i == fakePropNum)
+		fakePropNum++;
+	strcpy(fakeProp[i].key, key);
+	strcpy(fakeProp[i].value, value);
+	return 0;
+}
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+	const char *src = default_value;
+
+	for (int i = 0; i < fakePropNum; i++) {
+		if (!strcmp(fakeProp[i].key, key)) {
+			src = fakeProp[i].value;
+			break;
+		}
+	}
+	if (src == NULL) {
+		value[0] = 0;
+		return 0;
+	}
+	strncpy(value, src, PROPERTY_VALUE_MAX - 1);
+	value[PROPERTY_VALUE_MAX - 1] = 0;
+	return strlen(value);
+}
+
+int32_t property_get_int32(const char *key, int32_t default_value)
+{
+	char value[PROPERTY_VALUE_MAX];
+	char *end;
+	long ret;
+
+	if (property_get(key, value, NULL) <= 0)
+		return default_value;
+	ret = strtol(value, &end, 0);
+	return *end == 0 ? (int32_t)ret : default_value;
+}
+
+/* no uevent on the host, the event thread waits on a silent fd */
+int uevent_open_socket(int buf_sz, bool passcred)
+{
+	unusedpara(buf_sz);
+	unusedpara(passcred);
+	return eventfd(0, EFD_CLOEXEC);
+}
+
+ssize_t uevent_kernel_multicast_recv(int socket, void *buffer, size_t length)
+{
+	unusedpara(socket);
+	unusedpara(buffer);
+	unusedpara(length);
+	return 0;
+}
+
+/* the fences are the eventfds of fake_disp.cpp, no sw_sync timeline */
+int sync_wait(int fd, int timeout)
+{
+	struct pollfd fds;
+	int ret;
+
+	if (fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	fds.fd = fd;
+	fds.events = POLLIN;
+	do {
+		ret = poll(&fds, 1, timeout);
+		if (ret > 0)
+			return 0;
+		if (ret == 0) {
+			errno = ETIME;
+			return -1;
+		}
+	} while (errno == EINTR || errno == EAGAIN);
+	return ret;
+}
+
+int sw_sync_timeline_create(void)
+{
+	errno = ENOENT;
+	return -1;
+}
+
+int sw_sync_timeline_inc(int fd, unsigned count)
+{
+	unusedpara(fd);
+	unusedpara(count);
+	errno = EINVAL;
+	return -1;
+}
+
+int sw_sync_fence_create(int fd, const char *name, unsigned value)
+{
+	unusedpara(fd);
+	unusedpara(name);
+	unusedpara(value);
+	errno = EINVAL;
+	return -1;
+}
+
+/* /dev/ion is absent, every call fails as on a closed ion fd */
+int ion_alloc_fd(int fd, size_t len, size_t align, unsigned int heap_mask,
+		unsigned int flags, int *handle_fd)
+{
+	unusedpara(fd);
+	unusedpara(len);
+	unusedpara(align);
+	unusedpara(heap_mask);
+	unusedpara(flags);
+	*handle_fd = -1;
+	return -ENODEV;
+}
+
+int ion_import(int fd, int share_fd, ion_user_handle_t *handle)
+{
+	unusedpara(fd);
+	unusedpara(share_fd);
+	unusedpara(handle);
+	return -ENODEV;
+}
+
+int ion_free(int fd, ion_user_handle_t handle)
+{
+	unusedpara(fd);
+	unusedpara(handle);
+	return -ENODEV;
+}
+
+int ion_map(int fd, ion_user_handle_t handle, size_t length, int prot,
+		int flags, off_t offset, unsigned char **ptr, int *map_fd)
+{
+	unusedpara(fd);
+	unusedpara(handle);
+	unusedpara(length);
+	unusedpara(prot);
+	unusedpara(flags);
+	unusedpara(offset);
+	*ptr = NULL;
+	*map_fd = -1;
+	return -ENODEV;
+}
+
+int ion_sync_fd(int fd, int handle_fd)
+{
+	unusedpara(fd);
+	unusedpara(handle_fd);
+	return -ENODEV;
+}
+
+/* the binder service of the display config */
+void vendorservice_init()
+{
+}
+
+void setup_snr_info(struct disp_snr_info* snr)
+{
+	unusedpara(snr);
+}
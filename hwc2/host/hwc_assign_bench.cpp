@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * host benchmark of the layer assignment on synthetic stacks, against
+ * the fake /dev/disp of fake_disp.cpp. the stacks are 20, 32 and 64
+ * rgba layers of the screen:
+ *   tiles:   small layers spread over the screen
+ *   stacked: big layers piled up
+ * a quarter of the layers has no contiguous buffer, so it is client, as
+ * are the layers the assignment can not fit on the pipes.
+ * for each stack:
+ *   assign: de2AssignLayer a frame, the stack changes every frame so
+ *           assignLayersToPipe runs on each of them
+ *   walk:   checkLayerClientCross of each layer, on the stack as the
+ *           assignment left it
+ *   grid:   the same queries through the 8x8 layer grid of 38ec899,
+ *           built once a frame
+ *
+ * hwc_assign_bench [-s WxH] [-n frames]
+ */
+
+#include "../hwc.h"
+#include "fake_disp.h"
+
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <sys/eventfd.h>
+
+#define GRID_N 8
+#define GRID_MAX_LAYER 64
+
+extern struct hw_module_t HAL_MODULE_INFO_SYM;
+
+extern Display_t* findDisplay(hwc2_display_t display, bool needCheckDeinited);
+extern int32_t de2AssignLayer(Display_t *display);
+extern bool checkLayerClientCross(struct listnode *layerSortedByZorder, Layer_t *layer);
+
+/* cell[y][x] bit i is set if layer i covers the cell */
+typedef struct benchGrid {
+	bool valid;
+	int num;
+	hwc_rect_t bound;
+	int cellW;
+	int cellH;
+	Layer_t *layer[GRID_MAX_LAYER];
+	uint64_t below[GRID_MAX_LAYER];//layers with lower zorder
+	uint64_t cell[GRID_N][GRID_N];
+}benchGrid_t;
+
+typedef struct benchHal {
+	hwc2_device_t *dev;
+	hwc2_display_t disp;
+	bool connected;
+	int width;
+	int height;
+	HWC2_PFN_CREATE_LAYER createLayer;
+	HWC2_PFN_DESTROY_LAYER destroyLayer;
+	HWC2_PFN_SET_LAYER_BUFFER setBuffer;
+	HWC2_PFN_SET_LAYER_COMPOSITION_TYPE setType;
+	HWC2_PFN_SET_LAYER_SOURCE_CROP setCrop;
+	HWC2_PFN_SET_LAYER_DISPLAY_FRAME setFrame;
+	HWC2_PFN_SET_LAYER_Z_ORDER setZ;
+	HWC2_PFN_SET_LAYER_BLEND_MODE setBlend;
+	HWC2_PFN_VALIDATE_DISPLAY validate;
+	HWC2_PFN_ACCEPT_DISPLAY_CHANGES accept;
+} benchHal_t;
+
+typedef struct benchStack {
+	int num;
+	hwc2_layer_t id[GRID_MAX_LAYER];
+	Layer_t *layer[GRID_MAX_LAYER];
+	private_handle_t *buf[GRID_MAX_LAYER];
+} benchStack_t;
+
+static benchGrid_t grid;
+
+static inline int64_t benchNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static inline int gridCell(int pos, int from, int size)
+{
+	int cell = (pos - from) / size;
+
+	if (cell < 0)
+		return 0;
+	if (cell >= GRID_N)
+		return GRID_N - 1;
+	return cell;
+}
+
+/* the client target is the top of the list, it is below no layer */
+static void gridBuild(benchGrid_t *grid, struct listnode *list)
+{
+	struct listnode *node;
+	Layer_t *layer;
+	hwc_rect_t *rect;
+	int i = 0, x, y, x0, x1, y0, y1, sameZ = 0;
+
+	grid->valid = 0;
+	memset(grid->cell, 0, sizeof(grid->cell));
+	list_for_each(node, list) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET)
+			continue;
+		if (i >= GRID_MAX_LAYER)
+			return;
+		rect = &layer->frame;
+		if (i == 0) {
+			grid->bound = *rect;
+		} else {
+			grid->bound.left = std::min(grid->bound.left, rect->left);
+			grid->bound.top = std::min(grid->bound.top, rect->top);
+			grid->bound.right = std::max(grid->bound.right, rect->right);
+			grid->bound.bottom = std::max(grid->bound.bottom, rect->bottom);
+			if (layer->zorder != grid->layer[i - 1]->zorder)
+				sameZ = i;
+		}
+		grid->layer[i] = layer;
+		grid->below[i] = (1ULL << sameZ) - 1;
+		i++;
+	}
+	grid->num = i;
+	grid->cellW = (grid->bound.right - grid->bound.left + GRID_N - 1) / GRID_N;
+	grid->cellH = (grid->bound.bottom - grid->bound.top + GRID_N - 1) / GRID_N;
+	if (grid->cellW <= 0 || grid->cellH <= 0)
+		return;
+
+	for (i = 0; i < grid->num; i++) {
+		rect = &grid->layer[i]->frame;
+		if (rect->right <= rect->left || rect->bottom <= rect->top)
+			continue;
+		x0 = gridCell(rect->left, grid->bound.left, grid->cellW);
+		x1 = gridCell(rect->right - 1, grid->bound.left, grid->cellW);
+		y0 = gridCell(rect->top, grid->bound.top, grid->cellH);
+		y1 = gridCell(rect->bottom - 1, grid->bound.top, grid->cellH);
+		for (y = y0; y <= y1; y++)
+			for (x = x0; x <= x1; x++)
+				grid->cell[y][x] |= 1ULL << i;
+	}
+	grid->valid = 1;
+}
+
+/* the client layers below grid layer id which cross it */
+static bool gridClientCross(benchGrid_t *grid, int id)
+{
+	Layer_t *layer = grid->layer[id], *layer2;
+	hwc_rect_t *rect = &layer->frame;
+	int x, y, x0, x1, y0, y1, i;
+	uint64_t mask = 0;
+
+	if (!regionCrossed(&grid->bound, rect, NULL))
+		return 0;
+	x0 = gridCell(rect->left, grid->bound.left, grid->cellW);
+	x1 = gridCell(rect->right - 1, grid->bound.left, grid->cellW);
+	y0 = gridCell(rect->top, grid->bound.top, grid->cellH);
+	y1 = gridCell(rect->bottom - 1, grid->bound.top, grid->cellH);
+	for (y = y0; y <= y1; y++)
+		for (x = x0; x <= x1; x++)
+			mask |= grid->cell[y][x];
+	mask &= grid->below[id];
+	while (mask) {
+		i = __builtin_ctzll(mask);
+		mask &= mask - 1;
+		layer2 = grid->layer[i];
+		if (layer2->compositionType == HWC2_COMPOSITION_CLIENT
+				&& checkLayerCross(layer2, layer))
+			return 1;
+	}
+	return 0;
+}
+
+static int crossWalk(Display_t *dp)
+{
+	struct listnode *node;
+	Layer_t *layer;
+	int crossed = 0;
+
+	list_for_each(node, dp->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET)
+			continue;
+		crossed += checkLayerClientCross(dp->layerSortedByZorder, layer);
+	}
+	return crossed;
+}
+
+static int crossGrid(Display_t *dp)
+{
+	int crossed = 0;
+
+	gridBuild(&grid, dp->layerSortedByZorder);
+	if (!grid.valid)
+		return crossWalk(dp);
+	for (int i = 0; i < grid.num; i++)
+		crossed += gridClientCross(&grid, i);
+	return crossed;
+}
+
+static private_handle_t *bufferAlloc(int width, int height, bool contig)
+{
+	private_handle_t *handle;
+
+	handle = (private_handle_t *)calloc(1, sizeof(private_handle_t));
+	if (handle == NULL)
+		return NULL;
+	handle->version = sizeof(native_handle_t);
+	handle->numFds = 1;
+	handle->numInts = (sizeof(private_handle_t) - sizeof(native_handle_t)) / sizeof(int) - 1;
+	/* the hal only dups and closes the dma-buf, any fd does */
+	handle->share_fd = eventfd(0, EFD_CLOEXEC);
+	handle->metadata_fd = -1;
+	handle->format = HAL_PIXEL_FORMAT_RGBA_8888;
+	handle->width = width;
+	handle->height = height;
+	handle->stride = width;
+	handle->flags = contig ? SUNXI_MEM_CONTIGUOUS : 0;
+	handle->aw_byte_align[0] = 64;
+	handle->aw_byte_align[1] = 64;
+	handle->aw_byte_align[2] = 64;
+	return handle;
+}
+
+static void bufferFree(private_handle_t *handle)
+{
+	if (handle == NULL)
+		return;
+	if (handle->share_fd >= 0)
+		close(handle->share_fd);
+	free(handle);
+}
+
+static void hotplugHook(hwc2_callback_data_t data, hwc2_display_t display,
+		int32_t connection)
+{
+	benchHal_t *hal = (benchHal_t *)data;
+
+	/* the primary is the first display called back */
+	if (hal->connected && hal->disp != display)
+		return;
+	hal->disp = display;
+	hal->connected = connection == HWC2_CONNECTION_CONNECTED;
+}
+
+#define GET_FUNC(pfn, desc) \
+	(pfn = reinterpret_cast<decltype(pfn)>(hal->dev->getFunction(hal->dev, desc)))
+
+static int halOpen(benchHal_t *hal)
+{
+	HWC2_PFN_REGISTER_CALLBACK registerCallback;
+	HWC2_PFN_SET_POWER_MODE setPowerMode;
+	HWC2_PFN_GET_DISPLAY_ATTRIBUTE getAttribute;
+	HWC2_PFN_GET_ACTIVE_CONFIG getActiveConfig;
+	hw_device_t *device;
+	hwc2_config_t config;
+
+	if (HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM,
+			HWC_HARDWARE_COMPOSER, &device)) {
+		fprintf(stderr, "open hwc err\n");
+		return -1;
+	}
+	hal->dev = (hwc2_device_t *)device;
+	if (!GET_FUNC(registerCallback, HWC2_FUNCTION_REGISTER_CALLBACK)
+			|| !GET_FUNC(setPowerMode, HWC2_FUNCTION_SET_POWER_MODE)
+			|| !GET_FUNC(getAttribute, HWC2_FUNCTION_GET_DISPLAY_ATTRIBUTE)
+			|| !GET_FUNC(getActiveConfig, HWC2_FUNCTION_GET_ACTIVE_CONFIG)
+			|| !GET_FUNC(hal->createLayer, HWC2_FUNCTION_CREATE_LAYER)
+			|| !GET_FUNC(hal->destroyLayer, HWC2_FUNCTION_DESTROY_LAYER)
+			|| !GET_FUNC(hal->setBuffer, HWC2_FUNCTION_SET_LAYER_BUFFER)
+			|| !GET_FUNC(hal->setType, HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE)
+			|| !GET_FUNC(hal->setCrop, HWC2_FUNCTION_SET_LAYER_SOURCE_CROP)
+			|| !GET_FUNC(hal->setFrame, HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME)
+			|| !GET_FUNC(hal->setZ, HWC2_FUNCTION_SET_LAYER_Z_ORDER)
+			|| !GET_FUNC(hal->setBlend, HWC2_FUNCTION_SET_LAYER_BLEND_MODE)
+			|| !GET_FUNC(hal->validate, HWC2_FUNCTION_VALIDATE_DISPLAY)
+			|| !GET_FUNC(hal->accept, HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES)) {
+		fprintf(stderr, "hwc function missing\n");
+		return -1;
+	}
+
+	registerCallback(hal->dev, HWC2_CALLBACK_HOTPLUG, hal,
+		reinterpret_cast<hwc2_function_pointer_t>(hotplugHook));
+	if (!hal->connected) {
+		fprintf(stderr, "no primary display\n");
+		return -1;
+	}
+	setPowerMode(hal->dev, hal->disp, HWC2_POWER_MODE_ON);
+	getActiveConfig(hal->dev, hal->disp, &config);
+	getAttribute(hal->dev, hal->disp, config, HWC2_ATTRIBUTE_WIDTH, &hal->width);
+	getAttribute(hal->dev, hal->disp, config, HWC2_ATTRIBUTE_HEIGHT, &hal->height);
+	return 0;
+}
+
+/* the layers of the model of 584f6b5, seeded by their number */
+static int stackCreate(benchHal_t *hal, Display_t *dp, benchStack_t *stack,
+		int num, bool tiles)
+{
+	std::mt19937 random(num);
+	hwc_rect_t frame;
+	hwc_frect_t crop;
+	uint32_t types, reqs;
+	int w, h;
+
+	memset(stack, 0, sizeof(*stack));
+	for (int i = 0; i < num; i++) {
+		if (hal->createLayer(hal->dev, hal->disp, &stack->id[i]) != HWC2_ERROR_NONE)
+			return -1;
+		stack->num++;
+		stack->layer[i] = layerTableFind(&dp->layerTable, stack->id[i]);
+		w = tiles ? 64 + random() % 256 : hal->width / 2 + random() % (hal->width / 2);
+		h = tiles ? 64 + random() % 256 : hal->height / 2 + random() % (hal->height / 2);
+		frame.left = random() % (hal->width - w);
+		frame.top = random() % (hal->height - h);
+		frame.right = frame.left + w;
+		frame.bottom = frame.top + h;
+		crop.left = 0;
+		crop.top = 0;
+		crop.right = w;
+		crop.bottom = h;
+		stack->buf[i] = bufferAlloc(w, h, i % 4 != 3);
+		hal->setBuffer(hal->dev, hal->disp, stack->id[i], stack->buf[i], -1);
+		hal->setType(hal->dev, hal->disp, stack->id[i], HWC2_COMPOSITION_DEVICE);
+		hal->setCrop(hal->dev, hal->disp, stack->id[i], crop);
+		hal->setFrame(hal->dev, hal->disp, stack->id[i], frame);
+		hal->setZ(hal->dev, hal->disp, stack->id[i], i + 1);
+		hal->setBlend(hal->dev, hal->disp, stack->id[i], HWC2_BLEND_MODE_PREMULTIPLIED);
+	}
+	/* once through the hal, it sorts the list and adds the client target */
+	hal->validate(hal->dev, hal->disp, &types, &reqs);
+	hal->accept(hal->dev, hal->disp);
+	return 0;
+}
+
+static void stackDestroy(benchHal_t *hal, benchStack_t *stack)
+{
+	for (int i = 0; i < stack->num; i++) {
+		hal->destroyLayer(hal->dev, hal->disp, stack->id[i]);
+		bufferFree(stack->buf[i]);
+	}
+	stack->num = 0;
+}
+
+static int stackClient(benchStack_t *stack)
+{
+	int client = 0;
+
+	for (int i = 0; i < stack->num; i++)
+		client += stack->layer[i]->compositionType == HWC2_COMPOSITION_CLIENT;
+	return client;
+}
+
+static void benchStack(benchHal_t *hal, Display_t *dp, int num, bool tiles, int frames)
+{
+	benchStack_t stack;
+	int64_t begin, assign, walk, gridTime;
+	int crossed = 0, check = 0, move = 1, f;
+	Layer_t *first;
+
+	if (stackCreate(hal, dp, &stack, num, tiles)) {
+		fprintf(stderr, "create %d layers err\n", num);
+		stackDestroy(hal, &stack);
+		return;
+	}
+
+	/*
+	 * a frame as surfaceflinger requests it: every layer device again,
+	 * and a pixel move of the bottom layer that misses the assign cache.
+	 * nothing is presented, which showfps takes for a slow display.
+	 */
+	first = stack.layer[0];
+	begin = benchNow();
+	for (f = 0; f < frames; f++) {
+		for (int i = 0; i < stack.num; i++)
+			stack.layer[i]->compositionType = HWC2_COMPOSITION_DEVICE;
+		first->frame.left += move;
+		first->frame.right += move;
+		move = -move;
+		dp->forceClient = 0;
+		de2AssignLayer(dp);
+	}
+	assign = benchNow() - begin;
+
+	begin = benchNow();
+	for (f = 0; f < frames; f++)
+		crossed += crossWalk(dp);
+	walk = benchNow() - begin;
+
+	begin = benchNow();
+	for (f = 0; f < frames; f++)
+		check += crossGrid(dp);
+	gridTime = benchNow() - begin;
+
+	printf("%-8s %2d client:%2d assign:%7.0f walk:%6.0f grid:%6.0f ns/frame%s\n",
+		tiles ? "tiles" : "stacked", num, stackClient(&stack),
+		(double)assign / frames, (double)walk / frames,
+		(double)gridTime / frames, crossed == check ? "" : " grid and walk disagree");
+	stackDestroy(hal, &stack);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s WxH] [-n frames]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	static const int num[] = {20, 32, 64};
+	benchHal_t hal;
+	Display_t *dp;
+	int frames = 100000, width, height, i;
+
+	for (i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (!strcmp(argv[i], "-s") && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+			fakeDispSetLcd(width, height);
+		} else if (!strcmp(argv[i], "-n") && atoi(argv[i + 1]) > 0) {
+			frames = atoi(argv[i + 1]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	memset(&hal, 0, sizeof(hal));
+	if (halOpen(&hal))
+		return 1;
+	dp = findDisplay(hal.disp, true);
+	if (dp == NULL) {
+		fprintf(stderr, "no display %d\n", (int)hal.disp);
+		return 1;
+	}
+	for (int tiles = 1; tiles >= 0; tiles--)
+		for (i = 0; i < (int)(sizeof(num) / sizeof(num[0])); i++)
+			benchStack(&hal, dp, num[i], tiles, frames);
+
+	/* hal_exit joins the event thread, which waits for a uevent forever here */
+	fflush(stdout);
+	_exit(0);
+}
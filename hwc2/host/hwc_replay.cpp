@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * host replay of the layer stack traces of debug.cpp through the hal,
+ * against the fake /dev/disp of fake_disp.cpp. each block of display 0
+ * is a frame as surfaceflinger sends it: the layers are created or
+ * destroyed to the traced number, set from their L lines, validated,
+ * accepted and presented. the blocks of the other displays are skipped.
+ * for each trace:
+ *   validate/present: the cpu time of the calls, avg/p50/p99/max
+ *   malloc:           the heap allocations made in the calls, a frame
+ *   client:           the layers left to the gpu, and the layers of which
+ *                     the result is not the traced one
+ *
+ * hwc_replay [-s WxH] [-n loops] [-p key=value]... trace...
+ */
+
+#include "../hwc.h"
+#include "fake_disp.h"
+
+#include <time.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <vector>
+
+#define REPLAY_BUF_N 3
+#define REPLAY_FENCE_MS 1000
+
+extern struct hw_module_t HAL_MODULE_INFO_SYM;
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t n, size_t size);
+extern "C" void *__real_realloc(void *ptr, size_t size);
+
+/* the allocations of the replay thread while allocCount is set */
+static __thread bool allocCount;
+static __thread long long allocCalls;
+static __thread long long allocBytes;
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+	if (allocCount) {
+		allocCalls++;
+		allocBytes += size;
+	}
+	return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t n, size_t size)
+{
+	if (allocCount) {
+		allocCalls++;
+		allocBytes += n * size;
+	}
+	return __real_calloc(n, size);
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size)
+{
+	if (allocCount) {
+		allocCalls++;
+		allocBytes += size;
+	}
+	return __real_realloc(ptr, size);
+}
+
+typedef struct replayLayer {
+	int type;
+	int typeChange;
+	int dueto;
+	int format;
+	int width;
+	int height;
+	int stride;
+	hwc_frect_t crop;
+	hwc_rect_t frame;
+	int transform;
+	int blend;
+	float alpha;
+	int dataspace;
+	int damaged;
+} replayLayer_t;
+
+typedef struct replayFrame {
+	std::vector<replayLayer_t> layer;
+} replayFrame_t;
+
+/* the buffers surfaceflinger queues on a layer, the next one on damage */
+typedef struct replaySlot {
+	hwc2_layer_t id;
+	int format;
+	int width;
+	int height;
+	int stride;
+	int contig;
+	int next;
+	private_handle_t *buf[REPLAY_BUF_N];
+} replaySlot_t;
+
+typedef struct replayStat {
+	std::vector<int64_t> validate;
+	std::vector<int64_t> present;
+	long long validateCalls;
+	long long validateBytes;
+	long long presentCalls;
+	long long presentBytes;
+	long long layers;
+	long long client;
+	long long clientFrames;
+	long long differ;
+	long long timeout;
+	int frames;
+	int skipped;
+} replayStat_t;
+
+typedef struct replayHal {
+	hwc2_device_t *dev;
+	hwc2_display_t disp;
+	bool connected;
+	int width;
+	int height;
+	HWC2_PFN_CREATE_LAYER createLayer;
+	HWC2_PFN_DESTROY_LAYER destroyLayer;
+	HWC2_PFN_SET_LAYER_BUFFER setBuffer;
+	HWC2_PFN_SET_LAYER_COMPOSITION_TYPE setType;
+	HWC2_PFN_SET_LAYER_SOURCE_CROP setCrop;
+	HWC2_PFN_SET_LAYER_DISPLAY_FRAME setFrame;
+	HWC2_PFN_SET_LAYER_Z_ORDER setZ;
+	HWC2_PFN_SET_LAYER_TRANSFORM setTransform;
+	HWC2_PFN_SET_LAYER_BLEND_MODE setBlend;
+	HWC2_PFN_SET_LAYER_PLANE_ALPHA setAlpha;
+	HWC2_PFN_SET_LAYER_DATASPACE setDataspace;
+	HWC2_PFN_SET_LAYER_SURFACE_DAMAGE setDamage;
+	HWC2_PFN_SET_CLIENT_TARGET setClientTarget;
+	HWC2_PFN_VALIDATE_DISPLAY validate;
+	HWC2_PFN_GET_CHANGED_COMPOSITION_TYPES getChanged;
+	HWC2_PFN_ACCEPT_DISPLAY_CHANGES accept;
+	HWC2_PFN_PRESENT_DISPLAY present;
+	HWC2_PFN_GET_RELEASE_FENCES getReleaseFences;
+	std::vector<replaySlot_t> slot;
+	private_handle_t *target[REPLAY_BUF_N];
+	int targetNext;
+	long long bufId;
+} replayHal_t;
+
+static int64_t cpuNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static private_handle_t *bufferAlloc(replayHal_t *hal, int format, int width,
+		int height, int stride, int contig)
+{
+	private_handle_t *handle;
+
+	handle = (private_handle_t *)calloc(1, sizeof(private_handle_t));
+	if (handle == NULL)
+		return NULL;
+	handle->version = sizeof(native_handle_t);
+	handle->numFds = 1;
+	handle->numInts = (sizeof(private_handle_t) - sizeof(native_handle_t)) / sizeof(int) - 1;
+	/* the hal only dups and closes the dma-buf, any fd does */
+	handle->share_fd = eventfd(0, EFD_CLOEXEC);
+	handle->metadata_fd = -1;
+	handle->format = format;
+	handle->width = width;
+	handle->height = height;
+	handle->stride = stride;
+	handle->flags = contig ? SUNXI_MEM_CONTIGUOUS : 0;
+	handle->aw_byte_align[0] = 64;
+	handle->aw_byte_align[1] = 64;
+	handle->aw_byte_align[2] = 64;
+	handle->aw_buf_id = ++hal->bufId;
+	return handle;
+}
+
+static void bufferFree(private_handle_t *handle)
+{
+	if (handle == NULL)
+		return;
+	if (handle->share_fd >= 0)
+		close(handle->share_fd);
+	free(handle);
+}
+
+static void slotFree(replaySlot_t *slot)
+{
+	for (int i = 0; i < REPLAY_BUF_N; i++) {
+		bufferFree(slot->buf[i]);
+		slot->buf[i] = NULL;
+	}
+}
+
+/* the buffer of the slot for this frame, reallocated on a new geometry */
+static buffer_handle_t slotBuffer(replayHal_t *hal, replaySlot_t *slot,
+		const replayLayer_t *ly)
+{
+	int contig = ly->dueto != NOCONTIG_MEM;
+
+	if (ly->format == 0 || ly->width == 0 || ly->height == 0)
+		return NULL;
+	if (slot->format != ly->format || slot->width != ly->width
+			|| slot->height != ly->height || slot->stride != ly->stride
+			|| slot->contig != contig || slot->buf[0] == NULL) {
+		slotFree(slot);
+		slot->format = ly->format;
+		slot->width = ly->width;
+		slot->height = ly->height;
+		slot->stride = ly->stride;
+		slot->contig = contig;
+		for (int i = 0; i < REPLAY_BUF_N; i++)
+			slot->buf[i] = bufferAlloc(hal, ly->format, ly->width,
+				ly->height, ly->stride, contig);
+		slot->next = 0;
+	} else if (ly->damaged) {
+		slot->next = (slot->next + 1) % REPLAY_BUF_N;
+	}
+	return slot->buf[slot->next];
+}
+
+static void hotplugHook(hwc2_callback_data_t data, hwc2_display_t display,
+		int32_t connection)
+{
+	replayHal_t *hal = (replayHal_t *)data;
+
+	/* the primary is the first display called back */
+	if (hal->connected && hal->disp != display)
+		return;
+	hal->disp = display;
+	hal->connected = connection == HWC2_CONNECTION_CONNECTED;
+}
+
+#define GET_FUNC(pfn, desc) \
+	(pfn = reinterpret_cast<decltype(pfn)>(hal->dev->getFunction(hal->dev, desc)))
+
+static int halOpen(replayHal_t *hal)
+{
+	HWC2_PFN_REGISTER_CALLBACK registerCallback;
+	HWC2_PFN_SET_POWER_MODE setPowerMode;
+	HWC2_PFN_GET_DISPLAY_ATTRIBUTE getAttribute;
+	HWC2_PFN_GET_ACTIVE_CONFIG getActiveConfig;
+	hw_device_t *device;
+	hwc2_config_t config;
+
+	if (HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM,
+			HWC_HARDWARE_COMPOSER, &device)) {
+		fprintf(stderr, "open hwc err\n");
+		return -1;
+	}
+	hal->dev = (hwc2_device_t *)device;
+	if (!GET_FUNC(registerCallback, HWC2_FUNCTION_REGISTER_CALLBACK)
+			|| !GET_FUNC(setPowerMode, HWC2_FUNCTION_SET_POWER_MODE)
+			|| !GET_FUNC(getAttribute, HWC2_FUNCTION_GET_DISPLAY_ATTRIBUTE)
+			|| !GET_FUNC(getActiveConfig, HWC2_FUNCTION_GET_ACTIVE_CONFIG)
+			|| !GET_FUNC(hal->createLayer, HWC2_FUNCTION_CREATE_LAYER)
+			|| !GET_FUNC(hal->destroyLayer, HWC2_FUNCTION_DESTROY_LAYER)
+			|| !GET_FUNC(hal->setBuffer, HWC2_FUNCTION_SET_LAYER_BUFFER)
+			|| !GET_FUNC(hal->setType, HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE)
+			|| !GET_FUNC(hal->setCrop, HWC2_FUNCTION_SET_LAYER_SOURCE_CROP)
+			|| !GET_FUNC(hal->setFrame, HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME)
+			|| !GET_FUNC(hal->setZ, HWC2_FUNCTION_SET_LAYER_Z_ORDER)
+			|| !GET_FUNC(hal->setTransform, HWC2_FUNCTION_SET_LAYER_TRANSFORM)
+			|| !GET_FUNC(hal->setBlend, HWC2_FUNCTION_SET_LAYER_BLEND_MODE)
+			|| !GET_FUNC(hal->setAlpha, HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA)
+			|| !GET_FUNC(hal->setDataspace, HWC2_FUNCTION_SET_LAYER_DATASPACE)
+			|| !GET_FUNC(hal->setDamage, HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE)
+			|| !GET_FUNC(hal->setClientTarget, HWC2_FUNCTION_SET_CLIENT_TARGET)
+			|| !GET_FUNC(hal->validate, HWC2_FUNCTION_VALIDATE_DISPLAY)
+			|| !GET_FUNC(hal->getChanged, HWC2_FUNCTION_GET_CHANGED_COMPOSITION_TYPES)
+			|| !GET_FUNC(hal->accept, HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES)
+			|| !GET_FUNC(hal->present, HWC2_FUNCTION_PRESENT_DISPLAY)
+			|| !GET_FUNC(hal->getReleaseFences, HWC2_FUNCTION_GET_RELEASE_FENCES)) {
+		fprintf(stderr, "hwc function missing\n");
+		return -1;
+	}
+
+	registerCallback(hal->dev, HWC2_CALLBACK_HOTPLUG, hal,
+		reinterpret_cast<hwc2_function_pointer_t>(hotplugHook));
+	if (!hal->connected) {
+		fprintf(stderr, "no primary display\n");
+		return -1;
+	}
+	setPowerMode(hal->dev, hal->disp, HWC2_POWER_MODE_ON);
+	getActiveConfig(hal->dev, hal->disp, &config);
+	getAttribute(hal->dev, hal->disp, config, HWC2_ATTRIBUTE_WIDTH, &hal->width);
+	getAttribute(hal->dev, hal->disp, config, HWC2_ATTRIBUTE_HEIGHT, &hal->height);
+	for (int i = 0; i < REPLAY_BUF_N; i++)
+		hal->target[i] = bufferAlloc(hal, HAL_PIXEL_FORMAT_RGBA_8888,
+			hal->width, hal->height, hal->width, 1);
+	return 0;
+}
+
+/* the layers to the traced number, as surfaceflinger creates and destroys */
+static void layerResize(replayHal_t *hal, size_t num)
+{
+	replaySlot_t slot;
+
+	while (hal->slot.size() < num) {
+		memset(&slot, 0, sizeof(slot));
+		if (hal->createLayer(hal->dev, hal->disp, &slot.id) != HWC2_ERROR_NONE)
+			return;
+		hal->slot.push_back(slot);
+	}
+	while (hal->slot.size() > num) {
+		hal->destroyLayer(hal->dev, hal->disp, hal->slot.back().id);
+		slotFree(&hal->slot.back());
+		hal->slot.pop_back();
+	}
+}
+
+static void layerSet(replayHal_t *hal, replaySlot_t *slot,
+		const replayLayer_t *ly, uint32_t z)
+{
+	hwc_rect_t empty = {0, 0, 0, 0};
+	hwc_region_t damage;
+	int32_t type;
+
+	type = ly->typeChange ? HWC2_COMPOSITION_DEVICE : ly->type;
+	if (type == HWC2_COMPOSITION_CURSOR || type == HWC2_COMPOSITION_SIDEBAND)
+		type = HWC2_COMPOSITION_DEVICE;
+	/* no rect is all damaged, one empty rect is none */
+	damage.numRects = ly->damaged ? 0 : 1;
+	damage.rects = ly->damaged ? NULL : &empty;
+
+	hal->setBuffer(hal->dev, hal->disp, slot->id, slotBuffer(hal, slot, ly), -1);
+	hal->setType(hal->dev, hal->disp, slot->id, type);
+	hal->setCrop(hal->dev, hal->disp, slot->id, ly->crop);
+	hal->setFrame(hal->dev, hal->disp, slot->id, ly->frame);
+	hal->setZ(hal->dev, hal->disp, slot->id, z);
+	hal->setTransform(hal->dev, hal->disp, slot->id, ly->transform);
+	hal->setBlend(hal->dev, hal->disp, slot->id, ly->blend);
+	hal->setAlpha(hal->dev, hal->disp, slot->id, ly->alpha);
+	hal->setDataspace(hal->dev, hal->disp, slot->id, ly->dataspace);
+	hal->setDamage(hal->dev, hal->disp, slot->id, damage);
+}
+
+static void frameReplay(replayHal_t *hal, const replayFrame_t *frame,
+		replayStat_t *stat)
+{
+	std::vector<hwc2_layer_t> ids;
+	std::vector<int32_t> types;
+	hwc_region_t damage = {0, NULL};
+	uint32_t numTypes, numRequests, num;
+	int32_t retire = -1, ret;
+	int64_t begin;
+	int client;
+	size_t i, j;
+
+	layerResize(hal, frame->layer.size());
+	for (i = 0; i < hal->slot.size(); i++)
+		layerSet(hal, &hal->slot[i], &frame->layer[i], i + 1);
+
+	allocCalls = 0;
+	allocBytes = 0;
+	allocCount = true;
+	begin = cpuNow();
+	ret = hal->validate(hal->dev, hal->disp, &numTypes, &numRequests);
+	stat->validate.push_back(cpuNow() - begin);
+	allocCount = false;
+	stat->validateCalls += allocCalls;
+	stat->validateBytes += allocBytes;
+
+	for (i = 0; i < hal->slot.size(); i++)
+		types.push_back(frame->layer[i].typeChange ? HWC2_COMPOSITION_DEVICE
+			: frame->layer[i].type);
+	if (ret == HWC2_ERROR_HAS_CHANGES && numTypes > 0) {
+		num = numTypes;
+		ids.resize(num);
+		std::vector<int32_t> changed(num);
+		hal->getChanged(hal->dev, hal->disp, &num, ids.data(), changed.data());
+		for (j = 0; j < num; j++) {
+			for (i = 0; i < hal->slot.size(); i++) {
+				if (hal->slot[i].id == ids[j])
+					types[i] = changed[j];
+			}
+		}
+	}
+	hal->accept(hal->dev, hal->disp);
+
+	client = 0;
+	for (i = 0; i < hal->slot.size(); i++) {
+		if (types[i] == HWC2_COMPOSITION_CLIENT)
+			client++;
+		if (types[i] != frame->layer[i].type)
+			stat->differ++;
+	}
+	stat->layers += hal->slot.size();
+	stat->client += client;
+	stat->clientFrames += client > 0;
+	if (client > 0) {
+		hal->targetNext = (hal->targetNext + 1) % REPLAY_BUF_N;
+		hal->setClientTarget(hal->dev, hal->disp,
+			(buffer_handle_t)hal->target[hal->targetNext], -1,
+			HAL_DATASPACE_UNKNOWN, damage);
+	}
+
+	allocCalls = 0;
+	allocBytes = 0;
+	allocCount = true;
+	begin = cpuNow();
+	hal->present(hal->dev, hal->disp, &retire);
+	stat->present.push_back(cpuNow() - begin);
+	allocCount = false;
+	stat->presentCalls += allocCalls;
+	stat->presentBytes += allocBytes;
+
+	num = 0;
+	hal->getReleaseFences(hal->dev, hal->disp, &num, NULL, NULL);
+	if (num > 0) {
+		std::vector<hwc2_layer_t> layers(num);
+		std::vector<int32_t> fences(num);
+		hal->getReleaseFences(hal->dev, hal->disp, &num, layers.data(), fences.data());
+		for (j = 0; j < num; j++) {
+			if (fences[j] >= 0)
+				close(fences[j]);
+		}
+	}
+	/* as surfaceflinger, the next frame waits for this one on screen */
+	if (retire >= 0) {
+		if (sync_wait(retire, REPLAY_FENCE_MS))
+			stat->timeout++;
+		close(retire);
+	}
+	stat->frames++;
+}
+
+static int traceLoad(const char *path, std::vector<replayFrame_t> &frames, int *skipped)
+{
+	replayFrame_t *frame = NULL;
+	replayLayer_t ly;
+	int id, n, z;
+	char line[512];
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == 'F') {
+			frame = NULL;
+			if (sscanf(line, "F %d", &id) != 1)
+				continue;
+			if (id != 0) {
+				(*skipped)++;
+				continue;
+			}
+			frames.push_back(replayFrame_t());
+			frame = &frames.back();
+		} else if (line[0] == 'L' && frame != NULL) {
+			n = sscanf(line, "L %d %d %d %d %d %d %d %d %f %f %f %f %d %d %d %d %d %d %f %d %d",
+				&z, &ly.type, &ly.typeChange, &ly.dueto, &ly.format,
+				&ly.width, &ly.height, &ly.stride,
+				&ly.crop.left, &ly.crop.top, &ly.crop.right, &ly.crop.bottom,
+				&ly.frame.left, &ly.frame.top, &ly.frame.right, &ly.frame.bottom,
+				&ly.transform, &ly.blend, &ly.alpha, &ly.dataspace, &ly.damaged);
+			if (n != 21 || ly.type == HWC2_COMPOSITION_CLIENT_TARGET)
+				continue;
+			frame->layer.push_back(ly);
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static void statLine(const char *name, std::vector<int64_t> &v)
+{
+	int64_t sum = 0;
+	size_t n = v.size();
+
+	if (n == 0)
+		return;
+	std::sort(v.begin(), v.end());
+	for (size_t i = 0; i < n; i++)
+		sum += v[i];
+	printf("  %s(us cpu) avg:%.1f p50:%.1f p99:%.1f max:%.1f\n", name,
+		sum / 1000.0 / n, v[n / 2] / 1000.0, v[n * 99 / 100] / 1000.0,
+		v[n - 1] / 1000.0);
+}
+
+static void traceReport(const char *path, replayStat_t *stat,
+		fakeDispStat_t *before, fakeDispStat_t *after)
+{
+	unsigned int commits = after->commits - before->commits;
+	double frames = stat->frames ? stat->frames : 1;
+
+	printf("%s disp0 frames:%d layers/frame:%.1f skipped:%d\n", path,
+		stat->frames, stat->layers / frames, stat->skipped);
+	statLine("validate", stat->validate);
+	statLine("present", stat->present);
+	printf("  malloc/frame validate:%.1f (%.0f bytes) present:%.1f (%.0f bytes)\n",
+		stat->validateCalls / frames, stat->validateBytes / frames,
+		stat->presentCalls / frames, stat->presentBytes / frames);
+	printf("  client layers:%lld/%lld (%.1f%%) frames:%lld/%d (%.1f%%)\n",
+		stat->client, stat->layers,
+		stat->layers ? 100.0 * stat->client / stat->layers : 0.0,
+		stat->clientFrames, stat->frames, 100.0 * stat->clientFrames / frames);
+	printf("  not the traced result:%lld/%lld layers\n", stat->differ, stat->layers);
+	printf("  commits:%u layers/commit:%.1f retire timeouts:%lld\n", commits,
+		commits ? (double)(after->layers - before->layers) / commits : 0.0,
+		stat->timeout);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s WxH] [-n loops] [-p key=value]... trace...\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<replayFrame_t> frames;
+	fakeDispStat_t before, after;
+	replayStat_t stat;
+	replayHal_t hal;
+	int loops = 1, width, height, i;
+	char *value;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (!strcmp(argv[i], "-s") && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+			fakeDispSetLcd(width, height);
+		} else if (!strcmp(argv[i], "-n") && atoi(argv[i + 1]) > 0) {
+			loops = atoi(argv[i + 1]);
+		} else if (!strcmp(argv[i], "-p") && (value = strchr(argv[i + 1], '=')) != NULL) {
+			*value++ = 0;
+			fakePropertySet(argv[i + 1], value);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+		i++;
+	}
+	if (i >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(hal.target, 0, sizeof(hal.target));
+	hal.connected = false;
+	hal.targetNext = 0;
+	hal.bufId = 0;
+	if (halOpen(&hal))
+		return 1;
+
+	for (; i < argc; i++) {
+		frames.clear();
+		stat = replayStat_t();
+		if (traceLoad(argv[i], frames, &stat.skipped)) {
+			fprintf(stderr, "open %s err %d\n", argv[i], errno);
+			return 1;
+		}
+		fakeDispGetStat(0, &before);
+		for (int loop = 0; loop < loops; loop++) {
+			for (size_t f = 0; f < frames.size(); f++)
+				frameReplay(&hal, &frames[f], &stat);
+		}
+		fakeDispGetStat(0, &after);
+		layerResize(&hal, 0);
+		traceReport(argv[i], &stat, &before, &after);
+	}
+	/* hal_exit joins the event thread, which waits for a uevent forever here */
+	fflush(stdout);
+	_exit(0);
+}
@@ -37,6 +37,8 @@ enum class Hdr : int32_t {
 
 static int numberDisplay;
 Display_t **mDisplay;
+/* indexed by toClientId, the client id does not change after platform_init */
+static Display_t *clientDisplay[4];
 static int socketpair_fd[2];
 
 int primary_disp;
@@ -177,17 +179,16 @@ Display_t* findHwDisplay(int hwid)
 
 Display_t* findDisplay(hwc2_display_t display, bool needCheckDeinited = true)
 {
-    for (int i = 0; i < numberDisplay; i++) {
-        if(mDisplay[i]->clientId == display) {
-            if (needCheckDeinited && mDisplay[i] != NULL && mDisplay[i]->deinited) {
-                ALOGD("%s:display %d has been plug out and deinited", __FUNCTION__, i);
-                return NULL;
-            } else {
-                return mDisplay[i];
-            }
-        }
-    }
-    return NULL;
+	Display_t *dp = clientDisplay[toClientId(display)];
+
+	if (dp == NULL || dp->clientId != display)
+		return NULL;
+	if (needCheckDeinited && dp->deinited) {
+		ALOGD("%s:display %d has been plug out and deinited",
+			__FUNCTION__, (int)toClientId(display));
+		return NULL;
+	}
+	return dp;
 }
 
 int hwc_set_primary(int hwid,bool wait)
@@ -309,16 +310,20 @@ int32_t hwc_create_layer(hwc2_device_t* device, hwc2_display_t display, hwc2_lay
         return HWC2_ERROR_NO_RESOURCES;
     }
 
-    *outLayer = (hwc2_layer_t)layer;
-    addLayerRecord(display, (hwc2_layer_t)layer);
+	pthread_mutex_lock(&dp->listMutex);
+	*outLayer = layerTableAdd(&dp->layerTable, layer);
+	pthread_mutex_unlock(&dp->listMutex);
+	if (*outLayer == 0) {
+		layerCachePut(layer);
+		return HWC2_ERROR_NO_RESOURCES;
+	}
 
 	return HWC2_ERROR_NONE;
 }
 
 int32_t hwc_destroy_layer(hwc2_device_t* device, hwc2_display_t display, hwc2_layer_t layer)
 {
-
-    Layer_t* ly = (Layer*)layer;
+    Layer_t* ly;
     Display_t *dp = findDisplay(display);
 	unusedpara(device);
 
@@ -327,16 +332,17 @@ int32_t hwc_destroy_layer(hwc2_device_t* device, hwc2_display_t display, hwc2_la
         return HWC2_ERROR_BAD_DISPLAY;
     }
 
-    if (!removeLayerRecord(display, layer)) {
-        // Not a active layer
-        return HWC2_ERROR_BAD_LAYER;
-    }
-
 	pthread_mutex_lock(&dp->listMutex);
-	if (deletLayerByZorder(ly, dp->layerSortedByZorder)) {
-		dp->nubmerLayer--;
-    	layerCachePut(ly);
+	/* the layers of a display deinit on a hotplug are freed already */
+	ly = layerTableRemove(&dp->layerTable, layer);
+	if (ly == NULL) {
+		pthread_mutex_unlock(&dp->listMutex);
+		return dp->plugIn ? HWC2_ERROR_BAD_LAYER : HWC2_ERROR_NO_RESOURCES;
 	}
+	/* a layer never got a zorder is not in the list */
+	if (deletLayerByZorder(ly, dp->layerSortedByZorder))
+		dp->nubmerLayer--;
+	layerCachePut(ly);
 	pthread_mutex_unlock(&dp->listMutex);
 	if (!dp->plugIn) {
 		/* fix android comper 2.1 hotplug remove the display' s bug  */
@@ -394,7 +400,7 @@ int32_t hwc_get_changed_composition_types(hwc2_device_t* device, hwc2_display_t
 		list_for_each(node, list) {
 			ly = node_to_item(node, Layer_t, node);
 			if(ly != NULL && ly->typeChange && ly->compositionType != HWC2_COMPOSITION_CLIENT_TARGET){
-				*outLayers = (hwc2_layer_t)ly;
+				*outLayers = ly->id;
 				outLayers++;
 				*outTypes = ly->compositionType;
 				outTypes++;
@@ -574,7 +580,7 @@ int32_t hwc_get_display_requests(hwc2_device_t* device, hwc2_display_t display,
             if (!ly->clearClientTarget){
                 continue;
             }
-            *outLayers = (hwc2_layer_t)ly;
+            *outLayers = ly->id;
             outLayers++;
             *outLayerRequests = HWC2_LAYER_REQUEST_CLEAR_CLIENT_TARGET;
             outLayerRequests++;
@@ -667,7 +673,7 @@ int32_t hwc_get_release_fences(hwc2_device_t* device, hwc2_display_t display,
 			if(ly->compositionType == HWC2_COMPOSITION_CLIENT_TARGET){
 				continue;
 			}
-			*outLayers = (hwc2_layer_t)ly;
+			*outLayers = ly->id;
 			outLayers++;
 
 			ALOGV("%s: frame:%d, ID=%d, layer=%p, Fence=%d", __FUNCTION__, dp->frameCount-1, dp->displayId, ly, ly->preReleaseFence);
@@ -687,6 +693,55 @@ int32_t hwc_get_release_fences(hwc2_device_t* device, hwc2_display_t display,
 	return HWC2_ERROR_NONE;
 }
 
+/* must hold listMutex */
+static inline void sortLayerList(Display_t *dp)
+{
+	if (!dp->zorderDirty)
+		return;
+	sortLayerByZorder(dp->layerSortedByZorder);
+	dp->zorderDirty = 0;
+}
+
+/*
+ * the display already shows this frame if the layer state, the buffers
+ * and their content are all the same as the last committed frame.
+ */
+static bool frameUnchanged(Display_t *dp, uint64_t sign)
+{
+	struct listnode *node;
+	Layer_t *layer;
+
+	if (!dp->presentValid || dp->presentSign != sign || dp->retirfence < 0)
+		return false;
+#ifdef COMPOSER_READBACK
+	/* the readback is taken from a committed frame */
+	if (toClientId(dp->clientId) == HWC_DISPLAY_PRIMARY && readbackPending())
+		return false;
+#endif
+	list_for_each(node, dp->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET
+				&& !dp->needclientTarget)
+			continue;
+		if (layer->damaged || layer->buffer != layer->lastBuffer)
+			return false;
+	}
+	return true;
+}
+
+static void framePresented(Display_t *dp, uint64_t sign)
+{
+	struct listnode *node;
+	Layer_t *layer;
+
+	list_for_each(node, dp->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		layer->lastBuffer = layer->buffer;
+	}
+	dp->presentSign = sign;
+	dp->presentValid = 1;
+}
+
 void releasAllFence(Display_t* dp) {
 	Layer_t *layer;
 	struct listnode *node;
@@ -719,6 +774,8 @@ int32_t hwc_present_display(hwc2_device_t* device, hwc2_display_t display,
 	struct listnode *node;
 	unusedpara(device);
 	struct sync_info sync;
+	uint64_t sign;
+	int dropped = 0;
 #ifdef ENABLE_WRITEBACK
 	Display_t* de0 = findHwDisplay(0);
 	Display_t* de1 = findHwDisplay(1);
@@ -735,11 +792,10 @@ int32_t hwc_present_display(hwc2_device_t* device, hwc2_display_t display,
 
 	dp->active = 1;
 	dispOpr = dp->displayOpration;
+	frameTimeMark(dp, dp->frameCount, FRAME_PRESENT);
 
 #ifdef TARGET_PLATFORM_HOMLET
-	struct listnode *node1, *node2;
 	int cachedNum = 0;
-	submitThread_t *myThread = dp->commitThread;
 
 	if (dp->hwPlug == -1) {
 		ALOGD("%s:send buf without hw plug in", __FUNCTION__);
@@ -748,13 +804,9 @@ int32_t hwc_present_display(hwc2_device_t* device, hwc2_display_t display,
 		releasAllFence(dp);
 		return HWC2_ERROR_NONE;
 	}
-	myThread->mutex->lock();
-	list_for_each_safe(node1, node2, &myThread->SubmitHead) {
-		cachedNum++;
-	}
-	myThread->mutex->unlock();
+	cachedNum = submitPendingCount(dp);
 	/*get frames in cached*/
-	if (cachedNum > 1) {
+	if (cachedNum > 1 && dp->commitThread->policy == SUBMIT_DROP_NEW) {
 		if (toClientId(dp->clientId) == 0) {
 			/*should not happen as surfacefliner had synced to primary disp*/
 			ALOGV("ERROR %s:bad primary disp vsync", __FUNCTION__);
@@ -769,6 +821,36 @@ int32_t hwc_present_display(hwc2_device_t* device, hwc2_display_t display,
 #endif
 
 	pthread_mutex_lock(&dp->listMutex);
+	sortLayerList(dp);
+	sign = layerListSign(dp);
+#ifndef ENABLE_WRITEBACK
+	if (frameUnchanged(dp, sign)) {
+		/*
+		 * nothing to commit, the buffers stay on screen until the last
+		 * committed frame is released, so they get its release fence.
+		 */
+		list_for_each(node, dp->layerSortedByZorder) {
+			layer = node_to_item(node, Layer_t, node);
+			if (layer->releaseFence >= 0)
+				close(layer->releaseFence);
+			layer->releaseFence = -1;
+			if (layer->acquireFence >= 0)
+				close(layer->acquireFence);
+			layer->acquireFence = -1;
+			if (layer->compositionType != HWC2_COMPOSITION_CLIENT
+					&& layer->compositionType != HWC2_COMPOSITION_CLIENT_TARGET)
+				layer->releaseFence = dup(dp->retirfence);
+		}
+		pthread_mutex_unlock(&dp->listMutex);
+		/*
+		 * the last committed frame's own fence never signals as nothing
+		 * is committed after it, give the one of the last present again.
+		 */
+		*outRetireFence = dp->presentFence >= 0 ? dup(dp->presentFence) : -1;
+		dp->idleSkip++;
+		return HWC2_ERROR_NONE;
+	}
+#endif
 	if(dispOpr->presentDisplay(dp, &sync, &privateLayerSize)) {
 		pthread_mutex_unlock(&dp->listMutex);
 		ALOGE("ERROR %s:%d(%d)present err...", __FUNCTION__,
@@ -819,7 +901,7 @@ int32_t hwc_present_display(hwc2_device_t* device, hwc2_display_t display,
 				goto err_setup_layer;
 			}
 
-			if (layer->transform == 0) {
+			if (layer->transform == 0 && !layer->prescale) {
 				if (layer->compositionType != HWC2_COMPOSITION_CLIENT_TARGET)
 					layer->releaseFence = dup(sync.fd);
 			} else {
@@ -827,7 +909,8 @@ int32_t hwc_present_display(hwc2_device_t* device, hwc2_display_t display,
 					// Do not submit rotate task for soild layer with transform
 					layer->releaseFence = dup(sync.fd);
 				} else if (layer->compositionType != HWC2_COMPOSITION_CLIENT_TARGET) {
-					layer->releaseFence = get_rotate_fence_fd(layer2, dp, sync.fd, dp->frameCount);
+					layer->releaseFence = get_rotate_fence_fd(layer2, dp, sync.fd, dp->frameCount,
+						trCacheKey(layer));
 				}
 			}
 
@@ -864,7 +947,7 @@ deal:
 			cleanCaches();
 		}
 		//screen of de1 plug out, just submit
-		submitLayerToDisplay(dp, submitLayer);
+		dropped = submitLayerToDisplay(dp, submitLayer);
 	} else if (dp->displayId == 1 && de0 != NULL && !de0->plugIn) {
 		//screen of de0 plug out,fake it
 		Layer_t* frame =  NULL;
@@ -916,16 +999,11 @@ deal:
 		submitLayer->hwid = de0->displayId;
 
 		/*wb de0's one frame*/
-		frame = dequeueLayer(de0);
-		if (frame != NULL) {
-			if (writebackOneFrame(de0, frame, &sync0)) {
-				ALOGE("wboneframe failed");
-			}
-			queueLayer(frame);
-		} else {
-			ALOGE("wb:dequeueLayer failed");
-		}
-		submitLayerToDisplay(de0, submitLayer);
+		if (writebackQueueFrame(de0, &sync0))
+			ALOGE("wb:queue frame failed");
+		/* a dropped frame gives its fence back */
+		if (submitLayerToDisplay(de0, submitLayer))
+			close(sync0.fd);
 
 		frame =  acquireLayer(&sync, dp);
 		if (frame != NULL) {
@@ -940,7 +1018,7 @@ deal:
 				frame->acquireFence = -1;
 			}
 			list_add_tail(&wbSubmit->layerNode, &layer2->node);
-			submitLayerToDisplay(dp, wbSubmit);
+			dropped = submitLayerToDisplay(dp, wbSubmit);
 		} else {
 			submitLayerCachePut(wbSubmit);
 			ALOGE("wb:acquireLayer failed");
@@ -952,15 +1030,10 @@ deal:
 		resetWbDisplay();
 		//de0,just write back
 		if (de1 != NULL && de1->plugIn) {
-			Layer_t* frame = dequeueLayer(dp);
-			if (frame != NULL) {
-				writebackOneFrame(dp, frame, &sync);
-			} else {
-				ALOGE("wb:dequeueLayer failed");
-			}
-			queueLayer(frame);
+			if (writebackQueueFrame(dp, &sync))
+				ALOGE("wb:queue frame failed");
 		}
-		submitLayerToDisplay(dp, submitLayer);
+		dropped = submitLayerToDisplay(dp, submitLayer);
 	} else if (dp->displayId == 1 && de0 != NULL && de0->plugIn) {
 		//de1, just show one write back frame
 		Layer_t* frame =  acquireLayer(&sync, dp);
@@ -975,7 +1048,7 @@ deal:
 				frame->acquireFence = -1;
 			}
 			list_add_tail(&submitLayer->layerNode, &layer2->node);
-			submitLayerToDisplay(dp, submitLayer);
+			dropped = submitLayerToDisplay(dp, submitLayer);
 		} else {
 			submitLayerCachePut(submitLayer);
 			ALOGE("wb:acquireLayer failed");
@@ -984,16 +1057,32 @@ deal:
 		}
 	}
 #else
-	submitLayerToDisplay(dp, submitLayer);
+	dropped = submitLayerToDisplay(dp, submitLayer);
 #endif
 	*outRetireFence = dp->retirfence;
+	if (dp->presentFence >= 0)
+		close(dp->presentFence);
+	dp->presentFence = dp->retirfence >= 0 ? dup(dp->retirfence) : -1;
 	dp->retirfence = dup(sync.fd);
 	dp->frameCount++;
+	pthread_mutex_lock(&dp->listMutex);
+	/* a dropped frame is not on screen, the next one is not skipped */
+	if (dropped)
+		dp->presentValid = 0;
+	else
+		framePresented(dp, sign);
+	pthread_mutex_unlock(&dp->listMutex);
 
 #ifdef COMPOSER_READBACK
     if (toClientId(dp->clientId) == HWC_DISPLAY_PRIMARY)
         doReadback(dp, &sync);
 #endif
+	/*
+	 * the dropped frame gave its fence back, the dups above signal with
+	 * the next frame committed.
+	 */
+	if (dropped)
+		close(sync.fd);
 
 	return HWC2_ERROR_NONE;
 
@@ -1017,6 +1106,7 @@ int32_t hwc_set_active_config(hwc2_device_t* device, hwc2_display_t display,
 	i = find_config(dp, config);
 	if (i != BAD_HWC_CONFIG) {
 		dp->activeConfigId = i;
+		dp->presentValid = 0;
 		/* JetCui:now do not implement the mutex with other call,
 		  * because surfaceflinger just do call it 1 time on the initial.
 		  * but second display must be careful.
@@ -1057,6 +1147,9 @@ int32_t hwc_set_client_target(hwc2_device_t* device, hwc2_display_t display,
 	layer->crop.top = 0;
 	layer->crop.bottom = dp->displayConfigList[dp->activeConfigId]->height;
 	layer->damageRegion = damage;
+	layer->damaged = damage.numRects != 1
+		|| damage.rects[0].right > damage.rects[0].left
+		|| damage.rects[0].bottom > damage.rects[0].top;
 	layer->dataspace = dataspace;
 	layer->frame.left = 0;
 	layer->frame.right = dp->displayConfigList[dp->activeConfigId]->width;
@@ -1144,6 +1237,7 @@ int32_t hwc_set_power_mode(hwc2_device_t* device, hwc2_display_t display, int32_
         return HWC2_ERROR_BAD_DISPLAY;
     }
 
+	dp->presentValid = 0;
     return dp->displayOpration->setPowerMode(dp, mode);
 }
 
@@ -1186,6 +1280,10 @@ int32_t hwc_validate_display(hwc2_device_t* device, hwc2_display_t display,
 		return HWC2_ERROR_BAD_DISPLAY;
 	}
 
+	frameTimeMark(dp, dp->frameCount, FRAME_VALIDATE);
+	pthread_mutex_lock(&dp->listMutex);
+	sortLayerList(dp);
+	pthread_mutex_unlock(&dp->listMutex);
 	list = dp->layerSortedByZorder;
 	*outNumRequests = 0;
 	*outNumRequests = 0;
@@ -1243,6 +1341,7 @@ int32_t hwc_validate_display(hwc2_device_t* device, hwc2_display_t display,
 
 	pthread_mutex_lock(&dp->listMutex);
 
+	traceLayerBegin(dp);
 	dp->displayOpration->AssignLayer(dp);
 
 #ifdef ENABLE_WRITEBACK
@@ -1274,6 +1373,7 @@ int32_t hwc_validate_display(hwc2_device_t* device, hwc2_display_t display,
 		ret = HWC2_ERROR_NONE;
 	}
 	ALOGV("%s: %d layer changes and numRequests %d.\n",__FUNCTION__, numTypes, numRequests);
+	traceLayerEnd(dp);
 
 	pthread_mutex_unlock(&dp->listMutex);
 
@@ -1293,13 +1393,67 @@ int32_t hwc_set_cursor_position(hwc2_device_t* device, hwc2_display_t display,
     return HWC2_ERROR_NONE;
 }
 
+/* must hold listMutex, createLayer may grow the table */
+static inline Layer_t* findLayerLocked(Display_t *dp, hwc2_layer_t layer)
+{
+	Layer_t *ly = layerTableFind(&dp->layerTable, layer);
+
+	if (ly == NULL)
+		ALOGE("bad layer %llx on display %d", (unsigned long long)layer, dp->displayId);
+	return ly;
+}
+
+static inline Layer_t* findLayer(Display_t *dp, hwc2_layer_t layer)
+{
+	Layer_t *ly;
+
+	pthread_mutex_lock(&dp->listMutex);
+	ly = findLayerLocked(dp, layer);
+	pthread_mutex_unlock(&dp->listMutex);
+	return ly;
+}
+
+static inline void layerSetDamage(Layer_t *ly, hwc_region_t damage)
+{
+	ly->damageRegion = damage;
+	/* no rect means all damaged, 1 empty rect means nothing changed */
+	ly->damaged = damage.numRects != 1
+		|| damage.rects[0].right > damage.rects[0].left
+		|| damage.rects[0].bottom > damage.rects[0].top;
+}
+
+static inline void layerSetTransform(Layer_t *ly, int32_t transform)
+{
+	ly->transform = transform;
+	if (ly->transform == 0 && !ly->prescale) {
+		trCachePut(ly->trcache, 1);
+		ly->trcache = NULL;
+	}
+}
+
+/* must hold listMutex, the list is sorted in sortLayerList */
+static inline void layerSetZorder(Display_t *dp, Layer_t *ly, uint32_t z)
+{
+	ly->zorder = z;
+	if (list_empty(&ly->node)) {
+		list_add_tail(dp->layerSortedByZorder, &ly->node);
+		dp->nubmerLayer++;
+	}
+	dp->zorderDirty = 1;
+}
+
 int32_t hwc_set_layer_buffer(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, buffer_handle_t buffer, int32_t acquireFence){
 
-	Layer_t *ly = (Layer_t *)layer;
+	Layer_t *ly;
+	Display_t *dp = findDisplay(display);
 	unusedpara(device);
-	unusedpara(display);
 
+	if (!dp)
+		return HWC2_ERROR_BAD_DISPLAY;
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 	ly->buffer = buffer;
 	ly->acquireFence = acquireFence;
 	return HWC2_ERROR_NONE;
@@ -1308,26 +1462,34 @@ int32_t hwc_set_layer_buffer(hwc2_device_t* device, hwc2_display_t display,
 int32_t hwc_set_layer_surface_damage(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, hwc_region_t damage)
 {
-    Layer_t *ly = (Layer_t *)layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 	unusedpara(device);
-    if(!findDisplay(display)){
+    if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 
-    ly->damageRegion = damage;
+	layerSetDamage(ly, damage);
     return HWC2_ERROR_NONE;
 }
 
 int32_t hwc_set_layer_blend_mode(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, int32_t mode)
 {
-    Layer_t* ly = (Layer_t *) layer;
+    Layer_t* ly;
+    Display_t *dp = findDisplay(display);
 	unusedpara(device);
-    if(!findDisplay(display)){
+    if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 
     ly->blendMode = mode;
     return HWC2_ERROR_NONE;
@@ -1336,13 +1498,17 @@ int32_t hwc_set_layer_blend_mode(hwc2_device_t* device, hwc2_display_t display,
 int32_t hwc_set_layer_color(hwc2_display_t* device, hwc2_display_t display, hwc2_layer_t layer,
     hwc_color_t color)
 {
-	Layer_t *ly = (Layer_t *)layer;
+	Layer_t *ly;
+	Display_t *dp = findDisplay(display);
 	unusedpara(device);
 
-	if(!findDisplay(display)){
+	if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 
     ly->color = color;
     return HWC2_ERROR_NONE;
@@ -1355,13 +1521,17 @@ int32_t hwc_set_layer_color(hwc2_display_t* device, hwc2_display_t display, hwc2
 int32_t hwc_set_layer_composition_type(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, int32_t type)
 {
-    Layer_t *ly = (Layer_t *)layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 
 	unusedpara(device);
-	if(!findDisplay(display)){
+	if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 	ly->compositionType = type;
 
 	return HWC2_ERROR_NONE;
@@ -1370,13 +1540,17 @@ int32_t hwc_set_layer_composition_type(hwc2_device_t* device, hwc2_display_t dis
 int32_t hwc_set_layer_dataspace(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, int32_t dataspace)
 {
-	Layer_t *ly = (Layer_t *) layer;
+	Layer_t *ly;
+	Display_t *dp = findDisplay(display);
 
 	unusedpara(device);
-	if(!findDisplay(display)){
+	if(!dp){
 		ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
 		return HWC2_ERROR_BAD_DISPLAY;
 	}
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 	ly->dataspace = dataspace;
 
 	return HWC2_ERROR_NONE;
@@ -1385,12 +1559,16 @@ int32_t hwc_set_layer_dataspace(hwc2_device_t* device, hwc2_display_t display,
 int32_t hwc_set_layer_display_frame(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, hwc_rect_t frame)
 {
-    Layer_t *ly = (Layer_t *)layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 	unusedpara(device);
-    if(!findDisplay(display)){
+    if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
     ly->frame = frame;
 
 	return HWC2_ERROR_NONE;
@@ -1399,13 +1577,17 @@ int32_t hwc_set_layer_display_frame(hwc2_device_t* device, hwc2_display_t displa
 int32_t hwc_set_layer_plane_alpha(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, float alpha)
 {
-    Layer_t *ly = (Layer_t *)layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 	unusedpara(device);
 
-	if(!findDisplay(display)){
+	if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
     ly->planeAlpha = alpha;
 
 	return HWC2_ERROR_NONE;
@@ -1414,12 +1596,16 @@ int32_t hwc_set_layer_plane_alpha(hwc2_device_t* device, hwc2_display_t display,
 int32_t hwc_set_layer_sideband_stream(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, const native_handle_t* stream)
 {
-    Layer_t *ly = (Layer_t *) layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 	unusedpara(device);
-    if(!findDisplay(display)){
+    if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
     ly->stream = stream;
 
 	return HWC2_ERROR_NONE;
@@ -1428,14 +1614,18 @@ int32_t hwc_set_layer_sideband_stream(hwc2_device_t* device, hwc2_display_t disp
 int32_t hwc_set_layer_source_crop(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, hwc_frect_t crop)
 {
-    Layer_t *ly = (Layer_t *) layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 
 	unusedpara(device);
-	if(!findDisplay(display)){
+	if(!dp){
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
-    ly->crop = crop;	
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
+    ly->crop = crop;
 
 	return HWC2_ERROR_NONE;
 }
@@ -1443,33 +1633,36 @@ int32_t hwc_set_layer_source_crop(hwc2_device_t* device, hwc2_display_t display,
 int32_t hwc_set_layer_transform(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, int32_t transform)
 {
-    Layer_t *ly = (Layer_t *) layer;
+    Layer_t *ly;
+    Display_t *dp = findDisplay(display);
 
 	unusedpara(device);
-    if(!findDisplay(display)){
+    if(!dp){
         ALOGE("%s : bad display %llx", __FUNCTION__, display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 
-	ly->transform = transform;
-	if (ly->transform == 0) {
-		trCachePut(ly->trcache, 1);
-		ly->trcache = NULL;
-	}
-
+	layerSetTransform(ly, transform);
     return HWC2_ERROR_NONE;
 }
 
 int32_t hwc_set_layer_visible_region(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, hwc_region_t visible)
 {
-	Layer_t *ly = (Layer_t *)layer;
+	Layer_t *ly;
+	Display_t *dp = findDisplay(display);
 
 	unusedpara(device);
-    if(!findDisplay(display)){
+    if(!dp){
         ALOGE("%s : bad display %llx", __FUNCTION__, display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
+	ly = findLayer(dp, layer);
+	if (ly == NULL)
+		return HWC2_ERROR_BAD_LAYER;
 
     ly->visibleRegion = visible;
 
@@ -1480,7 +1673,7 @@ int32_t hwc_set_layer_z_order(hwc2_device_t* device, hwc2_display_t display,
     hwc2_layer_t layer, uint32_t z)
 {
 
-	Layer_t *ly = (Layer_t *)layer;
+	Layer_t *ly;
     Display_t* dp = findDisplay(display);
 
 	unusedpara(device);
@@ -1488,14 +1681,80 @@ int32_t hwc_set_layer_z_order(hwc2_device_t* device, hwc2_display_t display,
         ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
         return HWC2_ERROR_BAD_DISPLAY;
     }
-	ly->zorder = z;
 	pthread_mutex_lock(&dp->listMutex);
-    dp->nubmerLayer += insertLayerByZorder(ly, dp->layerSortedByZorder);
+	ly = findLayerLocked(dp, layer);
+	if (ly == NULL) {
+		pthread_mutex_unlock(&dp->listMutex);
+		return HWC2_ERROR_BAD_LAYER;
+	}
+	layerSetZorder(dp, ly, z);
 	pthread_mutex_unlock(&dp->listMutex);
 
     return HWC2_ERROR_NONE;
 }
 
+/*
+ * all the per layer state of a frame in one call, one display lookup
+ * and one lock instead of a call per field per layer.
+ * stop at the first bad layer, *outErrIndex is the number applied.
+ */
+int32_t hwc_set_layer_state(hwc2_device_t* device, hwc2_display_t display,
+    uint32_t num, const hwc2s_layer_state_t* state, uint32_t* outErrIndex)
+{
+	Layer_t *ly;
+	Display_t *dp = findDisplay(display);
+	int32_t ret = HWC2_ERROR_NONE;
+	uint32_t i;
+
+	unusedpara(device);
+	if (!dp) {
+		ALOGE("%s : bad display %p", __FUNCTION__, (void*)display);
+		return HWC2_ERROR_BAD_DISPLAY;
+	}
+
+	pthread_mutex_lock(&dp->listMutex);
+	for (i = 0; i < num; i++, state++) {
+		ly = findLayerLocked(dp, state->layer);
+		if (ly == NULL) {
+			ret = HWC2_ERROR_BAD_LAYER;
+			break;
+		}
+		if (state->mask & HWC2S_LAYER_BUFFER) {
+			ly->buffer = state->buffer;
+			ly->acquireFence = state->acquireFence;
+		}
+		if (state->mask & HWC2S_LAYER_DAMAGE)
+			layerSetDamage(ly, state->damage);
+		if (state->mask & HWC2S_LAYER_BLEND_MODE)
+			ly->blendMode = state->blendMode;
+		if (state->mask & HWC2S_LAYER_COLOR)
+			ly->color = state->color;
+		if (state->mask & HWC2S_LAYER_COMPOSITION_TYPE)
+			ly->compositionType = state->compositionType;
+		if (state->mask & HWC2S_LAYER_DATASPACE)
+			ly->dataspace = state->dataspace;
+		if (state->mask & HWC2S_LAYER_DISPLAY_FRAME)
+			ly->frame = state->frame;
+		if (state->mask & HWC2S_LAYER_PLANE_ALPHA)
+			ly->planeAlpha = state->planeAlpha;
+		if (state->mask & HWC2S_LAYER_SIDEBAND_STREAM)
+			ly->stream = state->stream;
+		if (state->mask & HWC2S_LAYER_SOURCE_CROP)
+			ly->crop = state->crop;
+		if (state->mask & HWC2S_LAYER_TRANSFORM)
+			layerSetTransform(ly, state->transform);
+		if (state->mask & HWC2S_LAYER_VISIBLE_REGION)
+			ly->visibleRegion = state->visibleRegion;
+		if (state->mask & HWC2S_LAYER_Z_ORDER)
+			layerSetZorder(dp, ly, state->z);
+	}
+	pthread_mutex_unlock(&dp->listMutex);
+
+	if (outErrIndex != NULL)
+		*outErrIndex = i;
+	return ret;
+}
+
 #ifdef COMPOSER_READBACK
 int32_t hwc_get_readback_buffer_attributes(
         hwc2_device_t* device, hwc2_display_t display,
@@ -1550,6 +1809,19 @@ int32_t hwc_set_readback_buffer(
     setReadbackBuffer(display, buffer, releaseFence);
     return HWC2_ERROR_NONE;
 }
+
+int hwc_set_readback_stream(int display, int enable)
+{
+    Display_t **dp = mDisplay;
+
+    if (display != HWC_DISPLAY_PRIMARY)
+        return -1;
+    for (int i = 0; i < numberDisplay; i++) {
+        if (toClientId(dp[i]->clientId) == display)
+            return readbackStreamEnable(dp[i], enable != 0);
+    }
+    return -1;
+}
 #endif
 
 int32_t /*hwc2_error_t*/ hwc_get_render_intents(
@@ -1634,6 +1906,23 @@ int hwc_set_screenfull(int display, int enable)
 	return 0;
 }
 
+int hwc_set_submit_policy(int display, int policy)
+{
+	Display_t **dp = mDisplay;
+
+	if (policy != SUBMIT_DROP_NEW && policy != SUBMIT_LATEST_WINS)
+		return -1;
+	for (int i = 0; i < numberDisplay; i++) {
+		if (toClientId(dp[i]->clientId) == display
+			&& dp[i]->commitThread != NULL) {
+			dp[i]->commitThread->policy = policy;
+			ALOGD("display:%d submit policy %d", display, policy);
+			return 0;
+		}
+	}
+	return -1;
+}
+
 /* hwc_set_display_command
   *  this is HIDL call for set display arg,
   *
@@ -1665,6 +1954,14 @@ int hwc_set_display_command(int display, int cmd1, int cmd2, int data)
 	case HIDL_SETVIDEORATIO:
 		ret = hwc_set_screenfull(display, data);
 	break;
+	case HIDL_SETSUBMITPOLICY:
+		ret = hwc_set_submit_policy(display, data);
+	break;
+#ifdef COMPOSER_READBACK
+	case HIDL_SETREADBACKSTREAM:
+		ret = hwc_set_readback_stream(display, data);
+	break;
+#endif
 	default:
 		ALOGD("give us a err cmd");
 	}
@@ -1714,6 +2011,11 @@ int hwc_setBlank(int clientId, int enable)
 int hwc_setBlank(int hwid)
 {
 	int ret;
+
+	for (int i = 0; i < numberDisplay; i++) {
+		if (mDisplay[i]->displayId == hwid)
+			mDisplay[i]->presentValid = 0;
+	}
 	ret = clearAllLayers(hwid);
 	if (ret)
 		ALOGE("Clear all layers failed!");
@@ -2092,6 +2394,9 @@ hwc2_function_pointer_t hwc_device_getFunction(struct hwc2_device* device,
 	case HWC2_FUNCTION_SUNXI_SET_DISPLY:
 		return asFP<SUNXI_SET_DISPLY_COMMAND>(
             hwc_set_display_command);
+	case HWC2_FUNCTION_SUNXI_SET_LAYER_STATE:
+		return asFP<HWC2S_PFN_SET_LAYER_STATE>(
+            hwc_set_layer_state);
     }
     return NULL;
 }
@@ -2195,6 +2500,9 @@ static int hwc_device_open(const struct hw_module_t* module, const char* id,
 	layerCacheInit();
 	Iondeviceinit();
 	rotateDeviceInit();
+#ifdef G2D_COMPOSE
+	g2dComposeInit();
+#endif
 	eventThreadInit(mDisplay, numberDisplay, socketpair_fd[1]);
 	debugInit(numberDisplay);
 	memCtrlInit(mDisplay, numberDisplay);
@@ -2205,6 +2513,8 @@ static int hwc_device_open(const struct hw_module_t* module, const char* id,
 	primarycond = new Condition();
 
 	platform_init(mDisplay, numberDisplay);
+	for (int i = 0; i < numberDisplay; i++)
+		clientDisplay[toClientId(mDisplay[i]->clientId)] = mDisplay[i];
 
 	// Private service for vendor display command handling.
 	vendorservice_init();
@@ -2247,6 +2557,9 @@ static void __attribute__((constructor))hal_Init(void) {
 static void __attribute__((destructor)) hal_exit(void){
 	IondeviceDeinit();
 	rotateDeviceDeInit(numberDisplay);
+#ifdef G2D_COMPOSE
+	g2dComposeDeinit();
+#endif
 	eventThreadDeinit();
 #ifdef ENABLE_WRITEBACK
 	Display_t* dp0 =  findHwDisplay(0);
@@ -28,6 +28,7 @@
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer2.h>
@@ -84,6 +85,14 @@ enum HIDL_set_cmd {
 	HIDL_SET3D_MODE,
 	HIDL_SETMARGIN,
 	HIDL_SETVIDEORATIO,
+	HIDL_SETSUBMITPOLICY,
+	HIDL_SETREADBACKSTREAM,
+};
+
+/* what to do with a new frame when the display consume too slow */
+enum submit_policy {
+	SUBMIT_DROP_NEW,//keep the queued frames, drop the new one
+	SUBMIT_LATEST_WINS,//keep only the newest frame, release the older
 };
 
 enum RatioType {
@@ -138,6 +147,10 @@ typedef struct Layer{
 	bool typeChange;
 	bool clearClientTarget;
 	bool memresrve;
+	bool damaged;//content changed since the last frame
+	bool prescale;//downscaled by g2d to the frame size before the de
+	buffer_handle_t lastBuffer;//buffer of the last committed frame
+	hwc2_layer_t id;//handle given to surfaceflinger
 	void *trcache;
 	enum sunnxi_dueto_flags duetoFlag;
 	struct listnode node;
@@ -192,21 +205,63 @@ typedef struct sunxiDisplay Display_t;
 typedef struct DisplayOpr DisplayOpr_t;
 typedef struct LayerSubmit LayerSubmit_t;
 
+/* must be power of 2, present producer and submit thread consumer */
+#define SUBMIT_RING_SIZE 8
+/* present to scanout latency in half vsync period, the last is the rest */
+#define VSYNC_HIST_N 8
+
+/*
+ * vsync phase of a display, written by the event thread from the vsync
+ * uevent and read by the submit thread, seq is odd while updating.
+ */
+typedef struct vsyncModel{
+	volatile unsigned int seq;
+	int64_t last;
+	int64_t period;//ns, filtered
+	unsigned int samples;
+}vsyncModel_t;
+
 typedef struct submitThread{
 	char thread_name[32];
 	int priority;
 	bool stop;
 	pthread_t thread_id;
-	struct listnode SubmitHead;
-	Mutex *mutex;
-	Condition *cond;
+	/* single producer(present) single consumer(submit thread) ring */
+	volatile unsigned int ringHead;
+	volatile unsigned int ringTail;
+	LayerSubmit_t *ring[SUBMIT_RING_SIZE];
+	int eventFd;
+	int epollFd;//eventFd and the fences the thread waits on
+	volatile int pendNum;//popped from ring but not committed yet
+	unsigned ringFullCount;
+	unsigned ringDropCount;//present gave up on a full ring
+	int policy;//enum submit_policy
+	unsigned dropCount;
 	unsigned SubmitCount;
 	unsigned diplayCount;
+	vsyncModel_t vsync;
+	int64_t commitMargin;//ns before the predicted vsync, 0 commit at once
+	unsigned holdCount;//commits held for the vsync
+	unsigned latHist[VSYNC_HIST_N];
+	int64_t latSum;
+	unsigned latNum;
 	int32_t (*setupLayer)(LayerSubmit_t*);
 	int32_t (*commitToDisplay)(Display_t* display, LayerSubmit_t*);
 	int32_t (*delayDeal)(Display_t* display, LayerSubmit_t*);
 }submitThread_t;
 
+/*
+ * layers created on a display, the handle is slot + 1 in the low 32 bits
+ * and the slot generation in the high, the generation is bumped when the
+ * slot is freed so a stale handle is refused.
+ */
+typedef struct layerTable{
+	Layer_t **layer;
+	uint32_t *gen;
+	int size;
+	int used;
+}layerTable_t;
+
 typedef struct sunxiDisplay{
 	int displayId;
 	hwc2_display_t clientId;
@@ -229,9 +284,12 @@ typedef struct sunxiDisplay{
 	uint32_t nubmerLayer;
 	pthread_mutex_t listMutex;
 	struct listnode *layerSortedByZorder;
+	bool zorderDirty;//a zorder is set since the list was sorted
+	layerTable_t layerTable;
 	DisplayOpr_t *displayOpration;
 	submitThread_t *commitThread;
 	int retirfence;
+	int presentFence;//the retire fence handed out by the last present
 
 	int VarDisplayWidth;
 	int VarDisplayHeight;
@@ -240,6 +298,10 @@ typedef struct sunxiDisplay{
 	int screenRadio;
 	int dataspace_mode;
 	bool secure;
+	/* the last committed frame, to skip the same one */
+	bool presentValid;
+	uint64_t presentSign;
+	unsigned int idleSkip;
 	int data[0];
 #ifdef TARGET_PLATFORM_HOMLET
 	int hwPlug;/* set -1 to stop send buf to hw*/
@@ -295,6 +357,7 @@ typedef struct LayerSubmit{
     struct sync_info sync;
     unsigned frameCount;
     DisplayConfig_t currentConfig;
+    int64_t waitStart;//enqueue, or the time it waits to retire
     struct listnode node;
 }LayerSubmit_t;
 
@@ -435,10 +498,12 @@ extern int hwc_hock_hotplug(int display, bool plug);
 
 extern int sizeList(struct listnode *list);
 extern bool insertLayerByZorder(Layer *element, struct listnode *list);
+extern void sortLayerByZorder(struct listnode *list);
 extern void showLayer(struct Layer *lay);
 extern bool regionCrossed(hwc_rect_t *rect0, hwc_rect_t *rect1, hwc_rect_t *rectx);
 extern bool checkLayerCross(Layer_t *srclayer, Layer_t *destlayer);
 extern void calcLayerFactor(Layer_t *layer, float *width, float *hight);
+extern void layerPreScaleSize(Layer_t *layer, int *width, int *height);
 extern char* layerType(Layer_t *layer);
 extern void layerCachePut(Layer_t *layer);
 extern void submitLayerCachePut(LayerSubmit_t *submitLayer);
@@ -456,10 +521,18 @@ extern bool checkSoildLayer(Layer_t *layer);
 extern bool layerIsScale(Display_t *display, Layer_t *layer);
 extern bool checkDealContiMem(Layer_t *layer);
 extern bool isSameForamt(Layer_t *layer1, Layer_t *layer2);
+extern uint64_t layerListSign(Display_t *display);
 extern Layer_t* layerCacheGet(int size);
+extern hwc2_layer_t layerTableAdd(layerTable_t *table, Layer_t *layer);
+extern Layer_t* layerTableFind(layerTable_t *table, hwc2_layer_t id);
+extern Layer_t* layerTableRemove(layerTable_t *table, hwc2_layer_t id);
+extern void layerTableClear(layerTable_t *table);
 extern void incRef(Layer_t *layer);
 extern submitThread_t* initSubmitThread(Display_t *disp);
 extern void deinitSubmitTread(Display_t *disp);
+extern int submitPendingCount(Display_t *disp);
+extern void vsyncModelUpdate(Display_t *disp, int64_t timestamp);
+extern int submitVsyncDump(Display_t *disp, char *outBuffer);
 extern int switchDisplay(Display_t *display, int type, int mode);
 
 extern hwc2_error_t registerEventCallback(int bitMapDisplay, int32_t descriptor, int zOrder,
@@ -470,6 +543,7 @@ extern void eventThreadDeinit(void);
 extern void clearList(struct listnode *list, bool layer);
 extern void deinitSubmitTread(Display_t *disp);
 extern void callRefresh(Display_t *display);
+extern Display_t* findHwDisplay(int hwid);
 extern int submitTransformLayer(Layer_t *layer);
 
 extern int clearAllLayers(int displayId);
@@ -483,6 +557,19 @@ extern void syncLayerBuffer(Layer_t *layer);
 extern unsigned int ionGetMetadataFlag(buffer_handle_t handle);
 
 /* For debug */
+enum frame_phase {
+	FRAME_VALIDATE = 0,
+	FRAME_PRESENT,
+	FRAME_ENQUEUE,
+	FRAME_FENCE,//acquire fence all signaled
+	FRAME_COMMIT,//commit ioctl return
+	FRAME_RETIRE,
+	FRAME_PHASE_NUM,
+};
+extern void frameTimeMark(Display_t *display, unsigned int frame, int phase);
+extern int frameTimeDump(Display_t *display, char *outBuffer);
+extern void traceLayerBegin(Display_t *display);
+extern void traceLayerEnd(Display_t *display);
 extern void debugInit(int num);
 extern void debugDeinit(void);
 extern bool showLayers(void);
@@ -511,10 +598,19 @@ extern int hwc_getPriDispSlt(int* width, int* height);
 /* For 3D */
 extern int hwc_set_3d_mode(int display, int mode);
 /* memctrl */
+typedef struct memCtrlShot{
+	int globcurrent;
+	int globReseveMem;
+	int dealReseveMem;
+	int currentTRMemLimit;
+	int currentTRPixelLimit;
+}memCtrlShot_t;
+
 extern void memCtrlInit(Display_t **display, int num);
 extern void memContrlComplet(Display_t *display);
 extern void memResetPerframe(Display_t *display);
 extern void memCtrlLimmitSet(Display_t *display, int screen);
+extern int memCtrlLimitStep(void);
 extern void memCtrlUpdateMaxFb(void);
 extern void memCtrlDealLayer(Layer_t *layer, bool add);
 extern void memCtrlDealFBLayer(Layer_t *layer, bool add);
@@ -525,24 +621,76 @@ extern void memCtrlDelCur(int mem);
 extern bool memCtrlAddLayer(Display_t *display, Layer_t *layer, int* pAddmem);
 extern void releaseTRlimmit(Layer_t *layer);
 extern bool aquireTRlimmit(Layer_t *layer);
+extern void memCtrlSnapshot(memCtrlShot_t *shot);
+extern void memCtrlShotDiff(memCtrlShot_t *delta, memCtrlShot_t *begin);
+extern bool memCtrlReplay(memCtrlShot_t *delta);
 
 /* rotate ==  transform */
 extern bool supportTR(Display_t *display, Layer_t *layer);
+extern bool supportPreScale(Display_t *display, Layer_t *layer);
 extern int rotateDeviceDeInit(int num);
 extern int rotateDeviceInit(void);
 extern int submitTransformLayer(Display_t *display, Layer_t *layer, unsigned int syncCount);
 extern bool trCachePut(void *aCache, bool destroyed);
 extern void* trCacheGet(Layer_t *layer);
 extern void trResetErr(void);
-extern int get_rotate_fence_fd(Layer_t *layer,Display_t *disp,  int fence, unsigned int syncCount);
+extern int get_rotate_fence_fd(Layer_t *layer,Display_t *disp,  int fence, unsigned int syncCount, uint64_t key);
+extern uint64_t trCacheKey(Layer_t *layer);
+extern void trCacheStat(bool hit, int size);
+extern int trCacheDump(char *outBuffer);
 extern bool supportedRotateWithFlip();
 
-/* mem debug */
+/* g2d pre-composition */
+extern int g2dComposeInit(void);
+extern void g2dComposeDeinit(void);
+extern bool g2dComposeUsable(Display_t *display);
+extern bool g2dComposeFallback(Display_t *display);
+extern bool g2dComposeSupport(Display_t *display, Layer_t *layer);
+extern int g2dComposeLayers(LayerSubmit_t *submitLayer, Layer_t *fb, Layer_t **layer, int num);
+extern int g2dComposeDump(Display_t *display, char *outBuffer);
+
+/* mem debug, hwc_malloc is accounted to MEM_MISC */
+enum hwc_mem_type {
+	MEM_MISC = 0,
+	MEM_LAYER,
+	MEM_SUBMIT,
+	MEM_ROTATE,
+	MEM_WRITEBACK,
+	MEM_TYPE_NUM,
+};
+/* callers listed by hwc_mem_dump, it adds a header and an other line */
+#define MEM_CALLER_N 16
+
 extern void *hwc_malloc(int size);
+extern void *hwc_malloc_type(int size, int type);
 extern void hwc_free(void *mem);
 extern int hwc_mem_dump(char* outBuffer);
 extern void hwc_mem_debug_init(void);
 
+/* slab */
+typedef struct hwcSlab {
+	const char *name;
+	int memType;
+	int objSize;
+	int objNum;
+	char *base;
+	void *freeList;
+	int freeNum;
+	pthread_mutex_t mutex;
+	pthread_key_t key;
+	struct listnode mags;//the magazine of every thread, under mutex
+	int used;
+	int peak;
+	unsigned int miss;
+}hwcSlab_t;
+
+extern int slabInit(hwcSlab_t *slab, const char *name, int memType, int objSize, int objNum);
+extern int slabDeinit(hwcSlab_t *slab);
+extern void* slabAlloc(hwcSlab_t *slab);
+extern void slabFree(hwcSlab_t *slab, void *obj);
+extern int slabDump(hwcSlab_t *slab, char* outBuffer);
+extern int layerCacheDump(char* outBuffer);
+
 
 #ifdef ENABLE_WRITEBACK
 extern int initWriteBack(Display_t* dp, bool isInitBuf = true);
@@ -553,12 +701,15 @@ extern Layer_t* dequeueLayer(Display_t* dp);
 extern Layer_t* acquireLayer(struct sync_info *sync, Display_t* dp);
 extern int queueLayer(Layer_t* layer);
 extern int writebackOneFrame(Display_t* dp, Layer_t* layer, struct sync_info *sync);
+extern int writebackQueueFrame(Display_t* dp, struct sync_info *sync);
+extern int writebackDump(char* outBuffer);
 extern void dumpLayer(Layer_t *layer, unsigned int framecout);
 extern bool isNeedWb(Layer_t *layer);
 extern void cleanCaches();
 #endif
 
-extern void addLayerRecord(hwc2_display_t display, hwc2_layer_t id);
-extern bool removeLayerRecord(hwc2_display_t display, hwc2_layer_t id);
+#ifdef COMPOSER_READBACK
+extern int readbackDump(char* outBuffer);
+#endif
 
 #endif
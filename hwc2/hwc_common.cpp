@@ -50,15 +50,28 @@ bool checkLayerCross(Layer_t *srclayer, Layer_t *destlayer)
 	return regionCrossed(&srclayer->frame, &destlayer->frame, &rectx);
 }
 
+/* yuv420 output, so keep it even */
+void layerPreScaleSize(Layer_t *layer, int *width, int *height)
+{
+	*width = (layer->frame.right - layer->frame.left) & ~1;
+	*height = (layer->frame.bottom - layer->frame.top) & ~1;
+}
+
 void calcLayerFactor(Layer_t *layer, float *width, float *hight)
 {
 	float srcW, srcH, swap;
-	int dstW,dstH;
+	int dstW,dstH, preW, preH;
 
 	dstW = layer->frame.right - layer->frame.left;
 	dstH = layer->frame.bottom - layer->frame.top;
 	srcW = layer->crop.right - layer->crop.left;
 	srcH = layer->crop.bottom - layer->crop.top;
+	if (layer->prescale) {
+		/* the de gets the g2d output */
+		layerPreScaleSize(layer, &preW, &preH);
+		srcW = preW;
+		srcH = preH;
+	}
 	if(layer->transform & HAL_TRANSFORM_ROT_90) {
 		swap = srcW;
 		srcW = srcH;
@@ -201,3 +214,131 @@ char* layerType(Layer_t *layer)
 	}
 }
 
+
+static inline uint64_t signMix(uint64_t sign, const void *data, int size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	/* FNV-1a */
+	while (size--) {
+		sign ^= *p++;
+		sign *= 0x100000001b3ULL;
+	}
+	return sign;
+}
+
+/*
+ * layerListSign() fingerprint all the layer state that the assignment
+ * depend on, same sign means the last pipe assignment can be reused.
+ */
+uint64_t layerListSign(Display_t *display)
+{
+	uint64_t sign = 0xcbf29ce484222325ULL;
+	struct listnode *node;
+	Layer_t *layer;
+	private_handle_t *handle;
+	int format, size[3], bits[3];
+
+	sign = signMix(sign, &display->nubmerLayer, sizeof(display->nubmerLayer));
+	sign = signMix(sign, &display->activeConfigId, sizeof(display->activeConfigId));
+	sign = signMix(sign, &display->forceClient, sizeof(display->forceClient));
+	sign = signMix(sign, &display->colorTransformHint, sizeof(display->colorTransformHint));
+	sign = signMix(sign, &display->VarDisplayWidth, sizeof(display->VarDisplayWidth));
+	sign = signMix(sign, &display->VarDisplayHeight, sizeof(display->VarDisplayHeight));
+	sign = signMix(sign, &display->hpercent, sizeof(display->hpercent));
+	sign = signMix(sign, &display->vpercent, sizeof(display->vpercent));
+	sign = signMix(sign, &display->screenRadio, sizeof(display->screenRadio));
+	sign = signMix(sign, &display->dataspace_mode, sizeof(display->dataspace_mode));
+
+	list_for_each(node, display->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		handle = (private_handle_t *)layer->buffer;
+		format = -1;
+		size[0] = size[1] = size[2] = 0;
+		bits[0] = bits[1] = bits[2] = 0;
+		if (handle != NULL) {
+			format = handle->format;
+			size[0] = handle->width;
+			size[1] = handle->height;
+			size[2] = handle->flags;
+			/* usage, secure and afbc decide the pipe and the mem budget */
+			bits[0] = (int)handle->usage;
+			bits[1] = layerIsProtected(layer);
+			bits[2] = is_afbc_buf(layer->buffer);
+		}
+		sign = signMix(sign, &layer, sizeof(layer));
+		sign = signMix(sign, &layer->compositionType, sizeof(layer->compositionType));
+		sign = signMix(sign, &format, sizeof(format));
+		sign = signMix(sign, size, sizeof(size));
+		sign = signMix(sign, bits, sizeof(bits));
+		sign = signMix(sign, &layer->dataspace, sizeof(layer->dataspace));
+		sign = signMix(sign, &layer->crop, sizeof(layer->crop));
+		sign = signMix(sign, &layer->frame, sizeof(layer->frame));
+		sign = signMix(sign, &layer->transform, sizeof(layer->transform));
+		sign = signMix(sign, &layer->blendMode, sizeof(layer->blendMode));
+		sign = signMix(sign, &layer->planeAlpha, sizeof(layer->planeAlpha));
+		sign = signMix(sign, &layer->color, sizeof(layer->color));
+		sign = signMix(sign, &layer->zorder, sizeof(layer->zorder));
+	}
+	return sign;
+}
+
+static unsigned int trHit, trMiss;
+static unsigned long long trSaved;
+
+/*
+ * trCacheKey() key the rotate source of this frame, a result rotated
+ * from the same key is still right. the buffer is keyed by its gralloc
+ * id, a handle address may be recycled for another buffer.
+ * the whole buffer is rotated, so crop is not a part of the key,
+ * a prescaled one only reads the crop, so it also keys on the crop
+ * and the output size. a damaged source bumps the serial.
+ * 0 if there is nothing to reuse.
+ */
+uint64_t trCacheKey(Layer_t *layer)
+{
+	tr_cache_Array *aCache = (tr_cache_Array *)layer->trcache;
+	private_handle_t *handle = (private_handle_t *)layer->buffer;
+	uint64_t key = 0xcbf29ce484222325ULL;
+	hwc_frect_t crop;
+	int width = 0, height = 0;
+
+	if (aCache == NULL || handle == NULL)
+		return 0;
+	memset(&crop, 0, sizeof(crop));
+	if (layer->prescale) {
+		layerPreScaleSize(layer, &width, &height);
+		crop = layer->crop;
+	}
+	if (layer->damaged)
+		aCache->serial++;
+	key = signMix(key, &handle->aw_buf_id, sizeof(handle->aw_buf_id));
+	key = signMix(key, &layer->buffer, sizeof(layer->buffer));
+	key = signMix(key, &layer->transform, sizeof(layer->transform));
+	key = signMix(key, &handle->format, sizeof(handle->format));
+	key = signMix(key, &crop, sizeof(crop));
+	key = signMix(key, &width, sizeof(width));
+	key = signMix(key, &height, sizeof(height));
+	key = signMix(key, &aCache->serial, sizeof(aCache->serial));
+	return key ? key : 1;
+}
+
+/* called by the rotate thread for each frame with a key */
+void trCacheStat(bool hit, int size)
+{
+	if (hit) {
+		trHit++;
+		/* one read and one write of the buffer */
+		trSaved += 2ULL * size;
+	} else {
+		trMiss++;
+	}
+}
+
+int trCacheDump(char *outBuffer)
+{
+	unsigned int total = trHit + trMiss;
+
+	return sprintf(outBuffer, "rotate cache hit:%u miss:%u(%u%%) saved:%lluMB\n",
+			trHit, trMiss, total ? trHit * 100 / total : 0, trSaved >> 20);
+}
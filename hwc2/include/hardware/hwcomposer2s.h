@@ -21,6 +21,53 @@
 __BEGIN_DECLS
 
 #define HWC2_FUNCTION_SUNXI_SET_DISPLY  1042
+#define HWC2_FUNCTION_SUNXI_SET_LAYER_STATE  1043
+
+/* hwc2s_layer_state_t.mask, the fields to set */
+enum {
+    HWC2S_LAYER_BUFFER = 1 << 0,
+    HWC2S_LAYER_DAMAGE = 1 << 1,
+    HWC2S_LAYER_BLEND_MODE = 1 << 2,
+    HWC2S_LAYER_COLOR = 1 << 3,
+    HWC2S_LAYER_COMPOSITION_TYPE = 1 << 4,
+    HWC2S_LAYER_DATASPACE = 1 << 5,
+    HWC2S_LAYER_DISPLAY_FRAME = 1 << 6,
+    HWC2S_LAYER_PLANE_ALPHA = 1 << 7,
+    HWC2S_LAYER_SIDEBAND_STREAM = 1 << 8,
+    HWC2S_LAYER_SOURCE_CROP = 1 << 9,
+    HWC2S_LAYER_TRANSFORM = 1 << 10,
+    HWC2S_LAYER_VISIBLE_REGION = 1 << 11,
+    HWC2S_LAYER_Z_ORDER = 1 << 12,
+};
+
+/* the same values as the setLayerXxx functions take */
+typedef struct hwc2s_layer_state {
+    hwc2_layer_t layer;
+    uint32_t mask;
+    buffer_handle_t buffer;
+    int32_t acquireFence;
+    hwc_region_t damage;
+    int32_t blendMode;
+    hwc_color_t color;
+    int32_t compositionType;
+    int32_t dataspace;
+    hwc_rect_t frame;
+    float planeAlpha;
+    const native_handle_t* stream;
+    hwc_frect_t crop;
+    int32_t transform;
+    hwc_region_t visibleRegion;
+    uint32_t z;
+} hwc2s_layer_state_t;
+
+/*
+ * set the state of num layers in one call, stop at the first bad layer
+ * with HWC2_ERROR_BAD_LAYER, outErrIndex is the number of layers set,
+ * the acquire fences of the layers not set still belong to the caller.
+ */
+typedef int32_t /*hwc2_error_t*/ (*HWC2S_PFN_SET_LAYER_STATE)(
+        hwc2_device_t* device, hwc2_display_t display, uint32_t num,
+        const hwc2s_layer_state_t* state, uint32_t* outErrIndex);
 
 __END_DECLS
 
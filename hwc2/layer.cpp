@@ -17,45 +17,54 @@
 #include "hwc.h"
 #include <cutils/list.h>
 
-#define LAYER_CACHE_SHRINK_NUM 16
-static struct listnode cacheList;
-static int cache_cout;
-static pthread_mutex_t chaceMutex;
+/*
+ * a slab layer is Layer_t + private data + a private_handle_t
+ * for layerDup, so dup a layer need no malloc.
+ */
+#define LAYER_SLAB_PRIV 64
+#define LAYER_SLAB_NUM 256
+#define SUBMIT_SLAB_NUM 32
 
-static struct listnode submitCacheList;
-static int submit_cache_cout;
-static pthread_mutex_t submitChaceMutex;
+static hwcSlab_t layerSlab;
+static hwcSlab_t submitSlab;
+static pthread_mutex_t chaceMutex;
 
 void layerCacheInit(void)
 {
 	pthread_mutex_init(&chaceMutex, 0);
-	list_init(&cacheList);
-	cache_cout = 0;
-
-	pthread_mutex_init(&submitChaceMutex, 0);
-	list_init(&submitCacheList);
-	submit_cache_cout = 0;
+	slabInit(&layerSlab, "layer", MEM_LAYER,
+		sizeof(Layer_t) + LAYER_SLAB_PRIV + sizeof(private_handle_t), LAYER_SLAB_NUM);
+	slabInit(&submitSlab, "submit", MEM_SUBMIT, sizeof(LayerSubmit_t), SUBMIT_SLAB_NUM);
 }
 
 void layerCacheDeinit(void)
 {
-	Layer_t *layer = NULL;
-	LayerSubmit_t *submitLayer = NULL;
-	struct listnode *node = NULL;
-
-    list_for_each(node, &cacheList) {
-	    layer = node_to_item(node, Layer_t, node);
-		hwc_free(layer);
-	}
-	list_for_each(node, &submitCacheList) {
-	   submitLayer = node_to_item(node, LayerSubmit_t, node);
-	   hwc_free(submitLayer);
-	}
-	cache_cout = 0;
-	submit_cache_cout = 0;
+	slabDeinit(&layerSlab);
+	slabDeinit(&submitSlab);
 	return;
 }
 
+int layerCacheDump(char* outBuffer)
+{
+	int count = 0;
+
+	count += slabDump(&layerSlab, outBuffer + count);
+	count += slabDump(&submitSlab, outBuffer + count);
+	return count;
+}
+
+static inline private_handle_t* layerSlabHandle(Layer_t *layer)
+{
+	return (private_handle_t *)((char *)layer + sizeof(Layer_t) + LAYER_SLAB_PRIV);
+}
+
+static inline Layer_t* layerAlloc(int size)
+{
+	if (size > LAYER_SLAB_PRIV)
+		return (Layer_t *)hwc_malloc_type(sizeof(Layer_t) + size, MEM_LAYER);
+	return (Layer_t *)slabAlloc(&layerSlab);
+}
+
 void createList(struct listnode *list) {
     list_init(list);
 }
@@ -63,26 +72,13 @@ void createList(struct listnode *list) {
 Layer_t* layerCacheGet(int size)
 {
 	Layer_t *layer = NULL;
-	struct listnode *node = NULL;
 
-	pthread_mutex_lock(&chaceMutex);
-	if (cache_cout > 0) {
-		cache_cout--;
-		node = list_head(&cacheList);
-		list_remove(node);
-		list_init(node);
-        layer = node_to_item(node, Layer_t, node);
-	}
-	pthread_mutex_unlock(&chaceMutex);
-	if (layer != NULL)
-		goto deal;
-	layer = (Layer_t *)hwc_malloc(sizeof(Layer_t)+ size);
+	layer = layerAlloc(size);
 	if (layer == NULL){
 		ALOGE("%s:malloc layer err...",__FUNCTION__);
 		return NULL;
 	}
 
-deal:
 	memset(layer, 0, sizeof(Layer_t)+ size);
 	layer->releaseFence = -1;
 	layer->preReleaseFence = -1;
@@ -98,22 +94,11 @@ deal:
 LayerSubmit_t* submitLayerCacheGet(void)
 {
 	LayerSubmit_t *submitLayer = NULL;
-	struct listnode *node = NULL;
 
-	pthread_mutex_lock(&submitChaceMutex);
-	if (submit_cache_cout > 0) {
-		submit_cache_cout--;
-		node = list_head(&submitCacheList);
-		list_remove(node);
-		list_init(node);
-        submitLayer = node_to_item(node, LayerSubmit_t, node);
-	}
-	pthread_mutex_unlock(&submitChaceMutex);
-	if (submitLayer != NULL)
-		goto deal;
+	submitLayer = (LayerSubmit_t *)slabAlloc(&submitSlab);
+	if (submitLayer == NULL)
+		return NULL;
 
-	submitLayer = (LayerSubmit_t *)hwc_malloc(sizeof(LayerSubmit_t));
-deal:
 	list_init(&submitLayer->node);
 	list_init(&submitLayer->layerNode);
 	submitLayer->sync.fd = -1;
@@ -152,7 +137,8 @@ void layerCachePut(Layer_t *layer)
 			close(handle->metadata_fd);
 #endif
 		layer->myselfHandle = 0;
-		hwc_free((void*)layer->buffer);
+		if (handle != layerSlabHandle(layer))
+			hwc_free((void*)layer->buffer);
 
 	}
 	if (layer->releaseFence >= 0) {
@@ -175,17 +161,7 @@ void layerCachePut(Layer_t *layer)
 	list_remove(&layer->node);
 	list_init(&layer->node);
 
-	pthread_mutex_lock(&chaceMutex);
-	if (cache_cout > LAYER_CACHE_SHRINK_NUM) {
-        hwc_free(layer);
-		pthread_mutex_unlock(&chaceMutex);
-		return;
-	}
-
-	cache_cout++;
-	list_add_tail(&cacheList, &layer->node);
-	pthread_mutex_unlock(&chaceMutex);
-
+	slabFree(&layerSlab, layer);
 }
 
 void submitLayerCachePut(LayerSubmit_t *submitLayer)
@@ -207,24 +183,18 @@ void submitLayerCachePut(LayerSubmit_t *submitLayer)
 	list_init(&submitLayer->node);
 	list_init(&submitLayer->layerNode);
 
-	pthread_mutex_lock(&submitChaceMutex);
-	if (submit_cache_cout > LAYER_CACHE_SHRINK_NUM) {
-        hwc_free(submitLayer);
-		pthread_mutex_unlock(&submitChaceMutex);
-		return;
-	}
-
-	submit_cache_cout++;
-	list_add_tail(&submitCacheList, &submitLayer->node);
-	pthread_mutex_unlock(&submitChaceMutex);
-
+	slabFree(&submitSlab, submitLayer);
 }
 
 Layer_t* layerDup(Layer_t *layer, int priveSize)
 {
-	Layer_t *duplayer = layerCacheGet(priveSize);
+	Layer_t *duplayer = layerAlloc(priveSize);
 	private_handle_t *handle = NULL, *handle2 = NULL;
 
+	if (duplayer == NULL) {
+		ALOGE("%s:malloc layer err...",__FUNCTION__);
+		return NULL;
+	}
 	memcpy(duplayer, layer, sizeof(Layer_t)+priveSize);
 	list_init(&duplayer->node);
 
@@ -234,7 +204,10 @@ Layer_t* layerDup(Layer_t *layer, int priveSize)
 	duplayer->myselfHandle = 0;
 	if (layer->buffer != NULL) {
 		duplayer->myselfHandle = 1;
-		handle2 = (private_handle_t *)hwc_malloc(sizeof(private_handle_t));
+		if (priveSize > LAYER_SLAB_PRIV)
+			handle2 = (private_handle_t *)hwc_malloc_type(sizeof(private_handle_t), MEM_LAYER);
+		else
+			handle2 = layerSlabHandle(duplayer);
 		handle = (private_handle_t *)duplayer->buffer;
 		*handle2= *handle;
 		/* other fd source.if nesesory */
@@ -313,6 +286,31 @@ bool insertLayerByZorder(Layer_t *element, struct listnode *list)
 	return addone;
 }
 
+/*
+ * stable insertion sort, setting the zorder only appends a new layer,
+ * the list is sorted once before validate/present, and is mostly
+ * in order already so it is close to a single walk.
+ */
+void sortLayerByZorder(struct listnode *list)
+{
+	struct listnode *node, *next, *pos;
+	Layer_t *layer, *prev;
+
+	for (node = list->next->next; node != list; node = next) {
+		next = node->next;
+		layer = node_to_item(node, Layer_t, node);
+		for (pos = node->prev; pos != list; pos = pos->prev) {
+			prev = node_to_item(pos, Layer_t, node);
+			if (prev->zorder <= layer->zorder)
+				break;
+		}
+		if (pos == node->prev)
+			continue;
+		list_remove(node);
+		list_add_head(pos, node);
+	}
+}
+
 bool deletLayerByZorder(Layer_t *element, struct listnode *list)
 {
 	struct listnode *node;
@@ -329,3 +327,89 @@ bool deletLayerByZorder(Layer_t *element, struct listnode *list)
 	return false;
 }
 
+
+#define LAYER_TABLE_MIN 16
+
+static int layerTableGrow(layerTable_t *table)
+{
+	int size = table->size ? table->size * 2 : LAYER_TABLE_MIN;
+	Layer_t **layer;
+	uint32_t *gen;
+
+	layer = (Layer_t **)hwc_malloc_type(size * sizeof(Layer_t *), MEM_LAYER);
+	gen = (uint32_t *)hwc_malloc_type(size * sizeof(uint32_t), MEM_LAYER);
+	if (layer == NULL || gen == NULL) {
+		ALOGE("%s:malloc layer table err...", __FUNCTION__);
+		if (layer != NULL)
+			hwc_free(layer);
+		if (gen != NULL)
+			hwc_free(gen);
+		return -1;
+	}
+	if (table->size) {
+		memcpy(layer, table->layer, table->size * sizeof(Layer_t *));
+		memcpy(gen, table->gen, table->size * sizeof(uint32_t));
+		hwc_free(table->layer);
+		hwc_free(table->gen);
+	}
+	table->layer = layer;
+	table->gen = gen;
+	table->size = size;
+	return 0;
+}
+
+/* return the handle of the layer, 0 if no memory */
+hwc2_layer_t layerTableAdd(layerTable_t *table, Layer_t *layer)
+{
+	int i;
+
+	if (table->used == table->size && layerTableGrow(table))
+		return 0;
+	for (i = 0; i < table->size; i++) {
+		if (table->layer[i] == NULL)
+			break;
+	}
+	table->layer[i] = layer;
+	table->used++;
+	layer->id = ((hwc2_layer_t)table->gen[i] << 32) | (uint32_t)(i + 1);
+	return layer->id;
+}
+
+Layer_t* layerTableFind(layerTable_t *table, hwc2_layer_t id)
+{
+	uint32_t slot = (uint32_t)id - 1;
+
+	if (slot >= (uint32_t)table->size
+		|| table->gen[slot] != (uint32_t)(id >> 32))
+		return NULL;
+	return table->layer[slot];
+}
+
+Layer_t* layerTableRemove(layerTable_t *table, hwc2_layer_t id)
+{
+	Layer_t *layer = layerTableFind(table, id);
+
+	if (layer == NULL)
+		return NULL;
+	table->layer[(uint32_t)id - 1] = NULL;
+	table->gen[(uint32_t)id - 1]++;
+	table->used--;
+	return layer;
+}
+
+/*
+ * free every layer of the table and bump all the generations, the handles
+ * surfaceflinger still holds are refused after that, a destroy included.
+ * layers in a list are taken off it by layerCachePut.
+ */
+void layerTableClear(layerTable_t *table)
+{
+	for (int i = 0; i < table->size; i++) {
+		if (table->layer[i] == NULL)
+			continue;
+		layerCachePut(table->layer[i]);
+		table->layer[i] = NULL;
+		table->gen[i]++;
+	}
+	table->used = 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "hwc.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+/*
+ * the zorder of every layer set again in a frame, as surfaceflinger does
+ * on a geometry change:
+ *   Insert: insertLayerByZorder on each set z, the old path
+ *   Sort:   append on set z and sortLayerByZorder once before validate
+ * Same keeps the zorders, Shuffle gives the layers new ones each frame.
+ */
+
+/* layer.cpp links alone, its allocation and rotate cache come from here */
+void *hwc_malloc(int size)
+{
+	return calloc(1, size);
+}
+
+void *hwc_malloc_type(int size, int type)
+{
+	return calloc(1, size);
+}
+
+void hwc_free(void *mem)
+{
+	free(mem);
+}
+
+void* trCacheGet(Layer_t *layer)
+{
+	return NULL;
+}
+
+bool trCachePut(void *aCache, bool destroyed)
+{
+	return false;
+}
+
+class LayerList {
+public:
+	LayerList(int num) : layer(num), order(num), random(num)
+	{
+		list_init(&head);
+		for (int i = 0; i < num; i++) {
+			memset(&layer[i], 0, sizeof(Layer_t));
+			list_init(&layer[i].node);
+			layer[i].zorder = i;
+			order[i] = i;
+		}
+	}
+
+	/* the zorders of the next frame, the set z calls come in layer order */
+	void nextFrame(bool shuffle)
+	{
+		if (shuffle)
+			std::shuffle(order.begin(), order.end(), random);
+	}
+
+	void setInsert(void)
+	{
+		for (size_t i = 0; i < layer.size(); i++) {
+			layer[i].zorder = order[i];
+			insertLayerByZorder(&layer[i], &head);
+		}
+	}
+
+	void setSort(void)
+	{
+		for (size_t i = 0; i < layer.size(); i++) {
+			layer[i].zorder = order[i];
+			if (list_empty(&layer[i].node))
+				list_add_tail(&head, &layer[i].node);
+		}
+		sortLayerByZorder(&head);
+	}
+
+	struct listnode head;
+
+private:
+	std::vector<Layer_t> layer;
+	std::vector<unsigned int> order;
+	std::mt19937 random;
+};
+
+static void BM_SetZorderInsert(benchmark::State& state)
+{
+	LayerList list(state.range(0));
+	bool shuffle = state.range(1);
+
+	list.setInsert();
+	for (auto _ : state) {
+		list.nextFrame(shuffle);
+		list.setInsert();
+		benchmark::DoNotOptimize(list.head.next);
+	}
+}
+BENCHMARK(BM_SetZorderInsert)->ArgNames({"layers", "shuffle"})
+	->Args({32, 0})->Args({64, 0})->Args({32, 1})->Args({64, 1});
+
+static void BM_SetZorderSort(benchmark::State& state)
+{
+	LayerList list(state.range(0));
+	bool shuffle = state.range(1);
+
+	list.setSort();
+	for (auto _ : state) {
+		list.nextFrame(shuffle);
+		list.setSort();
+		benchmark::DoNotOptimize(list.head.next);
+	}
+}
+BENCHMARK(BM_SetZorderSort)->ArgNames({"layers", "shuffle"})
+	->Args({32, 0})->Args({64, 0})->Args({32, 1})->Args({64, 1});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "hwc.h"
+
+#include <gtest/gtest.h>
+
+/* the layer table, as create/destroy layer and the display deinit use it */
+
+/* layer.cpp links alone, its allocation and rotate cache come from here */
+void *hwc_malloc(int size)
+{
+	return calloc(1, size);
+}
+
+void *hwc_malloc_type(int size, int type)
+{
+	return calloc(1, size);
+}
+
+void hwc_free(void *mem)
+{
+	free(mem);
+}
+
+void* trCacheGet(Layer_t *layer)
+{
+	return NULL;
+}
+
+bool trCachePut(void *aCache, bool destroyed)
+{
+	return false;
+}
+
+class LayerTableTest : public testing::Test {
+protected:
+	void SetUp()
+	{
+		layerCacheInit();
+		memset(&table, 0, sizeof(table));
+		list_init(&list);
+	}
+
+	void TearDown()
+	{
+		layerTableClear(&table);
+		clearList(&list, 1);
+		free(table.layer);
+		free(table.gen);
+		layerCacheDeinit();
+	}
+
+	/* create layer, and give it a zorder as surfaceflinger does */
+	hwc2_layer_t create(bool zorder)
+	{
+		Layer_t *layer = layerCacheGet(0);
+		hwc2_layer_t id = layerTableAdd(&table, layer);
+
+		if (zorder)
+			list_add_tail(&list, &layer->node);
+		return id;
+	}
+
+	/* what hwc_destroy_layer frees */
+	bool destroy(hwc2_layer_t id)
+	{
+		Layer_t *layer = layerTableRemove(&table, id);
+
+		if (layer == NULL)
+			return false;
+		deletLayerByZorder(layer, &list);
+		layerCachePut(layer);
+		return true;
+	}
+
+	int used(void)
+	{
+		char buf[256];
+		int num = -1;
+
+		layerCacheDump(buf);
+		sscanf(buf, "layer slab used:%d", &num);
+		return num;
+	}
+
+	layerTable_t table;
+	struct listnode list;
+};
+
+TEST_F(LayerTableTest, StaleHandleRefused)
+{
+	hwc2_layer_t id = create(true);
+
+	ASSERT_NE(id, 0u);
+	EXPECT_TRUE(destroy(id));
+	EXPECT_FALSE(destroy(id));
+
+	/* the slot is reused with another generation */
+	EXPECT_NE(create(true), id);
+	EXPECT_EQ(layerTableFind(&table, id), (Layer_t *)NULL);
+	EXPECT_EQ(used(), 1);
+}
+
+/* the display deinit on a hotplug out, surfaceflinger destroys its layers after */
+TEST_F(LayerTableTest, DestroyAfterDeinit)
+{
+	hwc2_layer_t id[4];
+	Layer_t *target = layerCacheGet(0);
+
+	for (int i = 0; i < 4; i++)
+		id[i] = create(i != 3);
+	list_add_tail(&list, &target->node);
+	EXPECT_EQ(used(), 5);
+
+	layerTableClear(&table);
+	clearList(&list, 1);
+	EXPECT_EQ(table.used, 0);
+	EXPECT_EQ(used(), 0);
+
+	for (int i = 0; i < 4; i++) {
+		EXPECT_EQ(layerTableFind(&table, id[i]), (Layer_t *)NULL);
+		EXPECT_FALSE(destroy(id[i]));
+	}
+	EXPECT_EQ(used(), 0);
+
+	/* plugged in again, the new handles are not the old ones */
+	for (int i = 0; i < 4; i++) {
+		hwc2_layer_t newId = create(true);
+
+		for (int j = 0; j < 4; j++)
+			EXPECT_NE(newId, id[j]);
+	}
+	EXPECT_EQ(table.used, 4);
+	EXPECT_EQ(used(), 4);
+}
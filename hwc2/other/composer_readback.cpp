@@ -1,6 +1,8 @@
 
 #include <unistd.h>
+#include <pthread.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include "composer_readback.h"
 
 enum {
@@ -24,8 +26,49 @@ struct ReadbackInfo {
 
 static ReadbackInfo _readbackInfo;
 
+/*
+ * streaming readback:
+ * a ring of targets allocated once when the stream is enabled, every
+ * present of the primary display is captured into a free slot, the
+ * client maps the slots once and takes the newest frame with its fence.
+ * a slot is reused only after the client released it and its release
+ * fence signaled, so present never allocate nor wait for the client.
+ */
+#define READBACK_RING_N   3
+#define READBACK_RING_MAX 4
+
+enum {
+    SLOT_FREE = 0,
+    SLOT_READY,
+    SLOT_HELD,
+};
+
+struct ReadbackSlot {
+    Layer_t* layer;
+    int state;
+    // the client done reading, for a free slot
+    int32_t releaseFence;
+    unsigned int frame;
+};
+
+struct ReadbackStream {
+    pthread_mutex_t mutex;
+    bool enabled;
+    int num;
+    ReadbackSlot slot[READBACK_RING_MAX];
+    // newest ready slot
+    int latest;
+    unsigned int captured;
+    unsigned int taken;
+    unsigned int dropped;  // ready but replaced by a newer one
+    unsigned int busy;     // no slot to capture into
+};
+
+static ReadbackStream _stream;
+
 extern int initWriteBack(Display_t* dp, bool allocBuffer);
 extern int writebackOneFrame(Display_t* dp, Layer_t* layer, struct sync_info *sync);
+extern int writebackMaxBufferSize(void);
 
 int initReadback(void)
 {
@@ -37,6 +80,9 @@ int initReadback(void)
     _readbackInfo.targetDisplay = -1;
     _readbackInfo.readbackFence = -1;
     _readbackInfo.releaseFence  = -1;
+
+    pthread_mutex_init(&_stream.mutex, 0);
+    _stream.latest = -1;
     return 0;
 }
 
@@ -95,6 +141,8 @@ static void setupWritebackTarget(Layer_t* wblayer)
     }
 
     wbBufferHandle->share_fd = dup(rbBufferHandle->share_fd);
+    if (wblayer->releaseFence >= 0)
+        close(wblayer->releaseFence);
     wblayer->releaseFence = dup(_readbackInfo.releaseFence);
 
     ALOGD("Readback1: format %d width %d height %d stride %d align %d %d %d",
@@ -103,18 +151,26 @@ static void setupWritebackTarget(Layer_t* wblayer)
             rbBufferHandle->aw_byte_align[0], rbBufferHandle->aw_byte_align[1], rbBufferHandle->aw_byte_align[2]);
 }
 
+static int streamCapture(Display_t* hwdevice, struct sync_info *sync);
+
 int doReadback(Display_t* hwdevice, struct sync_info *sync)
 {
     // No valid readback buffer, or no readback task
     if (!_readbackInfo.buffer
             || _readbackInfo.state != READBACK_PENDING) {
-        return 0;
+        return streamCapture(hwdevice, sync);
     }
 
     if (!_readbackInfo.wblayer)
         _readbackInfo.wblayer = allocHwcLayer(hwdevice);
 
     setupWritebackTarget(_readbackInfo.wblayer);
+    // writeback never waits, the client still holds the buffer, try the next present
+    if (_readbackInfo.wblayer->releaseFence >= 0
+            && sync_wait(_readbackInfo.wblayer->releaseFence, 0)) {
+        ALOGV("readback buffer still in use");
+        return 0;
+    }
     int error = writebackOneFrame(hwdevice, _readbackInfo.wblayer, sync);
     _readbackInfo.state = (!error) ? READBACK_COMMITTED : READBACK_ERROR;
 
@@ -135,6 +191,12 @@ int doReadback(Display_t* hwdevice, struct sync_info *sync)
     return error;
 }
 
+// a readback buffer is set and waits for the next present
+bool readbackPending(void)
+{
+    return _readbackInfo.buffer && _readbackInfo.state == READBACK_PENDING;
+}
+
 void setReadbackBuffer(hwc2_display_t display,
         buffer_handle_t buffer, int32_t releaseFence)
 {
@@ -169,3 +231,208 @@ int32_t getReadbackBufferFence(hwc2_display_t display, int32_t* fence)
     return 0;
 }
 
+
+static void streamFreeSlot(ReadbackSlot* slot)
+{
+    private_handle_t* handle;
+
+    if (slot->releaseFence >= 0) {
+        close(slot->releaseFence);
+        slot->releaseFence = -1;
+    }
+    if (slot->layer == NULL)
+        return;
+    handle = (private_handle_t *)slot->layer->buffer;
+    if (handle != NULL) {
+        if (handle->share_fd >= 0)
+            close(handle->share_fd);
+        hwc_free(handle);
+        slot->layer->buffer = NULL;
+    }
+    layerCachePut(slot->layer);
+    slot->layer = NULL;
+}
+
+static void streamDisable(void)
+{
+    for (int i = 0; i < _stream.num; i++)
+        streamFreeSlot(&_stream.slot[i]);
+    _stream.enabled = false;
+    _stream.num = 0;
+    _stream.latest = -1;
+}
+
+int readbackStreamEnable(Display_t* hwdevice, bool enable)
+{
+    bool mustconfig;
+    int i, num, size;
+
+#ifndef USE_IOMMU
+    mustconfig = true;
+#else
+    mustconfig = false;
+#endif
+    pthread_mutex_lock(&_stream.mutex);
+    if (!enable || _stream.enabled) {
+        if (!enable)
+            streamDisable();
+        pthread_mutex_unlock(&_stream.mutex);
+        return 0;
+    }
+
+    num = property_get_int32("persist.vendor.hwc.readback.buffers", READBACK_RING_N);
+    if (num < 2)
+        num = 2;
+    if (num > READBACK_RING_MAX)
+        num = READBACK_RING_MAX;
+    // big enough for the max writeback output in any format
+    size = writebackMaxBufferSize();
+    for (i = 0; i < num; i++) {
+        ReadbackSlot* slot = &_stream.slot[i];
+        private_handle_t* handle;
+
+        slot->state = SLOT_FREE;
+        slot->releaseFence = -1;
+        slot->layer = allocHwcLayer(hwdevice);
+        _stream.num = i + 1;
+        if (slot->layer == NULL)
+            goto err;
+        handle = (private_handle_t *)slot->layer->buffer;
+        handle->share_fd = ionAllocBuffer(size, mustconfig, 0);
+        if (handle->share_fd < 0)
+            goto err;
+    }
+    _stream.latest = -1;
+    _stream.enabled = true;
+    pthread_mutex_unlock(&_stream.mutex);
+    ALOGD("readback stream %d buffers of %d bytes", num, size);
+    return 0;
+
+err:
+    ALOGE("readback stream alloc err");
+    streamDisable();
+    pthread_mutex_unlock(&_stream.mutex);
+    return -1;
+}
+
+/* a free slot the client has finished, or the oldest frame not taken */
+static ReadbackSlot* streamDequeue(void)
+{
+    ReadbackSlot *slot, *ready = NULL;
+
+    for (int i = 0; i < _stream.num; i++) {
+        slot = &_stream.slot[i];
+        if (slot->state == SLOT_FREE) {
+            if (slot->releaseFence >= 0) {
+                if (sync_wait(slot->releaseFence, 0))
+                    continue;
+                close(slot->releaseFence);
+                slot->releaseFence = -1;
+            }
+            return slot;
+        }
+        if (slot->state == SLOT_READY && i != _stream.latest
+                && (ready == NULL || slot->frame < ready->frame))
+            ready = slot;
+    }
+    if (ready != NULL)
+        _stream.dropped++;
+    return ready;
+}
+
+static int streamCapture(Display_t* hwdevice, struct sync_info *sync)
+{
+    ReadbackSlot* slot;
+    int error;
+
+    pthread_mutex_lock(&_stream.mutex);
+    if (!_stream.enabled) {
+        pthread_mutex_unlock(&_stream.mutex);
+        return 0;
+    }
+    // only a slot the client has released, writeback never waits on present
+    slot = streamDequeue();
+    if (slot == NULL) {
+        _stream.busy++;
+        pthread_mutex_unlock(&_stream.mutex);
+        return 0;
+    }
+    // the last capture in it is not wanted any more
+    slot->state = SLOT_FREE;
+    error = writebackOneFrame(hwdevice, slot->layer, sync);
+    if (!error) {
+        slot->state = SLOT_READY;
+        slot->frame = hwdevice->frameCount;
+        _stream.latest = slot - _stream.slot;
+        _stream.captured++;
+    }
+    pthread_mutex_unlock(&_stream.mutex);
+    return error;
+}
+
+int readbackStreamBuffer(int index)
+{
+    private_handle_t* handle;
+    int fd = -1;
+
+    pthread_mutex_lock(&_stream.mutex);
+    if (_stream.enabled && index >= 0 && index < _stream.num) {
+        handle = (private_handle_t *)_stream.slot[index].layer->buffer;
+        fd = dup(handle->share_fd);
+    }
+    pthread_mutex_unlock(&_stream.mutex);
+    return fd;
+}
+
+int readbackStreamAcquire(ReadbackFrame_t* frame)
+{
+    ReadbackSlot* slot;
+    private_handle_t* handle;
+
+    pthread_mutex_lock(&_stream.mutex);
+    if (!_stream.enabled || _stream.latest < 0) {
+        pthread_mutex_unlock(&_stream.mutex);
+        return -1;
+    }
+    slot = &_stream.slot[_stream.latest];
+    handle = (private_handle_t *)slot->layer->buffer;
+    slot->state = SLOT_HELD;
+    frame->index = _stream.latest;
+    frame->frame = slot->frame;
+    frame->format = handle->format;
+    frame->width = (int)slot->layer->crop.right;
+    frame->height = (int)slot->layer->crop.bottom;
+    frame->stride = handle->stride;
+    frame->fence = slot->layer->acquireFence >= 0 ? dup(slot->layer->acquireFence) : -1;
+    _stream.latest = -1;
+    _stream.taken++;
+    pthread_mutex_unlock(&_stream.mutex);
+    return 0;
+}
+
+int readbackStreamRelease(int index, int32_t releaseFence)
+{
+    ReadbackSlot* slot;
+
+    pthread_mutex_lock(&_stream.mutex);
+    if (!_stream.enabled || index < 0 || index >= _stream.num
+            || _stream.slot[index].state != SLOT_HELD) {
+        pthread_mutex_unlock(&_stream.mutex);
+        if (releaseFence >= 0)
+            close(releaseFence);
+        return -1;
+    }
+    slot = &_stream.slot[index];
+    slot->state = SLOT_FREE;
+    slot->releaseFence = releaseFence;
+    pthread_mutex_unlock(&_stream.mutex);
+    return 0;
+}
+
+int readbackDump(char* outBuffer)
+{
+    if (!_stream.enabled)
+        return 0;
+    return sprintf(outBuffer, "readback stream buf:%d captured:%u taken:%u drop:%u busy:%u\n",
+            _stream.num, _stream.captured, _stream.taken, _stream.dropped, _stream.busy);
+}
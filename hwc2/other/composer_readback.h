@@ -29,7 +29,24 @@ void setReadbackBuffer(hwc2_display_t display,
 int32_t getReadbackBufferFence(hwc2_display_t display, int32_t* fence);
 
 int doReadback(Display_t* hwdevice, struct sync_info *sync);
+bool readbackPending(void);
 void resetReadback(void);
 
+// one captured frame of the readback stream
+typedef struct ReadbackFrame {
+    int index;     // slot, mapped once by readbackStreamBuffer()
+    unsigned int frame;
+    int format;
+    int width;
+    int height;
+    int stride;
+    int32_t fence; // signal when the capture is done, owned by the caller
+} ReadbackFrame_t;
+
+int readbackStreamEnable(Display_t* hwdevice, bool enable);
+int readbackStreamBuffer(int index);
+int readbackStreamAcquire(ReadbackFrame_t* frame);
+int readbackStreamRelease(int index, int32_t releaseFence);
+
 #endif
 
@@ -18,6 +18,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <sys/time.h>
 
 /*******************enhance and smt_backlight*****************/
 char attr_array[][20] =
@@ -58,10 +60,24 @@ extern int dispFd;
   * setprop debug.hwc  close.d1z1 or ....
   * setprop debug.hwc  show  or ....
   * setprop debug.hwc  off or off.dump.d0z2
+  * setprop debug.hwc  on.timing or off.timing
+  * setprop debug.hwc  on.trace or off.trace
   */
+#define FRAME_TIME_N 128
+#define TRACE_PATH "/data/hwc_trace.txt"
+#define TRACE_LINE 256
+
+typedef struct frameTime{
+	unsigned int frame;
+	int64_t ts[FRAME_PHASE_NUM];
+}frameTime_t;
+
 typedef struct debugPerDisp{
 	double fPreTime;
 	unsigned preFramecout;
+	frameTime_t frameTime[FRAME_TIME_N];
+	int64_t traceBegin;
+	int traceMem;
 }debugPerDisp_t;
 
 typedef struct hwcDebugFlags{
@@ -73,6 +89,9 @@ typedef struct hwcDebugFlags{
 	bool closeLayer;
 	bool ctrlfps;
 	bool stopSubmit;
+	bool showTiming;
+	bool traceLayer;
+	int traceFd;
 	int dumpDisplay;
 	int dumpZorder;
 	int closeDisplay;
@@ -80,9 +99,16 @@ typedef struct hwcDebugFlags{
 	debugPerDisp_t *debugDisp;
 } hwcDebugFlags_t;
 
+/*
+ * header of a hwc_malloc block, node is only linked to memList
+ * when the block is sampled by the mem debug.
+ */
 typedef struct hwcDebugmem{
 	struct listnode node;
+	void *caller;
 	int size;
+	short type;
+	bool tracked;
 	int data[0];
 } hwcDebugmem_t;
 
@@ -93,10 +119,17 @@ typedef struct hwcEnhanceinfo{
 
 hwcEnhanceinfo_t *enhanceinfo;
 
+static const char *memTypeName[MEM_TYPE_NUM] = {
+	"misc", "layer", "submit", "rotate", "writeback",
+};
 static struct listnode memList;
 static int memSize;
+static int memUsed[MEM_TYPE_NUM];
+static int memPeak[MEM_TYPE_NUM];
 static pthread_mutex_t memMutex;
-static bool memdebug = 0;
+static unsigned int memSeq;
+/* 0 off, or track 1 of memdebug allocations with the caller */
+static int memdebug = 0;
 
 hwcDebugFlags_t hwdeg;
 
@@ -294,6 +327,21 @@ void enhanceInit(void)
 	}
 }
 
+static void traceWrite(const char *fmt, ...)
+{
+	char line[TRACE_LINE];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+	if (len > 0 && write(hwcDebug->traceFd, line, len) != len)
+		ALOGV("write trace err %d", errno);
+}
+
 bool isStopSubmit() {
 	return hwcDebug->stopSubmit;
 }
@@ -339,6 +387,17 @@ void updateDebugFlags(void)
 				hwcDebug->ctrlfps = 0;
 				ALOGD("hwc close ctrlfps mode");
 			}
+			if (!hwc_cmp("off.timing", ps_fix, 0)
+				&& hwcDebug->showTiming == 1) {
+				hwcDebug->showTiming = 0;
+				ALOGD("hwc close show timing mode");
+			}
+			if ((!hwc_cmp("off.trace", ps_fix, 0) || !hwc_cmp("0", ps_fix, 0))
+				&& hwcDebug->traceLayer == 1) {
+				hwcDebug->traceLayer = 0;
+				close(hwcDebug->traceFd);
+				ALOGD("hwc close trace mode");
+			}
 			if(hwc_cmp("off.", ps_fix, 0)
 				&& hwcDebug->on == 1) {
 				hwcDebug->on = 0;
@@ -366,6 +425,22 @@ void updateDebugFlags(void)
 				hwcDebug->ctrlfps = 1;
 				ALOGD("hwc open ctrl fps mode");
 			}
+			if(hwcDebug->showTiming == 0
+				&& !hwc_cmp("on.timing", ps_fix, 0)) {
+				hwcDebug->showTiming = 1;
+				ALOGD("hwc open show timing mode");
+			}
+			if(hwcDebug->traceLayer == 0
+				&& !hwc_cmp("on.trace", ps_fix, 0)) {
+				hwcDebug->traceFd = open(TRACE_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				if (hwcDebug->traceFd >= 0) {
+					hwcDebug->traceLayer = 1;
+					traceWrite("# hwc layer trace v1\n");
+					ALOGD("hwc open trace mode to %s", TRACE_PATH);
+				} else {
+					ALOGE("open %s err %d", TRACE_PATH, errno);
+				}
+			}
 
 			if(hwcDebug->dumpLayer == 0
 				&& (!hwc_cmp("on.dump", ps_fix, 0) || !hwc_cmp("dump", ps_fix, 0))) {
@@ -494,6 +569,11 @@ void showfps(Display_t *display)
 					(int)(((display->frameCount - hwcDebug->debugDisp[display->displayId].preFramecout) * 1.0f+0.59)
 						/ (fCurrentTime - hwcDebug->debugDisp[display->displayId].fPreTime)));
 		}
+		if (hwcDebug->showTiming && hwcDebug->on) {
+			char timing[1024];
+			frameTimeDump(display, timing);
+			ALOGD(">>>Display:%d %s", display->displayId, timing);
+		}
 
 
 #ifndef TARGET_PLATFORM_HOMLET
@@ -512,6 +592,125 @@ void showfps(Display_t *display)
 	}
 }
 
+/*
+ * always on, the ring slot is opened by validate/present of the frame,
+ * other phases only fill the slot that still belong to their frame.
+ */
+void frameTimeMark(Display_t *display, unsigned int frame, int phase)
+{
+	frameTime_t *ft;
+	struct timespec now;
+
+	if (hwcDebug->debugDisp == NULL)
+		return;
+	ft = &hwcDebug->debugDisp[display->displayId].frameTime[frame & (FRAME_TIME_N - 1)];
+	if (ft->frame != frame) {
+		if (phase != FRAME_VALIDATE && phase != FRAME_PRESENT)
+			return;
+		memset(ft->ts, 0, sizeof(ft->ts));
+		ft->frame = frame;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ft->ts[phase] = now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int cmpInt(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static const char *phaseName[FRAME_PHASE_NUM] = {
+	"total",
+	"vali-pres",
+	"pres-enq",
+	"enq-fence",
+	"fence-commit",
+	"commit-retire",
+};
+
+/* percentile of every phase cost in us, [0] is validate to retire */
+int frameTimeDump(Display_t *display, char *outBuffer)
+{
+	frameTime_t *ring;
+	int cost[FRAME_TIME_N];
+	int i, phase, num, count = 0;
+	int64_t from, to;
+
+	if (hwcDebug->debugDisp == NULL)
+		return 0;
+	ring = hwcDebug->debugDisp[display->displayId].frameTime;
+	count += sprintf(outBuffer + count, "timing(us) p50/p90/p99/max:\n");
+	for (phase = 0; phase < FRAME_PHASE_NUM; phase++) {
+		num = 0;
+		for (i = 0; i < FRAME_TIME_N; i++) {
+			from = ring[i].ts[phase == 0 ? FRAME_VALIDATE : phase - 1];
+			to = ring[i].ts[phase == 0 ? FRAME_RETIRE : phase];
+			if (from == 0 || to == 0 || to < from)
+				continue;
+			cost[num++] = (int)((to - from) / 1000);
+		}
+		if (num == 0) {
+			count += sprintf(outBuffer + count, "  %-13s: -\n", phaseName[phase]);
+			continue;
+		}
+		qsort(cost, num, sizeof(int), cmpInt);
+		count += sprintf(outBuffer + count, "  %-13s: %d/%d/%d/%d n:%d\n", phaseName[phase],
+				cost[num * 50 / 100], cost[num * 90 / 100], cost[num * 99 / 100],
+				cost[num - 1], num);
+	}
+	return count;
+}
+
+/*
+ * layer stack trace, one block per validate:
+ * F disp frame validate_us malloc_bytes layers
+ * L z result typechange dueto format w h stride
+ *   crop(l t r b) frame(l t r b) transform blend alpha dataspace damaged
+ * the geometry is what surfaceflinger set, the result is ours,
+ * so the trace can be replayed to compare the assignment and the cost.
+ */
+void traceLayerBegin(Display_t *display)
+{
+	struct timespec now;
+
+	if (!hwcDebug->on || !hwcDebug->traceLayer || hwcDebug->debugDisp == NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	hwcDebug->debugDisp[display->displayId].traceBegin = now.tv_sec * 1000000000LL + now.tv_nsec;
+	hwcDebug->debugDisp[display->displayId].traceMem = memSize;
+}
+
+void traceLayerEnd(Display_t *display)
+{
+	debugPerDisp_t *disp;
+	struct listnode *node;
+	private_handle_t *handle;
+	struct timespec now;
+	Layer_t *layer;
+	int64_t cost;
+
+	if (!hwcDebug->on || !hwcDebug->traceLayer || hwcDebug->debugDisp == NULL)
+		return;
+	disp = &hwcDebug->debugDisp[display->displayId];
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	cost = now.tv_sec * 1000000000LL + now.tv_nsec - disp->traceBegin;
+	traceWrite("F %d %u %lld %d %d\n", display->displayId, display->frameCount,
+			(long long)(cost / 1000), memSize - disp->traceMem, display->nubmerLayer);
+
+	list_for_each(node, display->layerSortedByZorder) {
+		layer = node_to_item(node, Layer_t, node);
+		handle = (private_handle_t *)layer->buffer;
+		traceWrite("L %d %d %d %d %d %d %d %d %.1f %.1f %.1f %.1f %d %d %d %d %d %d %.3f %d %d\n",
+			layer->zorder, layer->compositionType, layer->typeChange, layer->duetoFlag,
+			handle ? handle->format : 0, handle ? handle->width : 0,
+			handle ? handle->height : 0, handle ? handle->stride : 0,
+			layer->crop.left, layer->crop.top, layer->crop.right, layer->crop.bottom,
+			layer->frame.left, layer->frame.top, layer->frame.right, layer->frame.bottom,
+			layer->transform, layer->blendMode, layer->planeAlpha,
+			layer->dataspace, layer->damaged);
+	}
+}
+
 bool showLayers(void)
 {
 	if (!hwcDebug->on || !hwcDebug->showLyaer)
@@ -527,10 +726,11 @@ hwcDebugmem_t* to_hwc_mem(void *mem)
 	return (hwcDebugmem_t*)(((char *)mem) - size);
 }
 
-void *hwc_malloc(int size)
+static void *memAlloc(int size, int type, void *caller)
 {
 	hwcDebugmem_t *mem;
-	int realsize;
+	int realsize, used, peak;
+
 	realsize = sizeof(hwcDebugmem_t) + size;
 	mem = (hwcDebugmem_t *)malloc(realsize);
 	if (mem == NULL) {
@@ -539,47 +739,135 @@ void *hwc_malloc(int size)
 	}
 	memset(mem, 0, realsize);
 	mem->size = size;
-	if (memdebug){
-		list_init(&mem->node);
+	mem->type = type;
+	list_init(&mem->node);
+	if (memdebug && __atomic_add_fetch(&memSeq, 1, __ATOMIC_RELAXED) % memdebug == 0) {
+		mem->caller = caller;
+		mem->tracked = 1;
 		pthread_mutex_lock(&memMutex);
 		list_add_tail(&memList, &mem->node);
 		pthread_mutex_unlock(&memMutex);
 	}
 
-	memSize += size;
+	__atomic_add_fetch(&memSize, size, __ATOMIC_RELAXED);
+	used = __atomic_add_fetch(&memUsed[type], size, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&memPeak[type], __ATOMIC_RELAXED);
+	while (used > peak && !__atomic_compare_exchange_n(&memPeak[type], &peak, used,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
 	return (void *)mem->data;
 }
 
+void *hwc_malloc(int size)
+{
+	return memAlloc(size, MEM_MISC, __builtin_return_address(0));
+}
+
+void *hwc_malloc_type(int size, int type)
+{
+	return memAlloc(size, type, __builtin_return_address(0));
+}
+
 void hwc_free(void *mem)
 {
 	hwcDebugmem_t *mem2;
 
 	mem2 = to_hwc_mem(mem);
-	if (memdebug){
+	if (mem2->tracked) {
 		pthread_mutex_lock(&memMutex);
 		list_remove(&mem2->node);
-		list_init(&mem2->node);
 		pthread_mutex_unlock(&memMutex);
 	}
-	memSize -= mem2->size;
+	__atomic_sub_fetch(&memSize, mem2->size, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&memUsed[mem2->type], mem2->size, __ATOMIC_RELAXED);
 	free(mem2);
 }
 
+/* the live sampled blocks summed by caller, for leak hunting */
+static int memCallerDump(char* outBuffer)
+{
+	struct {
+		void *caller;
+		int type;
+		int num;
+		int size;
+	} callers[MEM_CALLER_N];
+	struct listnode *node;
+	hwcDebugmem_t *mem;
+	int i, n = 0, other = 0, count = 0;
+
+	pthread_mutex_lock(&memMutex);
+	list_for_each(node, &memList) {
+		mem = node_to_item(node, hwcDebugmem_t, node);
+		for (i = 0; i < n; i++) {
+			if (callers[i].caller == mem->caller)
+				break;
+		}
+		if (i == n) {
+			if (n == MEM_CALLER_N) {
+				other++;
+				continue;
+			}
+			callers[n].caller = mem->caller;
+			callers[n].type = mem->type;
+			callers[n].num = 0;
+			callers[n].size = 0;
+			n++;
+		}
+		callers[i].num++;
+		callers[i].size += mem->size;
+	}
+	pthread_mutex_unlock(&memMutex);
+
+	for (i = 0; i < n; i++) {
+		if (outBuffer != NULL)
+			count += sprintf(outBuffer + count, "  %p %s num:%d size:%d\n", callers[i].caller,
+					memTypeName[callers[i].type], callers[i].num, callers[i].size);
+		else
+			ALOGD("  %p %s num:%d size:%d", callers[i].caller,
+				memTypeName[callers[i].type], callers[i].num, callers[i].size);
+	}
+	if (other && outBuffer != NULL)
+		count += sprintf(outBuffer + count, "  other:%d\n", other);
+	return count;
+}
+
 int hwc_mem_dump(char* outBuffer)
 {
-	if (outBuffer != NULL) {
-		return sprintf(outBuffer, "memmalloc:%d\n", memSize);
-	}else{
-		ALOGD("memmalloc:%d\n", memSize);
+	char line[256];
+	int i, len;
+
+	len = sprintf(line, "memmalloc:%d", memSize);
+	for (i = 0; i < MEM_TYPE_NUM; i++)
+		len += sprintf(line + len, " %s:%d/%d", memTypeName[i], memUsed[i], memPeak[i]);
+	if (outBuffer == NULL) {
+		ALOGD("%s", line);
+		if (memdebug)
+			memCallerDump(NULL);
+		return 0;
 	}
-	return 0;
+	len = sprintf(outBuffer, "%s\n", line);
+	if (memdebug) {
+		len += sprintf(outBuffer + len, "mem debug 1/%d callers:\n", memdebug);
+		len += memCallerDump(outBuffer + len);
+	}
+	return len;
 }
 
+/*
+ * setprop persist.vendor.hwc.memdebug N before hwc start,
+ * record 1 of N allocations with its caller, 0 is off.
+ */
 void hwc_mem_debug_init(void)
 {
 	pthread_mutex_init(&memMutex, 0);
 	list_init(&memList);
 	memSize = 0;
+	memdebug = property_get_int32("persist.vendor.hwc.memdebug", 0);
+	if (memdebug < 0)
+		memdebug = 0;
+	if (memdebug)
+		ALOGD("hwc mem debug 1/%d", memdebug);
 }
 
 void debugInit(int num)
@@ -613,6 +901,8 @@ void debugInitDisplay(Display_t *display)
 	fCurrentTime = tv.tv_sec + tv.tv_usec / 1.0e6;
 	hwcDebug->debugDisp[display->displayId].fPreTime = fCurrentTime;
 	hwcDebug->debugDisp[display->displayId].preFramecout = 0;
+	memset(hwcDebug->debugDisp[display->displayId].frameTime, 0,
+			sizeof(hwcDebug->debugDisp[display->displayId].frameTime));
 
 }
 
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include "g2d_compose.h"
+
+/*
+ * g2d pre-composition:
+ * the layers which can not get a pipe are blended by g2d into a scratch
+ * buffer in the submit thread, and the scratch is shown in the client
+ * target's place, so the gpu is not needed for them.
+ * the scratch is reused after the frame using it is released, the one
+ * of the last committed frame may stay on screen until the frame being
+ * composed is shown, so it is never waited for.
+ */
+#define G2D_SCRATCH_N 3
+#define G2D_COMPOSE_DISP 2
+#define G2D_ERR_MAX 3
+/* an older frame is released by the next vsync at most */
+#define G2D_RELEASE_WAIT_MS 32
+
+typedef struct g2dScratch {
+	int shareFd;
+	int releaseFd;
+	int size;
+	unsigned int frameCount;
+}g2dScratch_t;
+
+typedef struct g2dComposeDisp {
+	g2dScratch_t scratch[G2D_SCRATCH_N];
+	int onScreen;//scratch of the last committed frame
+	unsigned int frames;
+	unsigned int layers;
+	int errCnt;//contiguous err, disable g2d when too many
+	bool fallback;//a frame failed, the next assign goes to the gpu
+	unsigned int errTotal;
+}g2dComposeDisp_t;
+
+static bool g2dReady;
+static g2dComposeDisp_t g2dDisp[G2D_COMPOSE_DISP];
+
+static void scratchFree(g2dScratch_t *scratch)
+{
+	if (scratch->releaseFd >= 0) {
+		sync_wait(scratch->releaseFd, 3000);
+		close(scratch->releaseFd);
+		scratch->releaseFd = -1;
+	}
+	if (scratch->shareFd >= 0)
+		close(scratch->shareFd);
+	scratch->shareFd = -1;
+	scratch->size = 0;
+}
+
+int g2dComposeInit(void)
+{
+	int i, j;
+
+	memset(g2dDisp, 0, sizeof(g2dDisp));
+	for (i = 0; i < G2D_COMPOSE_DISP; i++) {
+		for (j = 0; j < G2D_SCRATCH_N; j++) {
+			g2dDisp[i].scratch[j].shareFd = -1;
+			g2dDisp[i].scratch[j].releaseFd = -1;
+		}
+		g2dDisp[i].onScreen = -1;
+	}
+	if (g2dComposeBackend.open() < 0) {
+		ALOGE("g2d compose %s backend open err", g2dComposeBackend.name);
+		return -1;
+	}
+	g2dReady = 1;
+	ALOGD("g2d compose with %s backend", g2dComposeBackend.name);
+	return 0;
+}
+
+void g2dComposeDeinit(void)
+{
+	int i, j;
+
+	if (!g2dReady)
+		return;
+	g2dReady = 0;
+	for (i = 0; i < G2D_COMPOSE_DISP; i++) {
+		for (j = 0; j < G2D_SCRATCH_N; j++)
+			scratchFree(&g2dDisp[i].scratch[j]);
+	}
+	g2dComposeBackend.close();
+}
+
+bool g2dComposeUsable(Display_t *display)
+{
+	return g2dReady && display->displayId < G2D_COMPOSE_DISP
+		&& g2dDisp[display->displayId].errCnt < G2D_ERR_MAX;
+}
+
+/* true once after a failed composition, the layers go back to the gpu */
+bool g2dComposeFallback(Display_t *display)
+{
+	if (!g2dReady || display->displayId >= G2D_COMPOSE_DISP)
+		return false;
+	return __atomic_exchange_n(&g2dDisp[display->displayId].fallback, 0, __ATOMIC_ACQ_REL);
+}
+
+static inline bool g2dFormatSupport(int format)
+{
+	switch (format) {
+	case HAL_PIXEL_FORMAT_RGBA_8888:
+	case HAL_PIXEL_FORMAT_RGBX_8888:
+	case HAL_PIXEL_FORMAT_BGRA_8888:
+	case HAL_PIXEL_FORMAT_BGRX_8888:
+	case HAL_PIXEL_FORMAT_RGB_565:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * only the layers which missed a pipe, and g2d blend them 1:1,
+ * the gpu keeps the scale, transform, and the rest.
+ */
+bool g2dComposeSupport(Display_t *display, Layer_t *layer)
+{
+	Layer_t *fb = display->clientTargetLayer;
+	private_handle_t *handle = (private_handle_t *)layer->buffer;
+	private_handle_t *fbHandle;
+
+	if (!g2dComposeUsable(display) || fb == NULL || fb->buffer == NULL)
+		return false;
+	fbHandle = (private_handle_t *)fb->buffer;
+	if (fbHandle->format != HAL_PIXEL_FORMAT_RGBA_8888
+		&& fbHandle->format != HAL_PIXEL_FORMAT_BGRA_8888)
+		return false;
+
+	switch (layer->duetoFlag) {
+	case NO_V_PIPE:
+	case NO_U_PIPE:
+	case CROSS_FB:
+	case MEM_CTRL:
+		break;
+	default:
+		return false;
+	}
+	if (handle == NULL || layerIsProtected(layer) || is_afbc_buf(layer->buffer)
+		|| layer->transform != 0 || !g2dFormatSupport(handle->format))
+		return false;
+	if ((int)(layer->crop.right - layer->crop.left) != layer->frame.right - layer->frame.left
+		|| (int)(layer->crop.bottom - layer->crop.top) != layer->frame.bottom - layer->frame.top)
+		return false;
+	if ((int)(fb->crop.right - fb->crop.left) != fb->frame.right - fb->frame.left
+		|| (int)(fb->crop.bottom - fb->crop.top) != fb->frame.bottom - fb->frame.top)
+		return false;
+
+	return layer->frame.left >= fb->frame.left && layer->frame.top >= fb->frame.top
+		&& layer->frame.right <= fb->frame.right && layer->frame.bottom <= fb->frame.bottom;
+}
+
+static void layerToSurface(Layer_t *layer, g2dSurface_t *surface)
+{
+	private_handle_t *handle = (private_handle_t *)layer->buffer;
+
+	surface->fd = handle->share_fd;
+	surface->format = handle->format;
+	surface->width = handle->stride;
+	surface->height = handle->height;
+	surface->align = handle->aw_byte_align[0];
+	surface->rect.left = (int)layer->crop.left;
+	surface->rect.top = (int)layer->crop.top;
+	surface->rect.right = (int)layer->crop.right;
+	surface->rect.bottom = (int)layer->crop.bottom;
+	surface->alpha = (int)ceilf(255 * layer->planeAlpha);
+	surface->premult = layer->blendMode == HWC2_BLEND_MODE_PREMULTIPLIED;
+	surface->blended = layer->blendMode != HWC2_BLEND_MODE_NONE;
+}
+
+static inline bool scratchReleased(g2dScratch_t *scratch)
+{
+	if (scratch->releaseFd >= 0 && sync_wait(scratch->releaseFd, 0))
+		return false;
+	if (scratch->releaseFd >= 0)
+		close(scratch->releaseFd);
+	scratch->releaseFd = -1;
+	return true;
+}
+
+/*
+ * a released scratch but the one on screen, or the oldest other one
+ * which the next vsync releases. frames may be dropped between two
+ * compositions, so the frame count can not pick it.
+ */
+static g2dScratch_t* scratchGet(g2dComposeDisp_t *g2d, unsigned int frameCount)
+{
+	g2dScratch_t *oldest = NULL;
+	int i;
+
+	for (i = 0; i < G2D_SCRATCH_N; i++) {
+		if (i == g2d->onScreen)
+			continue;
+		if (scratchReleased(&g2d->scratch[i])) {
+			g2d->onScreen = i;
+			return &g2d->scratch[i];
+		}
+		if (oldest == NULL || (int)(g2d->scratch[i].frameCount - oldest->frameCount) < 0)
+			oldest = &g2d->scratch[i];
+	}
+	if (sync_wait(oldest->releaseFd, G2D_RELEASE_WAIT_MS)) {
+		ALOGE("g2d compose no scratch released frame:%u", frameCount);
+		return NULL;
+	}
+	scratchReleased(oldest);
+	g2d->onScreen = (int)(oldest - g2d->scratch);
+	return oldest;
+}
+
+/*
+ * layer[] is in zorder, blend them into a scratch and
+ * let the client target display it.
+ */
+int g2dComposeLayers(LayerSubmit_t *submitLayer, Layer_t *fb, Layer_t **layer, int num)
+{
+	g2dComposeDisp_t *g2d = &g2dDisp[submitLayer->hwid];
+	g2dScratch_t *scratch;
+	private_handle_t *fbHandle = (private_handle_t *)fb->buffer;
+	g2dSurface_t dst, src;
+	int i, size, dx, dy;
+
+	ATRACE_CALL();
+	scratch = scratchGet(g2d, submitLayer->frameCount);
+	if (scratch == NULL)
+		goto err;
+	scratch->frameCount = submitLayer->frameCount;
+	dst.fd = -1;
+	dst.format = fbHandle->format;
+	dst.width = fbHandle->stride;
+	dst.height = fbHandle->height;
+	dst.align = fbHandle->aw_byte_align[0];
+	dst.rect.left = 0;
+	dst.rect.top = 0;
+	dst.rect.right = fbHandle->stride;
+	dst.rect.bottom = fbHandle->height;
+	size = HWC_ALIGN(g2dSurfacePitch(&dst) * dst.height, 4096);
+
+	if (scratch->size < size) {
+		scratchFree(scratch);
+		scratch->shareFd = g2dComposeBackend.allocBuffer(size);
+		if (scratch->shareFd < 0) {
+			ALOGE("g2d compose alloc scratch err");
+			goto err;
+		}
+		scratch->size = size;
+	}
+	dst.fd = scratch->shareFd;
+	if (g2dComposeBackend.clear(&dst))
+		goto err;
+
+	/* display frame to the client target buffer */
+	dx = (int)fb->crop.left - fb->frame.left;
+	dy = (int)fb->crop.top - fb->frame.top;
+	for (i = 0; i < num; i++) {
+		layerToSurface(layer[i], &src);
+		dst.rect.left = layer[i]->frame.left + dx;
+		dst.rect.top = layer[i]->frame.top + dy;
+		dst.rect.right = layer[i]->frame.right + dx;
+		dst.rect.bottom = layer[i]->frame.bottom + dy;
+		if (g2dComposeBackend.blend(&dst, &src))
+			goto err;
+	}
+
+	scratch->releaseFd = dup(submitLayer->sync.fd);
+	close(fbHandle->share_fd);
+	fbHandle->share_fd = dup(scratch->shareFd);
+	g2d->frames++;
+	g2d->layers += num;
+	g2d->errCnt = 0;
+	return 0;
+
+err:
+	g2d->errCnt++;
+	g2d->errTotal++;
+	if (g2d->errCnt == G2D_ERR_MAX)
+		ALOGE("g2d compose disabled on display %d after %d errors",
+			submitLayer->hwid, G2D_ERR_MAX);
+	__atomic_store_n(&g2d->fallback, 1, __ATOMIC_RELEASE);
+	return -1;
+}
+
+int g2dComposeDump(Display_t *display, char *outBuffer)
+{
+	g2dComposeDisp_t *g2d;
+
+	if (!g2dReady || display->displayId >= G2D_COMPOSE_DISP)
+		return 0;
+	g2d = &g2dDisp[display->displayId];
+	return sprintf(outBuffer, "g2d compose(%s) frames:%u layers:%u err:%u\n",
+			g2dComposeBackend.name, g2d->frames, g2d->layers, g2d->errTotal);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __G2D_COMPOSE_H
+#define __G2D_COMPOSE_H
+
+/*
+ * one plane of a 32/16 bit rgb buffer,
+ * width is the line length in pixel, rect is the clip in the buffer.
+ */
+typedef struct g2dSurface {
+	int fd;
+	int format;//HAL_PIXEL_FORMAT_xxx
+	int width;
+	int height;
+	int align;
+	hwc_rect_t rect;
+	int alpha;//plane alpha 0~255
+	bool premult;
+	bool blended;//use the pixel alpha
+}g2dSurface_t;
+
+/*
+ * backend of the pre-composition, the device one drive /dev/g2d,
+ * the stub one blend by cpu so it can run without the hardware.
+ * blend() is src over dst, src->rect and dst->rect have the same size.
+ */
+typedef struct g2dComposeOps {
+	const char *name;
+	int (*open)(void);
+	void (*close)(void);
+	int (*allocBuffer)(int size);
+	int (*clear)(g2dSurface_t *dst);
+	int (*blend)(g2dSurface_t *dst, g2dSurface_t *src);
+}g2dComposeOps_t;
+
+extern g2dComposeOps_t g2dComposeBackend;
+
+static inline int g2dSurfaceBpp(g2dSurface_t *surface)
+{
+	return surface->format == HAL_PIXEL_FORMAT_RGB_565 ? 2 : 4;
+}
+
+/* same as the display: DISPALIGN(width * bpp, align) */
+static inline int g2dSurfacePitch(g2dSurface_t *surface)
+{
+	int align = surface->align > 0 ? surface->align : 1;
+
+	return HWC_ALIGN(surface->width * g2dSurfaceBpp(surface), align);
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include "g2d_compose.h"
+
+/* g2d pre-composition backend on /dev/g2d */
+static int g2dFd = -1;
+
+#ifndef USE_IOMMU
+static const bool g2dMustConfig = 1;
+#else
+static const bool g2dMustConfig = 0;
+#endif
+
+static inline g2d_fmt_enh toG2dFormat(int format)
+{
+	switch (format) {
+	case HAL_PIXEL_FORMAT_RGBX_8888:
+		return G2D_FORMAT_RGBX8888;
+	case HAL_PIXEL_FORMAT_BGRA_8888:
+		return G2D_FORMAT_BGRA8888;
+	case HAL_PIXEL_FORMAT_BGRX_8888:
+		return G2D_FORMAT_BGRX8888;
+	case HAL_PIXEL_FORMAT_RGB_565:
+		return G2D_FORMAT_RGB565;
+	case HAL_PIXEL_FORMAT_RGBA_8888:
+	default:
+		return G2D_FORMAT_RGBA8888;
+	}
+}
+
+static void toG2dImage(g2dSurface_t *surface, g2d_image_enh *image)
+{
+	memset(image, 0, sizeof(g2d_image_enh));
+	image->use_phy_addr = 0;
+	image->fd = surface->fd;
+	image->format = toG2dFormat(surface->format);
+	image->width = surface->width;
+	image->height = surface->height;
+	image->align[0] = surface->align;
+	image->clip_rect.x = surface->rect.left;
+	image->clip_rect.y = surface->rect.top;
+	image->clip_rect.w = surface->rect.right - surface->rect.left;
+	image->clip_rect.h = surface->rect.bottom - surface->rect.top;
+	image->alpha = surface->alpha;
+	image->mode = surface->blended ? G2D_MIXER_ALPHA : G2D_GLOBAL_ALPHA;
+	image->bpremul = surface->premult;
+}
+
+static int g2dDevOpen(void)
+{
+	g2dFd = open("/dev/g2d", O_RDWR);
+	if (g2dFd < 0) {
+		ALOGE("Failed to open g2d device %d", errno);
+		return -1;
+	}
+	return 0;
+}
+
+static void g2dDevClose(void)
+{
+	if (g2dFd >= 0)
+		close(g2dFd);
+	g2dFd = -1;
+}
+
+static int g2dDevAllocBuffer(int size)
+{
+	return ionAllocBuffer(size, g2dMustConfig, 0);
+}
+
+static int g2dDevClear(g2dSurface_t *dst)
+{
+	g2d_fillrect_h fill;
+	int ret;
+
+	toG2dImage(dst, &fill.dst_image_h);
+	fill.dst_image_h.color = 0;
+	fill.dst_image_h.alpha = 0;
+	fill.dst_image_h.mode = G2D_GLOBAL_ALPHA;
+	ret = ioctl(g2dFd, G2D_CMD_FILLRECT_H, (unsigned long)&fill);
+	if (ret < 0)
+		ALOGE("g2d compose clear err %d", errno);
+	return ret;
+}
+
+static int g2dDevBlend(g2dSurface_t *dst, g2dSurface_t *src)
+{
+	g2d_bld bld;
+	int ret;
+
+	memset(&bld, 0, sizeof(g2d_bld));
+	bld.bld_cmd = G2D_BLD_SRCOVER;
+	toG2dImage(src, &bld.src_image_h);
+	toG2dImage(dst, &bld.dst_image_h);
+	/* the client target keep premultiplied like the gpu one */
+	bld.dst_image_h.bpremul = 1;
+	bld.dst_image_h.alpha = 0xff;
+	bld.dst_image_h.mode = G2D_PIXEL_ALPHA;
+	ret = ioctl(g2dFd, G2D_CMD_BLD_H, (unsigned long)&bld);
+	if (ret < 0)
+		ALOGE("g2d compose blend err %d", errno);
+	return ret;
+}
+
+g2dComposeOps_t g2dComposeBackend = {
+	.name = "g2d",
+	.open = g2dDevOpen,
+	.close = g2dDevClose,
+	.allocBuffer = g2dDevAllocBuffer,
+	.clear = g2dDevClear,
+	.blend = g2dDevBlend,
+};
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include "g2d_compose.h"
+#include <sys/syscall.h>
+
+/*
+ * g2d pre-composition backend blending by cpu, same result as the g2d one,
+ * only linked into the tests, the device uses /dev/g2d or no g2d compose.
+ * buffers are memfd so they can be mapped anywhere.
+ */
+
+static int g2dStubOpen(void)
+{
+	return 0;
+}
+
+static void g2dStubClose(void)
+{
+}
+
+static int g2dStubAllocBuffer(int size)
+{
+	int fd;
+
+	fd = syscall(__NR_memfd_create, "g2d_stub", 0);
+	if (fd < 0) {
+		ALOGE("g2d stub memfd err %d", errno);
+		return -1;
+	}
+	if (ftruncate(fd, size) < 0) {
+		ALOGE("g2d stub resize err %d", errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static unsigned char* surfaceMap(g2dSurface_t *surface, int *size, int prot)
+{
+	void *addr;
+
+	*size = g2dSurfacePitch(surface) * surface->height;
+	addr = mmap(NULL, *size, prot, MAP_SHARED, surface->fd, 0);
+	if (addr == MAP_FAILED) {
+		ALOGE("g2d stub map fd:%d err %d", surface->fd, errno);
+		return NULL;
+	}
+	return (unsigned char *)addr;
+}
+
+/* to r g b a */
+static inline void loadPixel(int format, unsigned char *p, unsigned int *c)
+{
+	unsigned short v;
+
+	switch (format) {
+	case HAL_PIXEL_FORMAT_RGB_565:
+		v = p[0] | (p[1] << 8);
+		c[0] = ((v >> 11) & 0x1f) * 255 / 31;
+		c[1] = ((v >> 5) & 0x3f) * 255 / 63;
+		c[2] = (v & 0x1f) * 255 / 31;
+		c[3] = 255;
+		break;
+	case HAL_PIXEL_FORMAT_BGRA_8888:
+	case HAL_PIXEL_FORMAT_BGRX_8888:
+		c[0] = p[2];
+		c[1] = p[1];
+		c[2] = p[0];
+		c[3] = format == HAL_PIXEL_FORMAT_BGRA_8888 ? p[3] : 255;
+		break;
+	default:
+		c[0] = p[0];
+		c[1] = p[1];
+		c[2] = p[2];
+		c[3] = format == HAL_PIXEL_FORMAT_RGBA_8888 ? p[3] : 255;
+	}
+}
+
+static inline void storePixel(int format, unsigned char *p, unsigned int *c)
+{
+	if (format == HAL_PIXEL_FORMAT_BGRA_8888) {
+		p[0] = c[2];
+		p[1] = c[1];
+		p[2] = c[0];
+	} else {
+		p[0] = c[0];
+		p[1] = c[1];
+		p[2] = c[2];
+	}
+	p[3] = c[3];
+}
+
+static int g2dStubClear(g2dSurface_t *dst)
+{
+	unsigned char *addr;
+	int size, y, pitch, bpp;
+
+	addr = surfaceMap(dst, &size, PROT_READ | PROT_WRITE);
+	if (addr == NULL)
+		return -1;
+	pitch = g2dSurfacePitch(dst);
+	bpp = g2dSurfaceBpp(dst);
+	for (y = dst->rect.top; y < dst->rect.bottom; y++)
+		memset(addr + y * pitch + dst->rect.left * bpp, 0,
+			(dst->rect.right - dst->rect.left) * bpp);
+	munmap(addr, size);
+	return 0;
+}
+
+/* src over premultiplied dst */
+static int g2dStubBlend(g2dSurface_t *dst, g2dSurface_t *src)
+{
+	unsigned char *daddr, *saddr, *d, *s;
+	unsigned int sc[4], dc[4], a, i;
+	int dsize, ssize, dpitch, spitch, sbpp, x, y, w, h;
+
+	daddr = surfaceMap(dst, &dsize, PROT_READ | PROT_WRITE);
+	if (daddr == NULL)
+		return -1;
+	saddr = surfaceMap(src, &ssize, PROT_READ);
+	if (saddr == NULL) {
+		munmap(daddr, dsize);
+		return -1;
+	}
+	dpitch = g2dSurfacePitch(dst);
+	spitch = g2dSurfacePitch(src);
+	sbpp = g2dSurfaceBpp(src);
+	w = dst->rect.right - dst->rect.left;
+	h = dst->rect.bottom - dst->rect.top;
+	if (src->rect.right - src->rect.left < w)
+		w = src->rect.right - src->rect.left;
+	if (src->rect.bottom - src->rect.top < h)
+		h = src->rect.bottom - src->rect.top;
+
+	for (y = 0; y < h; y++) {
+		s = saddr + (src->rect.top + y) * spitch + src->rect.left * sbpp;
+		d = daddr + (dst->rect.top + y) * dpitch + dst->rect.left * 4;
+		for (x = 0; x < w; x++, s += sbpp, d += 4) {
+			loadPixel(src->format, s, sc);
+			loadPixel(dst->format, d, dc);
+			if (!src->blended)
+				sc[3] = 255;
+			a = sc[3] * src->alpha / 255;
+			for (i = 0; i < 3; i++) {
+				sc[i] = src->premult ? sc[i] * src->alpha / 255 : sc[i] * a / 255;
+				dc[i] = sc[i] + dc[i] * (255 - a) / 255;
+			}
+			dc[3] = a + dc[3] * (255 - a) / 255;
+			storePixel(dst->format, d, dc);
+		}
+	}
+	munmap(saddr, ssize);
+	munmap(daddr, dsize);
+	return 0;
+}
+
+g2dComposeOps_t g2dComposeBackend = {
+	.name = "stub",
+	.open = g2dStubOpen,
+	.close = g2dStubClose,
+	.allocBuffer = g2dStubAllocBuffer,
+	.clear = g2dStubClear,
+	.blend = g2dStubBlend,
+};
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include "g2d_compose.h"
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include <gtest/gtest.h>
+
+/* g2d compose on the cpu stub backend, the release fences are sw_sync */
+
+#define FB_W 16
+#define FB_H 16
+
+/* the g2d layers are never afbc here */
+int is_afbc_buf(buffer_handle_t handle)
+{
+	return 0;
+}
+
+static int bufferAlloc(int size)
+{
+	int fd = syscall(__NR_memfd_create, "g2d_test", 0);
+
+	if (fd >= 0 && ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static ino_t bufferIno(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return 0;
+	return st.st_ino;
+}
+
+static int64_t nowMs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+class G2dComposeTest : public testing::Test {
+protected:
+	void SetUp()
+	{
+		ASSERT_EQ(g2dComposeInit(), 0);
+		timeline = sw_sync_timeline_create();
+		ASSERT_GE(timeline, 0);
+		signaled = 0;
+		fbHandle = (private_handle_t *)calloc(1, sizeof(private_handle_t));
+		srcHandle = (private_handle_t *)calloc(1, sizeof(private_handle_t));
+		initHandle(fbHandle, FB_W, FB_H);
+		initHandle(srcHandle, 4, 4);
+		fillSource(0xff0000ff);
+
+		memset(&fb, 0, sizeof(fb));
+		fb.compositionType = HWC2_COMPOSITION_CLIENT_TARGET;
+		fb.buffer = (buffer_handle_t)fbHandle;
+		fb.crop.right = FB_W;
+		fb.crop.bottom = FB_H;
+		fb.frame.right = FB_W;
+		fb.frame.bottom = FB_H;
+
+		memset(&src, 0, sizeof(src));
+		src.buffer = (buffer_handle_t)srcHandle;
+		src.blendMode = HWC2_BLEND_MODE_NONE;
+		src.planeAlpha = 1.0;
+		src.crop.right = 4;
+		src.crop.bottom = 4;
+		src.frame.left = 2;
+		src.frame.top = 2;
+		src.frame.right = 6;
+		src.frame.bottom = 6;
+		layer = &src;
+		frameCount = 0;
+	}
+
+	void TearDown()
+	{
+		/* release every frame so the scratches are freed at once */
+		sw_sync_timeline_inc(timeline, 1000);
+		g2dComposeDeinit();
+		close(fbHandle->share_fd);
+		close(srcHandle->share_fd);
+		free(fbHandle);
+		free(srcHandle);
+		close(timeline);
+	}
+
+	void initHandle(private_handle_t *handle, int width, int height)
+	{
+		handle->format = HAL_PIXEL_FORMAT_RGBA_8888;
+		handle->stride = width;
+		handle->height = height;
+		handle->aw_byte_align[0] = 4;
+		handle->share_fd = bufferAlloc(width * height * 4);
+	}
+
+	void fillSource(unsigned int pixel)
+	{
+		unsigned int *addr = (unsigned int *)mmap(NULL, 4 * 4 * 4,
+				PROT_WRITE, MAP_SHARED, srcHandle->share_fd, 0);
+
+		ASSERT_NE(addr, MAP_FAILED);
+		for (int i = 0; i < 4 * 4; i++)
+			addr[i] = pixel;
+		munmap(addr, 4 * 4 * 4);
+	}
+
+	unsigned int fbPixel(int x, int y)
+	{
+		unsigned int pixel, *addr = (unsigned int *)mmap(NULL, FB_W * FB_H * 4,
+				PROT_READ, MAP_SHARED, fbHandle->share_fd, 0);
+
+		if (addr == MAP_FAILED)
+			return 0xdeadbeef;
+		pixel = addr[y * FB_W + x];
+		munmap(addr, FB_W * FB_H * 4);
+		return pixel;
+	}
+
+	/* compose a frame released when the timeline reaches its count */
+	int compose(void)
+	{
+		LayerSubmit_t submit;
+		int ret;
+
+		memset(&submit, 0, sizeof(submit));
+		submit.hwid = 0;
+		submit.frameCount = ++frameCount;
+		submit.sync.fd = sw_sync_fence_create(timeline, "g2d_test", frameCount);
+		ret = g2dComposeLayers(&submit, &fb, &layer, 1);
+		close(submit.sync.fd);
+		return ret;
+	}
+
+	void release(unsigned int frame)
+	{
+		sw_sync_timeline_inc(timeline, frame - signaled);
+		signaled = frame;
+	}
+
+	int timeline;
+	unsigned int signaled;
+	unsigned int frameCount;
+	private_handle_t *fbHandle;
+	private_handle_t *srcHandle;
+	Layer_t fb;
+	Layer_t src;
+	Layer_t *layer;
+};
+
+TEST_F(G2dComposeTest, BlendIntoScratch)
+{
+	ASSERT_EQ(compose(), 0);
+	EXPECT_EQ(fbPixel(0, 0), 0u);
+	EXPECT_EQ(fbPixel(2, 2), 0xff0000ffu);
+	EXPECT_EQ(fbPixel(5, 5), 0xff0000ffu);
+	EXPECT_EQ(fbPixel(6, 6), 0u);
+}
+
+/* frames dropped between compositions must not bring back the on-screen scratch */
+TEST_F(G2dComposeTest, OnScreenNotReused)
+{
+	ino_t onScreen, used[3];
+	int64_t start;
+
+	for (int i = 0; i < 3; i++) {
+		ASSERT_EQ(compose(), 0);
+		used[i] = bufferIno(fbHandle->share_fd);
+		for (int j = 0; j < i; j++)
+			EXPECT_NE(used[i], used[j]);
+	}
+
+	/* nothing released, it fails in about a vsync rather than blocking */
+	start = nowMs();
+	EXPECT_EQ(compose(), -1);
+	EXPECT_LT(nowMs() - start, 1000);
+
+	/* frame 3 is on screen, releasing frames 1 and 2 frees their scratches only */
+	release(2);
+	onScreen = used[2];
+	for (int i = 0; i < 4; i++) {
+		ASSERT_EQ(compose(), 0);
+		EXPECT_NE(bufferIno(fbHandle->share_fd), onScreen);
+		onScreen = bufferIno(fbHandle->share_fd);
+		release(frameCount - 1);
+	}
+}
+
+TEST_F(G2dComposeTest, FallbackAfterError)
+{
+	Display_t display;
+
+	memset(&display, 0, sizeof(display));
+	display.displayId = 0;
+	EXPECT_TRUE(g2dComposeUsable(&display));
+	EXPECT_FALSE(g2dComposeFallback(&display));
+
+	/* the scratches stay busy, every composition fails */
+	for (int i = 0; i < 3; i++)
+		ASSERT_EQ(compose(), 0);
+	EXPECT_EQ(compose(), -1);
+	EXPECT_TRUE(g2dComposeFallback(&display));
+	EXPECT_FALSE(g2dComposeFallback(&display));
+	EXPECT_TRUE(g2dComposeUsable(&display));
+
+	EXPECT_EQ(compose(), -1);
+	EXPECT_EQ(compose(), -1);
+	EXPECT_FALSE(g2dComposeUsable(&display));
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * host report of the layer stack traces of debug.cpp, recorded by
+ * "setprop debug.hwc.showfps on.trace" into /data/hwc_trace.txt.
+ * for each trace and display:
+ *   validate: the cpu time of the layer assignment, avg/p50/p99/max
+ *   malloc:   the bytes hwc_malloc'ed during a validate
+ *   client:   the layers left to the gpu, and why, from the dueto flags
+ *
+ * hwc_trace_report trace...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <vector>
+
+#define TRACE_MAX_DISP 4
+
+/* hwcomposer2.h and hwc.h */
+#define COMPOSITION_CLIENT 1
+#define COMPOSITION_CLIENT_TARGET 0xFF
+
+/* in the order of sunnxi_dueto_flags in hwc.h */
+static const char *duetoName[] = {
+	"hwc_layer", "nocontig_mem", "solid_color", "transform_rt", "scale_out",
+	"skip_flags", "format_miss", "no_v_pipe", "no_u_pipe", "colort_hint",
+	"cross_fb", "not_assign", "no_buffer", "mem_ctrl", "force_gpu", "video_prem",
+};
+#define DUETO_N (int)(sizeof(duetoName) / sizeof(duetoName[0]))
+
+typedef struct traceDisp {
+	std::vector<int64_t> cost;
+	std::vector<int64_t> mem;
+	long long layers;
+	long long client;
+	long long changed;
+	long long clientFrames;
+	long long dueto[DUETO_N + 1];
+} traceDisp_t;
+
+static void traceStat(std::vector<int64_t> &v, double *avg, int64_t *p50,
+		int64_t *p99, int64_t *max)
+{
+	int64_t sum = 0;
+	size_t n = v.size();
+
+	std::sort(v.begin(), v.end());
+	for (size_t i = 0; i < n; i++)
+		sum += v[i];
+	*avg = n ? (double)sum / n : 0.0;
+	*p50 = n ? v[n / 2] : 0;
+	*p99 = n ? v[n * 99 / 100] : 0;
+	*max = n ? v[n - 1] : 0;
+}
+
+static void traceReport(const char *path, traceDisp_t *disp)
+{
+	int64_t p50, p99, max;
+	double avg;
+	size_t frames;
+
+	for (int id = 0; id < TRACE_MAX_DISP; id++) {
+		frames = disp[id].cost.size();
+		if (frames == 0)
+			continue;
+		printf("%s disp%d frames:%zu layers/frame:%.1f\n", path, id, frames,
+			(double)disp[id].layers / frames);
+		traceStat(disp[id].cost, &avg, &p50, &p99, &max);
+		printf("  validate(us) avg:%.1f p50:%lld p99:%lld max:%lld\n",
+			avg, (long long)p50, (long long)p99, (long long)max);
+		traceStat(disp[id].mem, &avg, &p50, &p99, &max);
+		printf("  malloc(bytes) avg:%.1f p50:%lld p99:%lld max:%lld\n",
+			avg, (long long)p50, (long long)p99, (long long)max);
+		printf("  client layers:%lld/%lld (%.1f%%) frames:%lld/%zu (%.1f%%) type changes:%lld\n",
+			disp[id].client, disp[id].layers,
+			disp[id].layers ? 100.0 * disp[id].client / disp[id].layers : 0.0,
+			disp[id].clientFrames, frames, 100.0 * disp[id].clientFrames / frames,
+			disp[id].changed);
+		for (int i = 0; i <= DUETO_N; i++) {
+			if (disp[id].dueto[i] == 0)
+				continue;
+			printf("    %-12s %lld\n", i < DUETO_N ? duetoName[i] : "unknown",
+				disp[id].dueto[i]);
+		}
+	}
+}
+
+static int traceLoad(const char *path)
+{
+	traceDisp_t disp[TRACE_MAX_DISP];
+	int id = -1, n, nlayer, type, change, dueto, mem;
+	bool client = false;
+	long long cost;
+	unsigned int frame;
+	char line[512];
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	for (int i = 0; i < TRACE_MAX_DISP; i++) {
+		disp[i].layers = 0;
+		disp[i].client = 0;
+		disp[i].changed = 0;
+		disp[i].clientFrames = 0;
+		memset(disp[i].dueto, 0, sizeof(disp[i].dueto));
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == 'F') {
+			if (id >= 0 && client)
+				disp[id].clientFrames++;
+			client = false;
+			n = sscanf(line, "F %d %u %lld %d %d", &id, &frame, &cost, &mem, &nlayer);
+			if (n != 5 || id < 0 || id >= TRACE_MAX_DISP) {
+				id = -1;
+				continue;
+			}
+			disp[id].cost.push_back(cost);
+			disp[id].mem.push_back(mem);
+		} else if (line[0] == 'L' && id >= 0) {
+			n = sscanf(line, "L %*d %d %d %d", &type, &change, &dueto);
+			if (n != 3 || type == COMPOSITION_CLIENT_TARGET)
+				continue;
+			disp[id].layers++;
+			if (change)
+				disp[id].changed++;
+			if (type != COMPOSITION_CLIENT)
+				continue;
+			client = true;
+			disp[id].client++;
+			disp[id].dueto[dueto >= 0 && dueto < DUETO_N ? dueto : DUETO_N]++;
+		}
+	}
+	if (id >= 0 && client)
+		disp[id].clientFrames++;
+	fclose(fp);
+	traceReport(path, disp);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace...\n", argv[0]);
+		return 1;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (traceLoad(argv[i])) {
+			fprintf(stderr, "open %s err %d\n", argv[i], errno);
+			return 1;
+		}
+	}
+	return 0;
+}
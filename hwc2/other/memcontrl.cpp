@@ -25,6 +25,28 @@ struct mem_speed_limit_t{
 	int demem;
 };
 
+/*
+ * the ddr devfreq moves under us, so the limit follows cur_freq:
+ * it is read every MEM_DDR_POLL frames and the table is interpolated.
+ * a layer cost is its fetch size weighted by the vertical downscale
+ * (more source lines in one line time) and the yuv planes page miss,
+ * weight is in 1/16.
+ */
+#define MEM_DDR_POLL 30
+#define MEM_COST_SHIFT 4
+#define MEM_COST_ONE (1 << MEM_COST_SHIFT)
+#define MEM_COST_MAX (4 << MEM_COST_SHIFT)
+#define MEM_COST_YUV 18
+#define MEM_COST_N 8
+#define MEM_LIMIT_STEP_DIV 18
+
+typedef struct memCtrlCost{
+	int disp;
+	int zorder;
+	int src;
+	int cost;
+}memCtrlCost_t;
+
 typedef struct memCtrlInfo{
 	int globlimit;// will varible for dvfs ddr
 	int globcurlimit;
@@ -39,6 +61,11 @@ typedef struct memCtrlInfo{
 	int currentTRPixelLimit;
 	Display_t **display;
 	int maxClientTarget;
+	int ddrFd;//devfreq cur_freq, -1 keep the limit of init
+	int ddrKHz;
+	int ddrPoll;
+	int costNum;
+	memCtrlCost_t cost[MEM_COST_N];
 }memCtrlInfo_t;
 
 memCtrlInfo_t globCtrl;
@@ -91,9 +118,37 @@ static inline int memCtrlFbSize(Display_t *display)
 	return max;
 }
 
+static int memCtrlLayerWeight(Layer_t *layer)
+{
+	float crop, frame;
+	int weight = MEM_COST_ONE;
+
+	if (layer->transform & HAL_TRANSFORM_ROT_90)
+		crop = layer->crop.right - layer->crop.left;
+	else
+		crop = layer->crop.bottom - layer->crop.top;
+	frame = layer->frame.bottom - layer->frame.top;
+	if (frame > 0 && crop > frame)
+		weight = (int)ceilf(crop * MEM_COST_ONE / frame);
+	if (weight > MEM_COST_MAX)
+		weight = MEM_COST_MAX;
+	if (layerIsVideo(layer))
+		weight = weight * MEM_COST_YUV / MEM_COST_ONE;
+
+	return weight;
+}
+
+static inline int memCtrlLayerMem(Layer_t *layer)
+{
+	float mem = (layer->crop.right - layer->crop.left)
+			* (layer->crop.bottom - layer->crop.top)
+			* getBitsPerPixel(layer) / 8;
+
+	return (int)ceilf(mem * memCtrlLayerWeight(layer) / MEM_COST_ONE);
+}
+
 static inline int memCtrlCheckResv(Layer_t *layer)
 {
-	int memcurrntresv;
 	private_handle_t *handle;
 	handle = (private_handle_t *)layer->buffer;
 
@@ -103,18 +158,14 @@ static inline int memCtrlCheckResv(Layer_t *layer)
 		return 0;
 	}
 
-	memcurrntresv = (int)ceilf((layer->crop.right - layer->crop.left)
-										* (layer->crop.bottom - layer->crop.top)
-										* getBitsPerPixel(layer) / 8);
 	layer->memresrve = 1;
-	return memcurrntresv;
+	return memCtrlLayerMem(layer);
 }
 
 void memCtrlDealFBLayer(Layer_t *layer, bool add)
 {
-	int mem =  (int)ceilf((layer->crop.right - layer->crop.left)
-			* (layer->crop.bottom - layer->crop.top)
-			* getBitsPerPixel(layer) / 8);
+	int mem = memCtrlLayerMem(layer);
+
 	if (add)
 		globCtrl.globReseveMem += mem;
 	else
@@ -123,9 +174,8 @@ void memCtrlDealFBLayer(Layer_t *layer, bool add)
 
 void memCtrlDealLayer(Layer_t *layer, bool add)
 {
-	int mem =  (int)ceilf((layer->crop.right - layer->crop.left)
-			* (layer->crop.bottom - layer->crop.top)
-			* getBitsPerPixel(layer) / 8);
+	int mem = memCtrlLayerMem(layer);
+
 	if (!layer->memresrve)
 		return;
 	if (add)
@@ -143,17 +193,19 @@ void memCtrlDelCur(int mem)
 bool memCtrlAddLayer(Display_t *display, Layer_t *layer, int* pAddmem)
 {
 	DisplayOpr_t *opt;
+	memCtrlCost_t *cost;
 	int addmem = 0, add = 0, srcmem = 0;
 	opt = display->displayOpration;
 	if (checkSoildLayer(layer)) {
 		*pAddmem = 0;
 		return true;
 	}
-	srcmem = (int)ceilf((layer->crop.right - layer->crop.left)
-							* (layer->crop.bottom - layer->crop.top)
-							* getBitsPerPixel(layer) / 8);
+	srcmem = memCtrlLayerMem(layer);
 
 	addmem = opt->memCtrlAddLayer(display, layer);
+	addmem = (int)ceilf((float)addmem * memCtrlLayerWeight(layer) / MEM_COST_ONE);
+	if (addmem > srcmem)
+		addmem = srcmem;
 	add = addmem;
 	if (layer->memresrve
 		|| layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET) {
@@ -172,6 +224,13 @@ bool memCtrlAddLayer(Display_t *display, Layer_t *layer, int* pAddmem)
 	if (layer->compositionType == HWC2_COMPOSITION_CLIENT_TARGET)
 		globCtrl.globReseveMem -= addmem;
 	globCtrl.globcurrent += addmem;
+	if (globCtrl.costNum < MEM_COST_N) {
+		cost = &globCtrl.cost[globCtrl.costNum++];
+		cost->disp = display->displayId;
+		cost->zorder = layer->zorder;
+		cost->src = srcmem;
+		cost->cost = addmem;
+	}
 
 	*pAddmem = addmem;
 	return true;
@@ -189,6 +248,67 @@ void memContrlComplet(Display_t *display)
 	globCtrl.cnt = 0;
 }
 
+/* KHz string of devfreq, -1 if it is not a number */
+static int memCtrlParseKHz(char *val, int len)
+{
+	int i, speed = 0;
+
+	for (i = 0; i < len && val[i] != '\n' && val[i] != '\0'; i++) {
+		if (val[i] < '0' || val[i] > '9')
+			return -1;
+		speed = speed * 10 + val[i] - '0';
+	}
+	return i ? speed : -1;
+}
+
+/* mem_speed_limit is sorted from high to low */
+static int memCtrlDdrLimit(int speed)
+{
+	int i, num = sizeof(mem_speed_limit)/sizeof(mem_speed_limit_t);
+	struct mem_speed_limit_t *hi, *lo;
+
+	if (speed >= mem_speed_limit[0].ddrKHz)
+		return mem_speed_limit[0].demem;
+	for (i = 1; i < num; i++) {
+		if (mem_speed_limit[i].ddrKHz <= speed)
+			break;
+	}
+	if (i == num)
+		return (int)((int64_t)mem_speed_limit[num - 1].demem * speed
+				/ mem_speed_limit[num - 1].ddrKHz);
+	hi = &mem_speed_limit[i - 1];
+	lo = &mem_speed_limit[i];
+	return lo->demem + (int)((int64_t)(hi->demem - lo->demem)
+			* (speed - lo->ddrKHz) / (hi->ddrKHz - lo->ddrKHz));
+}
+
+static void memCtrlUpdateDdr(void)
+{
+	char val[16];
+	int ret, speed;
+
+	if (globCtrl.ddrFd < 0 || globCtrl.ddrPoll-- > 0)
+		return;
+	globCtrl.ddrPoll = MEM_DDR_POLL;
+	ret = pread(globCtrl.ddrFd, val, sizeof(val) - 1, 0);
+	if (ret <= 0)
+		return;
+	speed = memCtrlParseKHz(val, ret);
+	if (speed <= 0 || speed == globCtrl.ddrKHz)
+		return;
+	globCtrl.ddrKHz = speed;
+	globCtrl.globlimit = memCtrlDdrLimit(speed);
+	if (globCtrl.globcurlimit > globCtrl.globlimit)
+		globCtrl.globcurlimit = globCtrl.globlimit;
+	ALOGV("ddr %d KHz, mem limit %d", speed, globCtrl.globlimit);
+}
+
+/* step to give back the limit taken by a client composition */
+int memCtrlLimitStep(void)
+{
+	return globCtrl.globlimit / MEM_LIMIT_STEP_DIV;
+}
+
 void memResetPerframe(Display_t *display)
 {
 	int i = 0;
@@ -196,6 +316,8 @@ void memResetPerframe(Display_t *display)
 	Layer_t *layer;
 
 	if (globCtrl.cnt == 0) {
+		memCtrlUpdateDdr();
+		globCtrl.costNum = 0;
 		globCtrl.globcurrent = 0;
 		globCtrl.dealReseveMem = 0;
 		globCtrl.currentTRMemLimit = 0;
@@ -250,10 +372,67 @@ void memCtrlLimmitSet(Display_t *display, int screen)
 
 int memCtrlDump(char* outBuffer)
 {
-	return sprintf(outBuffer, "GL:%d GCL:%d GC:%d GR:%d DR:%d RM(C):%d(%d) RP(C):%d(%d)\n", globCtrl.globlimit,
+	int count, i;
+
+	count = sprintf(outBuffer, "DDR:%dKHz GL:%d GCL:%d GC:%d GR:%d DR:%d RM(C):%d(%d) RP(C):%d(%d)\n",
+			globCtrl.ddrKHz, globCtrl.globlimit,
 			globCtrl.globcurlimit, globCtrl.globcurrent, globCtrl.globReseveMem, globCtrl.dealReseveMem,
 			globCtrl.globTRMemLimit, globCtrl.currentTRMemLimit, globCtrl.globTRPixelLimit, globCtrl.currentTRPixelLimit);
+	if (globCtrl.costNum == 0)
+		return count;
+	count += sprintf(outBuffer + count, "cost(d:z src>cost):");
+	for (i = 0; i < globCtrl.costNum; i++)
+		count += sprintf(outBuffer + count, " %d:%d %d>%d", globCtrl.cost[i].disp,
+				globCtrl.cost[i].zorder, globCtrl.cost[i].src, globCtrl.cost[i].cost);
+	count += sprintf(outBuffer + count, "\n");
+	return count;
+}
+
+void memCtrlSnapshot(memCtrlShot_t *shot)
+{
+	shot->globcurrent = globCtrl.globcurrent;
+	shot->globReseveMem = globCtrl.globReseveMem;
+	shot->dealReseveMem = globCtrl.dealReseveMem;
+	shot->currentTRMemLimit = globCtrl.currentTRMemLimit;
+	shot->currentTRPixelLimit = globCtrl.currentTRPixelLimit;
+}
+
+/* delta = what the display assign has added since begin */
+void memCtrlShotDiff(memCtrlShot_t *delta, memCtrlShot_t *begin)
+{
+	memCtrlSnapshot(delta);
+	delta->globcurrent -= begin->globcurrent;
+	delta->globReseveMem -= begin->globReseveMem;
+	delta->dealReseveMem -= begin->dealReseveMem;
+	delta->currentTRMemLimit -= begin->currentTRMemLimit;
+	delta->currentTRPixelLimit -= begin->currentTRPixelLimit;
+}
+
+static inline void memCtrlShotAdd(memCtrlShot_t *delta, int sign)
+{
+	globCtrl.globcurrent += sign * delta->globcurrent;
+	globCtrl.globReseveMem += sign * delta->globReseveMem;
+	globCtrl.dealReseveMem += sign * delta->dealReseveMem;
+	globCtrl.currentTRMemLimit += sign * delta->currentTRMemLimit;
+	globCtrl.currentTRPixelLimit += sign * delta->currentTRPixelLimit;
+}
 
+/*
+ * reuse the last assignment of a display, must be called between
+ * memResetPerframe and memContrlComplet like a normal assign.
+ * if the budget is no longer enough, nothing is changed.
+ */
+bool memCtrlReplay(memCtrlShot_t *delta)
+{
+	memCtrlShotAdd(delta, 1);
+	if (globCtrl.globReseveMem - globCtrl.dealReseveMem + globCtrl.globcurrent
+			> globCtrl.globcurlimit
+		|| globCtrl.currentTRPixelLimit > globCtrl.globTRPixelLimit
+		|| globCtrl.currentTRMemLimit > globCtrl.globTRMemLimit) {
+		memCtrlShotAdd(delta, -1);
+		return false;
+	}
+	return true;
 }
 
 bool aquireTRlimmit(Layer_t *layer)
@@ -274,7 +453,7 @@ bool aquireTRlimmit(Layer_t *layer)
 
 	size = pixel * getBitsPerPixel(layer) / 8;
 #endif
-	if (!layer->transform)
+	if (!layer->transform && !layer->prescale)
 		return false;
 	if (pixel + globCtrl.currentTRPixelLimit > globCtrl.globTRPixelLimit
 		|| size + globCtrl.currentTRMemLimit > globCtrl.globTRMemLimit)
@@ -290,7 +469,7 @@ void releaseTRlimmit(Layer_t *layer)
 {
 	int size;
 	int pixel;
-	if (!layer->transform)
+	if (!layer->transform && !layer->prescale)
 		return;
 
 #if (TARGET_BOARD_PLATFORM == tulip)
@@ -321,37 +500,27 @@ void memCtrlInit(Display_t **display, int num)
 	globCtrl.display = display;
 
 	ddrFreFd = open("/sys/class/devfreq/dramfreq/max_freq", O_RDONLY);
-    if(ddrFreFd >= 0)
-    {
-        char val_ddr[10] = {0x0,};
-        int ret = -1, i = 0, speed = 0;
-        ret = read(ddrFreFd, &val_ddr, 6);
-	    ALOGD("the ddr speed is %s",val_ddr);
-        close(ddrFreFd);
-        while(ret--) {
-            speed *= 10;
-            if ( val_ddr[i] >= '0' && val_ddr[i] <= '9') {
-                speed += val_ddr[i++] - 48;
-            } else {
-                speed = 552000;//defalt ddr max speed
-                break;
-            }
-        }
-        i = 0;
-        ret = sizeof(mem_speed_limit)/sizeof(mem_speed_limit_t);
-        for (i =0; i< ret; i++) {
-            if (mem_speed_limit[i].ddrKHz <= speed) {
-                break;
-            }
-        }
-        if (i == ret) {
-            i--;
-        }
-        globCtrl.globlimit = mem_speed_limit[i].demem;
-    } else {
-        ALOGD("open /sys/class/devfreq/dramfreq/max_freq err.");
+	if (ddrFreFd >= 0) {
+		char val_ddr[16] = {0x0,};
+		int ret, speed;
+
+		ret = read(ddrFreFd, val_ddr, sizeof(val_ddr) - 1);
+		ALOGD("the ddr speed is %s", val_ddr);
+		close(ddrFreFd);
+		speed = ret > 0 ? memCtrlParseKHz(val_ddr, ret) : -1;
+		if (speed <= 0)
+			speed = 552000;//defalt ddr max speed
+		globCtrl.ddrKHz = speed;
+		globCtrl.globlimit = memCtrlDdrLimit(speed);
+	} else {
+		ALOGD("open /sys/class/devfreq/dramfreq/max_freq err.");
 		globCtrl.globlimit  = mem_speed_limit[1].demem;
-    }
+	}
+	globCtrl.ddrPoll = 0;
+	globCtrl.ddrFd = open("/sys/class/devfreq/dramfreq/cur_freq", O_RDONLY);
+	if (globCtrl.ddrFd < 0)
+		ALOGD("open /sys/class/devfreq/dramfreq/cur_freq err, keep the limit %d",
+			globCtrl.globlimit);
 	globCtrl.globcurlimit = globCtrl.globlimit;
 	/*  */
 #if (TARGET_BOARD_PLATFORM == venus)
@@ -64,6 +64,7 @@ typedef struct rotate_info {
 	unsigned int gsyncCount;
 	Layer_t *layer2;
 	Display_t *disp;
+	uint64_t key;//source key, a result of the same key is shown again
 }rotate_info_t;
 
 /* alloc buffer */
@@ -102,7 +103,7 @@ rotate_info_t* trlistCacheGet(void)
 	pthread_mutex_unlock(&rchaceMutex);
 	if (tr_info != NULL)
 		goto deal;
-	tr_info = (rotate_info_t *)hwc_malloc(sizeof(rotate_info_t));
+	tr_info = (rotate_info_t *)hwc_malloc_type(sizeof(rotate_info_t), MEM_ROTATE);
 	if (tr_info == NULL){
 		ALOGE("%s:malloc tr_info err...",__FUNCTION__);
 		return NULL;
@@ -264,7 +265,7 @@ int rotateDeviceInit(void)
 		ALOGE("Failed to open transform device");
 		return -1;
 	}
-	tr_disp = (tr_per_disp_t *)hwc_malloc(sizeof(tr_per_disp_t));
+	tr_disp = (tr_per_disp_t *)hwc_malloc_type(sizeof(tr_per_disp_t), MEM_ROTATE);
 	if(tr_disp == NULL) {
 		close(trfd);
 		trfd = -1;
@@ -436,6 +437,9 @@ tr_cache_t* dequeueTrBuffer(Layer_t *layer, rotate_info_t *rt_info)
 	unsigned int little = rt_info->gsyncCount;
 
 	ccache = &aCache->array[rt_info->gsyncCount%NOMORL_CACHE_N];
+	/* a reused result may still be on screen */
+	if (ccache == acquireLastValid(layer))
+		ccache = &aCache->array[(rt_info->gsyncCount + 1)%NOMORL_CACHE_N];
 	if(ccache->share_fd < 0)
 		return NULL;
 	if (ccache->releasefd >= 0) {
@@ -470,7 +474,7 @@ bool dequeueTrCache(Display_t *display, Layer_t *layer)
 		trCachePut(layer->trcache, 1);
 	}
 
-	aCache = (tr_cache_Array *)hwc_malloc(sizeof(tr_cache_Array));
+	aCache = (tr_cache_Array *)hwc_malloc_type(sizeof(tr_cache_Array), MEM_ROTATE);
 	if (aCache == NULL) {
 		ALOGE("malloc cache array err");
 		return false;
@@ -565,6 +569,14 @@ bool supportTR(Display_t *display, Layer_t *layer)
 	return dequeueTrCache(display, layer);
 }
 
+/* the tr engine can not scale */
+bool supportPreScale(Display_t *display, Layer_t *layer)
+{
+	unusedpara(display);
+	unusedpara(layer);
+	return false;
+}
+
 bool layerToTrinfo(Layer_t *layer, tr_info *tr_inf, tr_cache_t *bCache)
 {
 	private_handle_t *handle;
@@ -714,6 +726,22 @@ int submitTransformLayer(rotate_info_t *rt_info, unsigned int syncCount)
 	tr_info trInfo;
 	int timeout = 0, ret = -1, i = 0;
 	bool last = 1;
+	if (rt_info->key != 0) {
+		bCache = acquireLastValid(layer);
+		/* only a result which was rotated from this same source */
+		if (bCache != NULL && bCache->key == rt_info->key) {
+			trCacheStat(1, ((tr_cache_Array *)layer->trcache)->size);
+			layerToTrinfo(layer, &trInfo, bCache);
+			/* shown again, keep it until this frame is released */
+			if (bCache->releasefd >= 0)
+				close(bCache->releasefd);
+			bCache->releasefd = dup(rt_info->dst_waite_fence);
+			bCache->sync_cnt = syncCount;
+			trAflterDeal(layer, bCache, &trInfo);
+			return 0;
+		}
+		trCacheStat(0, 0);
+	}
 	/* if 2 screen use the same tr layer, we must reduce this case
 	*/
 	if (tr_disp->clienId == 0) {
@@ -724,6 +752,9 @@ int submitTransformLayer(rotate_info_t *rt_info, unsigned int syncCount)
 	}
 	/* maybe crach for aCache== NULL, but amost impossible ,so no care*/
 	bCache = dequeueTrBuffer(layer, rt_info);
+	/* overwritten now, keyed again only if the rotate succeeds */
+	if (bCache != NULL)
+		bCache->key = 0;
 	if (!layerToTrinfo(layer, &trInfo, bCache)) {
 		goto last;
 	}
@@ -755,6 +786,7 @@ int submitTransformLayer(rotate_info_t *rt_info, unsigned int syncCount)
 		goto last;
 	}
 	bCache->valid = 1;
+	bCache->key = rt_info->key;
 	last = 0;
 	bCache->sync_cnt = syncCount;
 	bCache->releasefd = dup(rt_info->dst_waite_fence);
@@ -773,7 +805,7 @@ last:
 }
 
 int get_rotate_fence_fd(Layer_t *layer2,
-	Display_t *disp, int releasefence, unsigned int syncCount)
+	Display_t *disp, int releasefence, unsigned int syncCount, uint64_t key)
 {
 	char name[20];
 	int count;
@@ -795,6 +827,7 @@ int get_rotate_fence_fd(Layer_t *layer2,
 	tr_info->dst_waite_fence = dup(releasefence);
 	tr_info->gsyncCount = syncCount;
 	tr_info->disp = disp;
+	tr_info->key = key;
 
 	layer2->ref++;
 	if (inc_count + 2 < tr_info->syncCount)
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+#include <pthread.h>
+
+/*
+ * fixed size object slab:
+ * objects are carved from one block at init, every thread keeps a small
+ * magazine of free objects so alloc/free do not take the slab lock,
+ * the magazine refill/flush half of it from/to the slab free list.
+ * when the slab is used up, fall back to hwc_malloc.
+ * deinit frees the magazines of all threads, so the threads using the
+ * slab must be stopped first, it is refused while objects are used.
+ */
+#define SLAB_MAGAZINE_N 16
+
+typedef struct slabMagazine {
+	hwcSlab_t *slab;
+	struct listnode node;
+	int num;
+	void *obj[SLAB_MAGAZINE_N];
+}slabMagazine_t;
+
+static inline bool slabOwn(hwcSlab_t *slab, void *obj)
+{
+	return (char *)obj >= slab->base
+		&& (char *)obj < slab->base + slab->objSize * slab->objNum;
+}
+
+static void slabPutFree(hwcSlab_t *slab, void **obj, int num)
+{
+	pthread_mutex_lock(&slab->mutex);
+	while (num--) {
+		*(void **)obj[num] = slab->freeList;
+		slab->freeList = obj[num];
+		slab->freeNum++;
+	}
+	pthread_mutex_unlock(&slab->mutex);
+}
+
+static void slabMagazineDestroy(void *data)
+{
+	slabMagazine_t *mag = (slabMagazine_t *)data;
+
+	pthread_mutex_lock(&mag->slab->mutex);
+	list_remove(&mag->node);
+	pthread_mutex_unlock(&mag->slab->mutex);
+	slabPutFree(mag->slab, mag->obj, mag->num);
+	hwc_free(mag);
+}
+
+static slabMagazine_t* slabMagazine(hwcSlab_t *slab)
+{
+	slabMagazine_t *mag;
+
+	mag = (slabMagazine_t *)pthread_getspecific(slab->key);
+	if (mag != NULL)
+		return mag;
+	mag = (slabMagazine_t *)hwc_malloc(sizeof(slabMagazine_t));
+	if (mag == NULL)
+		return NULL;
+	mag->slab = slab;
+	pthread_setspecific(slab->key, mag);
+	pthread_mutex_lock(&slab->mutex);
+	list_add_tail(&slab->mags, &mag->node);
+	pthread_mutex_unlock(&slab->mutex);
+	return mag;
+}
+
+int slabInit(hwcSlab_t *slab, const char *name, int memType, int objSize, int objNum)
+{
+	int i;
+
+	memset(slab, 0, sizeof(hwcSlab_t));
+	slab->name = name;
+	slab->memType = memType;
+	slab->objSize = HWC_ALIGN(objSize, 16);
+	slab->base = (char *)hwc_malloc_type(slab->objSize * objNum, memType);
+	if (slab->base == NULL) {
+		ALOGE("%s slab alloc err", name);
+		return -1;
+	}
+	slab->objNum = objNum;
+	list_init(&slab->mags);
+	pthread_mutex_init(&slab->mutex, 0);
+	pthread_key_create(&slab->key, slabMagazineDestroy);
+
+	for (i = objNum - 1; i >= 0; i--) {
+		*(void **)(slab->base + i * slab->objSize) = slab->freeList;
+		slab->freeList = slab->base + i * slab->objSize;
+	}
+	slab->freeNum = objNum;
+	return 0;
+}
+
+int slabDeinit(hwcSlab_t *slab)
+{
+	struct listnode *node, *node2;
+	slabMagazine_t *mag;
+	int used;
+
+	if (slab->base == NULL)
+		return 0;
+	used = __atomic_load_n(&slab->used, __ATOMIC_RELAXED);
+	if (used != 0) {
+		ALOGE("%s slab deinit with %d objects used", slab->name, used);
+		return -1;
+	}
+	/* no destructor runs once the key is deleted */
+	pthread_setspecific(slab->key, NULL);
+	pthread_key_delete(slab->key);
+	list_for_each_safe(node, node2, &slab->mags) {
+		mag = node_to_item(node, slabMagazine_t, node);
+		list_remove(&mag->node);
+		hwc_free(mag);
+	}
+	pthread_mutex_destroy(&slab->mutex);
+	hwc_free(slab->base);
+	slab->base = NULL;
+	return 0;
+}
+
+void* slabAlloc(hwcSlab_t *slab)
+{
+	slabMagazine_t *mag = slabMagazine(slab);
+	void *obj;
+	int used, peak;
+
+	if (mag != NULL && mag->num == 0) {
+		pthread_mutex_lock(&slab->mutex);
+		while (slab->freeList != NULL && mag->num < SLAB_MAGAZINE_N / 2) {
+			mag->obj[mag->num++] = slab->freeList;
+			slab->freeList = *(void **)slab->freeList;
+			slab->freeNum--;
+		}
+		pthread_mutex_unlock(&slab->mutex);
+	}
+	if (mag == NULL || mag->num == 0) {
+		__atomic_add_fetch(&slab->miss, 1, __ATOMIC_RELAXED);
+		return hwc_malloc_type(slab->objSize, slab->memType);
+	}
+
+	obj = mag->obj[--mag->num];
+	used = __atomic_add_fetch(&slab->used, 1, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&slab->peak, __ATOMIC_RELAXED);
+	while (used > peak && !__atomic_compare_exchange_n(&slab->peak, &peak, used,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return obj;
+}
+
+void slabFree(hwcSlab_t *slab, void *obj)
+{
+	slabMagazine_t *mag;
+
+	if (!slabOwn(slab, obj)) {
+		hwc_free(obj);
+		return;
+	}
+	__atomic_sub_fetch(&slab->used, 1, __ATOMIC_RELAXED);
+	mag = slabMagazine(slab);
+	if (mag == NULL) {
+		slabPutFree(slab, &obj, 1);
+		return;
+	}
+	if (mag->num == SLAB_MAGAZINE_N) {
+		mag->num -= SLAB_MAGAZINE_N / 2;
+		slabPutFree(slab, &mag->obj[mag->num], SLAB_MAGAZINE_N / 2);
+	}
+	mag->obj[mag->num++] = obj;
+}
+
+int slabDump(hwcSlab_t *slab, char* outBuffer)
+{
+	return sprintf(outBuffer, "%s slab used:%d/%d peak:%d miss:%u\n", slab->name,
+			slab->used, slab->objNum, slab->peak, slab->miss);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) Allwinner Tech All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+
+#include <semaphore.h>
+#include <gtest/gtest.h>
+
+/* a slab used by other threads, as the layers are by the submit thread */
+
+#define SLAB_TEST_OBJ 64
+
+typedef struct slabUser {
+	hwcSlab_t *slab;
+	void *obj;
+	sem_t held;
+	sem_t release;
+	sem_t freed;
+	sem_t exit;
+}slabUser_t;
+
+static void* slabUserLoop(void *data)
+{
+	slabUser_t *user = (slabUser_t *)data;
+
+	user->obj = slabAlloc(user->slab);
+	sem_post(&user->held);
+	sem_wait(&user->release);
+	slabFree(user->slab, user->obj);
+	sem_post(&user->freed);
+	sem_wait(&user->exit);
+	return NULL;
+}
+
+TEST(SlabTest, DeinitWithOtherThreadMagazine)
+{
+	hwcSlab_t slab;
+	slabUser_t user;
+	pthread_t thread;
+
+	ASSERT_EQ(slabInit(&slab, "test", 0, 32, SLAB_TEST_OBJ), 0);
+	user.slab = &slab;
+	sem_init(&user.held, 0, 0);
+	sem_init(&user.release, 0, 0);
+	sem_init(&user.freed, 0, 0);
+	sem_init(&user.exit, 0, 0);
+	ASSERT_EQ(pthread_create(&thread, NULL, slabUserLoop, &user), 0);
+
+	/* refused while the thread holds an object */
+	sem_wait(&user.held);
+	EXPECT_EQ(slabDeinit(&slab), -1);
+	EXPECT_NE(slab.base, (char *)NULL);
+
+	/* the object is back in the thread's magazine, still alive */
+	sem_post(&user.release);
+	sem_wait(&user.freed);
+	EXPECT_EQ(slabDeinit(&slab), 0);
+	EXPECT_EQ(slab.base, (char *)NULL);
+
+	/* its exit must not touch the slab any more */
+	sem_post(&user.exit);
+	pthread_join(thread, NULL);
+}
+
+static void* slabPeakLoop(void *data)
+{
+	hwcSlab_t *slab = (hwcSlab_t *)data;
+	void *obj[4];
+
+	for (int i = 0; i < 10000; i++) {
+		for (int j = 0; j < 4; j++)
+			obj[j] = slabAlloc(slab);
+		for (int j = 0; j < 4; j++)
+			slabFree(slab, obj[j]);
+	}
+	return NULL;
+}
+
+TEST(SlabTest, PeakOfThreads)
+{
+	hwcSlab_t slab;
+	pthread_t thread[4];
+
+	ASSERT_EQ(slabInit(&slab, "test", 0, 32, SLAB_TEST_OBJ), 0);
+	for (int i = 0; i < 4; i++)
+		ASSERT_EQ(pthread_create(&thread[i], NULL, slabPeakLoop, &slab), 0);
+	for (int i = 0; i < 4; i++)
+		pthread_join(thread[i], NULL);
+
+	EXPECT_EQ(slab.used, 0);
+	EXPECT_GE(slab.peak, 4);
+	EXPECT_LE(slab.peak, 16);
+	EXPECT_EQ(slabDeinit(&slab), 0);
+}
@@ -65,6 +65,7 @@ typedef struct rotate_info {
 	unsigned int gsyncCount;
 	Layer_t *layer2;
 	Display_t *disp;
+	uint64_t key;//source key, a result of the same key is shown again
 }rotate_info_t;
 
 /* alloc buffer */
@@ -145,7 +146,7 @@ rotate_info_t* trlistCacheGet(void)
 	pthread_mutex_unlock(&rchaceMutex);
 	if (tr_info != NULL)
 		goto deal;
-	tr_info = (rotate_info_t *)hwc_malloc(sizeof(rotate_info_t));
+	tr_info = (rotate_info_t *)hwc_malloc_type(sizeof(rotate_info_t), MEM_ROTATE);
 	if (tr_info == NULL){
 		ALOGE("%s:malloc tr_info err...",__FUNCTION__);
 		return NULL;
@@ -262,7 +263,7 @@ int rotateDeviceInit(void)
 		ALOGE("Failed to open g2d device");
 		return -1;
 	}
-	tr_disp = (tr_per_disp_t *)hwc_malloc(sizeof(tr_per_disp_t));
+	tr_disp = (tr_per_disp_t *)hwc_malloc_type(sizeof(tr_per_disp_t), MEM_ROTATE);
 	if(tr_disp == NULL) {
 		close(trfd);
 		trfd = -1;
@@ -416,6 +417,9 @@ tr_cache_t* dequeueTrBuffer(Layer_t *layer, rotate_info_t *rt_info)
 	tr_cache_Array *aCache = (tr_cache_Array *)layer->trcache;
 
 	ccache = &aCache->array[rt_info->gsyncCount%NOMORL_CACHE_N];
+	/* a reused result may still be on screen */
+	if (ccache == acquireLastValid(layer))
+		ccache = &aCache->array[(rt_info->gsyncCount + 1)%NOMORL_CACHE_N];
 	if(ccache->share_fd < 0)
 		return NULL;
 	if (ccache->releasefd >= 0) {
@@ -431,36 +435,31 @@ tr_cache_t* dequeueTrBuffer(Layer_t *layer, rotate_info_t *rt_info)
 	return ccache;
 }
 
-bool dequeueTrCache(Display_t *display, Layer_t *layer)
+static int trCacheSize(Layer_t *layer, int dstw, int dsth)
 {
 	private_handle_t *handle;
 	handle = (private_handle_t *)layer->buffer;
-	tr_cache_Array *aCache =  NULL;
-	int size, i, stride;
-	/* duto alloc buffer usually use 100'ms, so need control */
+	int size;
 
-	stride = HWC_ALIGN(handle->width, handle->aw_byte_align[0]);
-	size = HWC_ALIGN(handle->width, handle->aw_byte_align[0]) * HWC_ALIGN(handle->height, handle->aw_byte_align[0])
+	size = HWC_ALIGN(dstw, handle->aw_byte_align[0]) * HWC_ALIGN(dsth, handle->aw_byte_align[0])
 			* getBitsPerPixel(layer) / 8;
 
 	/* because yv12 need align u pitch and y pitch */
 	if (handle->format == HAL_PIXEL_FORMAT_YV12) {
-		int dstw, dsth;
-		if (layer->transform & HAL_TRANSFORM_ROT_90) {
-			dstw = handle->height;
-			dsth = handle->width;
-		} else {
-			dstw = handle->width;
-			dsth = handle->height;
-		}
-
 		int ystride = HWC_ALIGN(dstw,     handle->aw_byte_align[0]);
 		int vstride = HWC_ALIGN(dstw / 2, handle->aw_byte_align[1]);
 		int ustride = HWC_ALIGN(dstw / 2, handle->aw_byte_align[2]);
 		size = dsth * ystride + dsth * vstride / 2 + dsth * ustride / 2;
 	}
 
-	size = HWC_ALIGN(size, 4096);
+	return HWC_ALIGN(size, 4096);
+}
+
+static bool trCacheReserve(Display_t *display, Layer_t *layer, int size)
+{
+	tr_cache_Array *aCache =  NULL;
+	int i;
+	/* duto alloc buffer usually use 100'ms, so need control */
 
 	aCache = (tr_cache_Array *) layer->trcache;
 	if (aCache != NULL) {
@@ -470,12 +469,12 @@ bool dequeueTrCache(Display_t *display, Layer_t *layer)
 		layer->trcache = NULL;
 	}
 
-	aCache = (tr_cache_Array *)hwc_malloc(sizeof(tr_cache_Array));
+	aCache = (tr_cache_Array *)hwc_malloc_type(sizeof(tr_cache_Array), MEM_ROTATE);
 	if (aCache == NULL) {
 		ALOGE("malloc cache array err");
 		return false;
 	}
-	ALOGV("layer:%p:  %p:size:%d x %d size:%d",layer, aCache,handle->width, handle->height, size);
+	ALOGV("layer:%p:  %p: size:%d", layer, aCache, size);
 	memset(aCache, 0, sizeof(tr_cache_Array));
 	for (i= 0; i < NOMORL_CACHE_N; i++) {
 		aCache->array[i].sync_cnt = -NOMORL_CACHE_N;
@@ -493,6 +492,18 @@ deal:
 
 }
 
+bool dequeueTrCache(Display_t *display, Layer_t *layer)
+{
+	private_handle_t *handle;
+	handle = (private_handle_t *)layer->buffer;
+
+	if (layer->transform & HAL_TRANSFORM_ROT_90)
+		return trCacheReserve(display, layer,
+				trCacheSize(layer, handle->height, handle->width));
+	return trCacheReserve(display, layer,
+			trCacheSize(layer, handle->width, handle->height));
+}
+
 void trResetErr(void)
 {
 	if (trfd < 0)
@@ -571,6 +582,31 @@ bool supportTR(Display_t *display, Layer_t *layer)
 	return dequeueTrCache(display, layer);
 }
 
+/*
+ * a yuv layer the de can not scale down in time is stretched by g2d
+ * to its frame size first, the de reads the small one and shows it 1:1.
+ */
+bool supportPreScale(Display_t *display, Layer_t *layer)
+{
+	int w, h;
+
+	if (trfd < 0 || tr_disp->trErrCnt > 3)
+		return false;
+	if (layer->transform != 0 || layerIsProtected(layer)
+		|| is_afbc_buf(layer->buffer) || !trHarewareRistrict(layer))
+		return false;
+
+	layerPreScaleSize(layer, &w, &h);
+	/* g2d smallest output is 8x4 and only for down scale */
+	if (w < 8 || h < 4)
+		return false;
+	if (w >= layer->crop.right - layer->crop.left
+		&& h >= layer->crop.bottom - layer->crop.top)
+		return false;
+
+	return trCacheReserve(display, layer, trCacheSize(layer, w, h));
+}
+
 bool layerToTrinfo(Layer_t *layer, g2d_blt_h *tr_info, tr_cache_t *bCache)
 {
 	private_handle_t *handle;
@@ -658,6 +694,22 @@ bool layerToTrinfo(Layer_t *layer, g2d_blt_h *tr_info, tr_cache_t *bCache)
 	tr_info->dst_image_h.align[2] = handle->aw_byte_align[2];
 	/*YUV format we only support yuv420 */
 
+	if (layer->prescale) {
+		int preW, preH;
+
+		/* stretch the crop to the whole output, rot_0 is the scaler path */
+		tr_info->flag_h = G2D_ROT_0;
+		tr_info->src_image_h.clip_rect.x = (int)layer->crop.left;
+		tr_info->src_image_h.clip_rect.y = (int)layer->crop.top;
+		tr_info->src_image_h.clip_rect.w = (int)(layer->crop.right - layer->crop.left);
+		tr_info->src_image_h.clip_rect.h = (int)(layer->crop.bottom - layer->crop.top);
+		layerPreScaleSize(layer, &preW, &preH);
+		tr_info->dst_image_h.width = preW;
+		tr_info->dst_image_h.height = preH;
+		tr_info->dst_image_h.clip_rect.w = preW;
+		tr_info->dst_image_h.clip_rect.h = preH;
+	}
+
 	tr_info->dst_image_h.fd = bCache->share_fd;
 
 	return 1;
@@ -674,6 +726,15 @@ int trAfterDeal(Layer_t *layer, tr_cache_t *bCache, g2d_blt_h *trInfo)
 /*	handle->aw_byte_align[2] = ROTATE_ALIGN / 2;*/
 
 	handle->format = trFormatToHal(trInfo->dst_image_h.format);
+	if (layer->prescale) {
+		handle->width = trInfo->dst_image_h.width;
+		handle->height = trInfo->dst_image_h.height;
+		handle->stride = HWC_ALIGN(handle->width, handle->aw_byte_align[0]);
+		layer->crop.left = 0;
+		layer->crop.top = 0;
+		layer->crop.right = handle->width;
+		layer->crop.bottom = handle->height;
+	}
 	return 0;
 }
 
@@ -690,8 +751,27 @@ int submitTransformLayer(rotate_info_t *rt_info, unsigned int syncCount)
 	bool bad_frame = 1;
 	/* if 2 screen use the same tr layer, we must reduce this case
 	*/
+	if (rt_info->key != 0) {
+		bCache = acquireLastValid(layer);
+		/* only a result which was rotated from this same source */
+		if (bCache != NULL && bCache->key == rt_info->key) {
+			trCacheStat(1, ((tr_cache_Array *)layer->trcache)->size);
+			layerToTrinfo(layer, &trInfo, bCache);
+			/* shown again, keep it until this frame is released */
+			if (bCache->releasefd >= 0)
+				close(bCache->releasefd);
+			bCache->releasefd = dup(rt_info->dst_waite_fence);
+			bCache->sync_cnt = syncCount;
+			trAfterDeal(layer, bCache, &trInfo);
+			return 0;
+		}
+		trCacheStat(0, 0);
+	}
 	/* maybe crach for aCache== NULL, but amost impossible ,so no care*/
 	bCache = dequeueTrBuffer(layer, rt_info);
+	/* overwritten now, keyed again only if the rotate succeeds */
+	if (bCache != NULL)
+		bCache->key = 0;
 	if (!layerToTrinfo(layer, &trInfo, bCache)) {
 		goto Last;
 	}
@@ -707,6 +787,7 @@ int submitTransformLayer(rotate_info_t *rt_info, unsigned int syncCount)
 	}
 
 	bCache->valid = 1;
+	bCache->key = rt_info->key;
 	bad_frame = 0;
 	bCache->sync_cnt = syncCount;
 	bCache->releasefd = dup(rt_info->dst_waite_fence);
@@ -724,7 +805,7 @@ Last:
 }
 
 int get_rotate_fence_fd(Layer_t *layer2,
-	Display_t *disp, int releasefence, unsigned int syncCount)
+	Display_t *disp, int releasefence, unsigned int syncCount, uint64_t key)
 {
 	char name[20];
 	int count;
@@ -746,6 +827,7 @@ int get_rotate_fence_fd(Layer_t *layer2,
 	tr_info->dst_waite_fence = dup(releasefence);
 	tr_info->gsyncCount = syncCount;
 	tr_info->disp = disp;
+	tr_info->key = key;
 
 	incRef(layer2);
 	if (inc_count + 2 < tr_info->syncCount)
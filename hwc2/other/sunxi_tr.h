@@ -106,6 +106,7 @@ typedef struct {
 	int releasefd;
 	int share_fd;//ion_handle share_fd
 	bool valid;
+	uint64_t key;//source it was rotated from, 0 if none
 }tr_cache_t;
 
 #define NOMORL_CACHE_N 3
@@ -117,6 +118,8 @@ typedef struct {
 	int size;
 	bool secure;
 	bool complete;
+	/* bumped when the source is damaged, a part of the key */
+	unsigned int serial;
 	struct listnode node;
 }tr_cache_Array;
 
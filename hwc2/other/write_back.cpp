@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <cutils/uevent.h>
@@ -27,6 +29,30 @@
 
 #include "hwc.h"
 
+/*
+ * max output size and buffer number come from Android.mk, and can be
+ * changed by persist.vendor.hwc.wb.size (WxH) and .buffers,
+ * a bigger screen is downscaled into it keeping the ratio.
+ */
+#ifndef WB_WIDTH
+#define WB_WIDTH 1280
+#endif
+#ifndef WB_HEIGHT
+#define WB_HEIGHT 720
+#endif
+#ifndef WB_CACHE_NUM
+#define WB_CACHE_NUM 6
+#endif
+#define WB_CACHE_MAX 8
+/*one shown by de1, one in capture, and MINCACHE queued*/
+#define WB_CACHE_MIN (MINCACHE + 3)
+
+/*a capture committed and waiting its fence, for the latency*/
+typedef struct wbInflight {
+	int fd;
+	int64_t reqTime;
+} wbInflight_t;
+
 /*store write back context*/
 typedef struct WriteBackContext {
 	struct listnode freebuf;
@@ -49,6 +75,30 @@ typedef struct WriteBackContext {
 	Layer_t* curShow;
 	bool bWbDispReset = false;
 	bool ownBuffer = false;
+	/*config*/
+	int maxW;
+	int maxH;
+	int bufNum;
+	/*wb thread, it arms a released buffer for present to capture into*/
+	pthread_t threadId;
+	bool threadRun = false;
+	bool stop;
+	int eventFd;
+	int epollFd;
+	Layer_t* armed;
+	Display_t* armDisplay;
+	wbInflight_t posted[WB_CACHE_MAX];
+	int postedNum;
+	wbInflight_t inflight[WB_CACHE_MAX];
+	/*metrics*/
+	unsigned int reqCount;
+	unsigned int doneCount;
+	unsigned int dropBuf;//no armed buffer, de1 still hold it
+	unsigned int errCount;
+	unsigned int skipCount;//de1 too slow, recycled without show
+	int64_t latLast;
+	int64_t latMax;
+	int64_t latSum;
 } wbctx_t;
 
 /*
@@ -63,11 +113,10 @@ typedef struct DELayerPrivate {
 }DELayerPrivate_t;
 
 wbctx_t WBCTX;
-#define MAXCACHE 6
 #define MINCACHE 2
 #define WB_ALIGN 4
-#define WB_WIDTH 1280
-#define WB_HEIGHT 720
+#define WB_EPOLL_N (WB_CACHE_MAX + 1)
+#define WB_EVENT_REQ 0
 #define INITED 1
 #define STARTED 2
 #define INVALID 0
@@ -79,6 +128,62 @@ enum {
 	ONNEED = 2,
 };
 
+static int wbThreadStart(void);
+static void wbThreadStop(void);
+
+static inline int64_t wbNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void wbLoadConfig(void)
+{
+	char property[PROPERTY_VALUE_MAX];
+	int w = 0, h = 0, num;
+
+	WBCTX.maxW = WB_WIDTH;
+	WBCTX.maxH = WB_HEIGHT;
+	if (property_get("persist.vendor.hwc.wb.size", property, NULL) > 0
+		&& sscanf(property, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+		WBCTX.maxW = w;
+		WBCTX.maxH = h;
+	}
+	num = property_get_int32("persist.vendor.hwc.wb.buffers", WB_CACHE_NUM);
+	if (num < WB_CACHE_MIN)
+		num = WB_CACHE_MIN;
+	if (num > WB_CACHE_MAX)
+		num = WB_CACHE_MAX;
+	WBCTX.bufNum = num;
+	ALOGD("wb max %dx%d buffers %d", WBCTX.maxW, WBCTX.maxH, WBCTX.bufNum);
+}
+
+/*fit the screen in the max size keeping the ratio, 4k to 1080p is 1/2x*/
+static void wbFitSize(int curW, int curH)
+{
+	WBCTX.width = curW;
+	WBCTX.height = curH;
+	if (curW <= WBCTX.maxW && curH <= WBCTX.maxH)
+		return;
+	if ((int64_t)curW * WBCTX.maxH > (int64_t)curH * WBCTX.maxW) {
+		WBCTX.width = WBCTX.maxW;
+		WBCTX.height = (int)((int64_t)curH * WBCTX.maxW / curW);
+	} else {
+		WBCTX.height = WBCTX.maxH;
+		WBCTX.width = (int)((int64_t)curW * WBCTX.maxH / curH);
+	}
+	WBCTX.width &= ~(WB_ALIGN - 1);
+	WBCTX.height &= ~1;
+}
+
+/*a buffer holding the max output in rgb or yuv, for the readback stream*/
+int writebackMaxBufferSize(void)
+{
+	return HWC_ALIGN(WBCTX.maxW, 64) * HWC_ALIGN(WBCTX.maxH, 64) * 4;
+}
+
 /*bring up driver's writeback resource*/
 void writebackStart(int hwid) {
 	unsigned long args[4];
@@ -166,7 +271,7 @@ int setupLayer(Layer_t* layer, Display_t* dp) {
 	ALOGV("setupLayer vpercent = %d, hpercent = %d", WBCTX.vpercent, WBCTX.hpercent);
 	/*only allocate once*/
 	if (layer->buffer == NULL) {
-		layer->buffer = (private_handle_t *)hwc_malloc(sizeof(private_handle_t));
+		layer->buffer = (private_handle_t *)hwc_malloc_type(sizeof(private_handle_t), MEM_WRITEBACK);
 	}
 	private_handle_t *handle = (private_handle_t *)layer->buffer;
 	if (handle == NULL) {
@@ -289,7 +394,7 @@ int initBuffer(Display_t* dp) {
 	DisplayOpr_t* opt = dp->displayOpration;
 	list_init(&WBCTX.freebuf);
 	list_init(&WBCTX.wbbuf);
-	for (int i = 0; i < MAXCACHE; i++) {
+	for (int i = 0; i < WBCTX.bufNum; i++) {
 		Layer_t* layer = opt->createLayer(dp);
 		if (setupLayer(layer, dp) == 0) {
 			list_add_tail(&WBCTX.freebuf, &layer->node);
@@ -308,8 +413,10 @@ int initWriteBack(Display_t* dp, bool isInitBuf) {
 #else
 	WBCTX.mustconfig = 0;
 #endif
-	WBCTX.width = WB_WIDTH;
-	WBCTX.height = WB_HEIGHT;
+	wbLoadConfig();
+	/*buffers are allocated once, for the max size*/
+	WBCTX.width = WBCTX.maxW;
+	WBCTX.height = WBCTX.maxH;
 	WBCTX.hpercent = 100;
 	WBCTX.vpercent = 100;
 	/*hw only writeback rgb->rgb or yuv->yuv series*/
@@ -329,6 +436,9 @@ int initWriteBack(Display_t* dp, bool isInitBuf) {
 	writebackStart(0);
 	WBCTX.state = INITED;
 	WBCTX.curShow = NULL;
+	/*readback capture synchronously, only the mirror need the thread*/
+	if (isInitBuf && wbThreadStart())
+		ALOGE("wb thread start fail, mirror disabled");
 	return 0;
 }
 
@@ -337,6 +447,7 @@ void deinitWriteBack(Display_t* dp) {
 		/*de0 is better, should de0 wb to de1*/
 		ALOGD("deinitWriteBack with wrong id=%d", dp->displayId);
 	}
+	wbThreadStop();
 	writebackStop(0);
 	deinitBuffer();
 	if(WBCTX.wbinfo != NULL) {
@@ -363,7 +474,7 @@ Display_t* getWbDisplay(Display_t* dp) {
 		return NULL;
 	}
 	if (WBCTX.wbDisplay == NULL) {
-		WBCTX.wbDisplay = (Display_t *)hwc_malloc(sizeof(Display_t) + sizeof(DisplayPrivate_t));
+		WBCTX.wbDisplay = (Display_t *)hwc_malloc_type(sizeof(Display_t) + sizeof(DisplayPrivate_t), MEM_WRITEBACK);
 		if (WBCTX.wbDisplay == NULL) {
 			ALOGE("Alloc display err, Can not initial the hwc module.");
 			return NULL;
@@ -526,6 +637,7 @@ Layer_t* acquireLayer(struct sync_info *sync, Display_t* dp) {
 			}
 			list_remove(&leftLayer->node);
 			list_add_tail(&WBCTX.freebuf, &leftLayer->node);
+			WBCTX.skipCount++;
 		}
 	}
 	pthread_mutex_unlock(&WBCTX.wbmutex);
@@ -608,16 +720,9 @@ int writebackOneFrame(Display_t* dp, Layer_t* layer, struct sync_info *sync) {
 	if (curH != WBCTX.curH || curW != WBCTX.curW
 			|| curH != layer->crop.bottom
 			|| curW != layer->crop.right) {
-		WBCTX.height = curH;
-		WBCTX.width = curW;
 		WBCTX.curH = curH;
 		WBCTX.curW = curW;
-		if (WBCTX.height > WB_HEIGHT) {
-			WBCTX.height = WB_HEIGHT;
-		}
-		if (WBCTX.width > WB_WIDTH) {
-			WBCTX.width = WB_WIDTH;
-		}
+		wbFitSize(curW, curH);
 	}
 	/*something change reset layer info*/
 	if (setupLayer(layer, dp)) {
@@ -627,10 +732,11 @@ int writebackOneFrame(Display_t* dp, Layer_t* layer, struct sync_info *sync) {
 	/*setup wb buffer*/
 	setupWbInfo(WBCTX.wbinfo, layer);
 
-	/*handle fence, de0's wb buf must without de1 using*/
+	/*handle fence, de0's wb buf must without de1 using, never wait it here*/
 	if (layer->releaseFence >= 0) {
-		if (sync_wait((int)layer->releaseFence, 3000)) {
-			ALOGE("writebackOneFrame release fence err %d", layer->releaseFence);
+		if (sync_wait((int)layer->releaseFence, 0)) {
+			ALOGV("writebackOneFrame buffer still in use %d", layer->releaseFence);
+			return -1;
 		}
 		close(layer->releaseFence);
 		layer->releaseFence = -1;
@@ -643,11 +749,6 @@ int writebackOneFrame(Display_t* dp, Layer_t* layer, struct sync_info *sync) {
 	arg[3] = 0;
 	if (ioctl(WBCTX.wbFd, DISP_CAPTURE_COMMIT2, (void*)arg) < 0) {
 		ALOGE("DISP_CAPTURE_COMMIT2 fail! ownBuffer= %d", WBCTX.ownBuffer);
-		if (WBCTX.ownBuffer) {
-			pthread_mutex_lock(&WBCTX.wbmutex);
-			list_add_tail(&WBCTX.freebuf, &layer->node);
-			pthread_mutex_unlock(&WBCTX.wbmutex);
-		}
 		if (layer->acquireFence >= 0) {
 			close(layer->acquireFence);
 			layer->acquireFence = -1;
@@ -666,6 +767,237 @@ int writebackOneFrame(Display_t* dp, Layer_t* layer, struct sync_info *sync) {
 	return 0;
 }
 
+/*
+ * the wb thread:
+ * it takes a free buffer and waits de1 release it, then arms it. present
+ * commits the capture into the armed buffer before the de0 frame is queued,
+ * so the capture is done with that frame and its fence, which de1 waits
+ * as the acquire fence, signals the capture. present never wait de1, when
+ * nothing is armed the frame is not captured.
+ */
+static void wbWatchDone(int fd, int64_t reqTime)
+{
+	struct epoll_event eventItem;
+	int i;
+
+	for (i = 0; i < WB_CACHE_MAX; i++) {
+		if (WBCTX.inflight[i].fd < 0)
+			break;
+	}
+	if (i == WB_CACHE_MAX || fd < 0)
+		return;
+	WBCTX.inflight[i].fd = dup(fd);
+	WBCTX.inflight[i].reqTime = reqTime;
+	memset(&eventItem, 0, sizeof(eventItem));
+	eventItem.events = EPOLLIN;
+	eventItem.data.u32 = i + 1;
+	if (epoll_ctl(WBCTX.epollFd, EPOLL_CTL_ADD, WBCTX.inflight[i].fd, &eventItem)) {
+		close(WBCTX.inflight[i].fd);
+		WBCTX.inflight[i].fd = -1;
+	}
+}
+
+static void wbCaptureDone(wbInflight_t *done, bool count)
+{
+	int64_t lat;
+
+	epoll_ctl(WBCTX.epollFd, EPOLL_CTL_DEL, done->fd, NULL);
+	close(done->fd);
+	done->fd = -1;
+	if (!count)
+		return;
+	lat = wbNow() - done->reqTime;
+	WBCTX.latLast = lat;
+	WBCTX.latSum += lat;
+	if (lat > WBCTX.latMax)
+		WBCTX.latMax = lat;
+	WBCTX.doneCount++;
+}
+
+static void wbArm(void)
+{
+	Layer_t* frame;
+	Display_t* dp;
+
+	ATRACE_CALL();
+	pthread_mutex_lock(&WBCTX.wbmutex);
+	frame = WBCTX.armed;
+	dp = WBCTX.armDisplay;
+	pthread_mutex_unlock(&WBCTX.wbmutex);
+	if (frame != NULL || dp == NULL)
+		return;
+	frame = dequeueLayer(dp);
+	if (frame == NULL)
+		return;
+	if (frame->releaseFence >= 0) {
+		if (sync_wait(frame->releaseFence, 3000))
+			ALOGE("wb:release fence err %d", frame->releaseFence);
+		close(frame->releaseFence);
+		frame->releaseFence = -1;
+	}
+	pthread_mutex_lock(&WBCTX.wbmutex);
+	WBCTX.armed = frame;
+	pthread_mutex_unlock(&WBCTX.wbmutex);
+}
+
+static void* wbThreadLoop(void *data)
+{
+	struct epoll_event eventItems[WB_EPOLL_N];
+	wbInflight_t posted[WB_CACHE_MAX];
+	uint64_t events;
+	int i, num;
+	unusedpara(data);
+
+	setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
+	while (!WBCTX.stop) {
+		num = epoll_wait(WBCTX.epollFd, eventItems, WB_EPOLL_N, -1);
+		for (i = 0; i < num; i++) {
+			if (eventItems[i].data.u32 == WB_EVENT_REQ)
+				read(WBCTX.eventFd, &events, sizeof(events));
+			else
+				wbCaptureDone(&WBCTX.inflight[eventItems[i].data.u32 - 1], 1);
+		}
+
+		/*the inflight set is only touched here, present post the fences*/
+		pthread_mutex_lock(&WBCTX.wbmutex);
+		num = WBCTX.postedNum;
+		memcpy(posted, WBCTX.posted, num * sizeof(posted[0]));
+		WBCTX.postedNum = 0;
+		pthread_mutex_unlock(&WBCTX.wbmutex);
+		for (i = 0; i < num; i++) {
+			wbWatchDone(posted[i].fd, posted[i].reqTime);
+			close(posted[i].fd);
+		}
+		wbArm();
+	}
+	return NULL;
+}
+
+static int wbThreadStart(void)
+{
+	struct epoll_event eventItem;
+	int i;
+
+	for (i = 0; i < WB_CACHE_MAX; i++)
+		WBCTX.inflight[i].fd = -1;
+	WBCTX.postedNum = 0;
+	WBCTX.armed = NULL;
+	WBCTX.armDisplay = NULL;
+	WBCTX.stop = 0;
+	WBCTX.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (WBCTX.eventFd < 0) {
+		ALOGE("creat wb eventfd err %d", errno);
+		return -1;
+	}
+	WBCTX.epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (WBCTX.epollFd < 0) {
+		ALOGE("creat wb epoll err %d", errno);
+		close(WBCTX.eventFd);
+		return -1;
+	}
+	memset(&eventItem, 0, sizeof(eventItem));
+	eventItem.events = EPOLLIN;
+	eventItem.data.u32 = WB_EVENT_REQ;
+	epoll_ctl(WBCTX.epollFd, EPOLL_CTL_ADD, WBCTX.eventFd, &eventItem);
+	if (pthread_create(&WBCTX.threadId, NULL, wbThreadLoop, NULL)) {
+		close(WBCTX.epollFd);
+		close(WBCTX.eventFd);
+		return -1;
+	}
+	WBCTX.threadRun = true;
+	return 0;
+}
+
+static void wbThreadStop(void)
+{
+	uint64_t one = 1;
+	int i;
+
+	if (!WBCTX.threadRun)
+		return;
+	WBCTX.stop = 1;
+	write(WBCTX.eventFd, &one, sizeof(one));
+	pthread_join(WBCTX.threadId, NULL);
+	WBCTX.threadRun = false;
+	for (i = 0; i < WB_CACHE_MAX; i++) {
+		if (WBCTX.inflight[i].fd >= 0)
+			wbCaptureDone(&WBCTX.inflight[i], 0);
+	}
+	for (i = 0; i < WBCTX.postedNum; i++)
+		close(WBCTX.posted[i].fd);
+	WBCTX.postedNum = 0;
+	if (WBCTX.armed != NULL) {
+		list_add_tail(&WBCTX.freebuf, &WBCTX.armed->node);
+		WBCTX.armed = NULL;
+	}
+	close(WBCTX.epollFd);
+	close(WBCTX.eventFd);
+}
+
+/*capture one frame of dp into the armed buffer, called by present before the frame is queued*/
+int writebackQueueFrame(Display_t* dp, struct sync_info *sync) {
+	uint64_t one = 1;
+	Layer_t* frame;
+	int64_t reqTime;
+	int ret = -1;
+
+	if (!WBCTX.threadRun || dp == NULL || sync == NULL) {
+		return -1;
+	}
+	reqTime = wbNow();
+	pthread_mutex_lock(&WBCTX.wbmutex);
+	frame = WBCTX.armed;
+	WBCTX.armed = NULL;
+	WBCTX.armDisplay = dp;
+	WBCTX.reqCount++;
+	if (frame == NULL)
+		WBCTX.dropBuf++;
+	pthread_mutex_unlock(&WBCTX.wbmutex);
+
+	if (frame == NULL) {
+		/*de1 still hold them, skip this frame*/
+		ALOGV("wb:no armed buffer frame:%u", dp->frameCount);
+		ret = 0;
+	} else if (writebackOneFrame(dp, frame, sync)) {
+		ALOGE("wboneframe failed frame:%u", dp->frameCount);
+		WBCTX.errCount++;
+		/*not captured, whatever failed the buffer is free again*/
+		pthread_mutex_lock(&WBCTX.wbmutex);
+		list_add_tail(&WBCTX.freebuf, &frame->node);
+		pthread_mutex_unlock(&WBCTX.wbmutex);
+	} else {
+		ret = 0;
+		pthread_mutex_lock(&WBCTX.wbmutex);
+		list_add_tail(&WBCTX.wbbuf, &frame->node);
+		/*the fence de1 will wait, so the latency is the capture's*/
+		if (frame->acquireFence >= 0 && WBCTX.postedNum < WB_CACHE_MAX) {
+			WBCTX.posted[WBCTX.postedNum].fd = dup(frame->acquireFence);
+			WBCTX.posted[WBCTX.postedNum].reqTime = reqTime;
+			WBCTX.postedNum++;
+		}
+		pthread_mutex_unlock(&WBCTX.wbmutex);
+	}
+
+	/*arm the next one*/
+	if (write(WBCTX.eventFd, &one, sizeof(one)) != sizeof(one))
+		ALOGE("wake wb thread err %d", errno);
+	return ret;
+}
+
+int writebackDump(char* outBuffer) {
+	unsigned int done = WBCTX.doneCount;
+
+	if (!WBCTX.threadRun)
+		return 0;
+	return sprintf(outBuffer, "wb %dx%d(max %dx%d) buf:%d req:%u done:%u drop(buf:%u err:%u skip:%u)"
+			" lat(us) last:%lld avg:%lld max:%lld\n",
+			WBCTX.width, WBCTX.height, WBCTX.maxW, WBCTX.maxH, WBCTX.bufNum,
+			WBCTX.reqCount, done, WBCTX.dropBuf, WBCTX.errCount, WBCTX.skipCount,
+			(long long)(WBCTX.latLast / 1000),
+			(long long)(done ? WBCTX.latSum / done / 1000 : 0),
+			(long long)(WBCTX.latMax / 1000));
+}
+
 /*dump one wb buffer for debug*/
 void dumpLayer(Layer_t *layer,unsigned int framecout)
 {
@@ -30,6 +30,7 @@
 #include <sys/eventfd.h>
 
 #include "../hwc.h"
+#include "hwc_vsync_parse.h"
 
 #define UEVENT_MSG_LEN  2048
 
@@ -52,6 +53,22 @@ typedef enum callbackType {
     CALLBACK_NUMBER,
 } callbackType_t;
 
+/*
+ * direct vsync source per hw display, only when the driver has one and
+ * persist.vendor.hwc.vsync_path names it, %d is the hw id. the timestamp
+ * in ns comes from: a sysfs attribute (path under /sys/) notified on
+ * every vsync and holding it as a decimal string, or a driver event fd
+ * giving a raw int64_t per vsync on read.
+ * uevent keeps the vsync of a display until its source gives one, and
+ * still delivers it when the source is VSYNC_SRC_LATE_NS behind, after
+ * VSYNC_SRC_STALL_N of those in a row the source is dropped. a timestamp
+ * within VSYNC_DUP_NS of the last one is the same vsync seen twice.
+ */
+#define VSYNC_SRC_N 2
+#define VSYNC_SRC_LATE_NS 25000000LL
+#define VSYNC_SRC_STALL_N 8
+#define VSYNC_DUP_NS 1000000LL
+
 typedef struct eventThreadContext {
 	pthread_mutex_t listMutex;
 	struct listnode callbackHead[CALLBACK_NUMBER];
@@ -61,6 +78,11 @@ typedef struct eventThreadContext {
 	int stop;
 	int epoll_fd;
 	int socketpair_fd;
+	int vsyncFd[VSYNC_SRC_N];
+	bool vsyncBin[VSYNC_SRC_N];
+	int64_t vsyncSrcLast[VSYNC_SRC_N];//last from the source, 0 none yet
+	int64_t vsyncLast[VSYNC_SRC_N];//last delivered
+	int vsyncSrcMiss[VSYNC_SRC_N];//uevents the source was late for
 }eventThreadContext_t;
 
 int hdmifd = -1;
@@ -269,19 +291,118 @@ bad:
 	return HWC2_ERROR_BAD_PARAMETER;
 }
 
+static void
+vsyncDeliver(eventThreadContext_t *context, int32_t hwid, int64_t timestamp)
+{
+	Display_t *display;
+
+	if (hwid >= 0 && hwid < VSYNC_SRC_N) {
+		if (timestamp > context->vsyncLast[hwid] - VSYNC_DUP_NS
+			&& timestamp < context->vsyncLast[hwid] + VSYNC_DUP_NS)
+			return;
+		context->vsyncLast[hwid] = timestamp;
+	}
+	display = findDisplayforhw(hwid);
+	if (display != NULL)
+		vsyncModelUpdate(display, timestamp);
+	callVsync(context, hwid, timestamp);
+}
+
+static void vsyncSourceClose(eventThreadContext_t *context, int hwid)
+{
+	epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, context->vsyncFd[hwid], NULL);
+	close(context->vsyncFd[hwid]);
+	context->vsyncFd[hwid] = -1;
+}
+
+/* uevent is taken until the source gives one, and when the source is late */
+static bool vsyncUeventWanted(eventThreadContext_t *context, int32_t hwid, int64_t timestamp)
+{
+	if (hwid < 0 || hwid >= VSYNC_SRC_N || context->vsyncFd[hwid] < 0
+		|| context->vsyncSrcLast[hwid] == 0)
+		return true;
+	if (timestamp - context->vsyncSrcLast[hwid] < VSYNC_SRC_LATE_NS)
+		return false;
+	if (++context->vsyncSrcMiss[hwid] >= VSYNC_SRC_STALL_N) {
+		ALOGW("display%d vsync source stalled, back to uevent", hwid);
+		vsyncSourceClose(context, hwid);
+	}
+	return true;
+}
+
 static void
 vsyncUeventParse(eventThreadContext_t *context, const char *msg)
 {
-    while (*msg) {
-
-        if (!strncmp(msg, "VSYNC", strlen("VSYNC"))) {
-            msg += strlen("VSYNC");
-            int32_t vsync_id = *(msg) - '0';
-            int64_t timestamp = strtoull(msg + 2, NULL, 0);
-            callVsync(context, vsync_id, timestamp);
-        }
-        while (*msg++);
-    }
+	int64_t timestamp;
+	int vsync_id;
+
+	while (vsyncUeventNext(&msg, &vsync_id, &timestamp)) {
+		if (vsyncUeventWanted(context, vsync_id, timestamp))
+			vsyncDeliver(context, vsync_id, timestamp);
+	}
+}
+
+static void vsyncSourceOpen(eventThreadContext_t *context)
+{
+	struct epoll_event eventItem;
+	char path[PROPERTY_VALUE_MAX];
+	char name[PROPERTY_VALUE_MAX + 8];
+	bool bin;
+	int i, fd;
+
+	for (i = 0; i < VSYNC_SRC_N; i++) {
+		context->vsyncFd[i] = -1;
+		context->vsyncSrcLast[i] = 0;
+		context->vsyncLast[i] = 0;
+		context->vsyncSrcMiss[i] = 0;
+	}
+	if (property_get("persist.vendor.hwc.vsync_path", path, NULL) <= 0)
+		return;
+	bin = strncmp(path, "/sys/", strlen("/sys/")) != 0;
+	for (i = 0; i < VSYNC_SRC_N; i++) {
+		snprintf(name, sizeof(name), path, i);
+		fd = open(name, O_RDONLY | O_CLOEXEC | (bin ? O_NONBLOCK : 0));
+		if (fd < 0)
+			continue;
+		/* read once to arm the sysfs notify */
+		if (!bin && vsyncSourceRead(fd, bin) < 0) {
+			close(fd);
+			continue;
+		}
+		memset(&eventItem, 0, sizeof(eventItem));
+		eventItem.events = bin ? EPOLLIN : EPOLLPRI | EPOLLERR;
+		eventItem.data.fd = fd;
+		if (epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, fd, &eventItem)) {
+			close(fd);
+			continue;
+		}
+		context->vsyncFd[i] = fd;
+		context->vsyncBin[i] = bin;
+		ALOGD("display%d vsync from %s", i, name);
+	}
+}
+
+/* true if fd is a vsync source */
+static bool vsyncSourceEvent(eventThreadContext_t *context, int fd)
+{
+	int64_t timestamp;
+	int i;
+
+	for (i = 0; i < VSYNC_SRC_N; i++) {
+		if (context->vsyncFd[i] != fd)
+			continue;
+		timestamp = vsyncSourceRead(fd, context->vsyncBin[i]);
+		if (timestamp < 0) {
+			ALOGE("display%d vsync source broken, back to uevent", i);
+			vsyncSourceClose(context, i);
+		} else if (timestamp > 0) {
+			context->vsyncSrcLast[i] = timestamp;
+			context->vsyncSrcMiss[i] = 0;
+			vsyncDeliver(context, i, timestamp);
+		}
+		return true;
+	}
+	return false;
 }
 
 static void
@@ -424,13 +545,16 @@ init_epoll:
 	result = epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, context->socketpair_fd, &eventItem);
 	if (result != 0)
 		ALOGD("creat socketpair_fd epoll event err %d fd %d", result,  context->socketpair_fd);
+	vsyncSourceOpen(context);
 
 	while (!context->stop) {
 		eventCount = epoll_wait(context->epoll_fd, eventItems, EPOLL_COUNT, -1);
 		for (int i = 0; i < eventCount; i++) {
 			int fd = eventItems[i].data.fd;
         	uint32_t epollEvents = eventItems[i].events;
-        	if (fd == ueventfd) {
+        	if (vsyncSourceEvent(context, fd)) {
+				continue;
+			} else if (fd == ueventfd) {
             	if (epollEvents & EPOLLIN) {
 					recvlen = uevent_kernel_multicast_recv(ueventfd, msg, UEVENT_MSG_LEN);
 					if (recvlen <= 0 || recvlen >= UEVENT_MSG_LEN)
@@ -499,6 +623,10 @@ init_epoll:
 			}
 		}
 	}
+	for (int i = 0; i < VSYNC_SRC_N; i++) {
+		if (context->vsyncFd[i] >= 0)
+			vsyncSourceClose(context, i);
+	}
 	close(ueventfd);
 	return NULL;
 }
@@ -516,6 +644,8 @@ int eventThreadInit(Display_t **display, int number, int socketpair_fd)
 	context->numberDisplay = number;
 	context->stop = 1;
 	context->socketpair_fd = socketpair_fd;
+	for (it = 0; it < VSYNC_SRC_N; it++)
+		context->vsyncFd[it] = -1;
 	ALOGD("init event thread Ok read socket fd:%d", socketpair_fd);
     return 0;
 }
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * host benchmark of the present to submit thread handoff, enqueue to
+ * commit latency of:
+ *   list: the old list + mutex + condition with the 16ms timed wait
+ *   ring: the SPSC ring + eventfd + epoll of submitLayerToDisplay
+ * the commit itself is empty, only the handoff is measured.
+ *
+ * hwc_submit_bench [frames] [interval_us]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <vector>
+
+#define RING_SIZE 8
+
+typedef struct benchFrame {
+	struct benchFrame *next;
+	int64_t enqueue;
+} benchFrame_t;
+
+typedef struct bench {
+	/*list*/
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	benchFrame_t *head;
+	benchFrame_t **tail;
+	/*ring*/
+	volatile unsigned int ringHead;
+	volatile unsigned int ringTail;
+	benchFrame_t *ring[RING_SIZE];
+	int eventFd;
+	int epollFd;
+
+	volatile bool stop;
+	int frames;
+	int done;
+	std::vector<int64_t> lat;
+} bench_t;
+
+static inline int64_t benchNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void benchCommit(bench_t *b, benchFrame_t *frame)
+{
+	b->lat.push_back(benchNow() - frame->enqueue);
+	b->done++;
+}
+
+static void listSubmit(bench_t *b, benchFrame_t *frame)
+{
+	pthread_mutex_lock(&b->mutex);
+	frame->next = NULL;
+	*b->tail = frame;
+	b->tail = &frame->next;
+	pthread_cond_signal(&b->cond);
+	pthread_mutex_unlock(&b->mutex);
+}
+
+static void* listLoop(void *data)
+{
+	bench_t *b = (bench_t *)data;
+	benchFrame_t *frame, *next;
+	struct timespec ts;
+
+	while (b->done < b->frames) {
+		pthread_mutex_lock(&b->mutex);
+		if (b->head == NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_nsec += 16000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&b->cond, &b->mutex, &ts);
+		}
+		frame = b->head;
+		b->head = NULL;
+		b->tail = &b->head;
+		pthread_mutex_unlock(&b->mutex);
+		for (; frame != NULL; frame = next) {
+			next = frame->next;
+			benchCommit(b, frame);
+		}
+	}
+	return NULL;
+}
+
+static int ringSubmit(bench_t *b, benchFrame_t *frame)
+{
+	unsigned int tail = b->ringTail;
+	uint64_t one = 1;
+
+	while (tail - __atomic_load_n(&b->ringHead, __ATOMIC_ACQUIRE) >= RING_SIZE)
+		usleep(1000);
+	b->ring[tail & (RING_SIZE - 1)] = frame;
+	__atomic_store_n(&b->ringTail, tail + 1, __ATOMIC_RELEASE);
+	if (write(b->eventFd, &one, sizeof(one)) != sizeof(one))
+		return -1;
+	return 0;
+}
+
+static void* ringLoop(void *data)
+{
+	bench_t *b = (bench_t *)data;
+	struct epoll_event eventItems[4];
+	unsigned int head;
+	uint64_t events;
+	int i, num;
+
+	while (b->done < b->frames) {
+		num = epoll_wait(b->epollFd, eventItems, 4, 16);
+		for (i = 0; i < num; i++)
+			read(b->eventFd, &events, sizeof(events));
+		head = b->ringHead;
+		while (head != __atomic_load_n(&b->ringTail, __ATOMIC_ACQUIRE)) {
+			benchCommit(b, b->ring[head & (RING_SIZE - 1)]);
+			__atomic_store_n(&b->ringHead, ++head, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+static int benchInit(bench_t *b, int frames)
+{
+	struct epoll_event eventItem;
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&b->mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&b->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	b->head = NULL;
+	b->tail = &b->head;
+	b->ringHead = 0;
+	b->ringTail = 0;
+	b->frames = frames;
+	b->done = 0;
+	b->lat.reserve(frames);
+	b->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	b->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (b->eventFd < 0 || b->epollFd < 0)
+		return -1;
+	memset(&eventItem, 0, sizeof(eventItem));
+	eventItem.events = EPOLLIN;
+	eventItem.data.fd = b->eventFd;
+	return epoll_ctl(b->epollFd, EPOLL_CTL_ADD, b->eventFd, &eventItem);
+}
+
+static void benchDeinit(bench_t *b)
+{
+	close(b->epollFd);
+	close(b->eventFd);
+	pthread_cond_destroy(&b->cond);
+	pthread_mutex_destroy(&b->mutex);
+}
+
+static void benchReport(const char *name, bench_t *b)
+{
+	std::vector<int64_t> &lat = b->lat;
+	int64_t sum = 0;
+	size_t n = lat.size();
+
+	std::sort(lat.begin(), lat.end());
+	for (size_t i = 0; i < n; i++)
+		sum += lat[i];
+	printf("%-5s frames:%zu latency(us) avg:%.1f p50:%.1f p99:%.1f max:%.1f\n",
+		name, n, n ? sum / 1000.0 / n : 0.0,
+		n ? lat[n / 2] / 1000.0 : 0.0,
+		n ? lat[n * 99 / 100] / 1000.0 : 0.0,
+		n ? lat[n - 1] / 1000.0 : 0.0);
+}
+
+static int benchRun(const char *name, bool ring, int frames, int interval)
+{
+	std::vector<benchFrame_t> frame(frames);
+	pthread_t thread;
+	bench_t b;
+
+	if (benchInit(&b, frames)) {
+		fprintf(stderr, "%s init err %d\n", name, errno);
+		return -1;
+	}
+	if (pthread_create(&thread, NULL, ring ? ringLoop : listLoop, &b)) {
+		benchDeinit(&b);
+		return -1;
+	}
+	for (int i = 0; i < frames; i++) {
+		usleep(interval);
+		frame[i].enqueue = benchNow();
+		if (ring)
+			ringSubmit(&b, &frame[i]);
+		else
+			listSubmit(&b, &frame[i]);
+	}
+	pthread_join(thread, NULL);
+	benchReport(name, &b);
+	benchDeinit(&b);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 1000;
+	int interval = argc > 2 ? atoi(argv[2]) : 2000;
+
+	if (frames <= 0 || interval < 0) {
+		fprintf(stderr, "usage: %s [frames] [interval_us]\n", argv[0]);
+		return 1;
+	}
+	if (benchRun("list", 0, frames, interval) || benchRun("ring", 1, frames, interval))
+		return 1;
+	return 0;
+}
@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <cutils/uevent.h>
@@ -27,20 +29,255 @@
 
 #include "hwc.h"
 
+#define SUBMIT_EPOLL_N 16
+/* a frame waiting its acquire fences longer than this is committed anyway */
+#define FENCE_LATE_NS 3000000000LL
+/*
+ * vsync prediction: the phase is the last vsync uevent, the period is
+ * filtered from the following ones. the model is too old to trust when
+ * vsync has been off longer than VSYNC_STALE_NS.
+ */
+#define VSYNC_VALID_SAMPLES 4
+#define VSYNC_STALE_NS 1000000000LL
+#define VSYNC_PERIOD_MIN 4000000LL
+#define VSYNC_PERIOD_MAX 50000000LL
+/* off by default, persist.vendor.hwc.commit_margin_us turns it on */
+#define COMMIT_MARGIN_US 0
+/* present wait so long at most for a full ring, then the frame is dropped */
+#define SUBMIT_FULL_WAIT_MS 50
+
+static inline int64_t submitNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int submitPendingCount(Display_t *disp)
+{
+	submitThread_t *myThread = disp->commitThread;
+
+	return (int)(__atomic_load_n(&myThread->ringTail, __ATOMIC_ACQUIRE)
+			- __atomic_load_n(&myThread->ringHead, __ATOMIC_ACQUIRE))
+			+ myThread->pendNum;
+}
+
 int submitLayerToDisplay(Display_t *disp, LayerSubmit_t *submitLayer)
 {
 	ATRACE_NAME(submitLayer->traceName);
 
 	submitThread_t *myThread = disp->commitThread;
+	unsigned int tail = myThread->ringTail;
+	uint64_t one = 1;
+	int waited = 0;
 
-	myThread->mutex->lock();
+	/*
+	 * only present thread push, so tail is owned by us. the thread paused
+	 * or stuck on a fence never empty the ring, drop this frame instead.
+	 * its fence is given back to the caller, which still dups it for the
+	 * retire and readback, it signals with the next frame committed.
+	 */
+	while (tail - __atomic_load_n(&myThread->ringHead, __ATOMIC_ACQUIRE)
+			>= SUBMIT_RING_SIZE) {
+		if (myThread->stop || !disp->active || isStopSubmit()
+			|| waited++ >= SUBMIT_FULL_WAIT_MS) {
+			ALOGW("submit ring full, drop frame:%u display:%d",
+				submitLayer->frameCount, disp->displayId);
+			myThread->ringDropCount++;
+			submitLayer->sync.fd = -1;
+			submitLayerCachePut(submitLayer);
+			return -1;
+		}
+		myThread->ringFullCount++;
+		usleep(1000);
+	}
+	frameTimeMark(disp, submitLayer->frameCount, FRAME_ENQUEUE);
+	submitLayer->waitStart = submitNow();
+	myThread->ring[tail & (SUBMIT_RING_SIZE - 1)] = submitLayer;
+	__atomic_store_n(&myThread->ringTail, tail + 1, __ATOMIC_RELEASE);
 
-	list_add_tail(&myThread->SubmitHead, &submitLayer->node);
-	myThread->cond->signal();
-	myThread->mutex->unlock();
+	if (write(myThread->eventFd, &one, sizeof(one)) != sizeof(one))
+		ALOGE("wake submit thread err %d", errno);
 	return 0;
 }
 
+void vsyncModelUpdate(Display_t *disp, int64_t timestamp)
+{
+	submitThread_t *myThread = disp->commitThread;
+	vsyncModel_t *model;
+	int64_t delta, sample;
+	int n;
+
+	if (myThread == NULL)
+		return;
+	model = &myThread->vsync;
+	delta = timestamp - model->last;
+	/* the same vsync reported twice */
+	if (model->samples != 0 && delta == 0)
+		return;
+	__atomic_add_fetch(&model->seq, 1, __ATOMIC_ACQ_REL);
+	if (model->samples == 0 || delta < 0 || delta > VSYNC_STALE_NS) {
+		model->samples = 1;
+	} else if (model->period == 0) {
+		if (delta >= VSYNC_PERIOD_MIN && delta <= VSYNC_PERIOD_MAX) {
+			model->period = delta;
+			model->samples++;
+		}
+	} else {
+		/* some uevents may be lost, count the periods between */
+		n = (int)((delta + model->period / 2) / model->period);
+		if (n > 0) {
+			sample = delta / n;
+			model->period += (sample - model->period) / 8;
+			model->samples++;
+		}
+	}
+	model->last = timestamp;
+	__atomic_add_fetch(&model->seq, 1, __ATOMIC_ACQ_REL);
+}
+
+/* the first predicted vsync after now, false if no model to trust */
+static bool vsyncModelNext(submitThread_t *myThread, int64_t now, int64_t *next, int64_t *period)
+{
+	vsyncModel_t *model = &myThread->vsync;
+	unsigned int seq, samples;
+	int64_t last;
+
+	do {
+		seq = __atomic_load_n(&model->seq, __ATOMIC_ACQUIRE);
+		last = model->last;
+		*period = model->period;
+		samples = model->samples;
+	} while ((seq & 1) || seq != __atomic_load_n(&model->seq, __ATOMIC_ACQUIRE));
+
+	if (samples < VSYNC_VALID_SAMPLES || *period <= 0
+		|| now - last > VSYNC_STALE_NS)
+		return false;
+	*next = last + (now - last) / *period * *period + *period;
+	return true;
+}
+
+/* ns to hold the ready frame, 0 commit it now */
+static int64_t submitHoldTime(submitThread_t *myThread, int64_t now)
+{
+	int64_t next, period;
+
+	if (myThread->commitMargin <= 0
+		|| !vsyncModelNext(myThread, now, &next, &period))
+		return 0;
+	if (next - myThread->commitMargin <= now)
+		return 0;
+	return next - myThread->commitMargin - now;
+}
+
+/* the frame reaches the screen at the first vsync after its commit */
+static void submitScanoutMark(submitThread_t *myThread, LayerSubmit_t *submitLayer)
+{
+	int64_t now = submitNow(), next, period, lat;
+	int bucket;
+
+	if (!vsyncModelNext(myThread, now, &next, &period))
+		return;
+	lat = next - submitLayer->waitStart;
+	if (lat < 0)
+		return;
+	bucket = (int)(lat * 2 / period);
+	if (bucket >= VSYNC_HIST_N)
+		bucket = VSYNC_HIST_N - 1;
+	myThread->latHist[bucket]++;
+	myThread->latSum += lat;
+	myThread->latNum++;
+}
+
+int submitVsyncDump(Display_t *disp, char *outBuffer)
+{
+	submitThread_t *myThread = disp->commitThread;
+	int64_t next, period;
+	int i, count = 0;
+
+	if (myThread == NULL)
+		return 0;
+	if (!vsyncModelNext(myThread, submitNow(), &next, &period))
+		period = 0;
+	count += sprintf(outBuffer + count, "vsync period:%lldus margin:%lldus hold:%u present-scanout avg:%lldus (1/2 vsync)",
+			(long long)(period / 1000), (long long)(myThread->commitMargin / 1000),
+			myThread->holdCount,
+			(long long)(myThread->latNum ? myThread->latSum / myThread->latNum / 1000 : 0));
+	for (i = 0; i < VSYNC_HIST_N; i++)
+		count += sprintf(outBuffer + count, " %d%s:%u", i,
+				i == VSYNC_HIST_N - 1 ? "+" : "", myThread->latHist[i]);
+	count += sprintf(outBuffer + count, "\n");
+	return count;
+}
+
+static LayerSubmit_t* submitRingPop(submitThread_t *myThread)
+{
+	unsigned int head = myThread->ringHead;
+	LayerSubmit_t *submitLayer;
+
+	if (head == __atomic_load_n(&myThread->ringTail, __ATOMIC_ACQUIRE))
+		return NULL;
+	submitLayer = myThread->ring[head & (SUBMIT_RING_SIZE - 1)];
+	__atomic_store_n(&myThread->ringHead, head + 1, __ATOMIC_RELEASE);
+
+	return submitLayer;
+}
+
+static inline void fenceWatch(submitThread_t *myThread, int fd)
+{
+	struct epoll_event eventItem;
+
+	memset(&eventItem, 0, sizeof(eventItem));
+	eventItem.events = EPOLLIN;
+	eventItem.data.fd = fd;
+	if (epoll_ctl(myThread->epollFd, EPOLL_CTL_ADD, fd, &eventItem))
+		ALOGE("watch fence %d err %d", fd, errno);
+}
+
+/*
+ * must unwatch before close, the fence file may be dup to others
+ * and stay signaled in the epoll set.
+ */
+static inline void fenceUnwatch(submitThread_t *myThread, int fd)
+{
+	epoll_ctl(myThread->epollFd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* close the signaled acquire fences, return true if all of them signaled */
+static bool submitFenceReady(submitThread_t *myThread, LayerSubmit_t *submitLayer, bool force)
+{
+	struct listnode *node;
+	Layer_t *layer;
+	bool ready = 1;
+
+	list_for_each(node, &submitLayer->layerNode) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->acquireFence < 0)
+			continue;
+		if (!force && sync_wait((int)layer->acquireFence, 0)) {
+			ready = 0;
+			continue;
+		}
+		fenceUnwatch(myThread, layer->acquireFence);
+		close((int)layer->acquireFence);
+		layer->acquireFence = -1;
+	}
+	return ready;
+}
+
+static void submitWatchFence(submitThread_t *myThread, LayerSubmit_t *submitLayer)
+{
+	struct listnode *node;
+	Layer_t *layer;
+
+	list_for_each(node, &submitLayer->layerNode) {
+		layer = node_to_item(node, Layer_t, node);
+		if (layer->acquireFence >= 0)
+			fenceWatch(myThread, layer->acquireFence);
+	}
+}
+
 void inline submitDelayWork(Display_t *disp, LayerSubmit_t *submitLayer)
 {
 	submitThread_t *myThread;
@@ -50,19 +287,66 @@ void inline submitDelayWork(Display_t *disp, LayerSubmit_t *submitLayer)
 	submitLayerCachePut(submitLayer);
 }
 
+static void submitCommit(Display_t *disp, LayerSubmit_t *submitLayer)
+{
+	submitThread_t *myThread = disp->commitThread;
+	struct listnode *node;
+	Layer_t *layer;
+
+	ATRACE_NAME(submitLayer->traceName);
+
+	/* for debug */
+	list_for_each(node, &submitLayer->layerNode) {
+		layer = node_to_item(node, Layer_t, node);
+		dumpLayerZorder(layer, submitLayer->frameCount);
+	}
+	/* no block so may after waite fence,  set up layer info to disp config2 info  */
+	myThread->setupLayer(submitLayer);
+
+	myThread->commitToDisplay(disp, submitLayer);
+	frameTimeMark(disp, submitLayer->frameCount, FRAME_COMMIT);
+	submitScanoutMark(myThread, submitLayer);
+
+	myThread->diplayCount = submitLayer->frameCount;
+	myThread->SubmitCount = submitLayer->sync.count;
+}
+
+/* only the newest pending frame is worth waiting for */
+static void submitKeepLatest(Display_t *disp, struct listnode *pendHead)
+{
+	submitThread_t *myThread = disp->commitThread;
+	struct listnode *node, *node2;
+	LayerSubmit_t *submitLayer;
+
+	list_for_each_safe(node, node2, pendHead) {
+		if (node == list_tail(pendHead))
+			break;
+		submitLayer = node_to_item(node, LayerSubmit_t, node);
+		myThread->pendNum--;
+		myThread->dropCount++;
+		submitFenceReady(myThread, submitLayer, 1);
+		submitDelayWork(disp, submitLayer);
+	}
+}
+
 void* submitThreadLoop(void *display)
 {
 	Display_t *disp;
 	submitThread_t *myThread;
-	struct listnode comHead, *commitHead, *node, *node2, *node3, *node4;
-	LayerSubmit_t *submitLayer = NULL, *preSubmit = NULL;
-	Layer_t *layer;
-	bool ctrlfps = 0;
+	struct listnode pendHead, retireHead, *node, *node2;
+	LayerSubmit_t *submitLayer = NULL, *readyLayer, *retire;
+	struct epoll_event eventItems[SUBMIT_EPOLL_N];
+	bool ctrlfps = 0, late;
+	uint64_t events;
+	int64_t hold;
+	unsigned heldFrame = 0;
+	int i, num, timeout = 16;
 
 	disp = (Display_t *)display;
 	myThread = disp->commitThread;
-	commitHead = &comHead;
-	list_init(commitHead);
+	/* popped frames waiting fences, and committed frames waiting retire */
+	list_init(&pendHead);
+	list_init(&retireHead);
 	ALOGD("new a thread to commit the display:%d", disp->displayId);
 	setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
 
@@ -74,100 +358,154 @@ void* submitThreadLoop(void *display)
 
 	while (!myThread->stop) {
 		updateDebugFlags();
-		myThread->mutex->lock();
-		if (list_empty(&myThread->SubmitHead)) {
-			myThread->cond->waitRelative(*myThread->mutex, 16000000);
-		}
-
-		if(!disp->active) {
-			myThread->mutex->unlock();
+		if(!disp->active || isStopSubmit()) {
+			usleep(16000);
 			continue;
 		}
-		if (isStopSubmit()) {
-			myThread->mutex->unlock();
-			continue;;
+
+		/* timeout keep the fps/debug work going when no frame come */
+		num = epoll_wait(myThread->epollFd, eventItems, SUBMIT_EPOLL_N, timeout);
+		timeout = 16;
+		for (i = 0; i < num; i++) {
+			if (eventItems[i].data.fd == myThread->eventFd)
+				read(myThread->eventFd, &events, sizeof(events));
 		}
+
 		showfps(disp);
 		ctrlfps = debugctrlfps();
-		if (list_empty(&myThread->SubmitHead)) {
-			myThread->mutex->unlock();
-			ALOGV("16ms not fresh");
-			continue;
-		}
-		memCtrlLimmitSet(disp, 2000000);
-		/* replace the list */
-		commitHead->next = myThread->SubmitHead.next;
-		myThread->SubmitHead.next->prev = commitHead;
-		commitHead->prev = myThread->SubmitHead.prev;
-		myThread->SubmitHead.prev->next = commitHead;
-		list_init(&myThread->SubmitHead);
 
-		myThread->mutex->unlock();
+		if (submitPendingCount(disp) != 0)
+			memCtrlLimmitSet(disp, memCtrlLimitStep());
+		while ((submitLayer = submitRingPop(myThread)) != NULL) {
+			list_add_tail(&pendHead, &submitLayer->node);
+			myThread->pendNum++;
+			submitWatchFence(myThread, submitLayer);
+		}
+		if (myThread->policy == SUBMIT_LATEST_WINS)
+			submitKeepLatest(disp, &pendHead);
 
-		list_for_each_safe(node, node2, commitHead) {
+		/*
+		 * commit the newest frame whose fences all signaled,
+		 * the older frames before it are superseded.
+		 */
+		readyLayer = NULL;
+		list_for_each(node, &pendHead) {
 			submitLayer = node_to_item(node, LayerSubmit_t, node);
+			late = submitNow() - submitLayer->waitStart > FENCE_LATE_NS;
+			if (late && readyLayer == NULL)
+				ALOGE("submit loop waite aquire fence timeout frame:%u",
+					submitLayer->frameCount);
+			if (submitFenceReady(myThread, submitLayer,
+					ctrlfps || (late && readyLayer == NULL)))
+				readyLayer = submitLayer;
+		}
 
-			ATRACE_NAME(submitLayer->traceName);
-
-			list_for_each_safe(node3, node4, &submitLayer->layerNode) {
-				layer = node_to_item(node3, Layer_t, node);
-				if (layer->acquireFence >= 0 && !ctrlfps) {
-					ATRACE_NAME("wait-acquire-fence");
-					if (sync_wait((int)layer->acquireFence, 3000)) {
-						ALOGE("submit loop waite aquire fence err %d", layer->acquireFence);
-						/* dump fence */
-					}
-					close((int)layer->acquireFence);
-					layer->acquireFence = -1;
-				}
-				/* gralloc unlock guarantee sync the buffer... */
-				/*if (checkSwWrite(layer))
-					syncLayerBuffer(layer);
-				*/
-				/* for debug */
-				dumpLayerZorder(layer, submitLayer->frameCount);
+		/*
+		 * commit a margin before the next vsync, a newer frame coming
+		 * in the meantime still make the same vsync.
+		 */
+		if (readyLayer != NULL && !ctrlfps) {
+			hold = submitHoldTime(myThread, submitNow());
+			if (hold >= 1000000) {
+				timeout = (int)(hold / 1000000);
+				if (myThread->holdCount == 0 || heldFrame != readyLayer->frameCount)
+					myThread->holdCount++;
+				heldFrame = readyLayer->frameCount;
+				readyLayer = NULL;
 			}
+		}
 
-			/* no block so may after waite fence,  set up layer info to disp config2 info  */
-			myThread->setupLayer(submitLayer);
-
-			myThread->commitToDisplay(disp, submitLayer);
-
-			/* wait for vsync  and a vsync send 1 frame ,
-			  * so we wait for the last releasefence
-			  */
-			list_remove(&submitLayer->node);
-
-			if (preSubmit != NULL) {
-				ATRACE_NAME("wait-prev-fence");
-				sync_wait(preSubmit->sync.fd, 3000);
-				submitDelayWork(disp, preSubmit);
+		if (readyLayer != NULL) {
+			list_for_each_safe(node, node2, &pendHead) {
+				submitLayer = node_to_item(node, LayerSubmit_t, node);
+				myThread->pendNum--;
+				if (submitLayer == readyLayer) {
+					list_remove(&submitLayer->node);
+					break;
+				}
+				ALOGV("drop frame:%u superseded by %u",
+					submitLayer->frameCount, readyLayer->frameCount);
+				myThread->dropCount++;
+				submitFenceReady(myThread, submitLayer, 1);
+				/* never on screen, so release it now */
+				submitDelayWork(disp, submitLayer);
 			}
+			frameTimeMark(disp, readyLayer->frameCount, FRAME_FENCE);
+			submitCommit(disp, readyLayer);
 
-			myThread->diplayCount = submitLayer->frameCount;
-			myThread->SubmitCount = submitLayer->sync.count;
-
-			preSubmit = submitLayer;
+			/* a vsync send 1 frame, the last frame can be released now */
+			if (!list_empty(&retireHead)) {
+				retire = node_to_item(list_tail(&retireHead), LayerSubmit_t, node);
+				retire->waitStart = submitNow();
+				if (retire->sync.fd >= 0)
+					fenceWatch(myThread, retire->sync.fd);
+			}
+			list_add_tail(&retireHead, &readyLayer->node);
 			if (ctrlfps)
 				usleep(20000);
 		}
+
+		/* every frame but the one on screen, in order of the timeline */
+		list_for_each_safe(node, node2, &retireHead) {
+			retire = node_to_item(node, LayerSubmit_t, node);
+			if (node == list_tail(&retireHead))
+				break;
+			if (retire->sync.fd >= 0 && sync_wait(retire->sync.fd, 0)) {
+				if (submitNow() - retire->waitStart <= FENCE_LATE_NS)
+					break;
+				ALOGE("submit loop waite release fence timeout frame:%u",
+					retire->frameCount);
+			}
+			if (retire->sync.fd >= 0)
+				fenceUnwatch(myThread, retire->sync.fd);
+			frameTimeMark(disp, retire->frameCount, FRAME_RETIRE);
+			submitDelayWork(disp, retire);
+		}
+	}
+
+	list_for_each_safe(node, node2, &pendHead) {
+		submitLayer = node_to_item(node, LayerSubmit_t, node);
+		submitFenceReady(myThread, submitLayer, 1);
+		submitDelayWork(disp, submitLayer);
+	}
+	myThread->pendNum = 0;
+	list_for_each_safe(node, node2, &retireHead) {
+		retire = node_to_item(node, LayerSubmit_t, node);
+		if (retire->sync.fd >= 0)
+			fenceUnwatch(myThread, retire->sync.fd);
+		submitDelayWork(disp, retire);
 	}
-	if (preSubmit != NULL)
-		submitDelayWork(disp, preSubmit);
 	return NULL;
 }
 
 submitThread_t* initSubmitThread(Display_t *disp)
 {
-	submitThread_t* myThread = (submitThread_t*)hwc_malloc(sizeof(submitThread_t));
+	struct epoll_event eventItem;
+	submitThread_t* myThread = (submitThread_t*)hwc_malloc_type(sizeof(submitThread_t), MEM_SUBMIT);
 	if (myThread == NULL) {
 		ALOGE("malloc an err....");
 		return NULL;
 	}
-	myThread->mutex = new Mutex();
-	myThread->cond = new Condition();
+	myThread->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (myThread->eventFd < 0) {
+		ALOGE("creat submit eventfd err %d", errno);
+		hwc_free(myThread);
+		return NULL;
+	}
+	myThread->commitMargin = (int64_t)property_get_int32("persist.vendor.hwc.commit_margin_us",
+			COMMIT_MARGIN_US) * 1000;
+	myThread->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (myThread->epollFd < 0) {
+		ALOGE("creat submit epoll err %d", errno);
+		close(myThread->eventFd);
+		hwc_free(myThread);
+		return NULL;
+	}
+	memset(&eventItem, 0, sizeof(eventItem));
+	eventItem.events = EPOLLIN;
+	eventItem.data.fd = myThread->eventFd;
+	epoll_ctl(myThread->epollFd, EPOLL_CTL_ADD, myThread->eventFd, &eventItem);
 
-	list_init(&myThread->SubmitHead);
 	disp->commitThread = myThread;
 	pthread_create(&myThread->thread_id, NULL, submitThreadLoop, disp);
 
@@ -177,15 +515,19 @@ submitThread_t* initSubmitThread(Display_t *disp)
 void deinitSubmitTread(Display_t *disp)
 {
 	submitThread_t* myThread = disp->commitThread;
+	LayerSubmit_t *submitLayer;
+	uint64_t one = 1;
+
 	if(myThread== NULL)
 		return;
 	myThread->stop = 1;
+	write(myThread->eventFd, &one, sizeof(one));
 	pthread_join(myThread->thread_id, NULL);
-	delete(myThread->mutex);
-	delete(myThread->cond);
+	while ((submitLayer = submitRingPop(myThread)) != NULL)
+		submitLayerCachePut(submitLayer);
+	close(myThread->epollFd);
+	close(myThread->eventFd);
 	disp->commitThread = NULL;
-	clearList(&myThread->SubmitHead, 0);
 	hwc_free(myThread);
 	disp->commitThread = NULL;
 }
-
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "../hwc.h"
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <gtest/gtest.h>
+
+/* the present side of the submit ring, the submit thread is not started */
+
+/* hwc_submit_thread.cpp links with layer.cpp only, the rest is from here */
+bool isStopSubmit()
+{
+	return false;
+}
+
+void frameTimeMark(Display_t *display, unsigned int frame, int phase)
+{
+}
+
+void dumpLayerZorder(Layer_t *layer, unsigned int framecout)
+{
+}
+
+bool debugctrlfps(void)
+{
+	return false;
+}
+
+void showfps(Display_t *display)
+{
+}
+
+void updateDebugFlags(void)
+{
+}
+
+int memCtrlLimitStep(void)
+{
+	return 0;
+}
+
+void memCtrlLimmitSet(Display_t *display, int screen)
+{
+}
+
+class SubmitRingTest : public testing::Test {
+protected:
+	void SetUp()
+	{
+		layerCacheInit();
+		memset(&disp, 0, sizeof(disp));
+		memset(&thread, 0, sizeof(thread));
+		thread.eventFd = eventfd(0, EFD_NONBLOCK);
+		disp.commitThread = &thread;
+		disp.active = 1;
+	}
+
+	void TearDown()
+	{
+		LayerSubmit_t *submitLayer;
+
+		while (thread.ringHead != thread.ringTail) {
+			submitLayer = thread.ring[thread.ringHead++ & (SUBMIT_RING_SIZE - 1)];
+			submitLayerCachePut(submitLayer);
+		}
+		close(thread.eventFd);
+		layerCacheDeinit();
+	}
+
+	/* a frame of one layer, its fence as the driver gives it */
+	int submit(unsigned int frame, int *fence)
+	{
+		LayerSubmit_t *submitLayer = submitLayerCacheGet();
+		Layer_t *layer = layerCacheGet(0);
+
+		list_add_tail(&submitLayer->layerNode, &layer->node);
+		submitLayer->frameCount = frame;
+		submitLayer->sync.fd = eventfd(0, 0);
+		submitLayer->sync.count = frame;
+		*fence = submitLayer->sync.fd;
+		return submitLayerToDisplay(&disp, submitLayer);
+	}
+
+	Display_t disp;
+	submitThread_t thread;
+};
+
+TEST_F(SubmitRingTest, FullRingDropKeepsFence)
+{
+	int fence;
+
+	for (int i = 0; i < SUBMIT_RING_SIZE; i++)
+		ASSERT_EQ(submit(i, &fence), 0);
+	EXPECT_EQ(submitPendingCount(&disp), SUBMIT_RING_SIZE);
+
+	/* nobody pops the ring, present gives up after the wait */
+	EXPECT_EQ(submit(SUBMIT_RING_SIZE, &fence), -1);
+	EXPECT_EQ(thread.ringDropCount, 1u);
+	EXPECT_GT(thread.ringFullCount, 0u);
+	EXPECT_EQ(submitPendingCount(&disp), SUBMIT_RING_SIZE);
+
+	/* the caller still dups it for the retire fence, then closes it */
+	ASSERT_NE(fcntl(fence, F_GETFD), -1);
+	int retire = dup(fence);
+	EXPECT_GE(retire, 0);
+	close(retire);
+	EXPECT_EQ(close(fence), 0);
+}
+
+TEST_F(SubmitRingTest, StoppedThreadDropsAtOnce)
+{
+	int fence;
+
+	for (int i = 0; i < SUBMIT_RING_SIZE; i++)
+		ASSERT_EQ(submit(i, &fence), 0);
+	thread.stop = 1;
+	EXPECT_EQ(submit(SUBMIT_RING_SIZE, &fence), -1);
+	EXPECT_EQ(thread.ringFullCount, 0u);
+	EXPECT_NE(fcntl(fence, F_GETFD), -1);
+	close(fence);
+}
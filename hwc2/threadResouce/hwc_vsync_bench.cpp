@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * host replay of a vsync uevent stream through the event thread parsers:
+ *   uevent: the VSYNC fields of the uevent messages
+ *   sysfs:  the decimal attribute read of a direct source
+ *   bin:    the raw int64_t read of a driver event fd
+ * the stream is recorded by "udevadm monitor --kernel --property", one
+ * uevent a block of KEY=VALUE lines, blocks split by an empty line.
+ * without a file a 60Hz stream of two displays is made up.
+ *
+ * hwc_vsync_bench [uevent_record]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <string>
+#include <vector>
+
+#include "hwc_vsync_parse.h"
+
+#define BENCH_REPEAT 20
+#define BENCH_FRAMES 10000
+#define BENCH_PIPE_N 1024
+
+static inline int64_t benchNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* one uevent in the kernel layout, "\0" split fields ended by "\0\0" */
+static void benchAddUevent(std::vector<std::string> *stream, std::vector<std::string> &fields)
+{
+	std::string msg;
+
+	if (fields.empty())
+		return;
+	for (size_t i = 0; i < fields.size(); i++) {
+		msg += fields[i];
+		msg += '\0';
+	}
+	msg += '\0';
+	stream->push_back(msg);
+	fields.clear();
+}
+
+static int benchLoad(const char *path, std::vector<std::string> *stream)
+{
+	std::vector<std::string> fields;
+	char line[512];
+	size_t len;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = 0;
+		if (len == 0)
+			benchAddUevent(stream, fields);
+		else if (strchr(line, '=') != NULL)
+			fields.push_back(line);
+	}
+	benchAddUevent(stream, fields);
+	fclose(fp);
+	return 0;
+}
+
+static void benchMakeUp(std::vector<std::string> *stream)
+{
+	std::vector<std::string> fields;
+	int64_t timestamp = 1000000000LL;
+	char field[64];
+
+	for (int i = 0; i < BENCH_FRAMES; i++) {
+		for (int id = 0; id < 2; id++) {
+			fields.push_back("ACTION=change");
+			fields.push_back("DEVPATH=/devices/platform/soc/disp");
+			fields.push_back("SUBSYSTEM=disp");
+			snprintf(field, sizeof(field), "VSYNC%d=%lld", id, (long long)timestamp);
+			fields.push_back(field);
+			snprintf(field, sizeof(field), "SEQNUM=%d", i * 2 + id);
+			fields.push_back(field);
+			benchAddUevent(stream, fields);
+		}
+		timestamp += 16666666;
+	}
+}
+
+static void benchReport(const char *name, int64_t ns, size_t events, int64_t sum)
+{
+	printf("%-6s events:%zu %.1f ns/event check:%llx\n", name, events,
+		events ? (double)ns / events : 0.0, (unsigned long long)sum);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> stream;
+	std::vector<int64_t> stamps;
+	const char *msg;
+	int64_t timestamp, start, ns, sum;
+	char buf[24];
+	int id, fd, pipefd[2];
+	size_t i, j, n;
+
+	if (argc > 1) {
+		if (benchLoad(argv[1], &stream)) {
+			fprintf(stderr, "open %s err %d\n", argv[1], errno);
+			return 1;
+		}
+	} else {
+		benchMakeUp(&stream);
+	}
+
+	/* uevent, the way the event thread parses each message */
+	ns = 0;
+	for (int r = 0; r < BENCH_REPEAT; r++) {
+		sum = 0;
+		stamps.clear();
+		start = benchNow();
+		for (i = 0; i < stream.size(); i++) {
+			msg = stream[i].data();
+			while (vsyncUeventNext(&msg, &id, &timestamp)) {
+				sum += timestamp;
+				stamps.push_back(timestamp);
+			}
+		}
+		ns += benchNow() - start;
+	}
+	n = stamps.size();
+	benchReport("uevent", ns, n * BENCH_REPEAT, sum);
+	if (n == 0) {
+		fprintf(stderr, "no VSYNC in the stream\n");
+		return 1;
+	}
+
+	/* sysfs attribute, one pread and parse each vsync */
+	fd = syscall(__NR_memfd_create, "vsync_bench", 0);
+	if (fd < 0)
+		return 1;
+	ns = 0;
+	for (int r = 0; r < BENCH_REPEAT; r++) {
+		sum = 0;
+		for (i = 0; i < n; i++) {
+			j = snprintf(buf, sizeof(buf), "%lld\n", (long long)stamps[i]);
+			if (pwrite(fd, buf, j, 0) != (ssize_t)j)
+				return 1;
+			start = benchNow();
+			sum += vsyncSourceRead(fd, 0);
+			ns += benchNow() - start;
+		}
+	}
+	close(fd);
+	benchReport("sysfs", ns, n * BENCH_REPEAT, sum);
+
+	/* event fd, one raw read each vsync, fed through a pipe */
+	if (pipe2(pipefd, O_NONBLOCK))
+		return 1;
+	ns = 0;
+	for (int r = 0; r < BENCH_REPEAT; r++) {
+		sum = 0;
+		for (i = 0; i < n; i += BENCH_PIPE_N) {
+			j = n - i < BENCH_PIPE_N ? n - i : BENCH_PIPE_N;
+			if (write(pipefd[1], &stamps[i], j * sizeof(int64_t))
+					!= (ssize_t)(j * sizeof(int64_t)))
+				return 1;
+			start = benchNow();
+			while ((timestamp = vsyncSourceRead(pipefd[0], 1)) > 0)
+				sum += timestamp;
+			ns += benchNow() - start;
+		}
+	}
+	close(pipefd[0]);
+	close(pipefd[1]);
+	benchReport("bin", ns, n * BENCH_REPEAT, sum);
+	return 0;
+}
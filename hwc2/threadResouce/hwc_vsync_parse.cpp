@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "hwc_vsync_parse.h"
+
+bool vsyncUeventNext(const char **msg, int *id, int64_t *timestamp)
+{
+	const char *field = *msg;
+	bool found = 0;
+
+	while (*field && !found) {
+		if (!strncmp(field, "VSYNC", strlen("VSYNC"))) {
+			field += strlen("VSYNC");
+			*id = *field - '0';
+			*timestamp = strtoull(field + 2, NULL, 0);
+			found = 1;
+		}
+		while (*field++);
+	}
+	*msg = field;
+	return found;
+}
+
+int64_t vsyncSourceRead(int fd, bool bin)
+{
+	char buf[24];
+	int64_t timestamp = 0;
+	int ret, i;
+
+	if (bin) {
+		ret = read(fd, &timestamp, sizeof(timestamp));
+		if (ret < 0 && errno == EAGAIN)
+			return 0;
+		return ret == sizeof(timestamp) ? timestamp : -1;
+	}
+	ret = pread(fd, buf, sizeof(buf), 0);
+	for (i = 0; i < ret && buf[i] >= '0' && buf[i] <= '9'; i++)
+		timestamp = timestamp * 10 + buf[i] - '0';
+	return i > 0 ? timestamp : -1;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __HWC_VSYNC_PARSE_H
+#define __HWC_VSYNC_PARSE_H
+
+#include <stdint.h>
+
+/*
+ * vsync timestamp parsers of the event thread, kept apart from it
+ * so the host replay bench runs the same code.
+ */
+
+/*
+ * next VSYNC<id>=<ns> field of a uevent, msg is the "\0\0" ended field
+ * list and is moved past it. false when no more.
+ */
+bool vsyncUeventNext(const char **msg, int *id, int64_t *timestamp);
+
+/*
+ * timestamp of a direct source: a sysfs attribute holding it in decimal,
+ * or an event fd(bin) giving a raw int64_t per vsync.
+ * 0 if nothing new, -1 if it is broken.
+ */
+int64_t vsyncSourceRead(int fd, bool bin);
+
+#endif